@@ -0,0 +1,187 @@
+#ifndef __AGILE_SE_BASE_BUILDER_H__
+#define __AGILE_SE_BASE_BUILDER_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include <ext/hash_map>
+#include "index/index.h"
+#include "index/signdict.h"
+#include "inc/event_parser.h"
+
+namespace inc
+{
+    // =====================================================================================
+    //        Class:  RunSorter
+    //  Description:  按(key, id, seq)排序的外排序，记录可以带payload
+    //                内存里有slot_num个缓冲，一个缓冲攒满后交给一个线程排序并写成run文件，
+    //                调用者继续往下一个空闲缓冲里写，finish之后多路归并读出
+    // =====================================================================================
+    class RunSorter
+    {
+        private:
+            RunSorter(const RunSorter &);
+            RunSorter &operator =(const RunSorter &);
+        public:
+            struct record_t
+            {
+                uint32_t key;
+                uint32_t id;
+                uint64_t seq;
+                uint16_t payload_len;
+                const void *payload;    /* 在下一次next之前有效 */
+            };
+        public:
+            RunSorter();
+            ~RunSorter();
+
+            /* run文件为prefix.0, prefix.1, ...，内存最多slot_num * slot_bytes */
+            int init(const std::string &prefix, uint32_t slot_num, uint64_t slot_bytes);
+            bool add(uint32_t key, uint32_t id, uint64_t seq, const void *payload, uint16_t payload_len);
+            /* 写完所有run并释放缓冲，之后才能next */
+            bool finish();
+            /* 1: 读出一条，0: 读完了，-1: 出错 */
+            int next(record_t &record);
+            /* 关闭并删除所有run文件 */
+            void clear();
+
+            uint64_t size() const { return m_size; }
+            size_t run_num() const { return m_paths.size(); }
+        private:
+            struct entry_t
+            {
+                uint32_t key;
+                uint32_t id;
+                uint64_t seq;
+                uint32_t offset;        /* payload在slot_t::payloads中的偏移 */
+                uint16_t payload_len;
+
+                bool operator <(const entry_t &o) const
+                {
+                    if (key != o.key) {
+                        return key < o.key;
+                    } else if (id != o.id) {
+                        return id < o.id;
+                    } else {
+                        return seq < o.seq;
+                    }
+                }
+            };
+            struct slot_t
+            {
+                std::vector<entry_t> entries;
+                std::string payloads;
+                std::string path;
+                pthread_t tid;
+                bool busy;
+                bool ok;
+            };
+            struct run_t
+            {
+                FILE *fp;
+                char *buffer;           /* setvbuf */
+                record_t record;
+                std::string payload;
+            };
+            /* 堆顶是最小的run */
+            struct run_greater_t
+            {
+                const std::vector<run_t> *runs;
+
+                bool operator()(size_t a, size_t b) const;
+            };
+
+            static void *sort_thread(void *args);
+            static bool write_run(slot_t &slot);
+            static int read_record(run_t &run);
+            bool flush();
+            bool wait(slot_t &slot);
+        private:
+            std::string m_prefix;
+            uint64_t m_slot_bytes;
+            std::vector<slot_t> m_slots;
+            size_t m_cur;
+            uint64_t m_size;
+            std::vector<std::string> m_paths;
+
+            std::vector<run_t> m_runs;
+            std::vector<size_t> m_heap;
+            bool m_merging;
+            size_t m_last;          /* 上一次next返回的run，下一次next时再读它的下一条 */
+    };
+
+    // =====================================================================================
+    //        Class:  BaseBuilder
+    //  Description:  离线建基准库，用于inc::base_build_processor
+    //                正排照常更新到各层的ForwardIndex(同时分配docid)，倒排不进内存，
+    //                签名后的(sign id, oid, seq, payload)交给RunSorter外排序，
+    //                读完基准文件后各层一个线程归并，直接写成InvertIndex的dump格式，
+    //                oid的倒排被整体替换或删除后，之前的记录按seq丢弃
+    //                结果写到0/1目录中的可写目录后切换，与Index::dump一致，之后正常加载即可
+    //                建完后进程内的索引没有倒排，只能用于离线建库
+    //                只写经典倒排格式，配置了segment_path的层不支持
+    // =====================================================================================
+    class BaseBuilder
+    {
+        private:
+            BaseBuilder(const BaseBuilder &);
+            BaseBuilder &operator =(const BaseBuilder &);
+        public:
+            BaseBuilder(Index &index);
+            ~BaseBuilder();
+
+            /* max_bytes为所有排序缓冲的总内存，临时文件写到tmp_path */
+            int init(uint32_t threads, uint64_t max_bytes, const char *tmp_path);
+            /* 读完基准文件，写出索引并切换0/1目录 */
+            int build();
+        private:
+            typedef __gnu_cxx::hash_map<int32_t, uint64_t> StartMap;
+
+            struct level_t
+            {
+                BaseBuilder *builder;
+                uint32_t level;
+                LevelIndex *index;
+                EventParser *parser;
+                SignDict dict;
+                std::vector<uint8_t> types;     /* sign id => 倒排类型 */
+                RunSorter lists;                /* (sign id, oid, seq) + payload */
+                RunSorter words;                /* (docid, sign id) */
+                StartMap starts;                /* oid => 当前倒排的第一个seq */
+                std::string dir;
+                uint64_t doc_num;
+                uint64_t list_num;
+                uint64_t total_len;
+                pthread_t tid;
+                bool ok;
+            };
+
+            bool read();
+            bool add_inverts(level_t &lv, int32_t oid, const std::vector<invert_data_t> &inverts);
+            bool add_inverts(level_t &lv, int32_t oid, const std::vector<invert_sign_t> &signs);
+            bool add_invert(level_t &lv, int32_t oid, uint8_t type, uint64_t sign,
+                    const char *word, uint32_t word_len, const void *payload);
+
+            static void *write_thread(void *args);
+            bool write_lists(level_t &lv);
+            bool write_words_bag(level_t &lv);
+            int dump();
+        private:
+            Index &m_index;
+            std::vector<level_t *> m_levels;
+            uint32_t m_threads;
+            uint64_t m_max_bytes;
+            std::string m_tmp_path;
+            uint64_t m_seq;
+
+            uint64_t m_line_count;
+            uint64_t m_invalid_count;
+            uint64_t m_forward_count;
+            uint64_t m_invert_count;
+            uint64_t m_delete_count;
+    };
+}
+
+#endif
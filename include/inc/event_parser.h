@@ -0,0 +1,73 @@
+#ifndef __AGILE_SE_EVENT_PARSER_H__
+#define __AGILE_SE_EVENT_PARSER_H__
+
+#include <string>
+#include <vector>
+#include "index/level_index.h"
+
+namespace inc
+{
+    // =====================================================================================
+    //        Class:  EventParser
+    //  Description:  原地流式解析事件中的正排/倒排json，不构造cJSON树
+    //                正排字段名在init时按本层配置预先解析成slot，倒排类型预先查好payload
+    //                默认先把json拷贝到parser自己的buffer里再解析，不修改传入的buffer；
+    //                调用者持有该行的私有拷贝时可以用*_inplace原地反转义，省掉一次拷贝
+    //                结果中的字符串在下一次reset之前有效
+    //                数字按json语法严格检查，不接受strtod额外支持的inf/nan/十六进制等
+    //                只有pb字段的Object值和带payload的倒排值会回退到cJSON，且只解析该值
+    // =====================================================================================
+    class EventParser
+    {
+        private:
+            EventParser(const EventParser &);
+            EventParser &operator =(const EventParser &);
+        public:
+            EventParser() : m_level(NULL) { }
+            ~EventParser() { this->reset(); }
+
+            int init(const LevelIndex *level);
+
+            /* {"field": value, ...}，未配置的字段直接跳过 */
+            bool parse_forward(const char *json, std::vector<forward_value_t> &values);
+            /* {"type": {"word": payload, ...}, ...} 或 {"type": ["word", ...], ...} */
+            bool parse_invert(const char *json, std::vector<invert_data_t> &values);
+            /* 同上，原地修改json */
+            bool parse_forward_inplace(char *json, std::vector<forward_value_t> &values);
+            bool parse_invert_inplace(char *json, std::vector<invert_data_t> &values);
+            /* 释放上一个事件中回退解析出的cJSON和拷贝的json */
+            void reset();
+            /*
+             * 把回退解析出的cJSON交给调用者，由调用者cJSON_Delete，用于解析和应用不在同一线程
+             * 拷贝的json不会交出，这种场景须用*_inplace解析调用者自己的buffer
+             * */
+            void detach(std::vector<cJSON *> &trees)
+            {
+                trees.insert(trees.end(), m_trees.begin(), m_trees.end());
+                m_trees.clear();
+            }
+        private:
+            struct slot_t
+            {
+                std::string name;
+                int slot;
+                int type;
+            };
+            int find_slot(const char *name, int len) const;
+            cJSON *parse_subtree(char *begin, char *end);
+            char *copy(const char *json);
+
+            static char *skip_ws(char *p);
+            static char *skip_number(char *p);
+            static char *parse_string(char *p, char **str, int *len);
+            static char *skip_value(char *p);
+        private:
+            const LevelIndex *m_level;
+            std::vector<slot_t> m_slots;
+            bool m_has_payload[256];
+            std::vector<cJSON *> m_trees;
+            std::vector<char *> m_copies;
+    };
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef __AGILE_SE_INC_PIPELINE_H__
+#define __AGILE_SE_INC_PIPELINE_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "cJSON.h"
+#include "fast_timer.h"
+#include "index/index.h"
+#include "inc/event_parser.h"
+
+namespace inc
+{
+    // =====================================================================================
+    //        Class:  IncPipeline
+    //  Description:  增量流水线，读、解析、应用分别在不同的线程
+    //                reader线程按文件顺序把原始行拷贝进定长的环形队列，
+    //                parser线程并行做切列、json解析和倒排签名，
+    //                调用run的线程按序号顺序把解析好的操作应用到LevelIndex，索引仍然只有一个写线程
+    //                队列满或在途字节超限时reader等待(背压)，内存不足时reader暂停读入，
+    //                应用线程照常回收内存、dump
+    //                level_writers时每个LevelIndex一个写线程，各自按序号顺序扫描队列，只应用本层的事件，
+    //                调用run的线程只回收所有层都应用过的位置(水位)，dump时让所有层停在同一个位置
+    //                coalesce窗口不为0时，应用一个操作前最多等max_ms让窗口凑满，
+    //                把窗口内同一(level, oid)的后续操作合并进来在第一个操作的位置一次应用，
+    //                delete清空之前合并的内容，之后的insert/update先remove再写入，
+    //                同一oid上不能合并的操作(字段值类型不合法)之后的操作不再合并，保证顺序
+    // =====================================================================================
+    class IncPipeline
+    {
+        private:
+            IncPipeline(const IncPipeline &);
+            IncPipeline &operator =(const IncPipeline &);
+        public:
+            enum { OP_FREE = 0, OP_READ, OP_PARSED };   /* op_t::state */
+            enum { STAT_INTERVAL = 60 };                /* 每60秒打印一次各阶段吞吐 */
+            enum { MAX_KEPT_BUFFER = 1024*1024 };       /* 超过1M的行缓冲用完即释放 */
+            enum { READER_RUNNING = 0, READER_EOF, READER_ERROR };
+
+            /* 队列中的一个事件，values/signs指向buf、words或trees */
+            struct op_t
+            {
+                op_t() : state(OP_FREE), file_no(0), line_no(0), eventid(0), binary(false),
+                    valid(false), has_invert(false), absorbed(false), remove_first(false),
+                    level(0), optype(0), oid(0),
+                    buf(NULL), len(0), capacity(0), origin_optype(0), origin_invert(false) { }
+
+                volatile uint32_t state;
+                uint32_t file_no;       /* 读完这一行之后IncReader的位置 */
+                uint32_t line_no;
+                uint64_t eventid;
+                bool binary;
+
+                bool valid;             /* 解析成功，可以应用 */
+                bool has_invert;
+                bool absorbed;          /* 已经合并到前面同一oid的操作里 */
+                bool remove_first;      /* 合并了delete之后的insert/update，先remove */
+                uint32_t level;
+                uint32_t optype;
+                uint64_t oid;
+
+                char *buf;              /* 原始行，以'\0'结尾，解析时原地修改 */
+                uint32_t len;
+                uint32_t capacity;
+
+                std::vector<forward_value_t> values;
+                std::vector<invert_sign_t> signs;
+                std::vector<const cJSON *> payloads;    /* 文本格式的倒排payload，与signs对齐，应用时解析 */
+                std::string words;                      /* 签名用的词，prefix + keystr + '\0' */
+                std::string payload_buf;
+                std::vector<cJSON *> trees;             /* parser回退解析出的cJSON */
+
+                /* 合并了后面的操作时保留自己原来的内容，合并后应用失败再逐个应用 */
+                std::vector<uint64_t> merged;           /* 被合并进来的操作的序号 */
+                uint32_t origin_optype;
+                bool origin_invert;
+                std::vector<forward_value_t> origin_values;
+                std::vector<invert_sign_t> origin_signs;
+                std::vector<const cJSON *> origin_payloads;
+            };
+        public:
+            IncPipeline(Index &index);
+            ~IncPipeline();
+
+            int init(uint32_t parse_threads, uint32_t queue_size, uint64_t max_bytes,
+                    bool level_writers = false);
+            /* 窗口最多window个操作，最多等待max_ms，须在run之前调用 */
+            void set_coalesce(uint32_t window, uint32_t max_ms);
+            /* 在增量线程里调用，启动reader/parser线程并应用，返回前停止所有线程 */
+            int run();
+        private:
+            /* 当前等待窗口凑满的操作 */
+            struct window_t
+            {
+                uint64_t seq;
+                FastTimer timer;
+            };
+            struct writer_t
+            {
+                IncPipeline *pipeline;
+                uint32_t level;
+                pthread_t tid;
+                volatile uint64_t seq;          /* 下一个要看的位置，只有本线程修改 */
+                volatile bool paused;
+                volatile uint64_t apply_count;
+                uint64_t last_count;
+                window_t window;
+            };
+
+            static void *reader_thread(void *args);
+            static void *parser_thread(void *args);
+            static void *writer_thread(void *args);
+
+            void read_loop();
+            void parse_loop();
+            bool parse_text(op_t &op, std::vector<EventParser *> &parsers,
+                    std::vector<invert_data_t> &inverts);
+            bool parse_binary(op_t &op);
+            bool mergeable(const op_t &op) const;
+            void merge(op_t &head, const op_t &op) const;
+            bool window_ready(uint64_t seq, window_t &window);
+            void coalesce(uint64_t seq, op_t &head);
+            bool prepare(uint64_t seq, op_t &op, window_t &window); /* 返回false表示还要等窗口 */
+            void apply(op_t &op);
+            bool apply_one(op_t &op);
+            void apply_loop();
+            void write_loop(writer_t &writer);
+            void coordinate_loop();
+            uint64_t release_applied();     /* 释放所有写线程都已经过的位置，返回个数 */
+            void pause_writers();
+            void resume_writers();
+            void release(op_t &op);
+            bool memory_panic(long &check_count);
+            void report(uint32_t seconds);
+            void stop();
+        private:
+            Index &m_index;
+
+            op_t *m_ops;
+            uint64_t m_mask;
+            uint64_t m_max_bytes;
+
+            /* 三个序号只增不减: apply <= parse <= read */
+            volatile uint64_t m_read_seq;       /* 下一个写入的位置，只有reader修改 */
+            volatile uint64_t m_parse_seq;      /* 下一个待解析的位置，parser之间CAS抢占 */
+            volatile uint64_t m_apply_seq;      /* 下一个待释放的位置，只有调用run的线程修改 */
+            volatile uint64_t m_inflight_bytes;
+
+            volatile int m_reader_status;
+            volatile bool m_stop;
+
+            pthread_t m_reader_tid;
+            bool m_reader_started;
+            std::vector<pthread_t> m_parser_tids;
+            size_t m_parser_started;
+            std::vector<writer_t> m_writers;    /* 为空时在run的线程里应用 */
+            size_t m_writer_started;
+            volatile bool m_pause;
+            volatile uint64_t m_barrier_seq;    /* 写线程不越过这个位置 */
+
+            uint32_t m_coalesce_window;
+            uint32_t m_coalesce_ms;
+            window_t m_window;                  /* 没有写线程时用 */
+
+            struct stat_t
+            {
+                uint64_t read_count;
+                uint64_t read_bytes;
+                uint64_t read_wait;     /* 队列满或在途字节超限 */
+                uint64_t parse_count;
+                uint64_t parse_fail;
+                uint64_t apply_count;
+                uint64_t apply_wait;    /* 下一个还没解析完 */
+                uint64_t forward_count;
+                uint64_t invert_count;
+                uint64_t delete_count;
+                uint64_t coalesced;     /* 被合并掉的操作数 */
+            };
+            stat_t m_stat;          /* 跨线程的计数用__sync_fetch_and_add */
+            stat_t m_last_stat;
+    };
+}
+
+#endif
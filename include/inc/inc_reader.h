@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <sys/types.h>
 #include <string>
 #include <vector>
 
@@ -21,6 +22,17 @@ namespace inc
         private:
             IncReader(const IncReader &);
             IncReader &operator =(const IncReader &);
+        public:
+            enum { CHUNK_SIZE = 16*1024*1024 };  /* chunk模式每次最多读16M */
+            enum { MAX_COLUMNS = 16 };
+            enum { FORMAT_UNKNOWN = 0, FORMAT_TEXT, FORMAT_BINARY }; /* 每个文件按文件头识别 */
+
+            /* 指向当前行内的一列，列尾已被替换成'\0' */
+            struct column_t
+            {
+                char *ptr;
+                uint32_t len;
+            };
         public:
             IncReader()
                 : _fp(NULL)
@@ -28,6 +40,17 @@ namespace inc
                 _filepath[0] = '\0';
                 _path_len = 0;
                 _snapshot = false;
+                _chunk_mode = false;
+                _format = FORMAT_UNKNOWN;
+                _fd = -1;
+                _chunk = NULL;
+                _chunk_begin = _chunk_end = 0;
+                _read_pos = 0;
+                _skip_tail = false;
+                _line = _line_buf;
+                _line_len = 0;
+                _use_checkpoint = false;
+                _ckpt_file_no = _ckpt_line_no = 0;
             }
             ~IncReader()
             {
@@ -36,6 +59,12 @@ namespace inc
                     ::fclose(_fp);
                     _fp = NULL;
                 }
+                this->close_chunk_file();
+                if (_chunk)
+                {
+                    delete [] _chunk;
+                    _chunk = NULL;
+                }
             }
     
             int init(const char *path, const char *meta);
@@ -44,11 +73,34 @@ namespace inc
             int snapshot();
             int rollback();
     
+            /*
+             * 读下一行，二进制文件中每个record算一行，line()/line_len()为整个record
+             * */
             int next();
             void split(std::vector<std::string> &columns, const std::string &sep = "\t");
+            /*
+             * 原地切分当前行，不分配内存，分隔符被替换成'\0'，返回列数
+             * 超过max_num的列并入最后一列，每行只能调用一次，二进制record返回0
+             * */
+            size_t split(column_t *columns, size_t max_num, char sep = '\t');
+            /* 同上，切分一行拷贝出来的文本，line[len]须为'\0' */
+            static size_t split(char *line, uint32_t len, bool base_mode,
+                    column_t *columns, size_t max_num, char sep = '\t');
+            static bool parse_uint32(const column_t &column, uint32_t &value);
+            static bool parse_uint64(const column_t &column, uint64_t &value);
             int collect_lines(int max_lines, int max_ms);
     
             void log(const char *str);
+            /*
+             * 读和应用不在同一线程时，由应用线程设置已经应用到的位置，
+             * 之后dumpMeta记录这个位置而不是已经读到的位置，且不再访问读线程修改的成员
+             * */
+            void set_checkpoint(uint32_t file_no, uint32_t line_no)
+            {
+                _ckpt_file_no = file_no;
+                _ckpt_line_no = line_no;
+                _use_checkpoint = true;
+            }
     
             uint32_t current_partition() const { return _partition_cur; }
             uint32_t total_partition() const { return _partition_num; }
@@ -57,6 +109,30 @@ namespace inc
             uint32_t get_line_no() const { return _line_no; }
             uint32_t get_eventid() const { return _eventid; }
             bool is_base_mode() const { return _base_mode; }
+            bool is_chunk_mode() const { return _chunk_mode; }
+            bool is_binary() const { return FORMAT_BINARY == _format; }
+            const char *line() const { return _line; }
+            uint32_t line_len() const { return _line_len; }
+        private:
+            int read_line();
+            int read_chunk_line();
+            int read_record();
+            int fill_chunk();
+            int open_file(uint32_t file_no);
+            int detect_format();
+            int open_chunk_file(const char *path);
+            void close_chunk_file();
+            void reset_chunk(off_t pos)
+            {
+                _chunk_begin = _chunk_end = 0;
+                _read_pos = pos;
+                _skip_tail = false;
+            }
+            /* 已经交给上层的字节数，即下一行在文件中的偏移 */
+            off_t consumed_pos() const
+            {
+                return _read_pos - off_t(_chunk_end - _chunk_begin);
+            }
         public:
             char _line_buf[1024*1024*10];       // 10M
         private:
@@ -80,6 +156,23 @@ namespace inc
             uint32_t _ss_file_no;
             uint32_t _ss_line_no;
             off_t _ss_pos;
+
+            /* read_mode: chunk, 大块pread+原地切行，不经过stdio; 二进制文件总是这样读 */
+            bool _chunk_mode;
+            int _format;
+            int _fd;
+            char *_chunk;
+            size_t _chunk_begin;
+            size_t _chunk_end;
+            off_t _read_pos;        /* _chunk_end对应的文件偏移 */
+            bool _skip_tail;        /* 超长行被截断后丢弃剩余部分 */
+
+            char *_line;
+            uint32_t _line_len;
+
+            bool _use_checkpoint;
+            uint32_t _ckpt_file_no;
+            uint32_t _ckpt_line_no;
     };
 }
 
@@ -0,0 +1,68 @@
+#ifndef __AGILE_SE_INC_RECORD_H__
+#define __AGILE_SE_INC_RECORD_H__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "index/forward_index.h"
+#include "index/invert_index.h"
+
+namespace inc
+{
+    /*
+     * 二进制增量文件，与tsv+json格式的文件可以混用，IncReader按文件头识别
+     *   文件头: 8字节magic
+     *   之后是连续的record，整数均为本机字节序(小端)
+     *   record: record_head_t | field * field_num | invert * invert_num
+     *   field:  field_head_t | double (NUMBER)
+     *           field_head_t | uint32_t len | bytes (RAW: binary字段的原始内容或pb序列化结果)
+     *   invert: invert_head_t | word | '\0' | payload
+     * slot为正排字段按offset排序后的序号(ForwardIndex::get_slot_by_name)，依赖正排配置，
+     * 字段有增删时需要重新转换；一行对应一个record，line_no的含义不变
+     */
+    const char INC_BINARY_MAGIC[] = "AGSEINC1";
+    enum { INC_BINARY_MAGIC_LEN = 8 };
+    enum { MAX_RECORD_LENGTH = 16*1024*1024 };  /* 与IncReader::CHUNK_SIZE一致 */
+    enum { OP_INSERT = 0, OP_DELETE = 1, OP_UPDATE = 2 };
+    enum { RECORD_FLAG_INVERT = 0x1 };          /* 带倒排，对应文本格式中的倒排json列 */
+    enum { RECORD_OP_INVALID = 0xFF };          /* 转换失败的行，保留以对齐line_no */
+
+    struct record_head_t
+    {
+        uint32_t length;        /* 整个record的字节数，含head */
+        uint32_t level;
+        uint64_t eventid;
+        uint64_t oid;
+        uint8_t optype;
+        uint8_t flags;
+        uint16_t field_num;
+        uint16_t invert_num;
+        uint16_t reserved;
+    } __attribute__((packed));
+
+    struct field_head_t
+    {
+        uint16_t slot;
+        uint8_t kind;           /* forward_value_t::NUMBER or RAW */
+        uint8_t reserved;
+    } __attribute__((packed));
+
+    struct invert_head_t
+    {
+        uint8_t type;
+        uint8_t reserved;
+        uint16_t word_len;      /* 不含结尾的'\0' */
+        uint16_t payload_len;
+        uint16_t reserved2;
+        uint64_t sign;          /* InvertTypes::create_sign */
+    } __attribute__((packed));
+
+    /* 在out后追加一个record，head中的length/field_num/invert_num由这里填，只编码NUMBER和RAW字段 */
+    bool encode_record(std::string &out, const record_head_t &head,
+            const std::vector<forward_value_t> &fields, const std::vector<invert_sign_t> &inverts);
+    /* 解析一个完整的record，fields和inverts指向record内部 */
+    bool decode_record(const char *record, uint32_t len, record_head_t &head,
+            std::vector<forward_value_t> &fields, std::vector<invert_sign_t> &inverts);
+}
+
+#endif
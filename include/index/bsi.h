@@ -0,0 +1,86 @@
+#ifndef __AGILE_SE_BIT_SLICED_INDEX_H__
+#define __AGILE_SE_BIT_SLICED_INDEX_H__
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "index/segment_array.h"
+
+// =====================================================================================
+//        Class:  BitSlicedIndex
+//  Description:  正排int/float字段的位切片索引(BSI)，值编码成保序的uint32后
+//                每一位一个按docid寻址的位图，区间查询按位从高到低计算，
+//                不需要读正排记录
+//                更新时先写各位切片再置exist位，exist位只在删除时清除；
+//                每64个docid一个版本号，改写期间为奇数，区间查询按字检查版本，
+//                不会用新旧混合的切片求值
+// =====================================================================================
+class BitSlicedIndex
+{
+    public:
+        enum { INT_FIELD = 0, FLOAT_FIELD = 1 };
+        enum { SLICE_NUM = 32 };
+        typedef SegmentArray<uint64_t, 10> Bitmap; /* 每段1024个字，对应65536个docid */
+        typedef SegmentArray<uint32_t, 10> Version; /* 与Bitmap的字一一对应 */
+
+        struct field_t
+        {
+            std::string name;
+            int type;
+            int array_offset;
+            Bitmap slices[SLICE_NUM];
+        };
+    private:
+        BitSlicedIndex(const BitSlicedIndex &);
+        BitSlicedIndex &operator =(const BitSlicedIndex &);
+    public:
+        BitSlicedIndex() : m_capacity(0), m_exist_num(0) { }
+        ~BitSlicedIndex();
+
+        int init(uint32_t capacity);
+        int add_field(const std::string &name, int type, int array_offset);
+
+        uint32_t capacity() const { return m_capacity; }
+        size_t word_num() const { return ((size_t)m_capacity + 63) >> 6; }
+        size_t exist_num() const { return m_exist_num; }
+        size_t field_num() const { return m_fields.size(); }
+        const field_t *get_field(const char *name) const;
+
+        /* 从行存info中取各字段值 */
+        bool set_row(uint32_t id, const void *info);
+        void clear_row(uint32_t id);
+
+        /*
+         * 编码值落在[lo, hi]内的docid写入bits(共nwords个字)，
+         * negate时取存在但不在区间内的docid，field为NULL时取所有存在的docid，
+         * 返回docid个数
+         * */
+        size_t range(const field_t *field, uint32_t lo, uint32_t hi, bool negate,
+                uint64_t *bits, size_t nwords) const;
+
+        static uint32_t encode_int(int32_t value)
+        {
+            return uint32_t(value) ^ 0x80000000U;
+        }
+        static uint32_t encode_float(float value)
+        {
+            union { float f; uint32_t u; } tmp;
+            tmp.f = value;
+            return (tmp.u & 0x80000000U) ? ~tmp.u : (tmp.u | 0x80000000U);
+        }
+
+        size_t mem_used() const;
+    private:
+        static void set_bit(Bitmap &bitmap, uint32_t id, bool on);
+        /* 一个字内编码值落在[lo, hi]的位 */
+        static uint64_t eval_word(const uint64_t *const *slices, size_t i,
+                uint64_t e, uint32_t lo, uint32_t hi);
+    private:
+        uint32_t m_capacity;
+        size_t m_exist_num;
+        Bitmap m_exist;
+        Version m_version;
+        std::vector<field_t *> m_fields;
+};
+
+#endif
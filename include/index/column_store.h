@@ -0,0 +1,195 @@
+#ifndef __AGILE_SE_COLUMN_STORE_H__
+#define __AGILE_SE_COLUMN_STORE_H__
+
+#include <new>
+#include <sched.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "index/segment_array.h"
+
+// =====================================================================================
+//        Class:  ColumnStore
+//  Description:  正排int/float字段的列存副本，每个字段一个按docid寻址的数组
+//                live位图标记docid是否存在，列值先于live位写入
+//                每64行一个版本号(与live位图的字对应)，改写行时先置为奇数，写完置回偶数，
+//                读线程读前后版本不同(或为奇数)时重读，多列的值总是同一次写入的
+//                行存仍然是权威数据，列存由ForwardIndex在更新时同步维护
+// =====================================================================================
+class ColumnStore
+{
+    public:
+        enum { INT_COLUMN = 0, FLOAT_COLUMN = 1 };
+        enum { SEGMENT_BITS = 16 };
+        typedef SegmentArray<uint32_t, SEGMENT_BITS> Data;
+        typedef SegmentArray<uint64_t, SEGMENT_BITS - 6> Bitmap; /* 与Data的段一一对应 */
+        typedef SegmentArray<uint32_t, SEGMENT_BITS - 6> Version; /* 与Bitmap的字一一对应 */
+
+        struct column_t
+        {
+            std::string name;
+            int type;
+            int array_offset;
+            Data data;
+
+            int32_t int_at(uint32_t id) const { return *(const int32_t *)data.at(id); }
+            float float_at(uint32_t id) const { return *(const float *)data.at(id); }
+        };
+    private:
+        ColumnStore(const ColumnStore &);
+        ColumnStore &operator =(const ColumnStore &);
+    public:
+        ColumnStore() : m_capacity(0), m_live_num(0) { }
+        ~ColumnStore()
+        {
+            for (size_t i = 0; i < m_columns.size(); ++i)
+            {
+                delete m_columns[i];
+            }
+            m_columns.clear();
+        }
+
+        int init(uint32_t capacity)
+        {
+            const uint32_t words = (uint32_t)(((uint64_t)capacity + 63) >> 6);
+            if (m_live.init(words) < 0 || m_version.init(words) < 0)
+            {
+                P_WARNING("failed to init live bitmap, capacity=%u", capacity);
+                return -1;
+            }
+            m_capacity = capacity;
+            return 0;
+        }
+        int add_column(const std::string &name, int type, int array_offset)
+        {
+            column_t *column = new (std::nothrow) column_t;
+            if (NULL == column || column->data.init(m_capacity) < 0)
+            {
+                P_WARNING("failed to init column[%s]", name.c_str());
+                delete column;
+                return -1;
+            }
+            column->name = name;
+            column->type = type;
+            column->array_offset = array_offset;
+            m_columns.push_back(column);
+            return m_columns.size() - 1;
+        }
+
+        uint32_t capacity() const { return m_capacity; }
+        size_t live_num() const { return m_live_num; }
+        size_t column_num() const { return m_columns.size(); }
+        const column_t *column(size_t i) const { return m_columns[i]; }
+        const column_t *get_column(const char *name) const
+        {
+            for (size_t i = 0; i < m_columns.size(); ++i)
+            {
+                if (m_columns[i]->name == name)
+                {
+                    return m_columns[i];
+                }
+            }
+            return NULL;
+        }
+
+        bool is_live(uint32_t id) const
+        {
+            const uint64_t *word = m_live.at(id >> 6);
+            return word && ((*word >> (id & 63)) & 0x1);
+        }
+        /* 第seg_no段对应的live位图，共Data::SEGMENT_SIZE/64个字 */
+        const uint64_t *live_segment(uint32_t seg_no) const { return m_live.segment(seg_no); }
+
+        /*
+         * 读id所在的64行之前取版本号，正在改写时等待；读完后用row_changed检查，
+         * 返回true表示期间有改写，需要重读
+         * */
+        uint32_t row_version(uint32_t id) const
+        {
+            const uint32_t *ptr = m_version.at(id >> 6);
+            if (NULL == ptr)
+            {
+                return 0;
+            }
+            uint32_t version;
+            while ((version = *(const volatile uint32_t *)ptr) & 0x1)
+            {
+                ::sched_yield();
+            }
+            __sync_synchronize();
+            return version;
+        }
+        bool row_changed(uint32_t id, uint32_t version) const
+        {
+            __sync_synchronize();
+            const uint32_t *ptr = m_version.at(id >> 6);
+            return (ptr ? *(const volatile uint32_t *)ptr : 0) != version;
+        }
+
+        /* 从行存info中拷贝列值，再置live位，单写线程调用 */
+        bool set_row(uint32_t id, const void *info)
+        {
+            if (id >= m_capacity)
+            {
+                P_WARNING("id[%u] exceeds column capacity[%u]", id, m_capacity);
+                return false;
+            }
+            uint64_t *word = m_live.alloc_at(id >> 6);
+            uint32_t *version = m_version.alloc_at(id >> 6);
+            if (NULL == word || NULL == version)
+            {
+                return false;
+            }
+            for (size_t i = 0; i < m_columns.size(); ++i) /* 先分配好段，改写期间不会失败 */
+            {
+                if (NULL == m_columns[i]->data.alloc_at(id))
+                {
+                    return false;
+                }
+            }
+            *(volatile uint32_t *)version = *version + 1;
+            __sync_synchronize();
+            for (size_t i = 0; i < m_columns.size(); ++i)
+            {
+                *(volatile uint32_t *)m_columns[i]->data.at(id) = ((const uint32_t *)info)[m_columns[i]->array_offset];
+            }
+            const uint64_t bit = ((uint64_t)1) << (id & 63);
+            if (0 == (*word & bit))
+            {
+                __sync_synchronize();
+                *(volatile uint64_t *)word = *word | bit;
+                ++m_live_num;
+            }
+            __sync_synchronize();
+            *(volatile uint32_t *)version = *version + 1;
+            return true;
+        }
+        void clear_row(uint32_t id)
+        {
+            uint64_t *word = m_live.at(id >> 6);
+            const uint64_t bit = ((uint64_t)1) << (id & 63);
+            if (word && (*word & bit))
+            {
+                *(volatile uint64_t *)word = *word & ~bit;
+                --m_live_num;
+            }
+        }
+
+        size_t mem_used() const
+        {
+            size_t mem = sizeof(*this) + m_live.mem_used() + m_version.mem_used();
+            for (size_t i = 0; i < m_columns.size(); ++i)
+            {
+                mem += m_columns[i]->data.mem_used();
+            }
+            return mem;
+        }
+    private:
+        uint32_t m_capacity;
+        size_t m_live_num;
+        Bitmap m_live;
+        Version m_version;
+        std::vector<column_t *> m_columns;
+};
+
+#endif
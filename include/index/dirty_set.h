@@ -0,0 +1,76 @@
+#ifndef __AGILE_SE_DIRTY_SET_H__
+#define __AGILE_SE_DIRTY_SET_H__
+
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+#include <ext/hash_map>
+
+// =====================================================================================
+//        Class:  DirtySet
+//  Description:  记录改动过的key(sign/docid/oid)，用于增量dump
+//                每个key记下最后一次改动时的版本号，每次dump之后版本号加1，
+//                增量dump取出版本号大于目标目录checkpoint的key，
+//                所有目录都已经包含的改动(版本号不超过synced)可以丢掉
+//                只在写线程使用
+// =====================================================================================
+class DirtySet
+{
+    private:
+        typedef __gnu_cxx::hash_map<uint32_t, uint32_t> Map;
+    public:
+        DirtySet()
+        {
+            m_enabled = false;
+            m_version = 1;
+        }
+
+        void enable() { m_enabled = true; }
+        bool enabled() const { return m_enabled; }
+        size_t size() const { return m_dirty.size(); }
+        uint32_t version() const { return m_version; }
+
+        void mark(uint32_t key)
+        {
+            if (m_enabled)
+            {
+                m_dirty[key] = m_version;
+            }
+        }
+        /* 之后的改动记为version，丢掉版本号不超过synced的改动 */
+        void checkpoint(uint32_t version, uint32_t synced)
+        {
+            m_version = version;
+            Map::iterator it = m_dirty.begin();
+            while (it != m_dirty.end())
+            {
+                if (it->second <= synced)
+                {
+                    m_dirty.erase(it++);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+        }
+        /* 版本号大于checkpoint的key，升序 */
+        void collect(uint32_t checkpoint, std::vector<uint32_t> &keys) const
+        {
+            keys.clear();
+            for (Map::const_iterator it = m_dirty.begin(); it != m_dirty.end(); ++it)
+            {
+                if (it->second > checkpoint)
+                {
+                    keys.push_back(it->first);
+                }
+            }
+            std::sort(keys.begin(), keys.end());
+        }
+    private:
+        bool m_enabled;
+        uint32_t m_version;
+        Map m_dirty;
+};
+
+#endif
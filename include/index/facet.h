@@ -0,0 +1,72 @@
+#ifndef __AGILE_SE_FACET_H__
+#define __AGILE_SE_FACET_H__
+
+#include <vector>
+#include <stdint.h>
+#include <ext/hash_map>
+#include "index/forward_index.h"
+#include "search/doclist.h"
+
+struct facet_t
+{
+    int32_t value;
+    uint32_t count;
+};
+
+// =====================================================================================
+//        Class:  FacetCounter
+//  Description:  统计一批doc上int正排字段的取值分布，有列存时读列存，否则批量读行存
+//                [0, DENSE_LIMIT)内的值用数组计数，其余的值用hash计数
+//                一个counter只给一个线程用，并行时每个线程一个counter，最后合并
+// =====================================================================================
+class FacetCounter
+{
+    public:
+        enum { DENSE_LIMIT = 1 << 20 };
+        enum { BATCH_SIZE = 256 };
+        enum { MIN_PARALLEL_NUM = 1 << 16 }; /* doc数太少时不值得起线程 */
+        typedef __gnu_cxx::hash_map<int32_t, uint32_t> Map;
+    public:
+        FacetCounter() : m_forward(NULL), m_column(NULL), m_array_offset(-1), m_doc_num(0) { }
+
+        bool init(const ForwardIndex *forward, const char *field);
+        void clear();
+
+        /* 统计一批docid，不存在的doc不计数 */
+        void count(const int32_t *ids, size_t num);
+        /* 将docid切成thread_num份并行统计 */
+        void count(const int32_t *ids, size_t num, int thread_num);
+        /* 遍历拉链统计，返回遍历的doc数 */
+        size_t count(DocList *list);
+        void merge(const FacetCounter &other);
+
+        /* 计数过的doc数 */
+        size_t doc_num() const { return m_doc_num; }
+        /* 按count降序取前n个值，count相同时value小的在前，n为0时返回全部 */
+        void top(size_t n, std::vector<facet_t> &result) const;
+    private:
+        void add(int32_t value)
+        {
+            if ((uint32_t)value < m_dense.size())
+            {
+                ++m_dense[value];
+            }
+            else
+            {
+                this->add_slow(value);
+            }
+        }
+        void add_slow(int32_t value);
+        void count_column(const int32_t *ids, size_t num);
+        void count_rows(const int32_t *ids, size_t num);
+        static void *count_thread(void *arg);
+    private:
+        const ForwardIndex *m_forward;
+        const ColumnStore::column_t *m_column;
+        int m_array_offset;
+        size_t m_doc_num;
+        std::vector<uint32_t> m_dense;
+        Map m_sparse;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef __AGILE_SE_FIELD_FILTER_H__
+#define __AGILE_SE_FIELD_FILTER_H__
+
+#include <vector>
+#include <stdint.h>
+#include "index/forward_index.h"
+#include "search/bitmaplist.h"
+
+// =====================================================================================
+//        Class:  FieldFilter
+//  Description:  正排int/float字段上的过滤条件，多个条件之间为AND关系
+//                条件在add时按字段名解析成列/行偏移，int比较统一转成闭区间
+//                有列存的字段按列批量计算，否则读行存
+//                有BSI的字段可以不读正排，直接算出整个docid空间的结果位图
+// =====================================================================================
+class FieldFilter
+{
+    public:
+        enum { OP_EQ = 0, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE };
+        enum { BATCH_SIZE = 256 };
+    private:
+        struct clause_t
+        {
+            int type;                           /* ForwardIndex::INT_TYPE/FLOAT_TYPE */
+            int array_offset;
+            const ColumnStore::column_t *column;
+            const BitSlicedIndex::field_t *bsi;
+            bool negate;                        /* NE: 区间取反 */
+            bool is_in;
+            int32_t ilo, ihi;                   /* int: [ilo, ihi] */
+            float flo, fhi;                     /* float: [flo, fhi] */
+            std::vector<int32_t> in;            /* int IN集合，有序 */
+        };
+    public:
+        FieldFilter() : m_forward(NULL), m_columnar(true), m_bitmap(true) { }
+
+        void init(const ForwardIndex *forward)
+        {
+            m_forward = forward;
+            m_clauses.clear();
+            m_columnar = true;
+            m_bitmap = true;
+        }
+
+        /* field op value */
+        bool add(const char *field, int op, double value);
+        /* lo <= field <= hi */
+        bool add_between(const char *field, double lo, double hi);
+        /* field in (values)，仅支持int字段 */
+        bool add_in(const char *field, const std::vector<int32_t> &values);
+
+        bool empty() const { return m_clauses.empty(); }
+        /* 所有条件都在列存上时才能做整段扫描 */
+        bool is_columnar() const { return m_columnar; }
+        /* 所有条件都在BSI或列存上时才能生成位图 */
+        bool is_bitmap() const { return m_bitmap && m_forward && (m_forward->bsi() || m_forward->columns()); }
+        const ForwardIndex *forward() const { return m_forward; }
+
+        /* 单条正排记录是否满足条件 */
+        bool match(const void *info) const;
+        /*
+         * 过滤一批docid，满足条件的docid按原顺序保留在ids前部，返回保留个数
+         * 不存在的docid会被过滤掉
+         * */
+        size_t filter(int32_t *ids, size_t num) const;
+        /*
+         * 扫描docid区间[begin, end)，结果写入bits(第i位对应begin + i)，返回满足条件的个数
+         * 要求is_columnar()，begin必须是64的倍数，bits至少(end - begin + 63) / 64个字
+         * */
+        size_t scan(uint32_t begin, uint32_t end, uint64_t *bits) const;
+        /*
+         * 在整个docid空间上求值，第i位对应docid i，返回满足条件的个数
+         * 有BSI的条件按位切片计算，其余条件只对非0的字读列存，要求is_bitmap()
+         * */
+        size_t to_bitmap(std::vector<uint64_t> &bits) const;
+        /* 结果位图包装成拉链，可以和倒排拉链求交，失败返回NULL，调用者负责delete */
+        DocList *to_list(int8_t type) const;
+    private:
+        bool resolve(const char *field, clause_t &clause) const;
+        bool match_value(const clause_t &clause, const void *info) const;
+        static bool match_column(const clause_t &clause, uint32_t value);
+        size_t filter_columns(int32_t *ids, size_t num) const;
+        size_t filter_rows(int32_t *ids, size_t num) const;
+        static uint64_t eval64(const clause_t &clause, const uint32_t *values);
+        size_t eval_bsi(const clause_t &clause, uint64_t *bits, size_t nwords) const;
+    private:
+        const ForwardIndex *m_forward;
+        bool m_columnar;
+        bool m_bitmap;
+        std::vector<clause_t> m_clauses;
+};
+
+#endif
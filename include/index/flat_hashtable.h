@@ -0,0 +1,628 @@
+#ifndef __AGILE_SE_FLAT_HASH_TABLE_H__
+#define __AGILE_SE_FLAT_HASH_TABLE_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <vector>
+#include "index/hashtable.h"
+
+#ifndef AGILE_SE_FLAT_SSE2
+#ifdef __SSE2__
+#define AGILE_SE_FLAT_SSE2  1
+#else
+#define AGILE_SE_FLAT_SSE2  0
+#endif
+#endif
+#if AGILE_SE_FLAT_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ * 开放寻址的哈希表，接口与HashTable一致，可以通过typedef替换
+ *
+ * 每个槽一个控制字节：EMPTY、DELETED或者hash的低7位，槽按16个一组，
+ * 查找时用SSE2一次比较一组控制字节，只有低7位相同的槽才比较key，
+ * 按组做二次探测，遇到有EMPTY的组结束；key和value直接放在槽数组里，不经过pool
+ *
+ * 单线程写、多线程读：
+ *   写槽之后再写控制字节，FULL的槽不再修改，覆盖时写到新槽再把旧槽标成DELETED；
+ *   DELETED的槽不复用，FULL+DELETED超过容量的7/8时整表重建(元素多时容量翻倍)，
+ *   新表发布后旧表按时间或epoch延迟释放，读线程可以一直读完旧表；
+ *   删除和覆盖的元素按时间或epoch延迟调用cleanup
+ *
+ * Key和Value须是POD，find返回的指针只读有效，重建后写旧槽不生效
+ */
+template<typename Key, typename Value,
+    typename HashFun = __gnu_cxx::hash<Key>,
+    typename EqualFun = std::equal_to<Key>,
+    typename TMemoryPool = Mempool>
+class FlatHashTable
+{
+    public:
+        struct node_t
+        {
+            Key key;
+            Value value;
+        };
+
+        /* 元素不在pool中，保留ObjectPool和set_pool只是为了和HashTable互换 */
+        typedef TObjectPool<node_t, TMemoryPool> ObjectPool;
+        typedef void (*cleanup_fun_t)(node_t *ptr, intptr_t arg);
+    private:
+        enum { GROUP = 16 };
+        enum { DELAYED_TIME = 5 };  /* 与TDelayPool默认的延迟时间一致 */
+        static const int8_t EMPTY = -128;
+        static const int8_t DELETED = -2;
+
+        struct table_t
+        {
+            size_t capacity;    /* 2的幂，不小于GROUP */
+            size_t mask;
+            int8_t *ctrl;       /* capacity+GROUP个，末尾复制开头的GROUP-1个，按组读取时不用回绕 */
+            node_t *slots;
+        };
+        struct retired_t
+        {
+            table_t *table;
+            uint32_t time;
+            uint64_t epoch;
+        };
+        struct garbage_t
+        {
+            node_t node;
+            cleanup_fun_t fun;
+            intptr_t arg;
+            uint32_t time;
+            uint64_t epoch;
+        };
+    public:
+        class iterator
+        {
+            public:
+                iterator(const FlatHashTable *table)
+                {
+                    m_t = table ? table->m_table : NULL;
+                    m_pos = 0;
+                    this->seek();
+                }
+                iterator & operator ++()
+                {
+                    if (m_t && m_pos < m_t->capacity)
+                    {
+                        ++m_pos;
+                        this->seek();
+                    }
+                    return *this;
+                }
+                iterator operator ++(int)
+                {
+                    iterator tmp(*this);
+                    this->operator ++();
+                    return tmp;
+                }
+                operator bool () const
+                {
+                    return m_t && m_pos < m_t->capacity;
+                }
+                const Key &key() const
+                {
+                    return m_t->slots[m_pos].key;
+                }
+                Value &value() const
+                {
+                    return m_t->slots[m_pos].value;
+                }
+            private:
+                void seek()
+                {
+                    if (m_t)
+                    {
+                        while (m_pos < m_t->capacity && m_t->ctrl[m_pos] < 0)
+                        {
+                            ++m_pos;
+                        }
+                    }
+                }
+            private:
+                const table_t *m_t;
+                size_t m_pos;
+        };
+    private:
+        FlatHashTable(const FlatHashTable &);
+        FlatHashTable &operator =(const FlatHashTable &);
+    public:
+        FlatHashTable(size_t bucket_size)
+        {
+            m_cleanup_fun = NULL;
+            m_cleanup_arg = 0;
+            m_table = NULL;
+            m_size = 0;
+            m_deleted = 0;
+            if (bucket_size > 0)
+            {
+                size_t capacity = GROUP; /* 装下bucket_size个元素不用重建 */
+                while (capacity / 8 * 7 < bucket_size)
+                {
+                    capacity <<= 1;
+                }
+                m_table = alloc_table(capacity);
+            }
+        }
+        ~FlatHashTable()
+        {
+            this->clear();
+            while (!m_garbage.empty())
+            {
+                garbage_t &g = m_garbage.front();
+                g.fun(&g.node, g.arg);
+                m_garbage.pop_front();
+            }
+            free_table(m_table);
+            m_table = NULL;
+            for (size_t i = 0; i < m_retired.size(); ++i)
+            {
+                free_table(m_retired[i].table);
+            }
+            m_retired.clear();
+            m_cleanup_fun = NULL;
+            m_cleanup_arg = 0;
+        }
+
+        void set_pool(ObjectPool * /* pool */) { }
+        void set_cleanup(cleanup_fun_t fun, intptr_t arg)
+        {
+            m_cleanup_fun = fun;
+            m_cleanup_arg = arg;
+        }
+
+        size_t bucket_size() const { return m_table ? m_table->capacity : 0; }
+        size_t size() const { return m_size; }
+        size_t pool_bytes() const { return 0; }
+        size_t mem_used() const
+        {
+            size_t mem = sizeof(*this) + m_garbage.size() * sizeof(garbage_t);
+            if (m_table)
+            {
+                mem += table_bytes(m_table->capacity);
+            }
+            for (size_t i = 0; i < m_retired.size(); ++i)
+            {
+                mem += table_bytes(m_retired[i].table->capacity);
+            }
+            return mem;
+        }
+
+        /* 换一张同样大小的空表，旧表中的元素延迟cleanup */
+        void clear()
+        {
+            if (NULL == m_table || 0 == m_size + m_deleted)
+            {
+                return ;
+            }
+            table_t *t = alloc_table(m_table->capacity);
+            if (NULL == t)
+            {
+                P_WARNING("failed to alloc table, capacity=%lu", (uint64_t)m_table->capacity);
+                return ;
+            }
+            for (size_t i = 0; i < m_table->capacity; ++i)
+            {
+                if (m_table->ctrl[i] >= 0)
+                {
+                    this->add_garbage(m_table->slots[i]);
+                }
+            }
+            this->publish(t);
+            m_size = 0;
+            m_deleted = 0;
+        }
+
+        iterator begin() const
+        {
+            return iterator(this);
+        }
+
+        Value *find(const Key &key) const
+        {
+            const table_t *t = m_table;
+            if (NULL == t)
+            {
+                return NULL;
+            }
+            const size_t hash = mix(m_hash(key));
+            size_t pos = (hash >> 7) & t->mask;
+            size_t step = 0;
+            while (true)
+            {
+                uint32_t empty;
+                const uint32_t bits = match(t->ctrl + pos, int8_t(hash & 0x7F), empty);
+                __asm__ __volatile__("" ::: "memory"); /* 先读控制字节再读槽 */
+                for (uint32_t m = bits; m; m &= m - 1)
+                {
+                    node_t *slot = t->slots + ((pos + __builtin_ctz(m)) & t->mask);
+                    if (m_equal(key, slot->key))
+                    {
+                        return &slot->value;
+                    }
+                }
+                if (empty)
+                {
+                    return NULL;
+                }
+                step += GROUP;
+                pos = (pos + step) & t->mask;
+            }
+        }
+
+        bool insert(const Key &key, const Value &v)
+        {
+            if (NULL == m_table)
+            {
+                return false;
+            }
+            this->reclaim();
+            if (m_size + m_deleted + 1 > m_table->capacity / 8 * 7 && !this->rebuild())
+            {
+                return false;
+            }
+            const size_t hash = mix(m_hash(key));
+            size_t empty;
+            const size_t old = this->probe(key, hash, empty);
+            node_t *slot = m_table->slots + empty;
+            slot->key = key;
+            slot->value = v;
+            __sync_synchronize();
+            this->set_ctrl(empty, int8_t(hash & 0x7F));
+            if (old != m_table->capacity)
+            { /* overwrite */
+                this->set_ctrl(old, DELETED);
+                ++m_deleted;
+                this->add_garbage(m_table->slots[old]);
+            }
+            else
+            {
+                ++m_size;
+            }
+            return true;
+        }
+
+        bool remove(const Key &key, Value *pv = NULL)
+        {
+            if (NULL == m_table)
+            {
+                return false;
+            }
+            this->reclaim();
+            size_t empty;
+            const size_t old = this->probe(key, mix(m_hash(key)), empty);
+            if (old == m_table->capacity)
+            {
+                return false;
+            }
+            if (pv)
+            {
+                *pv = m_table->slots[old].value;
+            }
+            this->set_ctrl(old, DELETED);
+            ++m_deleted;
+            --m_size;
+            this->add_garbage(m_table->slots[old]);
+            return true;
+        }
+
+        /*
+         * 元素不在pool中，删得只剩容量的1/4以下时按元素数重建一张小表，
+         * 旧表和rebuild一样延迟释放；返回搬迁的元素数
+         */
+        size_t compact()
+        {
+            if (NULL == m_table)
+            {
+                return 0;
+            }
+            size_t capacity = GROUP;
+            while (m_size + 1 > capacity / 16 * 7)
+            {
+                capacity <<= 1;
+            }
+            if (capacity > m_table->capacity / 4 || !this->rebuild(capacity))
+            {
+                return 0;
+            }
+            return m_size;
+        }
+
+        /* 到期的旧表和cleanup，写操作时也会调用 */
+        void recycle() { this->reclaim(); }
+
+        /*
+         * 控制字节和槽数组的镜像，加载时表须为空，容量以镜像为准；
+         * 延迟cleanup的元素不写入，与TDelayPool的镜像一样
+         */
+        bool dump_image(FSInterface *fs, FSInterface::File fp) const
+        {
+            uint64_t head[3] = { this->bucket_size(), m_size, m_deleted };
+            if (fs->fwrite(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to write hash head");
+                return false;
+            }
+            if (head[0] > 0 && (fs->fwrite(m_table->ctrl, head[0] + GROUP, 1, fp) != 1
+                        || fs->fwrite(m_table->slots, sizeof(node_t) * head[0], 1, fp) != 1))
+            {
+                P_WARNING("failed to write slots");
+                return false;
+            }
+            return true;
+        }
+        bool load_image(FSInterface *fs, FSInterface::File fp)
+        {
+            uint64_t head[3];
+            if (fs->fread(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to read hash head");
+                return false;
+            }
+            if (NULL == m_table || 0 == head[0] || (head[0] & (head[0] - 1)) || 0 != m_size + m_deleted)
+            {
+                P_WARNING("hash mismatch: bucket_size=%lu[%lu], size=%lu",
+                        (uint64_t)head[0], (uint64_t)this->bucket_size(), (uint64_t)m_size);
+                return false;
+            }
+            table_t *t = head[0] == m_table->capacity ? m_table : alloc_table(head[0]);
+            if (NULL == t)
+            {
+                P_WARNING("failed to alloc table, capacity=%lu", (uint64_t)head[0]);
+                return false;
+            }
+            if (fs->fread(t->ctrl, head[0] + GROUP, 1, fp) != 1
+                    || fs->fread(t->slots, sizeof(node_t) * head[0], 1, fp) != 1)
+            {
+                P_WARNING("failed to read slots");
+                ::memset(t->ctrl, EMPTY, head[0] + GROUP);
+                if (t != m_table)
+                {
+                    free_table(t);
+                }
+                return false;
+            }
+            if (t != m_table)
+            {
+                free_table(m_table);
+                m_table = t;
+            }
+            m_size = head[1];
+            m_deleted = head[2];
+            return true;
+        }
+    private:
+        static size_t mix(size_t hash)
+        {
+            uint64_t h = hash;
+            h ^= h >> 33;
+            h *= 0xFF51AFD7ED558CCDULL;
+            h ^= h >> 33;
+            return (size_t)h;
+        }
+        /* 一组控制字节中等于c的位置，empty为EMPTY的位置 */
+        static uint32_t match(const int8_t *ctrl, int8_t c, uint32_t &empty)
+        {
+#if AGILE_SE_FLAT_SSE2
+            const __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+            empty = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(EMPTY)));
+            return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+            /* 每次8个字节：借位可能误报等于c^1的FULL槽，比较key时会排除；EMPTY是唯一最高位为1且bit1为0的值 */
+            uint64_t lo, hi;
+            ::memcpy(&lo, ctrl, sizeof(lo));
+            ::memcpy(&hi, ctrl + 8, sizeof(hi));
+            const uint64_t ones = 0x0101010101010101ULL;
+            const uint64_t highs = 0x8080808080808080ULL;
+            const uint64_t xlo = lo ^ (ones * (uint8_t)c);
+            const uint64_t xhi = hi ^ (ones * (uint8_t)c);
+            empty = to_mask(lo & (~lo << 6) & highs) | (to_mask(hi & (~hi << 6) & highs) << 8);
+            return to_mask((xlo - ones) & ~xlo & highs) | (to_mask((xhi - ones) & ~xhi & highs) << 8);
+#endif
+        }
+
+#if !AGILE_SE_FLAT_SSE2
+        /* 每个字节的最高位收集到低8位 */
+        static uint32_t to_mask(uint64_t highs)
+        {
+            return (uint32_t)(((highs >> 7) * 0x0102040810204080ULL) >> 56);
+        }
+#endif
+        static size_t table_bytes(size_t capacity)
+        {
+            return sizeof(table_t) + capacity + GROUP + sizeof(node_t) * capacity + sizeof(node_t);
+        }
+        static table_t *alloc_table(size_t capacity)
+        {
+            char *mem = (char *)::malloc(table_bytes(capacity));
+            if (NULL == mem)
+            {
+                return NULL;
+            }
+            table_t *t = (table_t *)mem;
+            t->capacity = capacity;
+            t->mask = capacity - 1;
+            t->ctrl = (int8_t *)(mem + sizeof(table_t));
+            const size_t off = (sizeof(table_t) + capacity + GROUP + sizeof(node_t) - 1) / sizeof(node_t) * sizeof(node_t);
+            t->slots = (node_t *)(mem + off);
+            ::memset(t->ctrl, EMPTY, capacity + GROUP);
+            return t;
+        }
+        static void free_table(table_t *t)
+        {
+            if (t)
+            {
+                ::free(t);
+            }
+        }
+
+        void set_ctrl(size_t i, int8_t c)
+        {
+            volatile int8_t *ctrl = m_table->ctrl;
+            ctrl[i] = c;
+            if (i < GROUP - 1)
+            {
+                ctrl[m_table->capacity + i] = c;
+            }
+        }
+
+        /*
+         * 返回key所在的槽，不存在时返回capacity；
+         * empty为探测序列上第一个EMPTY槽，覆盖时新值写在这里，读线程沿探测序列一定能找到
+         */
+        size_t probe(const Key &key, size_t hash, size_t &empty) const
+        {
+            const table_t *t = m_table;
+            size_t found = t->capacity;
+            size_t pos = (hash >> 7) & t->mask;
+            size_t step = 0;
+            while (true)
+            {
+                uint32_t m;
+                uint32_t bits = match(t->ctrl + pos, int8_t(hash & 0x7F), m);
+                for (; bits && found == t->capacity; bits &= bits - 1)
+                {
+                    const size_t i = (pos + __builtin_ctz(bits)) & t->mask;
+                    if (m_equal(key, t->slots[i].key))
+                    {
+                        found = i;
+                    }
+                }
+                if (m)
+                {
+                    empty = (pos + __builtin_ctz(m)) & t->mask;
+                    return found;
+                }
+                step += GROUP;
+                pos = (pos + step) & t->mask;
+            }
+        }
+
+        /* 元素超过容量的7/16时翻倍，否则只清掉DELETED */
+        bool rebuild()
+        {
+            size_t capacity = m_table->capacity;
+            if (m_size + 1 > capacity / 16 * 7)
+            {
+                capacity <<= 1;
+            }
+            return this->rebuild(capacity);
+        }
+        bool rebuild(size_t capacity)
+        {
+            table_t *t = alloc_table(capacity);
+            if (NULL == t)
+            {
+                P_WARNING("failed to alloc table, capacity=%lu", (uint64_t)capacity);
+                return false;
+            }
+            for (size_t i = 0; i < m_table->capacity; ++i)
+            {
+                if (m_table->ctrl[i] < 0)
+                {
+                    continue;
+                }
+                size_t pos = (mix(m_hash(m_table->slots[i].key)) >> 7) & t->mask;
+                size_t step = 0;
+                uint32_t m;
+                match(t->ctrl + pos, EMPTY, m);
+                while (0 == m)
+                {
+                    step += GROUP;
+                    pos = (pos + step) & t->mask;
+                    match(t->ctrl + pos, EMPTY, m);
+                }
+                const size_t j = (pos + __builtin_ctz(m)) & t->mask;
+                t->slots[j] = m_table->slots[i];
+                t->ctrl[j] = m_table->ctrl[i];
+                if (j < GROUP - 1)
+                {
+                    t->ctrl[capacity + j] = m_table->ctrl[i];
+                }
+            }
+            P_WARNING("rebuild flat hash, size=%lu, deleted=%lu, capacity=%lu=>%lu",
+                    (uint64_t)m_size, (uint64_t)m_deleted, (uint64_t)m_table->capacity, (uint64_t)capacity);
+            this->publish(t);
+            m_deleted = 0;
+            return true;
+        }
+
+        void publish(table_t *t)
+        {
+            retired_t item;
+            item.table = m_table;
+            __sync_synchronize();
+            m_table = t;
+            item.time = g_now_time;
+            item.epoch = epoch_retire();
+            m_retired.push_back(item);
+        }
+
+        void add_garbage(const node_t &node)
+        {
+            if (NULL == m_cleanup_fun)
+            {
+                return ;
+            }
+            garbage_t g;
+            g.node = node;
+            g.fun = m_cleanup_fun;
+            g.arg = m_cleanup_arg;
+            g.time = g_now_time;
+            g.epoch = epoch_retire();
+            m_garbage.push_back(g);
+        }
+
+        void reclaim()
+        {
+            if (m_retired.empty() && m_garbage.empty())
+            {
+                return ;
+            }
+            const uint32_t now = g_now_time;
+            uint64_t min_epoch = 0;
+            if (g_epoch_reclaim)
+            {
+                epoch_advance();
+                min_epoch = epoch_min_active();
+            }
+            size_t n = 0;
+            while (n < m_retired.size() && (g_epoch_reclaim ? m_retired[n].epoch < min_epoch
+                        : m_retired[n].time + DELAYED_TIME < now))
+            {
+                free_table(m_retired[n].table);
+                ++n;
+            }
+            if (n > 0)
+            {
+                m_retired.erase(m_retired.begin(), m_retired.begin() + n);
+            }
+            while (!m_garbage.empty() && (g_epoch_reclaim ? m_garbage.front().epoch < min_epoch
+                        : m_garbage.front().time + DELAYED_TIME < now))
+            {
+                garbage_t &g = m_garbage.front();
+                g.fun(&g.node, g.arg);
+                m_garbage.pop_front();
+            }
+        }
+    private:
+        cleanup_fun_t m_cleanup_fun;
+        intptr_t m_cleanup_arg;
+
+        table_t *volatile m_table;
+        size_t m_size;
+        size_t m_deleted;
+        std::vector<retired_t> m_retired;
+        std::deque<garbage_t> m_garbage;
+
+        HashFun m_hash;
+        EqualFun m_equal;
+};
+
+#endif
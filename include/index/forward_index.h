@@ -10,7 +10,13 @@
 #include "pool/delaypool.h"
 #include "pool/objectpool.h"
 #include "index/hashtable.h"
+#include "index/flat_hashtable.h"
 #include "index/idmap.h"
+#include "index/segment_array.h"
+#include "index/column_store.h"
+#include "index/bsi.h"
+#include "index/dirty_set.h"
+#include "index/mem_stats.h"
 #include "cJSON.h"
 #include "fsint.h"
 #include <google/protobuf/message.h>
@@ -32,7 +38,21 @@ struct forward_data_t
         return true;
     }
 };
+/* 已解析到字段slot的正排值，不依赖cJSON树 */
+struct forward_value_t
+{
+    enum { NUMBER = 0, STRING = 1, OBJECT = 2, OTHER = 3, RAW = 4 };
+
+    int slot;               /* ForwardIndex::get_slot_by_name */
+    int kind;
+    double number;          /* NUMBER */
+    const char *str;        /* STRING: 已反转义，以'\0'结尾; RAW: 原始字节，不以'\0'结尾 */
+    int len;
+    cJSON *json;            /* OBJECT: 只用于pb字段 */
+};
+
 cJSON *parse_forward_json(const std::string &json, std::vector<forward_data_t> &values);
+cJSON *parse_forward_json(const char *json, std::vector<forward_data_t> &values);
 
 class ForwardIndex;
 class FieldIterator
@@ -88,13 +108,20 @@ class ForwardIndex
             int32_t oid;
             vaddr_t addr;
         };
+#ifdef AGILE_SE_FLAT_HASH
+        typedef FlatHashTable<int32_t, value_t> Hash;
+        typedef FlatHashTable<int32_t, int32_t> IDMap;
+#else
         typedef HashTable<int32_t, value_t> Hash;  /* id => oid, vaddr */
         typedef HashTable<int32_t, int32_t> IDMap; /* oid => id */
+#endif
+        typedef SegmentArray<value_t> DirectArray; /* id => oid, vaddr, 按id直接寻址 */
         typedef Hash::ObjectPool NodePool;
         typedef IDMap::ObjectPool IDPool;
 
         struct FieldDes
         {
+            int slot;
             int offset;
             int array_offset;
             int type; /* 0->int, 1->float, 2->google::protobuf::Message * */
@@ -109,27 +136,53 @@ class ForwardIndex
         {
             public:
                 iterator(const ForwardIndex *idx)
-                    : m_idx(idx), m_it(m_idx->m_dict->begin())
-                { }
+                    : m_idx(idx), m_it(m_idx->m_dict)
+                {
+                    m_pos = 0;
+                }
 
-                bool next(int32_t *docid, void** info = NULL)
+                /* 同时返回内部id和外部id */
+                bool next_id(int32_t *id, int32_t *oid, void **info = NULL)
                 {
-                    if (!m_it)
+                    int32_t cur_id;
+                    value_t value;
+                    if (m_idx->m_direct)
+                    {
+                        if (!m_idx->next_direct(m_pos, cur_id, value))
+                        {
+                            return false;
+                        }
+                    }
+                    else
                     {
-                        return false;
+                        if (!m_it)
+                        {
+                            return false;
+                        }
+                        cur_id = m_it.key();
+                        value = m_it.value();
+                        ++m_it;
                     }
-                    if (docid)
+                    if (id)
                     {
-                        *docid = m_it.value().oid;
+                        *id = cur_id;
+                    }
+                    if (oid)
+                    {
+                        *oid = value.oid;
                     }
                     if (info)
                     {
-                        *info = m_idx->m_pool.addr(m_it.value().addr);
+                        *info = m_idx->m_pool.addr(value.addr);
                     }
-                    ++m_it;
                     return true;
                 }
 
+                bool next(int32_t *docid, void** info = NULL)
+                {
+                    return this->next_id(NULL, docid, info);
+                }
+
                 bool next(int32_t *docid, FieldIterator *it = NULL)
                 {
                     if (it)
@@ -147,6 +200,7 @@ class ForwardIndex
             private:
                 const ForwardIndex *m_idx;
                 Hash::iterator m_it;
+                uint32_t m_pos;
         };
     private:
         ForwardIndex(const ForwardIndex &);
@@ -156,19 +210,48 @@ class ForwardIndex
         ~ForwardIndex();
 
         int init(const char *path, const char *file);
-        bool load(const char *dir, FSInterface *fs = NULL);
+        /* map_dir: IDMapper所在目录，增量dump时为最后一个增量目录 */
+        bool load(const char *dir, FSInterface *fs = NULL, const char *map_dir = NULL);
         bool dump(const char *dir, FSInterface *fs = NULL) const;
 
+        /* 增量dump：只写版本号大于checkpoint的oid，已删除的oid写成id为-1的记录 */
+        void enable_delta() { m_dirty.enable(); }
+        void delta_checkpoint(uint32_t version, uint32_t synced) { m_dirty.checkpoint(version, synced); }
+        bool dump_delta(const char *dir, uint32_t checkpoint, FSInterface *fs = NULL) const;
+        bool load_delta(const char *dir, FSInterface *fs = NULL);
+
         bool has_id_mapper() const { return m_map; }
 
         iterator begin() const { return iterator(this); }
-        size_t doc_num() const { return m_dict->size(); }
+        bool is_direct_address() const { return NULL != m_direct; }
+        size_t doc_num() const { return m_direct ? m_direct_num : m_dict->size(); }
 
         int get_offset_by_name(const char *name) const;
         int get_array_offset_by_name(const char *name) const;
+        int get_type_by_name(const char *name) const;
+        /* 字段按offset排序后的序号，用于预先解析字段名 */
+        int get_slot_by_name(const char *name) const;
+        size_t slot_num() const { return m_slots.size(); }
+        const char *get_slot_name(int slot) const { return m_field_names[slot].second.c_str(); }
+        int get_slot_type(int slot) const { return m_slots[slot].type; }
+        /* pb字段的默认message，其它类型返回NULL */
+        const google::protobuf::Message *get_slot_message(int slot) const
+        {
+            return PROTO_TYPE == m_slots[slot].type ? m_slots[slot].default_message : NULL;
+        }
+        /* 配置了field_N_columnar的int/float字段的列存，没有时为NULL */
+        const ColumnStore *columns() const { return m_columns; }
+        /* 配置了field_N_bsi的int/float字段的位切片索引，没有时为NULL */
+        const BitSlicedIndex *bsi() const { return m_bsi; }
 
         /* get info[outerid] by innerid(triggered by invert index) */
         void *get_info_by_id(int32_t id, int32_t *oid = NULL) const;
+        /*
+         * batch version of get_info_by_id, prefetch slots ahead,
+         * infos[i](oids[i]) is NULL(-1) if ids[i] doesn't exist, return found num
+         * */
+        size_t get_infos_by_ids(const int32_t *ids, size_t num,
+                void **infos, int32_t *oids = NULL) const;
         FieldIterator get_field_iterator(void *info) const
         {
             return FieldIterator(this, info);
@@ -186,6 +269,7 @@ class ForwardIndex
          * (may do some updates on invert index)
          * */
         bool update(int32_t oid, const std::vector<forward_data_t> &fields, ids_t *p_ids = NULL);
+        bool update(int32_t oid, const std::vector<forward_value_t> &values, ids_t *p_ids = NULL);
         /*
          * remove by outerid, by the way return innerid to caller
          * (remove it from invert index)
@@ -195,8 +279,23 @@ class ForwardIndex
         void recycle()
         {
             m_pool.recycle();
+            if (m_idmap)
+            {
+                m_idmap->recycle();
+            }
+            if (m_dict)
+            {
+                m_dict->recycle();
+            }
         }
+        /*
+         * 把空页归还系统，sparse_percent > 0时再把占用率低于它的页上的info、
+         * binary字段和hash节点搬到别的页上，这些页在旧元素延迟释放后归还；返回本次归还的字节数
+         */
+        size_t compact(uint32_t sparse_percent = 0);
         void print_meta() const;
+        /* 按结构记内存到prefix下，detail时遍历所有正排统计每个binary/pb字段 */
+        void mem_stats(MemStats &stats, const std::string &prefix, bool detail) const;
     private:
         struct cleanup_data_t
         {
@@ -208,6 +307,48 @@ class ForwardIndex
             void clean(Pool *pool);
         };
         static void cleanup(Hash::node_t *node, intptr_t arg);
+        static void cleanup_direct(void *mem, intptr_t arg);
+
+        bool get_value(int32_t id, value_t &value) const
+        {
+            if (m_direct)
+            {
+                const value_t *slot = m_direct->at((uint32_t)id);
+                if (NULL == slot)
+                {
+                    return false;
+                }
+                union { uint64_t u; value_t v; } tmp; /* 读写都是8字节整体操作 */
+                tmp.u = *(const volatile uint64_t *)slot;
+                if (0 == tmp.v.addr)
+                {
+                    return false;
+                }
+                value = tmp.v;
+                return true;
+            }
+            const value_t *pv = m_dict->find(id);
+            if (pv)
+            {
+                value = *pv;
+                return true;
+            }
+            return false;
+        }
+        bool insert_value(int32_t id, const value_t &value);
+        bool remove_value(int32_t id, value_t *value);
+        /* 删除oid但不通知IDMapper，remove和加载增量使用 */
+        bool remove_oid(int32_t oid, int32_t *p_id);
+        /* 正排序列化到buffer，pb/binary字段的位置上记长度，内容追加在后面 */
+        bool pack(const void *mem, char *&buffer, size_t &buffer_size, uint32_t &length) const;
+        /* 从pack的结果恢复正排并插入 */
+        bool unpack(int32_t oid, int32_t id, const char *buffer, uint32_t length, uint32_t info_size);
+        bool next_direct(uint32_t &pos, int32_t &id, value_t &value) const;
+        /* info或其binary字段在待搬迁的页上时拷贝一份，旧的延迟释放，value改为新地址 */
+        bool move_info(value_t &value);
+        /* 内存镜像：mempool的页和hash桶/直接寻址数组原样写出，加载后只重建列存和bsi */
+        bool dump_image(const char *dir, FSInterface *fs) const;
+        bool load_image(const char *dir, FSInterface *fs, const char *map_dir, uint32_t total);
     private:
         Pool m_pool;
         NodePool m_node_pool;
@@ -215,14 +356,22 @@ class ForwardIndex
 
         IDMap *m_idmap;
         Hash *m_dict;
+        DirectArray *m_direct; /* 配置direct_address时替代m_dict */
+        size_t m_direct_num;
+        ColumnStore *m_columns;
+        BitSlicedIndex *m_bsi;
 
         IDMapper *m_map;
+        DirtySet m_dirty;   /* 增量dump记录改动过的oid */
 
         __gnu_cxx::hash_map<std::string, FieldDes> m_fields;
         std::vector<std::pair<uint32_t, std::string> > m_field_names;
+        std::vector<FieldDes> m_slots;      /* 与m_field_names一一对应 */
+        std::vector<forward_value_t> m_update_values;
         std::vector<std::pair<uint32_t, double> > m_default_values;
         std::vector<const google::protobuf::Message *> m_default_messages;
         size_t m_info_size;
+        bool m_memory_image;    /* 配置memory_image时dump/load内存镜像 */
         std::string m_meta;
 
         cleanup_data_t m_cleanup_data;
@@ -2,11 +2,14 @@
 #define __AGILE_SE_HASH_TABLE_H__
 
 #include <string>
+#include <stdlib.h>
 #include <string.h>
+#include <vector>
 #include <functional>
 #include <ext/hash_map> /* <ext/hash_fun.h> is deprecated */
 #include "pool/mempool.h"
 #include "pool/objectpool.h"
+#include "fsint.h"
 
 namespace __gnu_cxx
 {
@@ -30,6 +33,24 @@ namespace std
         };
 }
 
+#ifndef AGILE_SE_HASH_MAX_LOAD
+#define AGILE_SE_HASH_MAX_LOAD      100     /* 元素数超过桶数的百分之多少时扩容，0为不扩容 */
+#endif
+#ifndef AGILE_SE_REHASH_STEP
+#define AGILE_SE_REHASH_STEP        4       /* 每次写操作最多搬迁的非空桶数 */
+#endif
+
+/*
+ * 单线程写、多线程读的拉链哈希表
+ *
+ * 元素数超过桶数*max_load%时桶数翻倍，渐进式rehash：新桶数组挂在旧桶数组的next上，
+ * 每次写操作搬迁AGILE_SE_REHASH_STEP个旧桶，写某个key前先搬迁它所在的旧桶，
+ * 所以一个key要么在未搬迁的旧桶中，要么在新桶中；
+ * 搬迁时把节点拷贝到新桶，再清空旧桶，旧节点延迟释放(不调用cleanup，值已经转移)，
+ * 读线程先查旧桶再沿next查新桶，不会漏查；换下来的桶数组按时间或epoch延迟释放
+ *
+ * 注意：find返回的指针只读有效，写线程之后再写同一个表时节点可能已被搬迁
+ */
 template<typename Key, typename Value,
     typename HashFun = __gnu_cxx::hash<Key>,
     typename EqualFun = std::equal_to<Key>,
@@ -51,29 +72,46 @@ class HashTable
 
         typedef TObjectPool<node_t, TMemoryPool> ObjectPool;
         typedef typename ObjectPool::cleanup_fun_t cleanup_fun_t;
+    private:
+        /* 桶数组，和桶数一起分配，读线程一次取到 */
+        struct table_t
+        {
+            table_t *volatile next; /* rehash的目标 */
+            size_t bucket_size;
+            vaddr_t buckets[1];
+        };
+        struct retired_t
+        {
+            table_t *table;
+            uint32_t time;
+            uint64_t epoch;
+        };
+        enum { DELAYED_TIME = 5 };  /* 与TDelayPool默认的延迟时间一致 */
     public:
+        /* 遍历时不保证快照语义，rehash过程中与写线程并发遍历可能重复看到被搬迁的元素 */
         class iterator
         {
             public:
                 iterator(const HashTable *table)
                     : m_table(table)
                 {
+                    m_t = NULL;
                     m_pos = 0;
                     m_cur = 0;
                     if (m_table)
                     {
-                        for (; m_pos < m_table->m_bucket_size; ++m_pos)
+                        table_t *cur = m_table->m_table;
+                        m_t = m_table->m_old;
+                        if (NULL == m_t)
                         {
-                            if (m_table->m_buckets[m_pos])
-                            {
-                                m_cur = m_table->m_buckets[m_pos];
-                                break;
-                            }
+                            m_t = cur;
                         }
+                        this->seek();
                     }
                 }
                 ~iterator()
                 {
+                    m_t = NULL;
                     m_pos = 0;
                     m_cur = 0;
                 }
@@ -88,14 +126,7 @@ class HashTable
                             if (0 == m_cur)
                             {
                                 ++m_pos;
-                                for (; m_pos < m_table->m_bucket_size; ++m_pos)
-                                {
-                                    if (m_table->m_buckets[m_pos])
-                                    {
-                                        m_cur = m_table->m_buckets[m_pos];
-                                        break;
-                                    }
-                                }
+                                this->seek();
                             }
                         }
                     }
@@ -119,8 +150,27 @@ class HashTable
                 {
                     return m_table->m_pool->addr(m_cur)->value;
                 }
+            private:
+                /* 从m_pos开始找下一个非空桶，当前桶数组找完后接着找next */
+                void seek()
+                {
+                    while (m_t)
+                    {
+                        for (; m_pos < m_t->bucket_size; ++m_pos)
+                        {
+                            if (m_t->buckets[m_pos])
+                            {
+                                m_cur = m_t->buckets[m_pos];
+                                return ;
+                            }
+                        }
+                        m_t = m_t->next;
+                        m_pos = 0;
+                    }
+                }
             private:
                 const HashTable *const m_table;
+                const table_t *m_t;
                 size_t m_pos;
                 vaddr_t m_cur;
         };
@@ -133,27 +183,26 @@ class HashTable
             m_pool = NULL;
             m_cleanup_fun = NULL;
             m_cleanup_arg = 0;
-            m_buckets = NULL;
+            m_table = NULL;
+            m_old = NULL;
+            m_rehash_pos = 0;
             if (bucket_size > 0)
             {
-                m_buckets = new vaddr_t [bucket_size];
-                if (m_buckets)
-                {
-                    ::memset(m_buckets, 0, sizeof(vaddr_t) * bucket_size);
-                }
+                m_table = alloc_table(bucket_size);
             }
-            m_bucket_size = bucket_size;
             m_size = 0;
+            this->set_max_load(AGILE_SE_HASH_MAX_LOAD);
         }
         ~HashTable()
         {
             this->clear();
-            if (m_buckets)
+            free_table(m_table);
+            m_table = NULL;
+            for (size_t i = 0; i < m_retired.size(); ++i)
             {
-                delete [] m_buckets;
-                m_buckets = NULL;
+                free_table(m_retired[i].table);
             }
-            m_bucket_size = 0;
+            m_retired.clear();
             m_pool = NULL;
             m_cleanup_fun = NULL;
             m_cleanup_arg = 0;
@@ -165,32 +214,52 @@ class HashTable
             m_cleanup_fun = fun;
             m_cleanup_arg = arg;
         }
+        /* 元素数超过桶数的percent%时扩容，0为不扩容 */
+        void set_max_load(uint32_t percent)
+        {
+            m_max_load = percent;
+            m_grow_size = 0;
+            if (m_table && percent > 0)
+            {
+                m_grow_size = m_table->bucket_size * percent / 100;
+            }
+        }
 
-        size_t bucket_size() const { return m_bucket_size; }
+        size_t bucket_size() const { return m_table ? m_table->bucket_size : 0; }
         size_t size() const { return m_size; }
+        bool rehashing() const { return NULL != m_old; }
+        size_t pool_bytes() const { return m_size * sizeof(node_t); }
         size_t mem_used() const
         {
-            return sizeof(*this)
-                + sizeof(vaddr_t) * m_bucket_size
-                + m_size * sizeof(node_t);
+            size_t mem = sizeof(*this) + m_size * sizeof(node_t);
+            if (m_table)
+            {
+                mem += table_bytes(m_table->bucket_size);
+            }
+            if (m_old)
+            {
+                mem += table_bytes(m_old->bucket_size);
+            }
+            for (size_t i = 0; i < m_retired.size(); ++i)
+            {
+                mem += table_bytes(m_retired[i].table->bucket_size);
+            }
+            return mem;
         }
 
         void clear()
         {
-            if (m_buckets && m_size > 0)
+            if (m_table && m_size > 0)
             {
-                vaddr_t cur;
-                node_t *node;
-                for (size_t i = 0; i < m_bucket_size; ++i)
+                if (m_old)
                 {
-                    while (0 != m_buckets[i])
-                    {
-                        cur = m_buckets[i];
-                        node = m_pool->addr(cur);
-                        m_buckets[i] = node->next;
-                        m_pool->delay_free(cur, m_cleanup_fun, m_cleanup_arg);
-                    }
+                    this->clear_table(m_old);
                 }
+                this->clear_table(m_table);
+            }
+            if (m_old)
+            {
+                this->finish_rehash();
             }
             m_size = 0;
         }
@@ -202,28 +271,45 @@ class HashTable
 
         Value *find(const Key &key) const
         {
-            if (NULL == m_buckets)
+            /* 先取新表再取旧表，rehash开始时写线程先设置m_old再切换m_table */
+            const table_t *t = m_table;
+            const table_t *old = m_old;
+            if (old)
+            {
+                t = old;
+            }
+            if (NULL == t)
             {
                 return NULL;
             }
-            size_t off = m_hash(key) % m_bucket_size;
+            const size_t hash = m_hash(key);
             node_t *node;
-            vaddr_t cur = m_buckets[off];
-            while (0 != cur)
+            vaddr_t cur;
+            do
             {
-                node = m_pool->addr(cur);
-                if (m_equal(key, node->key))
+                cur = ((volatile vaddr_t *)t->buckets)[hash % t->bucket_size];
+                while (0 != cur)
                 {
-                    return &node->value;
+                    node = m_pool->addr(cur);
+                    if (m_equal(key, node->key))
+                    {
+                        return &node->value;
+                    }
+                    cur = node->next;
                 }
-                cur = node->next;
-            }
+                t = t->next;
+            } while (t);
             return NULL;
         }
 
         bool insert(const Key &key, const Value &v)
         {
-            if (NULL == m_buckets)
+            if (NULL == m_table)
+            {
+                return false;
+            }
+            const size_t hash = m_hash(key);
+            if (!this->prepare_write(hash))
             {
                 return false;
             }
@@ -233,11 +319,12 @@ class HashTable
                 return false;
             }
             node_t *const add = m_pool->addr(vnew);
-            size_t off = m_hash(key) % m_bucket_size;
+            vaddr_t *const buckets = m_table->buckets;
+            size_t off = hash % m_table->bucket_size;
 
             node_t *node;
             node_t *pre = NULL;
-            vaddr_t cur = m_buckets[off];
+            vaddr_t cur = buckets[off];
             while (0 != cur)
             {
                 node = m_pool->addr(cur);
@@ -250,7 +337,7 @@ class HashTable
                     }
                     else
                     {
-                        m_buckets[off] = vnew;
+                        buckets[off] = vnew;
                     }
                     m_pool->delay_free(cur, m_cleanup_fun, m_cleanup_arg);
                     return true;
@@ -265,22 +352,32 @@ class HashTable
             }
             else
             {
-                m_buckets[off] = vnew;
+                buckets[off] = vnew;
             }
             ++m_size;
+            if (m_grow_size > 0 && m_size > m_grow_size && NULL == m_old)
+            {
+                this->start_rehash(m_table->bucket_size << 1);
+            }
             return true;
         }
 
         bool remove(const Key &key, Value *pv = NULL)
         {
-            if (NULL == m_buckets)
+            if (NULL == m_table)
+            {
+                return false;
+            }
+            const size_t hash = m_hash(key);
+            if (!this->prepare_write(hash))
             {
                 return false;
             }
-            size_t off = m_hash(key) % m_bucket_size;
+            vaddr_t *const buckets = m_table->buckets;
+            size_t off = hash % m_table->bucket_size;
             node_t *node;
             node_t *pre = NULL;
-            vaddr_t cur = m_buckets[off];
+            vaddr_t cur = buckets[off];
             while (0 != cur)
             {
                 node = m_pool->addr(cur);
@@ -292,7 +389,7 @@ class HashTable
                     }
                     else
                     {
-                        m_buckets[off] = node->next;
+                        buckets[off] = node->next;
                     }
                     if (pv)
                     {
@@ -307,14 +404,358 @@ class HashTable
             }
             return false;
         }
+
+        /* 释放到期的旧桶数组，写操作时也会调用 */
+        void recycle()
+        {
+            if (!m_retired.empty())
+            {
+                this->reclaim();
+            }
+        }
+
+        /*
+         * 把待搬迁页上的节点拷贝到新节点并替换，旧节点延迟释放(不调用cleanup，值已经转移)，
+         * 读线程仍可以沿旧节点的next走完；返回搬迁的节点数
+         */
+        size_t compact()
+        {
+            size_t moved = 0;
+            if (NULL == m_table || 0 == m_size)
+            {
+                return 0;
+            }
+            while (m_old) /* 先做完rehash，只整理新表 */
+            {
+                const size_t pos = m_rehash_pos;
+                this->rehash_step(m_old->bucket_size);
+                if (m_old && m_rehash_pos == pos)
+                {
+                    P_WARNING("failed to finish rehash, stop compacting");
+                    return 0;
+                }
+            }
+            vaddr_t *const buckets = m_table->buckets;
+            for (size_t i = 0; i < m_table->bucket_size; ++i)
+            {
+                node_t *pre = NULL;
+                vaddr_t cur = buckets[i];
+                while (0 != cur)
+                {
+                    node_t *node = m_pool->addr(cur);
+                    if (!m_pool->need_move(cur))
+                    {
+                        pre = node;
+                        cur = node->next;
+                        continue;
+                    }
+                    vaddr_t vnew = m_pool->template alloc<const Key &, const Value &>(node->key, node->value);
+                    if (0 == vnew)
+                    {
+                        P_WARNING("failed to alloc node, stop compacting");
+                        return moved;
+                    }
+                    node_t *add = m_pool->addr(vnew);
+                    add->next = node->next;
+                    if (pre)
+                    {
+                        pre->next = vnew;
+                    }
+                    else
+                    {
+                        buckets[i] = vnew;
+                    }
+                    m_pool->delay_free(cur);
+                    ++moved;
+                    pre = add;
+                    cur = add->next;
+                }
+            }
+            return moved;
+        }
+
+        /*
+         * 桶数组的镜像，节点在pool中，随pool的镜像一起恢复；
+         * rehash过程中的旧桶数组和搬迁位置一起写入，加载时表须为空，桶数以镜像为准
+         */
+        bool dump_image(FSInterface *fs, FSInterface::File fp) const
+        {
+            uint64_t head[4] = { this->bucket_size(), m_size, m_old ? m_old->bucket_size : 0, m_rehash_pos };
+            if (fs->fwrite(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to write hash head");
+                return false;
+            }
+            if (head[0] > 0 && fs->fwrite(m_table->buckets, sizeof(vaddr_t) * head[0], 1, fp) != 1)
+            {
+                P_WARNING("failed to write buckets");
+                return false;
+            }
+            if (head[2] > 0 && fs->fwrite(m_old->buckets, sizeof(vaddr_t) * head[2], 1, fp) != 1)
+            {
+                P_WARNING("failed to write old buckets");
+                return false;
+            }
+            return true;
+        }
+        bool load_image(FSInterface *fs, FSInterface::File fp)
+        {
+            uint64_t head[4];
+            if (fs->fread(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to read hash head");
+                return false;
+            }
+            if (NULL == m_table || 0 == head[0] || 0 != m_size || NULL != m_old)
+            {
+                P_WARNING("hash mismatch: bucket_size=%lu[%lu], size=%lu",
+                        (uint64_t)head[0], (uint64_t)this->bucket_size(), (uint64_t)m_size);
+                return false;
+            }
+            table_t *table = m_table;
+            table_t *old = NULL;
+            if (head[0] != table->bucket_size)
+            {
+                table = alloc_table(head[0]);
+            }
+            if (head[2] > 0)
+            {
+                old = alloc_table(head[2]);
+            }
+            if (NULL == table || (head[2] > 0 && NULL == old))
+            {
+                P_WARNING("failed to alloc buckets, bucket_size=%lu, old_bucket_size=%lu",
+                        (uint64_t)head[0], (uint64_t)head[2]);
+                goto FAIL;
+            }
+            if (fs->fread(table->buckets, sizeof(vaddr_t) * head[0], 1, fp) != 1
+                    || (old && fs->fread(old->buckets, sizeof(vaddr_t) * head[2], 1, fp) != 1))
+            {
+                P_WARNING("failed to read buckets");
+                goto FAIL;
+            }
+            if (table != m_table)
+            {
+                free_table(m_table);
+                m_table = table;
+            }
+            if (old)
+            {
+                old->next = m_table;
+                m_old = old;
+                m_rehash_pos = head[3];
+            }
+            m_size = head[1];
+            this->set_max_load(m_max_load);
+            return true;
+FAIL:
+            if (table != m_table)
+            {
+                free_table(table);
+            }
+            else
+            {
+                ::memset(table->buckets, 0, sizeof(vaddr_t) * table->bucket_size);
+            }
+            free_table(old);
+            return false;
+        }
+    private:
+        static size_t table_bytes(size_t bucket_size)
+        {
+            return sizeof(table_t) + sizeof(vaddr_t) * (bucket_size - 1);
+        }
+        static table_t *alloc_table(size_t bucket_size)
+        {
+            table_t *t = (table_t *)::calloc(1, table_bytes(bucket_size));
+            if (t)
+            {
+                t->next = NULL;
+                t->bucket_size = bucket_size;
+            }
+            return t;
+        }
+        static void free_table(table_t *t)
+        {
+            if (t)
+            {
+                ::free(t);
+            }
+        }
+
+        void clear_table(table_t *t)
+        {
+            vaddr_t cur;
+            node_t *node;
+            for (size_t i = 0; i < t->bucket_size; ++i)
+            {
+                while (0 != t->buckets[i])
+                {
+                    cur = t->buckets[i];
+                    node = m_pool->addr(cur);
+                    t->buckets[i] = node->next;
+                    m_pool->delay_free(cur, m_cleanup_fun, m_cleanup_arg);
+                }
+            }
+        }
+
+        /* 写key之前先搬迁它所在的旧桶，再推进rehash */
+        bool prepare_write(size_t hash)
+        {
+            if (m_old)
+            {
+                const size_t off = hash % m_old->bucket_size;
+                if (0 != m_old->buckets[off] && !this->migrate(off))
+                {
+                    return false;
+                }
+                this->rehash_step(AGILE_SE_REHASH_STEP);
+            }
+            if (!m_retired.empty())
+            {
+                this->reclaim();
+            }
+            return true;
+        }
+
+        bool start_rehash(size_t bucket_size)
+        {
+            table_t *t = alloc_table(bucket_size);
+            if (NULL == t)
+            {
+                m_grow_size <<= 1; /* 暂时不再尝试 */
+                P_WARNING("failed to alloc buckets, bucket_size=%lu", (uint64_t)bucket_size);
+                return false;
+            }
+            m_table->next = t;
+            m_rehash_pos = 0;
+            __sync_synchronize();
+            m_old = m_table;
+            __sync_synchronize();
+            m_table = t;
+            this->set_max_load(m_max_load);
+            P_WARNING("start rehash, size=%lu, bucket_size=%lu=>%lu",
+                    (uint64_t)m_size, (uint64_t)m_old->bucket_size, (uint64_t)bucket_size);
+            return true;
+        }
+
+        /* 搬迁最多step个非空桶，空桶最多跳过10*step个 */
+        void rehash_step(size_t step)
+        {
+            size_t empty = step * 10;
+            while (step > 0 && m_rehash_pos < m_old->bucket_size)
+            {
+                if (0 == m_old->buckets[m_rehash_pos])
+                {
+                    ++m_rehash_pos;
+                    if (0 == --empty)
+                    {
+                        break;
+                    }
+                    continue;
+                }
+                if (!this->migrate(m_rehash_pos))
+                {
+                    return ;
+                }
+                ++m_rehash_pos;
+                --step;
+            }
+            if (m_rehash_pos >= m_old->bucket_size)
+            {
+                this->finish_rehash();
+            }
+        }
+
+        /* 拷贝旧桶i的节点到新表，节点先全部分配好，失败时旧桶不变 */
+        bool migrate(size_t i)
+        {
+            m_moving.clear();
+            for (vaddr_t cur = m_old->buckets[i]; 0 != cur; cur = m_pool->addr(cur)->next)
+            {
+                node_t *node = m_pool->addr(cur);
+                vaddr_t vnew = m_pool->template alloc<const Key &, const Value &>(node->key, node->value);
+                if (0 == vnew)
+                {
+                    P_WARNING("failed to alloc node, cannot migrate bucket[%lu]", (uint64_t)i);
+                    for (size_t j = 0; j < m_moving.size(); ++j)
+                    {
+                        m_pool->free(m_moving[j].second);
+                    }
+                    m_moving.clear();
+                    return false;
+                }
+                m_moving.push_back(std::make_pair(cur, vnew));
+            }
+            vaddr_t *const buckets = m_table->buckets;
+            for (size_t j = 0; j < m_moving.size(); ++j)
+            {
+                node_t *add = m_pool->addr(m_moving[j].second);
+                const size_t off = m_hash(add->key) % m_table->bucket_size;
+                add->next = buckets[off];
+                __sync_synchronize();
+                buckets[off] = m_moving[j].second;
+            }
+            __sync_synchronize();
+            ((volatile vaddr_t *)m_old->buckets)[i] = 0;
+            for (size_t j = 0; j < m_moving.size(); ++j)
+            {
+                m_pool->delay_free(m_moving[j].first);
+            }
+            m_moving.clear();
+            return true;
+        }
+
+        void finish_rehash()
+        {
+            table_t *old = m_old;
+            m_old = NULL;
+            m_rehash_pos = 0;
+            __sync_synchronize();
+
+            retired_t item;
+            item.table = old;
+            item.time = g_now_time;
+            item.epoch = epoch_retire();
+            m_retired.push_back(item);
+            P_WARNING("finish rehash, size=%lu, bucket_size=%lu",
+                    (uint64_t)m_size, (uint64_t)m_table->bucket_size);
+        }
+
+        void reclaim()
+        {
+            const uint32_t now = g_now_time;
+            uint64_t min_epoch = 0;
+            if (g_epoch_reclaim)
+            {
+                epoch_advance();
+                min_epoch = epoch_min_active();
+            }
+            size_t n = 0;
+            while (n < m_retired.size() && (g_epoch_reclaim ? m_retired[n].epoch < min_epoch
+                        : m_retired[n].time + DELAYED_TIME < now))
+            {
+                free_table(m_retired[n].table);
+                ++n;
+            }
+            if (n > 0)
+            {
+                m_retired.erase(m_retired.begin(), m_retired.begin() + n);
+            }
+        }
     private:
         ObjectPool *m_pool;
         cleanup_fun_t m_cleanup_fun;
         intptr_t m_cleanup_arg;
 
-        vaddr_t *m_buckets;
-        size_t m_bucket_size;
+        table_t *volatile m_table;
+        table_t *volatile m_old;    /* rehash中的旧表，为NULL时没有rehash */
+        size_t m_rehash_pos;        /* 旧表中小于它的桶都已搬迁 */
         size_t m_size;
+        uint32_t m_max_load;
+        size_t m_grow_size;
+        std::vector<retired_t> m_retired;
+        std::vector<std::pair<vaddr_t, vaddr_t> > m_moving;
 
         HashFun m_hash;
         EqualFun m_equal;
@@ -23,14 +23,18 @@ class Index
         /* dump索引到磁盘，path == NULL->0/1目录切换 */
         int dump(const char *path = NULL);
         void print_meta() const;
+        /* 各level的内存统计，只能在写线程调用 */
+        void mem_stats(MemStats &stats, bool detail = false) const;
         void print_list() const;
         void exc_cmd() const;
 
+        bool check_dump_flag(); /* dump_flag文件是否更新过，由调用者自己dump */
         bool try2dump();
         void try_print_meta();
         void try_print_list();
         void try_exc_cmd();
         void try2merge();
+        void try2compact();
     public:
         LevelIndex *get_level_index(size_t level)
         {
@@ -44,6 +48,10 @@ class Index
         {
             return const_cast<Index *>(this)->get_level_index(level);
         }
+        size_t level_num() const /* 最大level + 1 */
+        {
+            return m_index.size();
+        }
     public:
         bool is_base_mode() const
         {
@@ -57,6 +65,57 @@ class Index
         {
             return m_conf.inc_das_warning_time;
         }
+        /* 以下用于inc::pipeline_processor和inc::level_pipeline_processor */
+        int32_t inc_parse_threads() const
+        {
+            return m_conf.inc_parse_threads;
+        }
+        int32_t inc_queue_size() const
+        {
+            return m_conf.inc_queue_size;
+        }
+        int32_t inc_queue_memory() const /* MB */
+        {
+            return m_conf.inc_queue_memory;
+        }
+        int32_t inc_coalesce_window() const /* 0表示不合并 */
+        {
+            return m_conf.inc_coalesce_window;
+        }
+        int32_t inc_coalesce_ms() const
+        {
+            return m_conf.inc_coalesce_ms;
+        }
+        /* 以下用于inc::base_build_processor */
+        int32_t base_build_threads() const
+        {
+            return m_conf.base_build_threads;
+        }
+        int32_t base_build_memory() const /* MB */
+        {
+            return m_conf.base_build_memory;
+        }
+        const std::string &base_build_tmp_path() const
+        {
+            return m_conf.base_build_tmp_path;
+        }
+        const std::string &index_meta_file() const
+        {
+            return m_conf.index_meta_file;
+        }
+        std::string level_dirname(size_t level) const
+        {
+            std::map<size_t, std::string>::const_iterator it = m_level2dirname.find(level);
+            return it == m_level2dirname.end() ? std::string() : it->second;
+        }
+        std::string writeable_path()
+        {
+            return m_dual_dir.writeable_path();
+        }
+        int switch_using()
+        {
+            return m_dual_dir.switch_using();
+        }
     public:
         pthread_t m_inc_tid;
         inc::IncReader m_inc_reader;
@@ -72,6 +131,18 @@ class Index
             std::string dump_flag_file;
             std::string inc_processor;
             int32_t inc_das_warning_time;
+            int32_t inc_parse_threads;
+            int32_t inc_queue_size;
+            int32_t inc_queue_memory;
+            int32_t inc_coalesce_window;
+            int32_t inc_coalesce_ms;
+            int32_t base_build_threads;
+            int32_t base_build_memory;
+            std::string base_build_tmp_path;
+            int32_t epoch_reclaim;          /* 按epoch回收延迟释放的内存，见pool/epoch.h */
+            std::string page_backend;
+            std::string numa_policy;
+            std::string numa_nodes;
         } m_conf;
     public:
         static std::map<std::string, thread_func_t> s_inc_processors;
@@ -19,10 +19,13 @@
 #include "pool/objectpool.h"
 #include "index/hashtable.h"
 #include "index/skiplist.h"
-#include "index/sortlist.h"
+#include "index/term_vector.h"
 #include "index/invert_type.h"
 #include "index/signdict.h"
+#include "index/segment_invert.h"
+#include "index/dirty_set.h"
 #include "search/doclist.h"
+#include "search/biglist.h"
 #include "file_watcher.h"
 #include "cJSON.h"
 #include "fsint.h"
@@ -65,7 +68,22 @@ struct invert_data_t
     }
 };
 cJSON *parse_invert_json(const std::string &json, std::vector<invert_data_t> &values);
+cJSON *parse_invert_json(const char *json, std::vector<invert_data_t> &values);
+/* 已经签过名的倒排项，用于二进制增量事件 */
+struct invert_sign_t
+{
+    int type;
+    uint64_t sign;          /* InvertTypes::create_sign */
+    const char *word;       /* prefix + keystr，以'\0'结尾，首次出现时写入签名词典 */
+    uint32_t word_len;
+    uint16_t payload_len;   /* 须与该类型配置的payload_len一致 */
+    const void *payload;    /* 类型没有payload时为NULL */
+};
 
+/*
+ * 倒排索引的接口，LevelIndex按配置选择池的地址宽度：TInvertIndex<Mempool>或TInvertIndex<Mempool64>
+ * 签名、payload解析和增量记录与池无关，在这里实现，不走虚函数
+ */
 class InvertIndex
 {
     public:
@@ -86,13 +104,126 @@ class InvertIndex
                 pos = (uint32_t)-1;
             }
         };
+    private:
+        InvertIndex(const InvertIndex &);
+        InvertIndex &operator =(const InvertIndex &);
     public:
-        typedef TDelayPool<Mempool> Pool;
-        typedef Pool::vaddr_t vaddr_t;
+        InvertIndex()
+        {
+            m_segments = NULL;
+        }
+        virtual ~InvertIndex() { }
+
+        virtual int init(const char *path, const char *file) = 0;
+        /* dict_dir: 签名词典所在目录，增量dump时为最后一个增量目录 */
+        virtual bool load(const char *dir, FSInterface *fs = NULL, const char *dict_dir = NULL) = 0;
+        virtual bool dump(const char *dir, FSInterface *fs = NULL) = 0;
+
+        /* 增量dump：只写版本号大于checkpoint的拉链和doc，分段倒排直接dump段清单 */
+        void enable_delta()
+        {
+            m_dirty_signs.enable();
+            m_dirty_docs.enable();
+        }
+        void delta_checkpoint(uint32_t version, uint32_t synced)
+        {
+            m_dirty_signs.checkpoint(version, synced);
+            m_dirty_docs.checkpoint(version, synced);
+        }
+        virtual bool dump_delta(const char *dir, uint32_t checkpoint, FSInterface *fs = NULL) = 0;
+        virtual bool load_delta(const char *dir, FSInterface *fs = NULL) = 0;
+        bool is_segmented() const { return NULL != m_segments; }
+
+        virtual size_t doc_num() const = 0;
+
+        bool is_valid_type(uint8_t type) const
+        {
+            return m_types.is_valid_type(type);
+        }
+        uint16_t get_payload_len(uint8_t type) const
+        {
+            return m_types.is_valid_type(type) ? m_types.types[type].payload_len : 0;
+        }
+        uint64_t get_sign(const char *keystr, uint8_t type) const
+        {
+            return m_types.get_sign(keystr, type);
+        }
+        bool create_sign(const char *keystr, uint8_t type,
+                char *buffer, uint32_t &buffer_len, uint64_t &sign) const
+        {
+            return m_types.is_valid_type(type) && m_types.create_sign(keystr, type, buffer, buffer_len, sign);
+        }
+        /* 用配置的parser把json解析成payload_len字节的payload */
+        const void *parse_payload(uint8_t type, const cJSON *json) const
+        {
+            if (!m_types.is_valid_type(type) || 0 == m_types.types[type].payload_len || NULL == json)
+            {
+                return NULL;
+            }
+            return m_types.types[type].parser->parse(json);
+        }
+
+        /* use binary logic DocList */
+        virtual DocList *parse(const std::string &query, const std::vector<term_t> &terms) const = 0;
+        /* use conjunction, disjunction */
+        virtual DocList *parse_hp(const std::string &query, const std::vector<term_t> &terms,
+                std::string *new_query = NULL) const = 0;
+        /* get a invert list */
+        virtual DocList *trigger(const char *keystr, uint8_t type) const = 0;
+        /* get all related lists of docid */
+        virtual bool get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const = 0;
+
+        /* 一个doc的所有倒排项，doc的TermVector只生成一次 */
+        virtual bool insert(int32_t docid, const std::vector<invert_data_t> &data) = 0;
+        virtual bool insert(int32_t docid, const std::vector<invert_sign_t> &data) = 0;
+        bool insert(int32_t docid, const invert_data_t &data)
+        {
+            return this->insert(data.key, data.type, docid, data.value);
+        }
+        /* insert docid to list: pre-signed word */
+        virtual bool insert(int32_t docid, const invert_sign_t &data) = 0;
+        /* insert docid to list: type + keystr */
+        virtual bool insert(const char *keystr, uint8_t type, int32_t docid, const cJSON *json) = 0;
+        /* remove docid from list: type + keystr */
+        virtual bool remove(const char *keystr, uint8_t type, int32_t docid) = 0;
+        /* remove docid from all related lists */
+        virtual bool remove(int32_t docid) = 0;
+        /* update docid: from->to, all related lists are updated */
+        virtual bool update_docid(int32_t from, int32_t to) = 0;
+
+        virtual void recycle() = 0;
+        /* 把空页归还系统，返回归还的字节数 */
+        virtual size_t trim() = 0;
+        virtual void print_meta() const = 0;
+        /* 按结构记内存到prefix下，detail时遍历所有拉链按倒排类型统计 */
+        virtual void mem_stats(MemStats &stats, const std::string &prefix, bool detail) const = 0;
+        virtual void print_list_length(const char *filename = NULL) const = 0;
+
+        virtual void try_exc_cmd() = 0;
+        virtual void exc_cmd() const = 0;
+
+        virtual void mergeAll(uint32_t length) = 0;
+    protected:
+        static void adjust_node(node_t &node);
+        static std::string print_node(const node_t &node);
+    protected:
+        InvertTypes m_types;
+        SegmentInvert *m_segments;  /* 配置了segment_path时使用分段倒排，子类的几个词典不再使用 */
+        DirtySet m_dirty_signs;
+        DirtySet m_dirty_docs;
+};
+
+/* 32位地址的池最多2^32个元素，超过时用Mempool64 */
+template<typename TMemoryPool = Mempool>
+class TInvertIndex: public InvertIndex
+{
+    public:
+        typedef TDelayPool<TMemoryPool> Pool;
+        typedef typename Pool::vaddr_t vaddr_t;
 
 #ifdef __NOT_USE_COWBTREE__
-        typedef HashTable<uint32_t, void *> Hash;
-        typedef Hash::ObjectPool NodePool;
+        typedef HashTable<uint32_t, void *, __gnu_cxx::hash<uint32_t>, std::equal_to<uint32_t>, TMemoryPool> Hash;
+        typedef typename Hash::ObjectPool NodePool;
 #else
 #if (1)
         typedef MultiMemoryPool RP;
@@ -101,27 +232,24 @@ class InvertIndex
 #endif
         typedef TDelayPool<RP> RPool;
         typedef CowBtree<RP, 32> Btree; /* use cowbtree32 */
-        typedef HashTable<uint32_t, vaddr_t> Hash;
+        typedef HashTable<uint32_t, vaddr_t, __gnu_cxx::hash<uint32_t>, std::equal_to<uint32_t>, TMemoryPool> Hash;
 
-        typedef TObjectPool<Btree, Mempool> BtreePool;
+        typedef TObjectPool<Btree, TMemoryPool> BtreePool;
 #endif
 
-        typedef HashTable<uint32_t, vaddr_t> VHash;
-        typedef VHash::ObjectPool VNodePool;
-
-        typedef SignDict::ObjectPool SNodePool;
+        typedef HashTable<uint32_t, vaddr_t, __gnu_cxx::hash<uint32_t>, std::equal_to<uint32_t>, TMemoryPool> VHash;
+        typedef typename VHash::ObjectPool VNodePool;
 
-        typedef TSkipList<Mempool> SkipList;
-        typedef TObjectPool<SkipList, Mempool> SkipListPool;
+        typedef TSkipList<TMemoryPool> SkipList;
+        typedef TObjectPool<SkipList, TMemoryPool> SkipListPool;
 
-        typedef SortList<uint32_t, Mempool> IDList;
-        typedef IDList::ObjectPool INodePool;
-        typedef TObjectPool<IDList, Mempool> IDListPool;
+        typedef HashTable<uint32_t, void *, __gnu_cxx::hash<uint32_t>, std::equal_to<uint32_t>, TMemoryPool> WHash; /* docid => TermVector */
+        typedef typename WHash::ObjectPool WNodePool;
     private:
-        InvertIndex(const InvertIndex &);
-        InvertIndex &operator =(const InvertIndex &);
+        TInvertIndex(const TInvertIndex &);
+        TInvertIndex &operator =(const TInvertIndex &);
     public:
-        InvertIndex()
+        TInvertIndex()
         {
             m_merge_threshold = 10000;
             m_merge_all_threshold = 1000;
@@ -131,64 +259,59 @@ class InvertIndex
             m_add_dict = NULL;
             m_del_dict = NULL;
             m_words_bag = NULL;
+            m_doc_batch = false;
         }
-        ~ InvertIndex();
+        ~TInvertIndex();
 
         int init(const char *path, const char *file);
-        bool load(const char *dir, FSInterface *fs = NULL);
+        bool load(const char *dir, FSInterface *fs = NULL, const char *dict_dir = NULL);
         bool dump(const char *dir, FSInterface *fs = NULL);
+        bool dump_delta(const char *dir, uint32_t checkpoint, FSInterface *fs = NULL);
+        bool load_delta(const char *dir, FSInterface *fs = NULL);
 
-        size_t doc_num() const { return m_words_bag->size(); }
-
-        bool is_valid_type(uint8_t type) const
-        {
-            return m_types.is_valid_type(type);
-        }
-        uint64_t get_sign(const char *keystr, uint8_t type) const
+        size_t doc_num() const
         {
-            return m_types.get_sign(keystr, type);
+            return m_segments ? m_segments->doc_num() : m_words_bag->size();
         }
 
-        /* use binary logic DocList */
         DocList *parse(const std::string &query, const std::vector<term_t> &terms) const;
-        /* use conjunction, disjunction */
         DocList *parse_hp(const std::string &query, const std::vector<term_t> &terms,
                 std::string *new_query = NULL) const;
-        /* get a invert list */
         DocList *trigger(const char *keystr, uint8_t type) const;
-        /* get all related lists of docid */
         bool get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const;
 
-        bool insert(int32_t docid, const std::vector<invert_data_t> &data)
-        {
-            bool ret = true;
-            for (size_t i = 0; i < data.size(); ++i)
-            {
-                ret = this->insert(docid, data[i]) && ret;
-            }
-            return ret;
-        }
-        bool insert(int32_t docid, const invert_data_t &data)
-        {
-            return this->insert(data.key, data.type, docid, data.value);
-        }
-        /* insert docid to list: type + keystr */
+        using InvertIndex::insert;
+        bool insert(int32_t docid, const std::vector<invert_data_t> &data) { return this->insert_doc(docid, data); }
+        bool insert(int32_t docid, const std::vector<invert_sign_t> &data) { return this->insert_doc(docid, data); }
+        bool insert(int32_t docid, const invert_sign_t &data);
         bool insert(const char *keystr, uint8_t type, int32_t docid, const cJSON *json);
-        /* remove docid from list: type + keystr */
         bool remove(const char *keystr, uint8_t type, int32_t docid);
-        /* remove docid from all related lists */
         bool remove(int32_t docid);
-        /* update docid: from->to, all related lists are updated */
         bool update_docid(int32_t from, int32_t to);
 
         void recycle()
         {
+            if (m_segments)
+            {
+                m_segments->recycle();
+            }
+            m_sign2id.recycle();
             m_pool.recycle();
 #ifndef __NOT_USE_COWBTREE__
             m_rpool.recycle();
 #endif
         }
+        size_t trim()
+        {
+            size_t released = m_pool.trim();
+            if (m_segments)
+            {
+                released += m_segments->trim();
+            }
+            return released;
+        }
         void print_meta() const;
+        void mem_stats(MemStats &stats, const std::string &prefix, bool detail) const;
         void print_list_length(const char *filename = NULL) const;
 
         void try_exc_cmd();
@@ -203,15 +326,29 @@ class InvertIndex
             return this->insert(m_types.record_sign(keystr, type), docid, payload, keystr, type);
         }
         bool insert(uint32_t sign, int32_t docid, void *payload, const char *keystr, uint8_t type);
+        template<typename Data>
+        bool insert_doc(int32_t docid, const std::vector<Data> &data)
+        {
+            m_doc_signs.clear();
+            m_doc_batch = true;
+            bool ret = true;
+            for (size_t i = 0; i < data.size(); ++i)
+            {
+                ret = this->insert(docid, data[i]) && ret;
+            }
+            m_doc_batch = false;
+            return this->add_terms(docid) && ret;
+        }
+        /* 把m_doc_signs并入docid的TermVector，生成一个新的替换旧的 */
+        bool add_terms(int32_t docid);
         uint32_t merge(uint32_t sign);
+        /* 用增量中的拉链替换sign当前的内容，doc_num为0时删除 */
+        bool replace_list(uint32_t sign, const bl_head_t &head, const int32_t *docids, const void *payloads);
     private:
-        static void cleanup_node(Hash::node_t *node, intptr_t arg);
-        static void cleanup_diff_node(VHash::node_t *node, intptr_t arg);
-        static void cleanup_id_node(VHash::node_t *node, intptr_t arg);
-        static void adjust_node(node_t &node);
-        static std::string print_node(const node_t &node);
+        static void cleanup_node(typename Hash::node_t *node, intptr_t arg);
+        static void cleanup_diff_node(typename VHash::node_t *node, intptr_t arg);
+        static void cleanup_id_node(typename WHash::node_t *node, intptr_t arg);
     private:
-        InvertTypes m_types;
         uint32_t m_merge_threshold;
         uint32_t m_merge_all_threshold;
         uint32_t m_merge_speed;
@@ -225,19 +362,21 @@ class InvertIndex
         BtreePool m_btree_pool;
 #endif
         VNodePool m_vnode_pool;
-        SNodePool m_snode_pool;
-        INodePool m_inode_pool;
+        WNodePool m_wnode_pool;
         SkipListPool m_skiplist_pool;
-        IDListPool m_idlist_pool;
 
         SignDict m_sign2id;
         Hash *m_dict;
         VHash *m_add_dict;
         VHash *m_del_dict;
-        VHash *m_words_bag;
+        WHash *m_words_bag;
+        bool m_doc_batch;                   /* 插入一个doc的倒排项期间，sign先攒在m_doc_signs里 */
+        std::vector<uint32_t> m_doc_signs;
 
         FileWatcher m_exc_cmd_fw;
         std::string m_exc_cmd_file;
 };
 
+typedef TInvertIndex<Mempool64> InvertIndex64;
+
 #endif
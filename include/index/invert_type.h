@@ -33,6 +33,7 @@ struct InvertTypes
     bool is_valid_type(uint8_t type) const;
     uint32_t get_sign(const char *keystr, uint8_t type) const; /* 0 is invalid */
     uint32_t record_sign(const char *keystr, uint8_t type); /* 0 is invalid */
+    uint32_t record_sign(uint64_t sign, const char *word, uint32_t len); /* 0 is invalid */
 
     void destroy();
     void clear();
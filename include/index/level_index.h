@@ -1,16 +1,20 @@
 #ifndef __AGILE_SE_LEVEL_INDEX_H__
 #define __AGILE_SE_LEVEL_INDEX_H__
 
+#include <map>
 #include <string>
 #include "index/invert_index.h"
 #include "index/forward_index.h"
+#include "index/field_filter.h"
+#include "index/facet.h"
+#include "search/filterlist.h"
 #include "dual_dir.h"
 #include "file_watcher.h"
 
 // =====================================================================================
 //        Class:  LevelIndex
 //  Description:  对InvertIndex和ForwardIndex进行封装，提供统一的查询/更新接口
-//                提供0/1目录dump功能
+//                提供0/1目录dump功能，配置DELTA_DUMP_NUM时每个目录是base+增量链
 // =====================================================================================
 class LevelIndex
 {
@@ -19,15 +23,27 @@ class LevelIndex
         {
             m_has_invert = false;
             m_last_merge_time = 0;
+            m_last_compact_time = 0;
+            m_delta_version = 1;
+            m_invert = NULL;
+        }
+        ~LevelIndex()
+        {
+            if (m_invert)
+            {
+                delete m_invert;
+                m_invert = NULL;
+            }
         }
-        ~LevelIndex() { }
 
         int init(const char *path, const char *file); /* 初始化函数，调用一次 */
         std::string name() const { return m_conf.index_name; }
+        bool has_invert() const { return m_has_invert; }
+        bool is_segmented() const { return m_has_invert && m_invert->is_segmented(); }
         size_t doc_num() const
         {
             if (m_has_invert) {
-                return m_invert.doc_num();
+                return m_invert->doc_num();
             } else {
                 return m_forward.doc_num();
             }
@@ -36,7 +52,7 @@ class LevelIndex
         {
             if (m_has_invert)
             {
-                m_invert.recycle();
+                m_invert->recycle();
             }
             m_forward.recycle();
         }
@@ -45,34 +61,87 @@ class LevelIndex
         bool is_valid_type(uint8_t type) const
         {
             if (m_has_invert) {
-                return m_invert.is_valid_type(type);
+                return m_invert->is_valid_type(type);
+            } else {
+                return false;
+            }
+        }
+        uint16_t get_payload_len(uint8_t type) const
+        {
+            if (m_has_invert) {
+                return m_invert->get_payload_len(type);
+            } else {
+                return 0;
+            }
+        }
+        bool create_sign(const char *keystr, uint8_t type,
+                char *buffer, uint32_t &buffer_len, uint64_t &sign) const
+        {
+            if (m_has_invert) {
+                return m_invert->create_sign(keystr, type, buffer, buffer_len, sign);
             } else {
                 return false;
             }
         }
+        const void *parse_payload(uint8_t type, const cJSON *json) const
+        {
+            if (m_has_invert) {
+                return m_invert->parse_payload(type, json);
+            } else {
+                return NULL;
+            }
+        }
         /* 倒排签名函数，生成倒排签名 */
         uint64_t get_sign(const char *keystr, uint8_t type) const
         {
             if (m_has_invert) {
-                return m_invert.get_sign(keystr, type);
+                return m_invert->get_sign(keystr, type);
             } else {
                 return ~(uint64_t)0;
             }
         }
+    /*
+     * 以下查询接口开启epoch回收时持有EpochGuard(见pool/epoch.h)，
+     * 返回的正排指针在拉链析构或调用者的EpochGuard退出之前有效
+     */
     public: /* 倒排触发接口 */
         DocList *trigger(const char *keystr, int8_t type) const
         {
+            EpochGuard guard;
             if (m_has_invert) {
-                return m_invert.trigger(keystr, type);
+                return m_invert->trigger(keystr, type);
             } else {
                 return NULL;
             }
         }
+        /* 触发拉链并下推正排过滤条件，复制一份拉链作为probe做批量过滤 */
+        DocList *trigger(const char *keystr, int8_t type, const FieldFilter &filter) const
+        {
+            EpochGuard guard;
+            if (!m_has_invert || filter.forward() != &m_forward) {
+                return NULL;
+            }
+            DocList *list = m_invert->trigger(keystr, type);
+            if (NULL == list) {
+                return NULL;
+            }
+            DocList *probe = list->clone(); /* 不支持复制时逐个doc过滤 */
+            DocList *result = new (std::nothrow) FilterList(list, filter, probe);
+            if (NULL == result) {
+                P_WARNING("failed to new FilterList");
+                delete list;
+                if (probe) {
+                    delete probe;
+                }
+            }
+            return result;
+        }
         DocList *parse(const std::string &query,
                 const std::vector<InvertIndex::term_t> &terms) const
         {
+            EpochGuard guard;
             if (m_has_invert) {
-                return m_invert.parse(query, terms);
+                return m_invert->parse(query, terms);
             } else {
                 return NULL;
             }
@@ -81,57 +150,136 @@ class LevelIndex
                 const std::vector<InvertIndex::term_t> &terms,
                 std::string *new_query = NULL) const
         {
+            EpochGuard guard;
             if (m_has_invert) {
-                return m_invert.parse_hp(query, terms, new_query);
+                return m_invert->parse_hp(query, terms, new_query);
             } else {
                 return NULL;
             }
         }
     public: /* 正排查询接口 */
+        int32_t get_field_offset_by_name(const char *field_name) const
+        {
+            return m_forward.get_offset_by_name(field_name);
+        }
         int32_t get_field_array_offset_by_name(const char *field_name) const
         {
             return m_forward.get_array_offset_by_name(field_name);
         }
+        /* 正排字段slot，用于事件的预解析 */
+        size_t field_slot_num() const
+        {
+            return m_forward.slot_num();
+        }
+        const char *get_field_slot_name(int slot) const
+        {
+            return m_forward.get_slot_name(slot);
+        }
+        int get_field_slot_type(int slot) const
+        {
+            return m_forward.get_slot_type(slot);
+        }
+        const google::protobuf::Message *get_field_slot_message(int slot) const
+        {
+            return m_forward.get_slot_message(slot);
+        }
+        /* 在本层正排上构造过滤条件 */
+        void init_field_filter(FieldFilter &filter) const
+        {
+            filter.init(&m_forward);
+        }
+        /* 过滤条件求值成位图拉链，可以和倒排拉链组合，条件不能生成位图时返回NULL */
+        DocList *filter_list(const FieldFilter &filter, int8_t type) const
+        {
+            EpochGuard guard;
+            if (filter.forward() != &m_forward || !filter.is_bitmap()) {
+                return NULL;
+            } else {
+                return filter.to_list(type);
+            }
+        }
         void *get_info_by_docid(int32_t docid, int32_t *oid = NULL) const
         {
+            EpochGuard guard;
             return m_forward.get_info_by_id(docid, oid);
         }
+        /*
+         * 统计拉链上int字段的取值分布，结果按count降序取前topn个
+         * thread_num > 1时先取出所有docid再分段并行统计，返回计数的doc数，失败返回-1
+         * */
+        int facet(DocList *list, const char *field, size_t topn,
+                std::vector<facet_t> &result, int thread_num = 1) const
+        {
+            EpochGuard guard;
+            FacetCounter counter;
+            if (!counter.init(&m_forward, field)) {
+                return -1;
+            }
+            if (thread_num > 1 && list) {
+                std::vector<int32_t> ids;
+                ids.reserve(list->cost());
+                for (int32_t docid = list->first(); docid != -1; docid = list->next()) {
+                    ids.push_back(docid);
+                }
+                if (!ids.empty()) {
+                    counter.count(&ids[0], ids.size(), thread_num);
+                }
+            } else {
+                counter.count(list);
+            }
+            counter.top(topn, result);
+            return counter.doc_num();
+        }
+        /* 批量获取正排，用于打分循环 */
+        size_t get_infos_by_docids(const int32_t *docids, size_t num,
+                void **infos, int32_t *oids = NULL) const
+        {
+            EpochGuard guard;
+            return m_forward.get_infos_by_ids(docids, num, infos, oids);
+        }
         int32_t get_id_by_oid(int32_t oid) const
         {
+            EpochGuard guard;
             return m_forward.get_id_by_oid(oid);
         }
         void *unpack_field(ForwardIndex::vaddr_t addr) const
         {
+            EpochGuard guard;
             return m_forward.unpack(addr);
         }
     public: /* 获取正排字段迭代器 */
         FieldIterator get_field_iterator(void *info) const
         {
+            EpochGuard guard;
             return this->m_forward.get_field_iterator(info);
         }
     public: /* 更新接口 */
-        bool forward_update(int32_t docid, const std::vector<forward_data_t> &fields)
+        /* Field为forward_data_t或forward_value_t */
+        template <typename Field>
+        bool forward_update(int32_t docid, const std::vector<Field> &fields)
         {
             if (m_has_invert) {
                 ForwardIndex::ids_t ids;
                 return m_forward.update(docid, fields, &ids)
-                    && m_invert.update_docid(ids.old_id, ids.new_id);
+                    && m_invert->update_docid(ids.old_id, ids.new_id);
             } else {
                 return m_forward.update(docid, fields, NULL);
             }
         }
-        bool update(int32_t docid, const std::vector<forward_data_t> &fields,
-                const std::vector<invert_data_t> &inverts)
+        /* Invert为invert_data_t或invert_sign_t */
+        template <typename Field, typename Invert>
+        bool update(int32_t docid, const std::vector<Field> &fields,
+                const std::vector<Invert> &inverts)
         {
             if (m_has_invert) {
                 ForwardIndex::ids_t ids;
                 if (!m_forward.update(docid, fields, &ids)) {
                     return false;
                 }
-                if (!m_invert.remove(ids.old_id)) {
+                if (!m_invert->remove(ids.old_id)) {
                     return false;
                 }
-                return m_invert.insert(ids.new_id, inverts);
+                return m_invert->insert(ids.new_id, inverts);
             } else {
                 return this->forward_update(docid, fields);
             }
@@ -140,33 +288,42 @@ class LevelIndex
         {
             if (m_has_invert) {
                 int32_t id = 0;
-                return m_forward.remove(docid, &id) && m_invert.remove(id);
+                return m_forward.remove(docid, &id) && m_invert->remove(id);
             } else {
                 return m_forward.remove(docid, NULL);
             }
         }
     public:
-        int dump(const char *path = NULL); /* dump索引到磁盘，0/1目录切换 */
+        int dump(const char *path = NULL); /* dump索引到磁盘，0/1目录切换，能增量时只写增量 */
         void print_meta() const
         {
             if (m_has_invert)
             {
-                m_invert.print_meta();
+                m_invert->print_meta();
             }
             m_forward.print_meta();
         }
+        /* 记到index_name下，detail时遍历全部拉链和正排，只能在写线程调用 */
+        void mem_stats(MemStats &stats, bool detail = false) const
+        {
+            if (m_has_invert)
+            {
+                m_invert->mem_stats(stats, m_conf.index_name + "/invert", detail);
+            }
+            m_forward.mem_stats(stats, m_conf.index_name + "/forward", detail);
+        }
         void print_list() const
         {
             if (m_has_invert)
             {
-                m_invert.print_list_length(m_conf.print_list_file.c_str());
+                m_invert->print_list_length(m_conf.print_list_file.c_str());
             }
         }
         void exc_cmd() const
         {
             if (m_has_invert)
             {
-                m_invert.exc_cmd();
+                m_invert->exc_cmd();
             }
         }
         bool try2dump() /* 若dump_flag文件更新，则dump索引 */
@@ -183,6 +340,12 @@ class LevelIndex
             if (m_print_meta_fw.check_and_update_timestamp() > 0)
             {
                 this->print_meta();
+                if (!m_conf.mem_stats_file.empty())
+                {
+                    MemStats stats;
+                    this->mem_stats(stats, true);
+                    stats.dump_json(m_conf.mem_stats_file.c_str());
+                }
             }
         }
         void try_print_list()
@@ -196,7 +359,7 @@ class LevelIndex
         {
             if (m_has_invert)
             {
-                m_invert.try_exc_cmd();
+                m_invert->try_exc_cmd();
             }
         }
         void try2merge(bool force = false)
@@ -206,19 +369,53 @@ class LevelIndex
             {
 #ifndef __NOT_USE_COWBTREE__
                 P_WARNING("start to merge");
-                m_invert.mergeAll(0);
+                m_invert->mergeAll(0);
                 P_WARNING("end of merge");
                 m_last_merge_time = g_now_time;
 #endif
             }
         }
+        /* 只能在写线程调用 */
+        void try2compact(bool force = false)
+        {
+            if (force || (m_conf.trim_interval > 0 && g_now_time >=
+                        m_last_compact_time + m_conf.trim_interval))
+            {
+                size_t released = m_forward.compact(m_conf.compact_sparse_percent);
+                if (m_has_invert)
+                {
+                    released += m_invert->trim();
+                }
+                P_WARNING("index[%s] released %lu bytes to os", m_conf.index_name.c_str(), (uint64_t)released);
+                m_last_compact_time = g_now_time;
+            }
+        }
+    private:
+        /* dump目录中的base+增量链，增量在delta.1 ... delta.N子目录中，由delta.meta记录 */
+        struct checkpoint_t
+        {
+            uint32_t version;   /* 目录包含了版本号不超过它的改动 */
+            uint32_t delta_num;
+        };
+        int dump_full(const std::string &dir, uint32_t version);
+        int dump_delta(const std::string &dir, const checkpoint_t &cp, uint32_t version);
+        void set_checkpoint(const std::string &dir, const checkpoint_t &cp);
+
+        static std::string delta_dir(const std::string &dir, uint32_t no);
+        /* 没有delta.meta时cp为{0, 0} */
+        static bool read_delta_meta(const std::string &dir, checkpoint_t &cp);
+        static bool write_delta_meta(const std::string &dir, const checkpoint_t &cp);
     private:
         ForwardIndex m_forward;
-        InvertIndex m_invert;
+        InvertIndex *m_invert;      /* 按INVERT_MEM64选择TInvertIndex<Mempool>或<Mempool64> */
         DualDir m_dual_dir; /* 0,1目录控制器 */
 
         bool m_has_invert;
         time_t m_last_merge_time;
+        time_t m_last_compact_time;
+
+        uint32_t m_delta_version;   /* 当前改动记的版本号，每次dump之后加1 */
+        std::map<std::string, checkpoint_t> m_checkpoints; /* 目录的绝对路径 => checkpoint */
 
         FileWatcher m_dump_fw;
         FileWatcher m_print_meta_fw;
@@ -236,11 +433,16 @@ class LevelIndex
 
             std::string dump_flag_file;
             std::string print_meta_flag_file;
+            std::string mem_stats_file;     /* print meta时把内存统计以json写到这个文件，不配置则不写 */
             std::string print_list_flag_file;
             std::string print_list_file;
 
             int32_t rebuild_index;
             int32_t merge_interval;
+            int32_t delta_dump_num;     /* 两次全量dump之间最多几次增量dump，0为只做全量dump */
+            int32_t trim_interval;      /* 每隔多少秒把空页归还系统，0为不做 */
+            int32_t compact_sparse_percent; /* 占用率低于它的正排页搬迁后归还，0为不搬迁 */
+            int32_t invert_mem64;       /* 倒排的池用64位地址，元素可以超过2^32个 */
         } m_conf;
 };
 
@@ -0,0 +1,65 @@
+#ifndef __AGILE_SE_MEM_STATS_H__
+#define __AGILE_SE_MEM_STATS_H__
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include "pool/mempool.h"
+
+/*
+ * 内存统计，按'/'分隔的路径记字节数，如"goods/invert/type[3]/btree_nodes"
+ * 输出json时路径展开为嵌套对象，每个对象带total为其下所有叶子之和
+ */
+class MemStats
+{
+    public:
+        typedef std::map<std::string, uint64_t> Map;
+    public:
+        void add(const std::string &path, uint64_t bytes) { m_bytes[path] += bytes; }
+        void clear() { m_bytes.clear(); }
+
+        /* path及其下所有叶子之和，path为空时为总和 */
+        uint64_t get(const std::string &path) const;
+        const Map &items() const { return m_bytes; }
+
+        std::string to_json() const;
+        /* 先写临时文件再rename，读的一方不会看到写了一半的文件 */
+        bool dump_json(const char *file) const;
+    private:
+        Map m_bytes;
+};
+
+/* hash的桶在堆上，节点在池中，返回在池中的字节数 */
+template<typename Hash>
+uint64_t add_hash_stats(MemStats &stats, const std::string &path, const Hash &hash)
+{
+    const uint64_t nodes = hash.pool_bytes();
+    stats.add(path + "/buckets", hash.mem_used() - nodes);
+    stats.add(path + "/nodes", nodes);
+    return nodes;
+}
+
+/*
+ * 池的驻留内存中没有被调用者计入的部分：free为空闲元素和未切分的页，garbage为等待延迟释放的元素，
+ * delay_queue为延迟队列自身的节点，unattributed为在用但不在attributed中的元素
+ * (不做详细统计时的拉链、由回调释放而没有记为garbage的元素等)
+ */
+template<typename Pool>
+void add_pool_stats(MemStats &stats, const std::string &path, const Pool &pool, uint64_t attributed)
+{
+    mempool_stats_t ps;
+    pool.get_stats(ps);
+    const uint64_t resident = ps.page_bytes - ps.released_bytes;
+    const uint64_t garbage = pool.garbage_bytes();
+    const uint64_t queue = pool.queue_bytes();
+    const uint64_t live = ps.live_bytes > garbage + queue ? ps.live_bytes - garbage - queue : 0;
+    stats.add(path + "/free", resident > ps.live_bytes ? resident - ps.live_bytes : 0);
+    stats.add(path + "/garbage", garbage);
+    stats.add(path + "/delay_queue", queue);
+    if (live > attributed)
+    {
+        stats.add(path + "/unattributed", live - attributed);
+    }
+}
+
+#endif
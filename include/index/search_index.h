@@ -68,6 +68,17 @@ class SearchIndex
         {
             return m_idx->get_field_iterator(info);
         }
+        /* 统计level层上拉链中int字段的取值分布，返回前topn个值 */
+        int facet(size_t level, DocList *list, const char *field, size_t topn,
+                std::vector<facet_t> &result, int thread_num = 1) const
+        {
+            const LevelIndex *li = m_idx->get_level_index(level);
+            if (NULL == li)
+            {
+                return -1;
+            }
+            return li->facet(list, field, topn, result, thread_num);
+        }
     private:
         Index *m_idx;
 };
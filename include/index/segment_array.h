@@ -0,0 +1,218 @@
+#ifndef __AGILE_SE_SEGMENT_ARRAY_H__
+#define __AGILE_SE_SEGMENT_ARRAY_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "log_utils.h"
+#include "fsint.h"
+
+// =====================================================================================
+//        Class:  SegmentArray
+//  Description:  按下标直接寻址的分段数组，段表在init时一次分配，之后只按需分配段，
+//                已分配的段地址永不变化，读线程无需加锁即可访问
+//                单写多读：写线程负责alloc_at/set，读线程只调用at
+// =====================================================================================
+template<typename T, uint32_t SEGMENT_BITS = 16>
+class SegmentArray
+{
+    public:
+        enum { SEGMENT_SIZE = (1U << SEGMENT_BITS) };
+    private:
+        SegmentArray(const SegmentArray &);
+        SegmentArray &operator =(const SegmentArray &);
+    public:
+        SegmentArray()
+        {
+            m_segments = NULL;
+            m_segment_num = 0;
+            m_alloced_num = 0;
+            m_capacity = 0;
+        }
+        ~SegmentArray()
+        {
+            this->clear();
+        }
+
+        int init(uint32_t capacity)
+        {
+            if (m_segments)
+            {
+                P_WARNING("ignore duplicate init call");
+                return -1;
+            }
+            m_segment_num = (uint32_t)(((uint64_t)capacity + SEGMENT_SIZE - 1) >> SEGMENT_BITS);
+            if (0 == m_segment_num)
+            {
+                P_WARNING("invalid capacity=%u", capacity);
+                return -1;
+            }
+            m_segments = (T **)::calloc(m_segment_num, sizeof(T *));
+            if (NULL == m_segments)
+            {
+                P_WARNING("failed to alloc segment table, segment_num=%u", m_segment_num);
+                m_segment_num = 0;
+                return -1;
+            }
+            m_capacity = capacity;
+            return 0;
+        }
+
+        void clear()
+        {
+            if (m_segments)
+            {
+                for (uint32_t i = 0; i < m_segment_num; ++i)
+                {
+                    if (m_segments[i])
+                    {
+                        ::free(m_segments[i]);
+                    }
+                }
+                ::free(m_segments);
+                m_segments = NULL;
+            }
+            m_segment_num = 0;
+            m_alloced_num = 0;
+            m_capacity = 0;
+        }
+
+        uint32_t capacity() const { return m_capacity; }
+        uint32_t segment_num() const { return m_segment_num; }
+        uint32_t alloced_segment_num() const { return m_alloced_num; }
+        size_t mem_used() const
+        {
+            return sizeof(*this)
+                + sizeof(T *) * m_segment_num
+                + sizeof(T) * SEGMENT_SIZE * m_alloced_num;
+        }
+
+        /* 段未分配或越界时返回NULL */
+        T *at(uint32_t pos) const
+        {
+            if (pos >= m_capacity)
+            {
+                return NULL;
+            }
+            T *seg = ((T *volatile *)m_segments)[pos >> SEGMENT_BITS];
+            if (NULL == seg)
+            {
+                return NULL;
+            }
+            return seg + (pos & (SEGMENT_SIZE - 1));
+        }
+        /* 段的起始地址，供批量扫描使用 */
+        T *segment(uint32_t seg_no) const
+        {
+            if (seg_no >= m_segment_num)
+            {
+                return NULL;
+            }
+            return ((T *volatile *)m_segments)[seg_no];
+        }
+        void prefetch(uint32_t pos) const
+        {
+            T *ptr = this->at(pos);
+            if (ptr)
+            {
+                __builtin_prefetch(ptr, 0, 1);
+            }
+        }
+
+        /* 写线程调用，段不存在时分配并清零 */
+        T *alloc_at(uint32_t pos)
+        {
+            if (pos >= m_capacity)
+            {
+                return NULL;
+            }
+            const uint32_t seg_no = pos >> SEGMENT_BITS;
+            T *seg = m_segments[seg_no];
+            if (NULL == seg)
+            {
+                seg = (T *)::calloc(SEGMENT_SIZE, sizeof(T));
+                if (NULL == seg)
+                {
+                    P_WARNING("failed to alloc segment[%u]", seg_no);
+                    return NULL;
+                }
+                __sync_synchronize(); /* 段内容先于段指针对读线程可见 */
+                ((T *volatile *)m_segments)[seg_no] = seg;
+                ++m_alloced_num;
+            }
+            return seg + (pos & (SEGMENT_SIZE - 1));
+        }
+
+        /* 已分配的段原样写出：段号 + 段内容，加载时容量须一致且还没有分配过段 */
+        bool dump_image(FSInterface *fs, FSInterface::File fp) const
+        {
+            uint32_t head[2] = { m_capacity, m_alloced_num };
+            if (fs->fwrite(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to write segment array head");
+                return false;
+            }
+            for (uint32_t i = 0; i < m_segment_num; ++i)
+            {
+                if (NULL == m_segments[i])
+                {
+                    continue;
+                }
+                if (fs->fwrite(&i, sizeof(i), 1, fp) != 1
+                        || fs->fwrite(m_segments[i], sizeof(T) * SEGMENT_SIZE, 1, fp) != 1)
+                {
+                    P_WARNING("failed to write segment[%u]", i);
+                    return false;
+                }
+            }
+            return true;
+        }
+        bool load_image(FSInterface *fs, FSInterface::File fp)
+        {
+            uint32_t head[2];
+            if (fs->fread(head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to read segment array head");
+                return false;
+            }
+            if (NULL == m_segments || head[0] != m_capacity || 0 != m_alloced_num)
+            {
+                P_WARNING("segment array mismatch: capacity=%u[%u], alloced_num=%u",
+                        head[0], m_capacity, m_alloced_num);
+                return false;
+            }
+            for (uint32_t i = 0; i < head[1]; ++i)
+            {
+                uint32_t seg_no;
+                if (fs->fread(&seg_no, sizeof(seg_no), 1, fp) != 1 || seg_no >= m_segment_num
+                        || NULL != m_segments[seg_no])
+                {
+                    P_WARNING("invalid segment no, i=%u", i);
+                    return false;
+                }
+                T *seg = (T *)::malloc(sizeof(T) * SEGMENT_SIZE);
+                if (NULL == seg)
+                {
+                    P_WARNING("failed to alloc segment[%u]", seg_no);
+                    return false;
+                }
+                if (fs->fread(seg, sizeof(T) * SEGMENT_SIZE, 1, fp) != 1)
+                {
+                    P_WARNING("failed to read segment[%u]", seg_no);
+                    ::free(seg);
+                    return false;
+                }
+                __sync_synchronize();
+                ((T *volatile *)m_segments)[seg_no] = seg;
+                ++m_alloced_num;
+            }
+            return true;
+        }
+    private:
+        T **m_segments;
+        uint32_t m_segment_num;
+        uint32_t m_alloced_num;
+        uint32_t m_capacity;
+};
+
+#endif
@@ -0,0 +1,251 @@
+#ifndef __AGILE_SE_SEGMENT_INVERT_H__
+#define __AGILE_SE_SEGMENT_INVERT_H__
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "pool/mempool.h"
+#include "pool/delaypool.h"
+#include "pool/objectpool.h"
+#include "index/hashtable.h"
+#include "index/skiplist.h"
+#include "index/sortlist.h"
+#include "index/segment_array.h"
+#include "index/invert_type.h"
+#include "index/mem_stats.h"
+#include "search/doclist.h"
+#include "fsint.h"
+
+// =====================================================================================
+//        Class:  InvertSegment
+//  Description:  不可变的倒排段，一个文件，只写一次，mmap加载
+//                head + 拉链(bl_head_t + docids + payloads，8字节对齐) + 词表(按sign排序)
+//                + doc的词(sign ids) + doc表(按docid排序)
+// =====================================================================================
+class InvertSegment
+{
+    public:
+        enum { MAGIC = 0x49474553 /* SEGI */, VERSION = 1 };
+
+        struct head_t
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t id;            /* 代数，生效代数不超过它的doc在本段中有效 */
+            uint32_t term_num;
+            uint32_t doc_num;
+            uint32_t reserved;
+            uint64_t posting_num;
+            uint64_t terms_offset;
+            uint64_t docs_offset;
+            uint64_t size;
+        };
+        struct term_t
+        {
+            uint32_t sign;
+            uint32_t doc_num;
+            uint64_t offset;        /* bl_head_t的偏移 */
+        };
+        struct doc_t
+        {
+            int32_t docid;
+            uint32_t word_num;
+            uint64_t offset;        /* sign ids的偏移 */
+        };
+    private:
+        InvertSegment(const InvertSegment &);
+        InvertSegment &operator =(const InvertSegment &);
+        InvertSegment();
+    public:
+        ~InvertSegment();
+
+        /* mmap段文件，失败返回NULL */
+        static InvertSegment *open(const std::string &path, uint32_t file_no);
+
+        uint32_t id() const { return m_head->id; }
+        uint32_t file_no() const { return m_file_no; }
+        uint32_t term_num() const { return m_head->term_num; }
+        uint32_t doc_num() const { return m_head->doc_num; }
+        uint64_t posting_num() const { return m_head->posting_num; }
+        uint64_t size() const { return m_head->size; }
+
+        const term_t *terms() const { return m_terms; }
+        const doc_t *docs() const { return m_docs; }
+        void *list(const term_t &term) const { return m_base + term.offset; }
+        const uint32_t *words(const doc_t &doc) const { return (const uint32_t *)(m_base + doc.offset); }
+
+        /* 拉链的起始地址(bl_head_t)，没有时返回NULL */
+        void *find(uint32_t sign) const;
+        const doc_t *find_doc(int32_t docid) const;
+        /* docid在sign拉链上的payload，没有时返回false */
+        bool find_posting(uint32_t sign, int32_t docid, uint8_t &type, const void *&payload) const;
+    private:
+        int8_t *m_base;
+        const head_t *m_head;
+        const term_t *m_terms;
+        const doc_t *m_docs;
+        uint32_t m_file_no;
+};
+
+// =====================================================================================
+//        Class:  SegmentInvert
+//  Description:  分段(LSM)的倒排，InvertIndex在配置了segment_path时使用
+//                写入只进可变段(sign => SkipList, docid => sign ids)，
+//                可变段超过seal_size个posting时封成不可变段写到segment_path并mmap，
+//                不可变段按posting数分层，同一层满merge_factor个时后台线程合并成一个新段，
+//                live记录每个docid当前内容的生效代数，段的代数小于它时段中该doc的内容已失效，
+//                删除/重写doc只改live，合并时丢弃失效的posting
+//                查询对各段的拉链求并，读线程通过快照访问段集合，旧快照和段延迟释放
+//                dump时只写新封的段，再写段清单、live和签名词典，已有的段文件不重写
+//                单写多读：insert/remove/recycle/dump只能在写线程调用
+// =====================================================================================
+class SegmentInvert
+{
+    public:
+        typedef TDelayPool<Mempool> Pool;
+        typedef Pool::vaddr_t vaddr_t;
+
+        typedef HashTable<uint32_t, vaddr_t> VHash;
+        typedef VHash::ObjectPool VNodePool;
+
+        typedef TSkipList<Mempool> SkipList;
+        typedef TObjectPool<SkipList, Mempool> SkipListPool;
+
+        typedef SortList<uint32_t, Mempool> IDList;
+        typedef IDList::ObjectPool INodePool;
+        typedef TObjectPool<IDList, Mempool> IDListPool;
+
+        enum { DELAYED_TIME = 5 };  /* 与TDelayPool默认的延迟时间一致，开启epoch回收时按epoch回收 */
+        enum { MERGE_IDLE = 0, MERGE_RUNNING, MERGE_DONE, MERGE_FAILED };
+
+        struct conf_t
+        {
+            std::string path;           /* 段文件目录，0/1目录共用 */
+            uint32_t max_items_num;
+            uint32_t hash_size;         /* 可变段的hash桶数 */
+            uint32_t seal_size;         /* 可变段的posting数超过它时封段 */
+            uint32_t merge_factor;      /* 同一层的段数达到它时合并 */
+        };
+    private:
+        /* 可变段 */
+        struct memtable_t
+        {
+            uint32_t id;
+            uint64_t posting_num;
+            VHash *dict;            /* sign => SkipList */
+            VHash *words;           /* docid => IDList */
+        };
+        /* 读线程看到的段集合 */
+        struct snapshot_t
+        {
+            std::vector<InvertSegment *> segments;
+            memtable_t *memtable;
+        };
+        /* 延迟释放 */
+        struct retired_t
+        {
+            uint32_t time;
+            uint64_t epoch;         /* 开启epoch回收时使用 */
+            snapshot_t *snapshot;
+            InvertSegment *segment;
+            memtable_t *memtable;
+        };
+        struct posting_t
+        {
+            uint32_t sign;
+            uint8_t type;
+            std::string payload;
+        };
+    private:
+        SegmentInvert(const SegmentInvert &);
+        SegmentInvert &operator =(const SegmentInvert &);
+    public:
+        SegmentInvert();
+        ~SegmentInvert();
+
+        int init(const InvertTypes &types, const conf_t &conf);
+        bool load(const char *dir, FSInterface *fs);
+        /* 封可变段后写段清单和live，签名词典由InvertIndex写 */
+        bool dump(const char *dir, FSInterface *fs);
+
+        size_t doc_num() const { return m_doc_num; }
+
+        DocList *trigger(uint32_t sign) const;
+        bool get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const;
+
+        bool insert(uint32_t sign, uint8_t type, int32_t docid, const void *payload);
+        bool remove(uint32_t sign, int32_t docid);
+        bool remove(int32_t docid);
+        bool update_docid(int32_t from, int32_t to);
+
+        /* 写线程定期调用：可变段满了封段，安装合并好的段，启动新的合并，延迟释放 */
+        void recycle();
+        size_t trim() { return m_pool.trim(); }
+        /* 把可变段封成不可变段 */
+        bool seal();
+        void print_meta() const;
+        void mem_stats(MemStats &stats, const std::string &prefix, bool detail) const;
+    private:
+        static void cleanup_list(VHash::node_t *node, intptr_t arg);
+        static void cleanup_words(VHash::node_t *node, intptr_t arg);
+        memtable_t *new_memtable(uint32_t id);
+        void delete_memtable(memtable_t *memtable);
+        SkipList *mem_list(const memtable_t *memtable, uint32_t sign) const;
+        IDList *mem_words(const memtable_t *memtable, int32_t docid) const;
+        bool insert_mem(memtable_t *memtable, uint32_t sign, uint8_t type, int32_t docid, const void *payload);
+        void remove_mem_posting(memtable_t *memtable, uint32_t sign, int32_t docid);
+        void remove_mem_doc(memtable_t *memtable, int32_t docid);
+
+        uint32_t live(int32_t docid) const
+        {
+            const uint32_t *gen = m_live.at(docid);
+            return gen ? *gen : 0;
+        }
+        bool set_live(int32_t docid, uint32_t gen);
+        /* 不可变段中docid仍然有效的posting，不含可变段 */
+        void collect(int32_t docid, std::vector<posting_t> &postings) const;
+        /* 把docid在不可变段中的内容搬到可变段(跳过skip_sign)，之后不可变段中的都失效 */
+        bool rewrite(int32_t docid, uint32_t skip_sign);
+        bool has_sign(int32_t docid, uint32_t sign) const;
+
+        std::string segment_path(uint32_t file_no) const;
+        InvertSegment *write_memtable(const memtable_t *memtable, uint32_t file_no);
+        void publish(const std::vector<InvertSegment *> &segments, memtable_t *memtable);
+        void retire(snapshot_t *snapshot, InvertSegment *segment, memtable_t *memtable);
+
+        uint32_t tier(const InvertSegment *segment) const;
+        void try_merge();
+        void install_merge();
+        static void *merge_thread(void *args);
+        InvertSegment *merge(const std::vector<InvertSegment *> &inputs, uint32_t file_no) const;
+        void remove_garbage(const std::vector<uint32_t> &keep);
+    private:
+        conf_t m_conf;
+        uint16_t m_payload_lens[256];
+
+        Pool m_pool;
+        VNodePool m_vnode_pool;
+        INodePool m_inode_pool;
+        SkipListPool m_skiplist_pool;
+        IDListPool m_idlist_pool;
+
+        snapshot_t *volatile m_snapshot;
+        std::vector<retired_t> m_retired;
+        SegmentArray<uint32_t> m_live;  /* docid => 生效代数，0为不存在 */
+        int32_t m_max_docid;
+        size_t m_doc_num;
+        uint32_t m_next_file_no;
+        std::vector<uint32_t> m_dumped; /* 上一次dump的段文件，另一个目录还在用 */
+
+        pthread_t m_merge_tid;
+        volatile int m_merge_state;
+        std::vector<InvertSegment *> m_merge_inputs;
+        InvertSegment *m_merge_output;
+        uint32_t m_merge_file_no;
+        uint32_t m_merge_retry_time;    /* 合并失败后隔一段时间再试 */
+        uint64_t m_merge_count;
+        uint64_t m_seal_count;
+};
+
+#endif
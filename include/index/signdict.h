@@ -1,30 +1,37 @@
 #ifndef __AGILE_SE_SIGN_DICT_H__
 #define __AGILE_SE_SIGN_DICT_H__
 
+#include <stdint.h>
+#include <pthread.h>
 #include <string>
 #include <vector>
-#include "index/hashtable.h"
+#include "index/mem_stats.h"
 #include "fsint.h"
 
+#ifndef AGILE_SE_SIGNDICT_MAX_SEGS
+#define AGILE_SE_SIGNDICT_MAX_SEGS  16384   /* id上限为MAX_SEGS*SEG_SIZE */
+#endif
+
+/*
+ * 词签名 => id，id从1开始连续分配
+ *
+ * 读(find)无锁且wait-free：开放寻址表，线性探测有界，槽的id写好之前读不到；
+ * 插入(find_or_insert)可以多线程并发：CAS抢占签名槽，词写入分块的arena，
+ * 再按id顺序CAS分配id，写好id => 词之后发布槽的id；
+ * 只有表扩容时持写锁，插入之间持读锁互不阻塞，读线程不受影响，换下来的表按时间或epoch延迟释放，
+ * 在之后的扩容或recycle中回收
+ *
+ * dump格式不变；load可以把signdict.data直接mmap进来，词指向映射的内存，之后新插入的词写入arena，
+ * 映射着的时候dump先写临时文件再rename，不截断映射的文件
+ */
 class SignDict
 {
     public:
+        /* dump格式中的key和value */
         struct key_t
         {
             uint32_t sign1;
             uint32_t sign2;
-
-            bool operator == (const key_t &o) const
-            {
-                return sign1 == o.sign1 && sign2 == o.sign2;
-            }
-        };
-        struct hash_fun_t
-        {
-            size_t operator()(const key_t &o) const
-            {
-                return ((((uint64_t)o.sign1) << 32) | o.sign2);
-            }
         };
         struct value_t
         {
@@ -32,8 +39,42 @@ class SignDict
             uint32_t offset;
             uint32_t length;
         };
-        typedef HashTable<key_t, value_t, hash_fun_t> Hash;
-        typedef Hash::ObjectPool ObjectPool;
+    private:
+        enum { SEG_SIZE = 65536 };
+        enum { DELAYED_TIME = 5 };  /* 与TDelayPool默认的延迟时间一致 */
+        enum { ID_FAILED = 0xFFFFFFFFu };  /* 插入失败，下一个插入同一签名的线程重新抢占 */
+
+        struct slot_t
+        {
+            volatile uint64_t sign;     /* 0为空槽，签名0单独存放 */
+            volatile uint32_t id;       /* 0为正在插入 */
+            uint32_t reserved;
+        };
+        struct table_t
+        {
+            uint64_t capacity;          /* 2的幂 */
+            uint64_t mask;
+            volatile uint64_t used;
+            slot_t slots[1];
+        };
+        struct retired_t
+        {
+            table_t *table;
+            uint32_t time;
+            uint64_t epoch;
+        };
+        struct word_t
+        {
+            const char *ptr;
+            uint32_t len;
+        };
+        struct chunk_t
+        {
+            chunk_t *prev;
+            uint32_t size;
+            volatile uint32_t pos;
+            char data[1];
+        };
     private:
         SignDict(const SignDict &);
         SignDict &operator =(const SignDict &);
@@ -41,26 +82,63 @@ class SignDict
         SignDict();
         virtual ~SignDict();
 
-        int init(ObjectPool *pool, uint32_t bucket_size, uint32_t buffer_size);
+        /* bucket_size: 表的初始大小，buffer_size: arena每块的大小，都会按需增长 */
+        int init(uint32_t bucket_size, uint32_t buffer_size);
+        /* 开启后load时把signdict.data mmap进来，只对本地文件(fs为NULL或DefaultFS)生效 */
+        void set_mmap_load(bool on) { m_mmap_load = on; }
+
+        /* dump期间的插入会等待 */
         bool dump(const char *dir, FSInterface *fs = NULL) const;
+        /* 不能与读写并发 */
         bool load(const char *dir, FSInterface *fs = NULL);
 
+        /* 释放过了延迟时间(或epoch)的换下来的表，在写线程的recycle路径上调用 */
+        void recycle();
+
         void print_meta() const;
+        /* 返回记入的字节中在池里的部分，都不在池中，返回0 */
+        uint64_t mem_stats(MemStats &stats, const std::string &path) const;
         const uint32_t idnum() const { return m_max_id - 1; }
 
-        /* thread safe */
+        /* thread safe, wait free */
         bool find(uint64_t sign, uint32_t &id) const;
-        /* do not use this func */
+        /* thread safe, do not use this func */
         bool find(uint32_t id, std::string &word) const;
-        /* not thread safe */
+        /* thread safe */
         bool find_or_insert(uint64_t sign, const char *word, uint32_t len, uint32_t &id);
-    protected:
-        Hash *m_dict;
-        char *m_buffer;
-        uint32_t m_max_id;
-        uint32_t m_buffer_pos;
-        uint32_t m_buffer_size;
-        std::vector<std::pair<uint32_t, uint32_t> > m_ids;
+    private:
+        void reset();
+        bool load_words(const std::string &path, FSInterface *fs,
+                const std::vector<std::pair<uint32_t, uint32_t> > &ids);
+
+        static uint64_t mix(uint64_t sign);
+        static table_t *alloc_table(uint64_t capacity);
+        slot_t *lookup(const table_t *t, uint64_t sign) const;
+        /* 在表中抢占sign的槽，返回NULL表示需要扩容 */
+        slot_t *claim(table_t *t, uint64_t sign, bool &owner);
+        bool grow(table_t *t);
+        /* 已持写锁 */
+        void sweep_retired();
+
+        const char *alloc_word(uint32_t len);
+        void push_chunk(chunk_t *chunk);
+        bool alloc_id(uint32_t &id);
+        const word_t *get_word(uint32_t id) const;
+    private:
+        table_t *volatile m_table;
+        slot_t m_zero;                      /* 签名0，sign为1表示已占用 */
+        volatile uint32_t m_max_id;
+        std::vector<retired_t> m_retired;
+        mutable pthread_rwlock_t m_lock;    /* 扩容和dump持写锁，插入持读锁 */
+
+        word_t *volatile m_words[AGILE_SE_SIGNDICT_MAX_SEGS];
+        chunk_t *volatile m_chunk;          /* 当前切分的块 */
+        chunk_t *volatile m_big;            /* 大词和加载的词单独分配的块 */
+        uint32_t m_chunk_size;
+
+        bool m_mmap_load;
+        void *m_map;                        /* mmap的signdict.data */
+        size_t m_map_size;
 };
 
 #endif
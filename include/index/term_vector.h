@@ -0,0 +1,228 @@
+#ifndef __AGILE_SE_TERM_VECTOR_H__
+#define __AGILE_SE_TERM_VECTOR_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+/*
+ * 一个doc的sign集合：升序，相邻做差后varint编码，头和数据放在一块malloc的内存里
+ *
+ * 建好之后不再修改，插入/删除时生成新的一块(copy-on-write)，调用者用新的替换旧的，
+ * 旧的延迟释放，读线程顺序解码不需要加锁
+ */
+class TermVector
+{
+    private:
+        struct head_t
+        {
+            uint32_t size;      /* sign个数 */
+            uint32_t bytes;     /* 编码后的字节数 */
+        };
+    public:
+        class iterator
+        {
+            public:
+                iterator(const void *tv)
+                {
+                    if (tv)
+                    {
+                        const head_t *head = (const head_t *)tv;
+                        m_cur = (const uint8_t *)(head + 1);
+                        m_end = m_cur + head->bytes;
+                    }
+                    else
+                    {
+                        m_cur = m_end = NULL;
+                    }
+                    m_sign = 0;
+                }
+                /* 到末尾时返回false */
+                bool next(uint32_t &sign)
+                {
+                    if (m_cur >= m_end)
+                    {
+                        return false;
+                    }
+                    uint32_t delta = 0;
+                    int shift = 0;
+                    uint8_t byte;
+                    do
+                    {
+                        byte = *m_cur++;
+                        delta |= uint32_t(byte & 0x7F) << shift;
+                        shift += 7;
+                    } while (byte & 0x80);
+                    m_sign += delta;
+                    sign = m_sign;
+                    return true;
+                }
+            private:
+                const uint8_t *m_cur;
+                const uint8_t *m_end;
+                uint32_t m_sign;
+        };
+    public:
+        static uint32_t size(const void *tv) { return tv ? ((const head_t *)tv)->size : 0; }
+        static size_t mem_used(const void *tv) { return tv ? sizeof(head_t) + ((const head_t *)tv)->bytes : 0; }
+        static void destroy(void *tv) { ::free(tv); }
+
+        static void decode(const void *tv, std::vector<uint32_t> &signs)
+        {
+            signs.clear();
+            signs.reserve(size(tv));
+            iterator it(tv);
+            uint32_t sign;
+            while (it.next(sign))
+            {
+                signs.push_back(sign);
+            }
+        }
+
+        /* signs须升序且不重复，num为0时返回NULL */
+        static void *create(const uint32_t *signs, uint32_t num)
+        {
+            if (0 == num)
+            {
+                return NULL;
+            }
+            uint32_t bytes = 0;
+            uint32_t prev = 0;
+            for (uint32_t i = 0; i < num; ++i)
+            {
+                bytes += encode(NULL, signs[i] - prev);
+                prev = signs[i];
+            }
+            head_t *head = alloc(num, bytes);
+            if (head)
+            {
+                uint8_t *out = (uint8_t *)(head + 1);
+                prev = 0;
+                for (uint32_t i = 0; i < num; ++i)
+                {
+                    out += encode(out, signs[i] - prev);
+                    prev = signs[i];
+                }
+            }
+            return head;
+        }
+
+        /* 先排序去重，会修改signs */
+        static void *create(std::vector<uint32_t> &signs)
+        {
+            std::sort(signs.begin(), signs.end());
+            signs.erase(std::unique(signs.begin(), signs.end()), signs.end());
+            return signs.empty() ? NULL : create(&signs[0], signs.size());
+        }
+
+        /*
+         * 插入sign，生成新的vector放到out，tv可以为NULL
+         * 返回1表示生成了新的，0表示已经存在，-1表示分配内存失败
+         */
+        static int insert(const void *tv, uint32_t sign, void *&out)
+        {
+            return rebuild(tv, sign, true, out);
+        }
+        /* 删除sign，返回值同insert，删空时out为NULL */
+        static int remove(const void *tv, uint32_t sign, void *&out)
+        {
+            return rebuild(tv, sign, false, out);
+        }
+    private:
+        static head_t *alloc(uint32_t size, uint32_t bytes)
+        {
+            head_t *head = (head_t *)::malloc(sizeof(head_t) + bytes);
+            if (head)
+            {
+                head->size = size;
+                head->bytes = bytes;
+            }
+            return head;
+        }
+
+        /* out为NULL时只计算长度 */
+        static uint32_t encode(uint8_t *out, uint32_t delta)
+        {
+            uint32_t len = 0;
+            while (delta >= 0x80)
+            {
+                if (out)
+                {
+                    out[len] = uint8_t(delta) | 0x80;
+                }
+                delta >>= 7;
+                ++len;
+            }
+            if (out)
+            {
+                out[len] = uint8_t(delta);
+            }
+            return len + 1;
+        }
+
+        /* 按新的集合重新编码到out，out为NULL时只计算长度，found返回sign是否已经存在 */
+        static uint32_t merge(const void *tv, uint32_t sign, bool add, uint8_t *out, bool &found)
+        {
+            iterator it(tv);
+            uint32_t bytes = 0;
+            uint32_t prev = 0;
+            uint32_t cur;
+            bool done = false;
+            found = false;
+            while (it.next(cur))
+            {
+                if (!done && cur >= sign)
+                {
+                    done = true;
+                    if (cur == sign)
+                    {
+                        found = true;
+                        if (!add)
+                        {
+                            continue;
+                        }
+                    }
+                    else if (add)
+                    {
+                        bytes += encode(out ? out + bytes : NULL, sign - prev);
+                        prev = sign;
+                    }
+                }
+                bytes += encode(out ? out + bytes : NULL, cur - prev);
+                prev = cur;
+            }
+            if (!done && add)
+            {
+                bytes += encode(out ? out + bytes : NULL, sign - prev);
+            }
+            return bytes;
+        }
+
+        static int rebuild(const void *tv, uint32_t sign, bool add, void *&out)
+        {
+            out = NULL;
+            bool found;
+            const uint32_t bytes = merge(tv, sign, add, NULL, found);
+            if (found == add)
+            {
+                return 0;
+            }
+            const uint32_t num = add ? size(tv) + 1 : size(tv) - 1;
+            if (0 == num)
+            {
+                return 1;
+            }
+            head_t *head = alloc(num, bytes);
+            if (NULL == head)
+            {
+                return -1;
+            }
+            merge(tv, sign, add, (uint8_t *)(head + 1), found);
+            out = head;
+            return 1;
+        }
+};
+
+#endif
@@ -0,0 +1,549 @@
+#ifndef __AGILE_SE_CONCURRENT_POOL_H__
+#define __AGILE_SE_CONCURRENT_POOL_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <new>
+#include <vector>
+#include <algorithm>
+#include "log_utils.h"
+#include "pool/page_alloc.h"
+#include "pool/mempool.h"
+#include "fsint.h"
+
+/* 每个线程每个尺寸缓存的元素数，空了/满了时和中心free list交换一半 */
+#ifndef AGILE_SE_MAGAZINE_SIZE
+#define AGILE_SE_MAGAZINE_SIZE      64
+#endif
+/* 不超过它的尺寸直接查表找slab */
+#ifndef AGILE_SE_SIZE_TABLE_MAX
+#define AGILE_SE_SIZE_TABLE_MAX     4096
+#endif
+
+/*
+ * 线程安全的按尺寸分级的内存池，接口和vaddr布局与TMempool相同，
+ * 可以做TDelayPool和容器的TMemoryPool模板参数，如HashTable<Key, Value, Hash, Equal, ConcurrentPool>；
+ * 只有alloc/free/addr是线程安全的，TDelayPool的延迟队列不是，共用一个TDelayPool的容器仍只能有一个写线程
+ *
+ * 页不归还系统也不搬迁：trim返回0，need_move总是false；不支持内存镜像，dump_image/load_image返回false
+ *
+ * 每个线程在每个slab上有一个magazine，alloc/free只在本线程的magazine上进行，
+ * magazine空了从slab的中心free list(不够时切新页)取一半，满了把一半还给中心free list，只有这时才加slab锁；
+ * 尺寸到slab的映射在init时算好放在数组里，free根据vaddr的block号找slab
+ *
+ * register_item/init/clear不是线程安全的，须在其它线程使用之前/之后调用；
+ * 线程退出时它缓存的元素还给中心free list
+ */
+template<typename VAddr>
+class TConcurrentPool
+{
+    public:
+        typedef VAddr vaddr_t;
+    private:
+        struct SlabMeta
+        {
+            uint32_t elem_size;
+            uint32_t page_size;
+            uint32_t slab_index;
+            uint32_t page_bits;
+            uint32_t offset_bits;
+        };
+        struct Slab
+        {
+            SlabMeta meta;
+            pthread_mutex_t lock;
+            vaddr_t freelist;       /* 中心free list */
+            uint32_t free_num;
+            uint32_t block_num;
+            uint32_t cur_block_no;  /* 正在切分的block/页/位置 */
+            uint32_t cur_page_no;
+            uint32_t cur_offset;
+            char padding[64];       /* 不同slab的锁不共享cache line */
+        };
+        struct Block
+        {
+            SlabMeta meta;
+            void **pages;
+        };
+        struct Magazine
+        {
+            uint32_t num;
+            vaddr_t items[AGILE_SE_MAGAZINE_SIZE];
+        };
+        struct ThreadCache
+        {
+            TConcurrentPool *pool;
+            Magazine *mags;         /* 每个slab一个 */
+        };
+    private:
+        TConcurrentPool(const TConcurrentPool &);
+        TConcurrentPool &operator =(const TConcurrentPool &);
+    public:
+        TConcurrentPool()
+        {
+            m_block_bits = 0;
+            m_block_shift = 0;
+            m_blocks = NULL;
+            m_block_num = 0;
+            ::pthread_mutex_init(&m_block_lock, NULL);
+            ::pthread_mutex_init(&m_cache_lock, NULL);
+            ::pthread_key_create(&m_cache_key, release_cache);
+        }
+        ~TConcurrentPool()
+        {
+            ::pthread_key_delete(m_cache_key); /* 之后退出的线程不再回调release_cache */
+            for (size_t i = 0; i < m_caches.size(); ++i)
+            {
+                delete [] m_caches[i]->mags;
+                delete m_caches[i];
+            }
+            m_caches.clear();
+            this->clear();
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                ::pthread_mutex_destroy(&m_slabs[i].lock);
+            }
+            if (m_blocks)
+            {
+                ::free(m_blocks);
+                m_blocks = NULL;
+            }
+            ::pthread_mutex_destroy(&m_block_lock);
+            ::pthread_mutex_destroy(&m_cache_lock);
+        }
+
+        int register_item(uint32_t elem_size)
+        {
+            if (elem_size < sizeof(vaddr_t))
+            {
+                P_WARNING("too small elem size=%u", elem_size);
+                return -1;
+            }
+            if (elem_size > AGILE_SE_MEM_PAGE_SIZE)
+            {
+                P_WARNING("too large elem size=%u", elem_size);
+                return -1;
+            }
+            if (std::find(m_items.begin(), m_items.end(), elem_size) != m_items.end())
+            {
+                return 1;
+            }
+            m_items.push_back(elem_size);
+            P_WARNING("register item: elem size=%u", elem_size);
+            return 0;
+        }
+
+        int init(uint32_t max_items_num)
+        {
+            if (max_items_num <= 0)
+            {
+                P_WARNING("invalid max_items_num=%u", max_items_num);
+                return -1;
+            }
+            if (m_items.size() == 0)
+            {
+                P_WARNING("register nothing, register some item first");
+                return -1;
+            }
+            if (m_blocks)
+            {
+                P_WARNING("ignore duplicate init call");
+                return -1;
+            }
+            std::sort(m_items.begin(), m_items.end());
+            /* vaddr布局同TMempool: block | page | offset */
+            uint32_t second = log2(max_items_num);
+            uint32_t first = sizeof(vaddr_t) * 8 - second;
+            if (sizeof(vaddr_t) > sizeof(uint32_t) && first > AGILE_SE_MEM64_BLOCK_BITS)
+            {
+                first = AGILE_SE_MEM64_BLOCK_BITS;
+            }
+            m_block_bits = first;
+            m_block_shift = second;
+            m_blocks = (Block *)::calloc((size_t)1 << first, sizeof(Block));
+            if (NULL == m_blocks)
+            {
+                P_WARNING("failed to alloc block table, block bits=%u", first);
+                return -1;
+            }
+            P_WARNING("block occupies %u bits", first);
+
+            m_slabs.resize(m_items.size());
+            m_size_table.assign(std::min(m_items.back(), (uint32_t)AGILE_SE_SIZE_TABLE_MAX) + 1, -1);
+            for (size_t i = 0; i < m_items.size(); ++i)
+            {
+                uint32_t elem_size = m_items[i];
+                uint32_t third = log2(AGILE_SE_MEM_PAGE_SIZE / elem_size);
+                if (third > second)
+                {
+                    third = second;
+                }
+                Slab &slab = m_slabs[i];
+                slab.meta.elem_size = elem_size;
+                slab.meta.page_size = (1u << third) * elem_size;
+                slab.meta.slab_index = i;
+                slab.meta.page_bits = second - third;
+                slab.meta.offset_bits = third;
+                ::pthread_mutex_init(&slab.lock, NULL);
+                slab.freelist = 0;
+                slab.free_num = 0;
+                slab.block_num = 0;
+                slab.cur_block_no = UINT32_MAX;
+                slab.cur_page_no = 0;
+                slab.cur_offset = 0;
+                if (elem_size < m_size_table.size())
+                {
+                    m_size_table[elem_size] = i;
+                }
+                P_WARNING("slab[%d]: elem_size=%u, page_size=%u, page_bits=%u, offset_bits=%u",
+                        int(i), elem_size, slab.meta.page_size, slab.meta.page_bits, slab.meta.offset_bits);
+            }
+            P_WARNING("init ok, magazine size=%d", AGILE_SE_MAGAZINE_SIZE);
+            return 0;
+        }
+
+        vaddr_t alloc(uint32_t elem_size)
+        {
+            const int idx = this->slab_of(elem_size);
+            if (idx < 0)
+            {
+                P_WARNING("unregistered elem size: %u", elem_size);
+                return 0;
+            }
+            Magazine &mag = this->cache()->mags[idx];
+            if (0 == mag.num && 0 == this->refill(m_slabs[idx], mag))
+            {
+                P_WARNING("failed to alloc elem, elem size: %u", elem_size);
+                return 0;
+            }
+            return mag.items[--mag.num];
+        }
+
+        void free(vaddr_t ptr, uint32_t /* elem_size */)
+        {
+            if (0 == ptr)
+            {
+                return ;
+            }
+            const uint32_t block_no = ((ptr - 1) >> m_block_shift);
+            if (block_no >= m_block_num)
+            {
+                P_WARNING("failed to free ptr=%lu", (uint64_t)ptr);
+                return ;
+            }
+            const uint32_t idx = m_blocks[block_no].meta.slab_index;
+            Magazine &mag = this->cache()->mags[idx];
+            if (AGILE_SE_MAGAZINE_SIZE == mag.num)
+            {
+                this->flush(m_slabs[idx], mag, AGILE_SE_MAGAZINE_SIZE / 2);
+            }
+            mag.items[mag.num++] = ptr;
+        }
+
+        void *addr(vaddr_t ptr) const
+        {
+            if (0 == ptr)
+            {
+                return NULL;
+            }
+            --ptr;
+            const uint32_t block_no = (ptr >> m_block_shift);
+            if (block_no >= m_block_num)
+            {
+                P_WARNING("invalid block no");
+                return NULL;
+            }
+            const Block *p_block = &m_blocks[block_no];
+            const uint32_t page_no = ((ptr >> p_block->meta.offset_bits) & ((1u << p_block->meta.page_bits) - 1));
+            if (NULL == p_block->pages[page_no])
+            {
+                P_WARNING("invalid page no, page is NULL");
+                return NULL;
+            }
+            const uint32_t offset = (ptr & ((1u << p_block->meta.offset_bits) - 1));
+            return ((char *)p_block->pages[page_no]) + offset * p_block->meta.elem_size;
+        }
+
+        /* 其它线程不再使用时调用，各线程缓存的元素一并作废 */
+        void clear()
+        {
+            for (uint32_t i = 0; i < m_block_num; ++i)
+            {
+                for (size_t j = 0, page_num = (1u << m_blocks[i].meta.page_bits); j < page_num; ++j)
+                {
+                    if (m_blocks[i].pages[j])
+                    {
+                        page_free(m_blocks[i].pages[j], m_blocks[i].meta.page_size);
+                    }
+                }
+                ::free(m_blocks[i].pages);
+                m_blocks[i].pages = NULL;
+            }
+            m_block_num = 0;
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                m_slabs[i].freelist = 0;
+                m_slabs[i].free_num = 0;
+                m_slabs[i].block_num = 0;
+                m_slabs[i].cur_block_no = UINT32_MAX;
+                m_slabs[i].cur_page_no = 0;
+                m_slabs[i].cur_offset = 0;
+            }
+            ::pthread_mutex_lock(&m_cache_lock);
+            for (size_t i = 0; i < m_caches.size(); ++i)
+            {
+                for (size_t j = 0; j < m_slabs.size(); ++j)
+                {
+                    m_caches[i]->mags[j].num = 0;
+                }
+            }
+            ::pthread_mutex_unlock(&m_cache_lock);
+        }
+
+        size_t trim(uint32_t /* sparse_percent */ = 0) { return 0; }
+        bool need_move(vaddr_t /* ptr */) const { return false; }
+
+        /* 不加锁，统计用 */
+        void get_stats(mempool_stats_t &stats) const
+        {
+            ::memset(&stats, 0, sizeof(stats));
+            ::pthread_mutex_lock((pthread_mutex_t *)&m_cache_lock);
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                const Slab &slab = m_slabs[i];
+                if (0 == slab.block_num)
+                {
+                    continue;
+                }
+                const uint64_t per_page = (1u << slab.meta.offset_bits);
+                const uint64_t carved = ((uint64_t)(slab.block_num - 1) * (1u << slab.meta.page_bits)
+                        + slab.cur_page_no) * per_page + slab.cur_offset;
+                uint64_t free_num = slab.free_num;
+                for (size_t j = 0; j < m_caches.size(); ++j)
+                {
+                    free_num += m_caches[j]->mags[i].num;
+                }
+                const uint64_t pages = (carved + per_page - 1) / per_page;
+                stats.page_num += pages;
+                stats.page_bytes += pages * slab.meta.page_size;
+                stats.live_bytes += (carved - free_num) * slab.meta.elem_size;
+                stats.free_bytes += free_num * slab.meta.elem_size;
+            }
+            ::pthread_mutex_unlock((pthread_mutex_t *)&m_cache_lock);
+        }
+
+        bool dump_image(FSInterface * /* fs */, FSInterface::File /* fp */) const
+        {
+            P_WARNING("memory image is not supported by TConcurrentPool");
+            return false;
+        }
+        bool load_image(FSInterface * /* fs */, FSInterface::File /* fp */)
+        {
+            P_WARNING("memory image is not supported by TConcurrentPool");
+            return false;
+        }
+
+        void print_meta() const
+        {
+            size_t total_used = 0;
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                const Slab &slab = m_slabs[i];
+                uint64_t cached = 0;
+                ::pthread_mutex_lock((pthread_mutex_t *)&m_cache_lock);
+                for (size_t j = 0; j < m_caches.size(); ++j)
+                {
+                    cached += m_caches[j]->mags[i].num; /* 统计用，不加slab锁 */
+                }
+                ::pthread_mutex_unlock((pthread_mutex_t *)&m_cache_lock);
+                uint64_t pages = 0;
+                if (slab.block_num > 0)
+                {
+                    pages = (uint64_t)(slab.block_num - 1) * (1u << slab.meta.page_bits) + slab.cur_page_no
+                        + (slab.cur_offset > 0 ? 1 : 0);
+                }
+                total_used += pages * slab.meta.page_size;
+                P_WARNING("slab[%d]: elem_size=%u, page_size=%u, block_num=%u, pages=%lu, free_num=%u, cached=%lu",
+                        int(i), slab.meta.elem_size, slab.meta.page_size, slab.block_num,
+                        pages, slab.free_num, cached);
+            }
+            P_WARNING("block num used=%u, thread caches=%u, total mem used=%lu",
+                    m_block_num, (uint32_t)m_caches.size(), (uint64_t)total_used);
+        }
+    private:
+        static int log2(uint32_t num)
+        {
+            for (int i = 0; i < 32; ++i)
+            {
+                if ((1u << i) >= num)
+                {
+                    return i > 1 ? i - 1 : 1;
+                }
+            }
+            return 31;
+        }
+        int slab_of(uint32_t elem_size) const
+        {
+            if (elem_size < m_size_table.size())
+            {
+                return m_size_table[elem_size];
+            }
+            std::vector<uint32_t>::const_iterator it = std::lower_bound(m_items.begin(), m_items.end(), elem_size);
+            if (it == m_items.end() || *it != elem_size)
+            {
+                return -1;
+            }
+            return it - m_items.begin();
+        }
+
+        ThreadCache *cache()
+        {
+            ThreadCache *tc = (ThreadCache *)::pthread_getspecific(m_cache_key);
+            if (NULL == tc)
+            {
+                tc = new (std::nothrow) ThreadCache;
+                if (NULL == tc || NULL == (tc->mags = new (std::nothrow) Magazine[m_slabs.size()]))
+                {
+                    P_FATAL("failed to alloc thread cache");
+                    ::abort();
+                }
+                tc->pool = this;
+                for (size_t i = 0; i < m_slabs.size(); ++i)
+                {
+                    tc->mags[i].num = 0;
+                }
+                ::pthread_mutex_lock(&m_cache_lock);
+                m_caches.push_back(tc);
+                ::pthread_mutex_unlock(&m_cache_lock);
+                ::pthread_setspecific(m_cache_key, tc);
+            }
+            return tc;
+        }
+        static void release_cache(void *arg) /* 线程退出时把缓存还给中心free list */
+        {
+            ThreadCache *tc = (ThreadCache *)arg;
+            TConcurrentPool *pool = tc->pool;
+            for (size_t i = 0; i < pool->m_slabs.size(); ++i)
+            {
+                if (tc->mags[i].num > 0)
+                {
+                    pool->flush(pool->m_slabs[i], tc->mags[i], tc->mags[i].num);
+                }
+            }
+            ::pthread_mutex_lock(&pool->m_cache_lock);
+            pool->m_caches.erase(std::find(pool->m_caches.begin(), pool->m_caches.end(), tc));
+            ::pthread_mutex_unlock(&pool->m_cache_lock);
+            delete [] tc->mags;
+            delete tc;
+        }
+
+        /* 从中心free list取，不够时切新页，返回取到的个数 */
+        uint32_t refill(Slab &slab, Magazine &mag)
+        {
+            const uint32_t want = AGILE_SE_MAGAZINE_SIZE / 2;
+            uint32_t n = 0;
+            ::pthread_mutex_lock(&slab.lock);
+            while (n < want && 0 != slab.freelist)
+            {
+                mag.items[n++] = slab.freelist;
+                slab.freelist = *(vaddr_t *)this->addr(slab.freelist);
+                --slab.free_num;
+            }
+            while (n < want)
+            {
+                if (UINT32_MAX == slab.cur_block_no || slab.cur_page_no >= (1u << slab.meta.page_bits))
+                {
+                    if (!this->alloc_one_block(slab))
+                    {
+                        break;
+                    }
+                }
+                void *&page = m_blocks[slab.cur_block_no].pages[slab.cur_page_no];
+                if (NULL == page)
+                {
+                    page = page_alloc(slab.meta.page_size);
+                    if (NULL == page)
+                    {
+                        P_WARNING("failed to alloc a page, page_size=%u, cur_page_no=%u, cur_block_no=%u",
+                                slab.meta.page_size, slab.cur_page_no, slab.cur_block_no);
+                        break;
+                    }
+                }
+                mag.items[n++] = (((vaddr_t)slab.cur_block_no << m_block_shift)
+                        | (slab.cur_page_no << slab.meta.offset_bits)
+                        | slab.cur_offset) + 1;
+                if (++slab.cur_offset >= (1u << slab.meta.offset_bits))
+                {
+                    slab.cur_offset = 0;
+                    ++slab.cur_page_no;
+                }
+            }
+            ::pthread_mutex_unlock(&slab.lock);
+            mag.num = n;
+            return n;
+        }
+        /* 把magazine顶部的num个元素还给中心free list，先在锁外串好 */
+        void flush(Slab &slab, Magazine &mag, uint32_t num)
+        {
+            const vaddr_t *items = mag.items + mag.num - num;
+            for (uint32_t i = 0; i + 1 < num; ++i)
+            {
+                *(vaddr_t *)this->addr(items[i]) = items[i + 1];
+            }
+            ::pthread_mutex_lock(&slab.lock);
+            *(vaddr_t *)this->addr(items[num - 1]) = slab.freelist;
+            slab.freelist = items[0];
+            slab.free_num += num;
+            ::pthread_mutex_unlock(&slab.lock);
+            mag.num -= num;
+        }
+        /* 已持有slab锁 */
+        bool alloc_one_block(Slab &slab)
+        {
+            const uint32_t page_num = (1u << slab.meta.page_bits);
+            void **pages = (void **)::calloc(page_num, sizeof(void *));
+            if (NULL == pages)
+            {
+                P_WARNING("failed to alloc pages array, page_num=%u, elem_size=%u", page_num, slab.meta.elem_size);
+                return false;
+            }
+            ::pthread_mutex_lock(&m_block_lock);
+            const uint32_t block_no = m_block_num;
+            if (block_no >= (1u << m_block_bits))
+            {
+                ::pthread_mutex_unlock(&m_block_lock);
+                ::free(pages);
+                P_WARNING("too many blocks alloced, block num=%u", block_no);
+                return false;
+            }
+            m_blocks[block_no].meta = slab.meta;
+            m_blocks[block_no].pages = pages;
+            __sync_synchronize(); /* 先填好block，再让addr看到 */
+            m_block_num = block_no + 1;
+            ::pthread_mutex_unlock(&m_block_lock);
+
+            slab.cur_block_no = block_no;
+            slab.cur_page_no = 0;
+            slab.cur_offset = 0;
+            ++slab.block_num;
+            return true;
+        }
+    private:
+        std::vector<uint32_t> m_items;
+        std::vector<int16_t> m_size_table; /* elem_size => slab，未注册为-1 */
+        uint32_t m_block_bits;
+        uint32_t m_block_shift;
+        std::vector<Slab> m_slabs;
+        Block *m_blocks;                   /* init时按最大block数分配，地址不变 */
+        volatile uint32_t m_block_num;
+        pthread_mutex_t m_block_lock;
+
+        pthread_key_t m_cache_key;
+        pthread_mutex_t m_cache_lock;
+        std::vector<ThreadCache *> m_caches;
+};
+
+typedef TConcurrentPool<uint32_t> ConcurrentPool;
+
+#endif
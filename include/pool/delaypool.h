@@ -2,7 +2,12 @@
 #define __AGILE_SE_DELAY_MEMORY_POOL_H__
 
 #include <stdint.h>
+#include <vector>
+#include <deque>
 #include "log_utils.h"
+#include "fsint.h"
+#include "pool/epoch.h"
+#include "pool/mempool.h"
 
 extern volatile uint32_t g_now_time;
 
@@ -28,12 +33,27 @@ class TDelayPool
             vaddr_t head;
             vaddr_t tail;
         };
+        /* 开启epoch回收时，延迟释放的元素按释放时的epoch分批，不再为每个元素分配node_t */
+        struct retired_t
+        {
+            vaddr_t ptr;
+            uint32_t elem_size;
+            destroy_fun_t fun;
+            intptr_t arg;
+        };
+        struct batch_t
+        {
+            uint64_t epoch;
+            std::vector<retired_t> items;
+        };
     public:
         TDelayPool()
         {
             m_delayed_num = 0;
             m_delayed_time = 5;
             m_delayed_list.head = m_delayed_list.tail = 0;
+            m_garbage_bytes = 0;
+            m_peak_garbage_bytes = 0;
         }
 
         ~TDelayPool()
@@ -75,6 +95,11 @@ class TDelayPool
         vaddr_t alloc(uint32_t elem_size) { return m_pool.alloc(elem_size); }
         void free(vaddr_t ptr, uint32_t elem_size) { m_pool.free(ptr, elem_size); }
 
+        /* 见Mempool::trim */
+        size_t trim(uint32_t sparse_percent = 0) { return m_pool.trim(sparse_percent); }
+        bool need_move(vaddr_t ptr) const { return m_pool.need_move(ptr); }
+        void get_stats(mempool_stats_t &stats) const { m_pool.get_stats(stats); }
+
         int delay_free(vaddr_t ptr, uint32_t elem_size, destroy_fun_t fun = NULL, intptr_t arg = 0)
         {
             if (0 == ptr)
@@ -90,6 +115,25 @@ class TDelayPool
                 m_pool.free(ptr, elem_size);
                 return 0;
             }
+            if (g_epoch_reclaim)
+            {
+                const uint64_t epoch = epoch_retire();
+                if (m_batches.empty() || m_batches.back().epoch != epoch)
+                {
+                    m_batches.push_back(batch_t());
+                    m_batches.back().epoch = epoch;
+                    m_batches.back().items.swap(m_spare); /* 复用回收过的批次的空间 */
+                }
+                retired_t item;
+                item.ptr = ptr;
+                item.elem_size = elem_size;
+                item.fun = fun;
+                item.arg = arg;
+                m_batches.back().items.push_back(item);
+                this->add_garbage(elem_size);
+                ++m_delayed_num;
+                return 0;
+            }
             vaddr_t addr = m_pool.alloc(sizeof(node_t));
             node_t *node = (node_t *)m_pool.addr(addr);
             if (NULL == node)
@@ -120,6 +164,7 @@ class TDelayPool
             {
                 m_delayed_list.head = m_delayed_list.tail = addr;
             }
+            this->add_garbage(elem_size);
             ++m_delayed_num;
             return 0;
         }
@@ -143,6 +188,7 @@ class TDelayPool
                     node->fun(m_pool.addr(node->ptr), node->arg);
                 }
                 m_pool.free(node->ptr, node->elem_size);
+                m_garbage_bytes -= node->elem_size;
                 m_delayed_list.head = node->next;
                 if (0 == m_delayed_list.head)
                 {
@@ -151,12 +197,145 @@ class TDelayPool
                 m_pool.free(cur, sizeof(node_t));
                 --m_delayed_num;
             }
+            /*
+             * 开启epoch回收之前按时间延迟释放的元素更早，先全部释放完再回收epoch批次，
+             * 保证回调按delay_free的顺序执行
+             */
+            if (!m_batches.empty() && 0 == m_delayed_list.head)
+            {
+                epoch_advance();
+                const uint64_t min_epoch = epoch_min_active();
+                while (!m_batches.empty()
+                        && (!m_delayed_time /* 等于0时，立即回收 */
+                            || m_batches.front().epoch < min_epoch))
+                {
+                    std::vector<retired_t> &items = m_batches.front().items;
+                    for (size_t i = 0; i < items.size(); ++i)
+                    {
+                        if (items[i].fun)
+                        {
+                            items[i].fun(m_pool.addr(items[i].ptr), items[i].arg);
+                        }
+                        m_pool.free(items[i].ptr, items[i].elem_size);
+                        m_garbage_bytes -= items[i].elem_size;
+                    }
+                    m_delayed_num -= items.size();
+                    items.clear();
+                    m_spare.swap(items);
+                    m_batches.pop_front();
+                }
+            }
+        }
+
+        /*
+         * 内存镜像，见Mempool::dump_image
+         * 回调是本进程的函数指针，不能跨进程使用：加载时延迟队列中的元素直接释放，不调用回调，
+         * 回调负责释放的内存不会回收，最多是dump前几秒内延迟释放的那部分
+         */
+        bool dump_image(FSInterface *fs, FSInterface::File fp) const
+        {
+            if (fs->fwrite(&m_delayed_list, sizeof(m_delayed_list), 1, fp) != 1)
+            {
+                P_WARNING("failed to write delayed list");
+                return false;
+            }
+            std::vector<std::pair<vaddr_t, uint32_t> > items; /* epoch批次中的元素 */
+            for (size_t i = 0; i < m_batches.size(); ++i)
+            {
+                for (size_t j = 0; j < m_batches[i].items.size(); ++j)
+                {
+                    items.push_back(std::make_pair(m_batches[i].items[j].ptr, m_batches[i].items[j].elem_size));
+                }
+            }
+            const uint64_t num = items.size();
+            if (fs->fwrite(&num, sizeof(num), 1, fp) != 1
+                    || (num > 0 && fs->fwrite(&items[0], sizeof(items[0]) * num, 1, fp) != 1))
+            {
+                P_WARNING("failed to write epoch batches");
+                return false;
+            }
+            return m_pool.dump_image(fs, fp);
+        }
+        bool load_image(FSInterface *fs, FSInterface::File fp)
+        {
+            if (0 != m_delayed_num)
+            {
+                P_WARNING("delayed list is not empty, cannot load image");
+                return false;
+            }
+            queue_t list;
+            if (fs->fread(&list, sizeof(list), 1, fp) != 1)
+            {
+                P_WARNING("failed to read delayed list");
+                return false;
+            }
+            uint64_t num = 0;
+            if (fs->fread(&num, sizeof(num), 1, fp) != 1)
+            {
+                P_WARNING("failed to read epoch batches");
+                return false;
+            }
+            std::vector<std::pair<vaddr_t, uint32_t> > items(num);
+            if (num > 0 && fs->fread(&items[0], sizeof(items[0]) * num, 1, fp) != 1)
+            {
+                P_WARNING("failed to read epoch batches");
+                return false;
+            }
+            if (!m_pool.load_image(fs, fp))
+            {
+                return false;
+            }
+            for (size_t i = 0; i < items.size(); ++i)
+            {
+                m_pool.free(items[i].first, items[i].second);
+            }
+            while (0 != list.head)
+            {
+                const vaddr_t cur = list.head;
+                node_t *node = (node_t *)m_pool.addr(cur);
+                if (NULL == node)
+                {
+                    P_WARNING("invalid delayed node in image");
+                    return false;
+                }
+                list.head = node->next;
+                m_pool.free(node->ptr, node->elem_size);
+                m_pool.free(cur, sizeof(node_t));
+                ++num;
+            }
+            P_WARNING("released %lu delayed elems in image without callbacks", (uint64_t)num);
+            return true;
+        }
+
+        /* 等待回收的字节数及其峰值 */
+        size_t garbage_bytes() const { return m_garbage_bytes; }
+        size_t peak_garbage_bytes() const { return m_peak_garbage_bytes; }
+        /* 延迟队列的node_t占用池中的字节数，epoch批次在堆上，不算在内 */
+        size_t queue_bytes() const
+        {
+            size_t batched = 0;
+            for (size_t i = 0; i < m_batches.size(); ++i)
+            {
+                batched += m_batches[i].items.size();
+            }
+            return (m_delayed_num - batched) * sizeof(node_t);
         }
 
         void print_meta() const
         {
             m_pool.print_meta();
-            P_WARNING("delayed elem num=%lu", (uint64_t)m_delayed_num);
+            P_WARNING("delayed elem num=%lu, garbage bytes=%lu, peak garbage bytes=%lu, epoch batches=%lu",
+                    (uint64_t)m_delayed_num, (uint64_t)m_garbage_bytes,
+                    (uint64_t)m_peak_garbage_bytes, (uint64_t)m_batches.size());
+        }
+    private:
+        void add_garbage(uint32_t elem_size)
+        {
+            m_garbage_bytes += elem_size;
+            if (m_garbage_bytes > m_peak_garbage_bytes)
+            {
+                m_peak_garbage_bytes = m_garbage_bytes;
+            }
         }
     private:
         TMemoryPool m_pool;
@@ -165,6 +344,11 @@ class TDelayPool
         uint32_t m_delayed_time;
 
         queue_t m_delayed_list;
+        std::deque<batch_t> m_batches;
+        std::vector<retired_t> m_spare;
+
+        size_t m_garbage_bytes;
+        size_t m_peak_garbage_bytes;
 };
 
 #endif
@@ -0,0 +1,68 @@
+#ifndef __AGILE_SE_EPOCH_H__
+#define __AGILE_SE_EPOCH_H__
+
+#include <stdint.h>
+
+#ifndef AGILE_SE_EPOCH_MAX_READERS
+#define AGILE_SE_EPOCH_MAX_READERS  1024
+#endif
+
+/*
+ * 基于epoch的内存回收(EBR)，替代按时间的延迟释放
+ *
+ * 读线程访问索引(包括遍历DocList)期间持有EpochGuard，进入时记下当前的全局epoch，退出时清零；
+ * 写线程延迟释放的元素按释放时的epoch分批，recycle时推进全局epoch，
+ * 批次的epoch小于所有活跃读线程的epoch时，读线程已经不可能看到其中的元素，马上回收
+ *
+ * 默认关闭，由index.conf的EPOCH_RECLAIM在Index::init加载索引之前开启，不能再关闭；
+ * 开启后库内的查询入口(LevelIndex的触发/正排接口)都持有EpochGuard，DocList在存活期间也持有，
+ * 所以查询中拿到的正排指针在拉链析构之前可以使用，之后还要用时调用者自己持有EpochGuard
+ */
+extern volatile uint64_t g_epoch;
+extern volatile bool g_epoch_reclaim;
+
+void enable_epoch_reclaim();
+
+/* 读线程进入/退出，可嵌套，只有最外层生效 */
+void epoch_enter();
+void epoch_exit();
+
+/* 延迟释放时取当前epoch，含一次全屏障，保证摘链先于读取epoch */
+inline uint64_t epoch_retire()
+{
+    return __sync_add_and_fetch(&g_epoch, 0);
+}
+/* 推进全局epoch，返回新值 */
+inline uint64_t epoch_advance()
+{
+    return __sync_add_and_fetch(&g_epoch, 1);
+}
+/* 活跃读线程的最小epoch，没有活跃读线程时返回当前全局epoch；epoch小于它的批次可以回收 */
+uint64_t epoch_min_active();
+
+class EpochGuard
+{
+    private:
+        EpochGuard(const EpochGuard &);
+        EpochGuard &operator =(const EpochGuard &);
+    public:
+        /* 未开启时什么都不做 */
+        EpochGuard() : m_on(g_epoch_reclaim)
+        {
+            if (m_on)
+            {
+                epoch_enter();
+            }
+        }
+        ~EpochGuard()
+        {
+            if (m_on)
+            {
+                epoch_exit();
+            }
+        }
+    private:
+        const bool m_on;
+};
+
+#endif
@@ -2,10 +2,15 @@
 #define __AGILE_SE_MEMPOOL_H__
 
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include <vector>
 #include <algorithm>
 #include <ext/hash_map>
 #include "log_utils.h"
+#include "fsint.h"
+#include "pool/page_alloc.h"
 
 #ifndef AGILE_SE_MEM_PAGE_SIZE
 #define AGILE_SE_MEM_PAGE_SIZE   (1024*1024u)
@@ -15,10 +20,32 @@
 #define UINT32_MAX		(4294967295U)
 #endif
 
-class Mempool
+/* 64位vaddr时block号最多占的位数，block表按它预留 */
+#ifndef AGILE_SE_MEM64_BLOCK_BITS
+#define AGILE_SE_MEM64_BLOCK_BITS   20
+#endif
+
+/* 碎片统计，单位字节；fragmentation = 1 - live / (pages - released) */
+struct mempool_stats_t
+{
+    uint64_t page_num;
+    uint64_t page_bytes;        /* 分配过的页 */
+    uint64_t live_bytes;        /* 在用的元素 */
+    uint64_t free_bytes;        /* free list中的元素 */
+    uint64_t released_bytes;    /* 已madvise归还系统的空页 */
+    uint64_t evacuating_bytes;  /* 等待搬迁的稀疏页 */
+    uint64_t sparse_pages;      /* 占用率低于一半的页 */
+};
+
+/*
+ * vaddr_t为uint32_t时元素总数不超过2^32，uint64_t时block号不再受32位限制，
+ * 地址布局和查找过程完全相同，见Mempool/Mempool64
+ */
+template<typename VAddr>
+class TMempool
 {
     public:
-        typedef uint32_t vaddr_t;
+        typedef VAddr vaddr_t;
     private:
         typedef __gnu_cxx::hash_map<uint32_t, uint32_t> Map;
     private:
@@ -38,6 +65,18 @@ class Mempool
             uint32_t block_num;
             uint32_t cur_block_no;
         };
+        /*
+         * 页的占用情况：live为页上在用的元素数
+         * EVACUATING: 稀疏页，元素已从free list摘除，等待持有者搬走在用元素，全部释放后归还系统
+         * RELEASED: 空页，已madvise(MADV_DONTNEED)，free list为空时整页重新切分
+         */
+        struct PageInfo
+        {
+            uint32_t live;
+            uint32_t state;
+        };
+        enum { PAGE_NORMAL = 0, PAGE_EVACUATING, PAGE_RELEASED };
+        typedef std::pair<uint32_t, uint32_t> PageNo; /* block_no, page_no */
         struct Block
         {
             SlabMeta meta;
@@ -45,13 +84,32 @@ class Mempool
             uint32_t cur_page_no;
             uint32_t cur_offset;
             void **pages;
+            PageInfo *infos;
         };
+        /* 内存镜像的头和block表项 */
+        struct ImageHead
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint32_t block_bits;
+            uint32_t slab_num;
+            uint32_t block_num;
+        };
+        struct BlockImage
+        {
+            SlabMeta meta;
+            uint32_t alloced_num;
+            uint32_t cur_page_no;
+            uint32_t cur_offset;
+            uint32_t page_num;  /* 已分配的页数，页总是按顺序分配 */
+        };
+        enum { IMAGE_MAGIC = 0x494d504d /* MPMI */, IMAGE_VERSION = 2 };
     private:
-        Mempool(const Mempool &);
-        Mempool &operator =(const Mempool &);
+        TMempool(const TMempool &);
+        TMempool &operator =(const TMempool &);
     public:
-        Mempool() { }
-        ~Mempool() { this->clear(); }
+        TMempool() { }
+        ~TMempool() { this->clear(); }
 
         int register_item(uint32_t elem_size)
         {
@@ -94,12 +152,18 @@ class Mempool
              *    first     *     second      *    third      *
              **************************************************/
             uint32_t second = log2(max_items_num);
-            uint32_t first = 32 - second;
+            uint32_t first = sizeof(vaddr_t) * 8 - second;
+            if (sizeof(vaddr_t) > sizeof(uint32_t) && first > AGILE_SE_MEM64_BLOCK_BITS)
+            {
+                first = AGILE_SE_MEM64_BLOCK_BITS;
+            }
 
             P_WARNING("block occupies %u bits", first);
             m_block_bits = first;
+            m_block_shift = second;
             m_blocks.reserve((1u << first));
             m_slabs.resize(m_items.size());
+            m_released.resize(m_items.size());
             for (size_t i = 0; i < m_items.size(); ++i)
             {
                 uint32_t elem_size = m_items[i];
@@ -159,16 +223,22 @@ class Mempool
                 }
             }
             vaddr_t ret = p_slab->freelist;
+            if (0 == ret && !m_released[p_slab->meta.slab_index].empty())
+            {
+                this->reuse_page(p_slab); /* 先复用归还过的页 */
+                ret = p_slab->freelist;
+            }
             if (ret)
             {
                 void *ptr = this->addr(ret);
-                p_slab->freelist = *(uint32_t *)ptr;
+                p_slab->freelist = *(vaddr_t *)ptr;
                 --p_slab->free_num;
+                ++this->page_info(ret).live;
             }
             else
             {
                 Block *p_block = &m_blocks[p_slab->cur_block_no];
-                if (p_block->alloced_num >= (1u << (32 - m_block_bits))) /* cur block full */
+                if (p_block->alloced_num >= (1u << m_block_shift)) /* cur block full */
                 {
                     if (!this->alloc_one_block(p_slab))
                     {
@@ -184,7 +254,7 @@ class Mempool
                 }
                 if (NULL == p_block->pages[p_block->cur_page_no]) /* try alloc a new page */
                 {
-                    p_block->pages[p_block->cur_page_no] = ::malloc(p_slab->meta.page_size);
+                    p_block->pages[p_block->cur_page_no] = page_alloc(p_slab->meta.page_size);
                     if (NULL == p_block->pages[p_block->cur_page_no])
                     {
                         P_WARNING("failed to alloc a page, page_size=%u, cur_page_no=%u, cur_block_no=%u, elem_size=%u",
@@ -192,11 +262,12 @@ class Mempool
                         return 0;
                     }
                 }
-                ret = ((p_slab->cur_block_no << (32 - m_block_bits))
+                ret = (((vaddr_t)p_slab->cur_block_no << m_block_shift)
                         | (p_block->cur_page_no << p_slab->meta.offset_bits)
                         | p_block->cur_offset) + 1;
                 ++p_block->cur_offset;
                 ++p_block->alloced_num;
+                ++p_block->infos[p_block->cur_page_no].live;
             }
             return ret;
         }
@@ -210,12 +281,23 @@ class Mempool
             void *real = this->addr(ptr);
             if (NULL == real)
             {
-                P_WARNING("failed to free ptr=%u", ptr);
+                P_WARNING("failed to free ptr=%lu", (uint64_t)ptr);
                 return ;
             }
-            const uint32_t block_no = ((ptr - 1) >> (32 - m_block_bits));
+            const uint32_t block_no = ((ptr - 1) >> m_block_shift);
             const uint32_t idx = m_blocks[block_no].meta.slab_index;
-            *((uint32_t *)real) = m_slabs[idx].freelist;
+            PageInfo &info = this->page_info(ptr);
+            --info.live;
+            if (PAGE_EVACUATING == info.state) /* 搬迁中的页不再放回free list */
+            {
+                if (0 == info.live)
+                {
+                    this->release_page(PageNo(block_no, (uint32_t)((ptr - 1) >> m_blocks[block_no].meta.offset_bits)
+                                & ((1u << m_blocks[block_no].meta.page_bits) - 1)));
+                }
+                return ;
+            }
+            *((vaddr_t *)real) = m_slabs[idx].freelist;
             m_slabs[idx].freelist = ptr;
             ++m_slabs[idx].free_num;
         }
@@ -227,7 +309,7 @@ class Mempool
                 return NULL;
             }
             --ptr;
-            const uint32_t block_no = (ptr >> (32 - m_block_bits));
+            const uint32_t block_no = (ptr >> m_block_shift);
             if (block_no >= m_blocks.size())
             {
                 P_WARNING("invalid block no");
@@ -252,10 +334,11 @@ class Mempool
                 {
                     if (m_blocks[i].pages[j])
                     {
-                        ::free(m_blocks[i].pages[j]);
+                        page_free(m_blocks[i].pages[j], m_blocks[i].meta.page_size);
                     }
                 }
                 ::free(m_blocks[i].pages);
+                ::free(m_blocks[i].infos);
             }
             m_blocks.resize(0);
             m_blocks.reserve((1u << m_block_bits));
@@ -265,10 +348,293 @@ class Mempool
                 m_slabs[i].free_num = 0;
                 m_slabs[i].block_num = 0;
                 m_slabs[i].cur_block_no = UINT32_MAX;
+                m_released[i].clear();
             }
             return ;
         }
 
+        /*
+         * 把空页归还系统，sparse_percent > 0时把占用率低于它的页标记为待搬迁，
+         * 返回本次归还的字节数；只能在写线程调用
+         *
+         * 待搬迁页上的元素不再分配出去，持有者通过need_move找到它们，
+         * 分配新元素、拷贝并改写引用后延迟释放旧元素，最后一个元素释放时整页归还
+         */
+        size_t trim(uint32_t sparse_percent = 0)
+        {
+            std::vector<PageNo> empties;
+            std::vector<uint32_t> marked(m_slabs.size(), 0);
+            for (uint32_t i = 0; i < m_blocks.size(); ++i)
+            {
+                const Block &block = m_blocks[i];
+                const Slab &slab = m_slabs[block.meta.slab_index];
+                const uint32_t capacity = (1u << block.meta.offset_bits);
+                for (uint32_t j = 0, page_num = (1u << block.meta.page_bits); j < page_num; ++j)
+                {
+                    if (NULL == block.pages[j] || (i == slab.cur_block_no && j >= block.cur_page_no
+                                && block.cur_offset < capacity)) /* 还没有切分完的页 */
+                    {
+                        break;
+                    }
+                    PageInfo &info = block.infos[j];
+                    if (PAGE_NORMAL != info.state)
+                    {
+                        continue;
+                    }
+                    if (0 == info.live)
+                    {
+                        info.state = PAGE_EVACUATING; /* 先从free list摘除，再归还 */
+                        empties.push_back(PageNo(i, j));
+                    }
+                    else if ((uint64_t)info.live * 100 < (uint64_t)capacity * sparse_percent)
+                    {
+                        info.state = PAGE_EVACUATING;
+                    }
+                    else
+                    {
+                        continue;
+                    }
+                    ++marked[block.meta.slab_index];
+                }
+            }
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                if (0 == marked[i])
+                {
+                    continue;
+                }
+                /* 重建free list，保留正常页上的元素 */
+                Slab &slab = m_slabs[i];
+                vaddr_t head = 0;
+                vaddr_t tail = 0;
+                uint32_t num = 0;
+                vaddr_t cur = slab.freelist;
+                while (0 != cur)
+                {
+                    const vaddr_t next = *(vaddr_t *)this->addr(cur);
+                    if (PAGE_NORMAL == this->page_info(cur).state)
+                    {
+                        if (tail)
+                        {
+                            *(vaddr_t *)this->addr(tail) = cur;
+                        }
+                        else
+                        {
+                            head = cur;
+                        }
+                        tail = cur;
+                        ++num;
+                    }
+                    cur = next;
+                }
+                if (tail)
+                {
+                    *(vaddr_t *)this->addr(tail) = 0;
+                }
+                slab.freelist = head;
+                slab.free_num = num;
+            }
+            size_t released = 0;
+            for (size_t i = 0; i < empties.size(); ++i)
+            {
+                this->release_page(empties[i]);
+                released += m_blocks[empties[i].first].meta.page_size;
+            }
+            return released;
+        }
+
+        /* 元素在待搬迁的页上 */
+        bool need_move(vaddr_t ptr) const
+        {
+            return 0 != ptr && PAGE_EVACUATING == this->page_info(ptr).state;
+        }
+
+        void get_stats(mempool_stats_t &stats) const
+        {
+            ::memset(&stats, 0, sizeof(stats));
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                this->add_stats(i, stats);
+            }
+        }
+
+        /*
+         * 内存镜像：vaddr与页的实际地址无关，slab/block表和页内容原样写出，
+         * 加载时按页整块顺序读回，不需要逐条重建，free list等状态也一并恢复
+         * 加载方必须用相同的register_item/init参数初始化，加载会先clear
+         */
+        bool dump_image(FSInterface *fs, FSInterface::File fp) const
+        {
+            ImageHead head;
+            head.magic = IMAGE_MAGIC;
+            head.version = IMAGE_VERSION;
+            head.block_bits = m_block_bits;
+            head.slab_num = m_slabs.size();
+            head.block_num = m_blocks.size();
+            if (fs->fwrite(&head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to write image head");
+                return false;
+            }
+            if (m_slabs.size() > 0 && fs->fwrite(&m_slabs[0], sizeof(Slab), m_slabs.size(), fp) != m_slabs.size())
+            {
+                P_WARNING("failed to write slabs");
+                return false;
+            }
+            size_t total = 0;
+            for (size_t i = 0; i < m_blocks.size(); ++i)
+            {
+                const Block &block = m_blocks[i];
+                BlockImage image;
+                image.meta = block.meta;
+                image.alloced_num = block.alloced_num;
+                image.cur_page_no = block.cur_page_no;
+                image.cur_offset = block.cur_offset;
+                image.page_num = 0;
+                for (uint32_t j = 0, page_num = (1u << block.meta.page_bits); j < page_num; ++j)
+                {
+                    if (NULL == block.pages[j])
+                    {
+                        break;
+                    }
+                    ++image.page_num;
+                }
+                if (fs->fwrite(&image, sizeof(image), 1, fp) != 1)
+                {
+                    P_WARNING("failed to write block[%u]", (uint32_t)i);
+                    return false;
+                }
+                for (uint32_t j = 0; j < image.page_num; ++j)
+                {
+                    if (fs->fwrite(block.pages[j], block.meta.page_size, 1, fp) != 1)
+                    {
+                        P_WARNING("failed to write page[%u] of block[%u]", j, (uint32_t)i);
+                        return false;
+                    }
+                }
+                if (image.page_num > 0 && fs->fwrite(block.infos, sizeof(PageInfo) * image.page_num, 1, fp) != 1)
+                {
+                    P_WARNING("failed to write page infos of block[%u]", (uint32_t)i);
+                    return false;
+                }
+                total += (size_t)block.meta.page_size * image.page_num;
+            }
+            P_WARNING("dump image ok, slab_num=%u, block_num=%u, page bytes=%lu",
+                    head.slab_num, head.block_num, (uint64_t)total);
+            return true;
+        }
+        bool load_image(FSInterface *fs, FSInterface::File fp)
+        {
+            if (m_slabs.size() == 0)
+            {
+                P_WARNING("init mempool before loading image");
+                return false;
+            }
+            this->clear();
+
+            ImageHead head;
+            size_t total = 0;
+            if (fs->fread(&head, sizeof(head), 1, fp) != 1)
+            {
+                P_WARNING("failed to read image head");
+                return false;
+            }
+            if (IMAGE_MAGIC != head.magic || IMAGE_VERSION != head.version)
+            {
+                P_WARNING("invalid image, magic=%#x, version=%u", head.magic, head.version);
+                return false;
+            }
+            if (head.block_bits != m_block_bits || head.slab_num != m_slabs.size()
+                    || head.block_num > (1u << m_block_bits))
+            {
+                P_WARNING("image mismatch: block_bits=%u[%u], slab_num=%u[%u], block_num=%u",
+                        head.block_bits, m_block_bits, head.slab_num, (uint32_t)m_slabs.size(), head.block_num);
+                return false;
+            }
+            for (size_t i = 0; i < m_slabs.size(); ++i)
+            {
+                Slab slab;
+                if (fs->fread(&slab, sizeof(slab), 1, fp) != 1)
+                {
+                    P_WARNING("failed to read slab[%u]", (uint32_t)i);
+                    goto FAIL;
+                }
+                if (::memcmp(&slab.meta, &m_slabs[i].meta, sizeof(SlabMeta)) != 0)
+                {
+                    P_WARNING("slab[%u] mismatch: elem_size=%u[%u], page_size=%u[%u]", (uint32_t)i,
+                            slab.meta.elem_size, m_slabs[i].meta.elem_size,
+                            slab.meta.page_size, m_slabs[i].meta.page_size);
+                    goto FAIL;
+                }
+                m_slabs[i] = slab;
+            }
+            for (uint32_t i = 0; i < head.block_num; ++i)
+            {
+                BlockImage image;
+                if (fs->fread(&image, sizeof(image), 1, fp) != 1)
+                {
+                    P_WARNING("failed to read block[%u]", i);
+                    goto FAIL;
+                }
+                if (image.meta.slab_index >= m_slabs.size()
+                        || ::memcmp(&image.meta, &m_slabs[image.meta.slab_index].meta, sizeof(SlabMeta)) != 0
+                        || image.page_num > (1u << image.meta.page_bits))
+                {
+                    P_WARNING("invalid block[%u], slab_index=%u, page_num=%u", i, image.meta.slab_index, image.page_num);
+                    goto FAIL;
+                }
+                void **pages = (void **)::calloc((1u << image.meta.page_bits), sizeof(void *));
+                PageInfo *infos = (PageInfo *)::calloc((1u << image.meta.page_bits), sizeof(PageInfo));
+                if (NULL == pages || NULL == infos)
+                {
+                    ::free(pages);
+                    ::free(infos);
+                    P_WARNING("failed to alloc pages array of block[%u]", i);
+                    goto FAIL;
+                }
+                m_blocks.resize(i + 1);
+                m_blocks[i].meta = image.meta;
+                m_blocks[i].alloced_num = image.alloced_num;
+                m_blocks[i].cur_page_no = image.cur_page_no;
+                m_blocks[i].cur_offset = image.cur_offset;
+                m_blocks[i].pages = pages;
+                m_blocks[i].infos = infos;
+                for (uint32_t j = 0; j < image.page_num; ++j)
+                {
+                    pages[j] = page_alloc(image.meta.page_size);
+                    if (NULL == pages[j])
+                    {
+                        P_WARNING("failed to alloc page[%u] of block[%u], page_size=%u", j, i, image.meta.page_size);
+                        goto FAIL;
+                    }
+                    if (fs->fread(pages[j], image.meta.page_size, 1, fp) != 1)
+                    {
+                        P_WARNING("failed to read page[%u] of block[%u]", j, i);
+                        goto FAIL;
+                    }
+                }
+                if (image.page_num > 0 && fs->fread(infos, sizeof(PageInfo) * image.page_num, 1, fp) != 1)
+                {
+                    P_WARNING("failed to read page infos of block[%u]", i);
+                    goto FAIL;
+                }
+                for (uint32_t j = 0; j < image.page_num; ++j)
+                {
+                    if (PAGE_RELEASED == infos[j].state)
+                    {
+                        this->release_page(PageNo(i, j));
+                    }
+                }
+                total += (size_t)image.meta.page_size * image.page_num;
+            }
+            P_WARNING("load image ok, slab_num=%u, block_num=%u, page bytes=%lu",
+                    head.slab_num, head.block_num, (uint64_t)total);
+            return true;
+FAIL:
+            this->clear();
+            return false;
+        }
+
         void print_meta() const
         {
             int block_num = 0;
@@ -292,10 +658,24 @@ class Mempool
                 P_WARNING("    elem_size=%u, page_size=%u, page_num_per_block=%u",
                         m_slabs[i].meta.elem_size, m_slabs[i].meta.page_size, page_num);
                 P_WARNING("    free_num=%u, block_num=%u", m_slabs[i].free_num, m_slabs[i].block_num);
+
+                mempool_stats_t stats;
+                ::memset(&stats, 0, sizeof(stats));
+                this->add_stats(i, stats);
+                P_WARNING("    page_num=%lu, live=%lu, released=%lu, evacuating=%lu, sparse_pages=%lu",
+                        stats.page_num, stats.live_bytes, stats.released_bytes,
+                        stats.evacuating_bytes, stats.sparse_pages);
             }
             total_used += (m_blocks.capacity() - block_num) * sizeof(Block);
             P_WARNING("block num used=%u, not used=%u, total mem used=%lu",
                     block_num, (uint32_t)(m_blocks.capacity() - block_num), (uint64_t)total_used);
+
+            mempool_stats_t stats;
+            this->get_stats(stats);
+            const uint64_t resident = stats.page_bytes - stats.released_bytes;
+            P_WARNING("pages=%lu, live=%lu, free=%lu, released=%lu, evacuating=%lu, fragmentation=%.1f%%",
+                    stats.page_bytes, stats.live_bytes, stats.free_bytes, stats.released_bytes,
+                    stats.evacuating_bytes, resident > 0 ? 100.0 - stats.live_bytes * 100.0 / resident : 0.0);
         }
     private:
         static int log2(uint32_t num)
@@ -309,6 +689,81 @@ class Mempool
             }
             return 31;
         }
+        PageInfo &page_info(vaddr_t ptr) const
+        {
+            --ptr;
+            const Block &block = m_blocks[ptr >> m_block_shift];
+            return block.infos[(ptr >> block.meta.offset_bits) & ((1u << block.meta.page_bits) - 1)];
+        }
+        void release_page(const PageNo &no)
+        {
+            const Block &block = m_blocks[no.first];
+            block.infos[no.second].state = PAGE_RELEASED;
+            m_released[block.meta.slab_index].push_back(no);
+
+            /* 只归还页内对齐的部分，malloc的页首尾可能和别的内存共享系统页 */
+            static const uintptr_t sys_page_size = ::sysconf(_SC_PAGESIZE);
+            const uintptr_t begin = ((uintptr_t)block.pages[no.second] + sys_page_size - 1) & ~(sys_page_size - 1);
+            const uintptr_t end = ((uintptr_t)block.pages[no.second] + block.meta.page_size) & ~(sys_page_size - 1);
+            if (begin < end && ::madvise((void *)begin, end - begin, MADV_DONTNEED) != 0)
+            {
+                P_WARNING("failed to madvise page[%u] of block[%u]", no.second, no.first);
+            }
+        }
+        /* 把一个归还过的页整页放回free list */
+        void reuse_page(Slab *p_slab)
+        {
+            std::vector<PageNo> &released = m_released[p_slab->meta.slab_index];
+            const PageNo no = released.back();
+            released.pop_back();
+
+            Block &block = m_blocks[no.first];
+            block.infos[no.second].state = PAGE_NORMAL;
+            const vaddr_t base = (((vaddr_t)no.first << m_block_shift) | (no.second << block.meta.offset_bits)) + 1;
+            char *page = (char *)block.pages[no.second];
+            for (uint32_t i = (1u << block.meta.offset_bits); i > 0; --i)
+            {
+                *(vaddr_t *)(page + (i - 1) * block.meta.elem_size) = p_slab->freelist;
+                p_slab->freelist = base + i - 1;
+            }
+            p_slab->free_num += (1u << block.meta.offset_bits);
+        }
+        void add_stats(uint32_t slab_index, mempool_stats_t &stats) const
+        {
+            const SlabMeta &meta = m_slabs[slab_index].meta;
+            const uint32_t capacity = (1u << meta.offset_bits);
+            for (size_t i = 0; i < m_blocks.size(); ++i)
+            {
+                if (m_blocks[i].meta.slab_index != slab_index)
+                {
+                    continue;
+                }
+                for (uint32_t j = 0, page_num = (1u << meta.page_bits); j < page_num; ++j)
+                {
+                    if (NULL == m_blocks[i].pages[j])
+                    {
+                        break;
+                    }
+                    const PageInfo &info = m_blocks[i].infos[j];
+                    ++stats.page_num;
+                    stats.page_bytes += meta.page_size;
+                    stats.live_bytes += (uint64_t)info.live * meta.elem_size;
+                    if (PAGE_RELEASED == info.state)
+                    {
+                        stats.released_bytes += meta.page_size;
+                    }
+                    else if (PAGE_EVACUATING == info.state)
+                    {
+                        stats.evacuating_bytes += meta.page_size;
+                    }
+                    else if (info.live * 2 < capacity)
+                    {
+                        ++stats.sparse_pages;
+                    }
+                }
+            }
+            stats.free_bytes += (uint64_t)m_slabs[slab_index].free_num * meta.elem_size;
+        }
         bool alloc_one_block(Slab *p_slab)
         {
             if (m_blocks.size() >= (1u << m_block_bits))
@@ -321,8 +776,11 @@ class Mempool
 
             uint32_t page_num = (1u << p_slab->meta.page_bits);
             void **pages = (void **)::calloc(page_num, sizeof(void *));
-            if (NULL == pages)
+            PageInfo *infos = (PageInfo *)::calloc(page_num, sizeof(PageInfo));
+            if (NULL == pages || NULL == infos)
             {
+                ::free(pages);
+                ::free(infos);
                 m_blocks.resize(block_no);
 
                 P_WARNING("failed to alloc pages array, page_num=%u, elem_size=%u, page_size=%u",
@@ -334,6 +792,7 @@ class Mempool
             m_blocks[block_no].cur_page_no = 0;
             m_blocks[block_no].cur_offset = 0;
             m_blocks[block_no].pages = pages;
+            m_blocks[block_no].infos = infos;
 
             p_slab->cur_block_no = block_no;
             ++p_slab->block_num;
@@ -344,8 +803,13 @@ class Mempool
         Map m_size2off;
         Map::iterator m_size2off_end;
         uint32_t m_block_bits;
+        uint32_t m_block_shift; /* vaddr中block号以下的位数 */
         std::vector<Slab> m_slabs;
         std::vector<Block> m_blocks;
+        std::vector<std::vector<PageNo> > m_released; /* 每个slab归还过的页 */
 };
 
+typedef TMempool<uint32_t> Mempool;
+typedef TMempool<uint64_t> Mempool64;    /* 倒排可以按层选用，见LevelIndex的INVERT_MEM64 */
+
 #endif
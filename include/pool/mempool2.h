@@ -7,6 +7,8 @@
 #include <vector>
 #include <ext/hash_map>
 #include "log_utils.h"
+#include "pool/page_alloc.h"
+#include "pool/mempool.h"
 
 namespace mem_detail
 {
@@ -66,11 +68,7 @@ namespace mem_detail
                     --m_free_num;
                     return ptr;
                 }
-#if (1)
-                void *page = ::memalign(64, m_page_size); /* cpu cache line alginment */
-#else
-                void *page = ::malloc(m_page_size);
-#endif
+                void *page = page_alloc(m_page_size, 64); /* cpu cache line alginment */
                 if (NULL == page)
                 {
                     P_WARNING("failed to alloc new page, page_size=%u", m_page_size);
@@ -82,7 +80,7 @@ namespace mem_detail
                 }
                 catch (...)
                 {
-                    ::free(page);
+                    page_free(page, m_page_size);
     
                     P_WARNING("failed to push back new page, pages_size=%u", (uint32_t)m_pages.size());
                     return NULL;
@@ -117,6 +115,7 @@ namespace mem_detail
             size_t elem_size() const { return m_elem_size; }
             size_t alloc_num() const { return m_alloc_num; }
             size_t free_num() const { return m_free_num; }
+            size_t page_num() const { return m_pages.size(); }
     
             size_t mem() const
             {
@@ -127,7 +126,7 @@ namespace mem_detail
             {
                 for (size_t i = 0; i < m_pages.size(); ++i)
                 {
-                    ::free(m_pages[i]);
+                    page_free(m_pages[i], m_page_size);
                 }
                 m_pages.clear();
                 m_alloc_num = 0;
@@ -270,6 +269,21 @@ class MultiMemoryPool
             }
         }
 
+        void get_stats(mempool_stats_t &stats) const
+        {
+            ::memset(&stats, 0, sizeof(stats));
+            for (Map::const_iterator it = m_pools.begin(); it != m_pools.end(); ++it)
+            {
+                if (it->second)
+                {
+                    stats.page_num += it->second->page_num();
+                    stats.page_bytes += it->second->page_num() * it->second->page_size();
+                    stats.live_bytes += it->second->alloc_num() * it->second->elem_size();
+                    stats.free_bytes += it->second->free_num() * it->second->elem_size();
+                }
+            }
+        }
+
         void print_meta() const
         {
             int i = 0;
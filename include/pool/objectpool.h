@@ -88,6 +88,7 @@ class TObjectPool
         }
 
         T *addr(vaddr_t ptr) const { return (T *)m_pool->addr(ptr); }
+        bool need_move(vaddr_t ptr) const { return m_pool->need_move(ptr); }
 
         vaddr_t alloc()
         {
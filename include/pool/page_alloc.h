@@ -0,0 +1,56 @@
+#ifndef __AGILE_SE_PAGE_ALLOC_H__
+#define __AGILE_SE_PAGE_ALLOC_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+/*
+ * Mempool/MultiMemoryPool的页分配后端，进程内全局，须在初始化索引之前设置
+ * malloc: 默认，::malloc/::memalign
+ * huge:   按2MB对齐mmap大块并madvise(MADV_HUGEPAGE)，页从大块中顺序切分，
+ *         大块中的页全部释放后归还系统；可把大块绑定到指定NUMA节点或在节点间交错分配
+ */
+enum { PAGE_BACKEND_MALLOC = 0, PAGE_BACKEND_HUGE };
+enum { NUMA_POLICY_NONE = 0, NUMA_POLICY_BIND, NUMA_POLICY_INTERLEAVE };
+
+#define AGILE_SE_HUGE_PAGE_SIZE     (2*1024*1024u)
+#ifndef AGILE_SE_HUGE_CHUNK_SIZE
+#define AGILE_SE_HUGE_CHUNK_SIZE    (32*AGILE_SE_HUGE_PAGE_SIZE)
+#endif
+
+struct page_alloc_conf_t
+{
+    int backend;
+    int numa_policy;
+    std::vector<int> numa_nodes;
+
+    page_alloc_conf_t()
+    {
+        backend = PAGE_BACKEND_MALLOC;
+        numa_policy = NUMA_POLICY_NONE;
+    }
+};
+
+struct page_alloc_stats_t
+{
+    uint64_t chunk_num;         /* mmap的大块数 */
+    uint64_t mapped_bytes;
+    uint64_t used_bytes;        /* 已切分给pool且未释放的字节数 */
+    uint64_t huge_bytes;        /* 由透明大页支撑的字节数，取自/proc/self/smaps的AnonHugePages */
+};
+
+/* backend: malloc/huge，policy: none/bind/interleave，nodes: 逗号分隔的节点号 */
+int page_alloc_parse(const std::string &backend, const std::string &policy,
+        const std::string &nodes, page_alloc_conf_t &conf);
+int page_alloc_init(const page_alloc_conf_t &conf);
+
+/* align为0时按8字节对齐 */
+void *page_alloc(size_t size, size_t align = 0);
+void page_free(void *ptr, size_t size);
+
+void page_alloc_stats(page_alloc_stats_t &stats);
+void page_alloc_print_meta();
+
+#endif
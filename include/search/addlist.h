@@ -42,6 +42,10 @@ class AddList: public DocList
         {
             return m_it.size();
         }
+        DocList *clone() const
+        {
+            return new (std::nothrow) AddList(m_sign, m_it_c);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -109,6 +109,10 @@ class BigList: public DocList
         {
             return m_head.doc_num;
         }
+        DocList *clone() const
+        {
+            return new (std::nothrow) BigList(m_sign, this->data());
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -127,6 +131,9 @@ class BigList: public DocList
             }
             return NULL;
         }
+    protected:
+        uint32_t sign() const { return m_sign; }
+        void *data() const { return ((int8_t *)m_docids) - sizeof(bl_head_t); }
     private:
         uint32_t m_sign;
         bl_head_t m_head;
@@ -0,0 +1,90 @@
+#ifndef __AGILE_SE_BITMAPLIST_H__
+#define __AGILE_SE_BITMAPLIST_H__
+
+#include <vector>
+#include <stdint.h>
+#include "search/doclist.h"
+
+/* 位图拉链，第i位为1表示docid i存在，没有payload */
+class BitmapList: public DocList
+{
+    public:
+        BitmapList(int8_t type, std::vector<uint64_t> &bits) /* 接管bits的内容 */
+        {
+            m_type = type;
+            m_bits.swap(bits);
+            m_count = 0;
+            for (size_t i = 0; i < m_bits.size(); ++i)
+            {
+                m_count += __builtin_popcountll(m_bits[i]);
+            }
+            m_curr = -1;
+        }
+
+        int32_t first()
+        {
+            return (m_curr = this->seek(0));
+        }
+        int32_t next()
+        {
+            if (-1 == m_curr) { return -1; }
+            return (m_curr = this->seek(uint32_t(m_curr) + 1));
+        }
+        int32_t curr()
+        {
+            return m_curr;
+        }
+        int32_t find(int32_t docid)
+        {
+            if (-1 == m_curr) { return -1; }
+            if (docid <= m_curr)
+            {
+                return m_curr;
+            }
+            return (m_curr = this->seek(docid));
+        }
+        uint32_t cost() const
+        {
+            return m_count;
+        }
+
+        InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
+        {
+            if (-1 != m_curr)
+            {
+                m_strategy_data.data = m_data;
+                m_strategy_data.sign = 0;
+                m_strategy_data.type = m_type;
+                m_strategy_data.length = 0;
+                st.work(&m_strategy_data);
+                return &m_strategy_data;
+            }
+            return NULL;
+        }
+    private:
+        int32_t seek(uint32_t pos) const
+        {
+            size_t w = pos >> 6;
+            if (w >= m_bits.size())
+            {
+                return -1;
+            }
+            uint64_t word = m_bits[w] & (~(uint64_t)0 << (pos & 63));
+            while (0 == word)
+            {
+                if (++w >= m_bits.size())
+                {
+                    return -1;
+                }
+                word = m_bits[w];
+            }
+            return int32_t((w << 6) + __builtin_ctzll(word));
+        }
+    private:
+        int8_t m_type;
+        int32_t m_curr;
+        uint32_t m_count;
+        std::vector<uint64_t> m_bits;
+};
+
+#endif
@@ -37,6 +37,10 @@ class CowBtreeList: public DocList
         {
             return m_it.size();
         }
+        DocList *clone() const
+        {
+            return new (std::nothrow) CowBtreeList(m_sign, m_it);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -1,8 +1,11 @@
 #ifndef __AGILE_SE_DOCLIST_H__
 #define __AGILE_SE_DOCLIST_H__
 
+#include <new>
+#include "pool/epoch.h"
 #include "search/invert_strategy.h"
 
+/* 开启epoch回收时，拉链存活期间持有EpochGuard，须在创建它的线程析构 */
 class DocList
 {
     public:
@@ -30,10 +33,14 @@ class DocList
         /* 获得策略数据 */
         virtual InvertStrategy::info_t *
             get_strategy_data(InvertStrategy &st) = 0;
+        /* 复制一份同样内容的拉链(需重新first)，不支持或失败时返回NULL */
+        virtual DocList *clone() const { return NULL; }
     protected:
         InvertStrategy::info_t m_strategy_data;
         InvertStrategy::data_t m_data;
     private:
+        EpochGuard m_epoch_guard;
+
         /* 禁止copy&assign */
         DocList(const DocList &);
         DocList &operator = (const DocList &);
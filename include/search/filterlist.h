@@ -0,0 +1,151 @@
+#ifndef __AGILE_SE_FILTERLIST_H__
+#define __AGILE_SE_FILTERLIST_H__
+
+#include "search/doclist.h"
+#include "index/field_filter.h"
+
+// =====================================================================================
+//        Class:  FilterList
+//  Description:  用正排过滤条件包装拉链，不满足条件的doc不会走到策略
+//                传入probe(与list相同的另一份拉链)时，probe先往前取一批docid，
+//                批量预取正排/列存过滤后，list再find到通过的docid，策略数据不受影响
+//                没有probe时逐个doc过滤
+// =====================================================================================
+class FilterList: public DocList
+{
+    public:
+        enum { BATCH_SIZE = FieldFilter::BATCH_SIZE };
+
+        FilterList(DocList *list, const FieldFilter &filter, DocList *probe = NULL)
+            : m_list(list), m_probe(probe), m_filter(filter)
+        {
+            m_curr = -1;
+            m_pos = m_num = 0;
+        }
+        ~FilterList()
+        {
+            delete m_list;
+            if (m_probe)
+            {
+                delete m_probe;
+            }
+        }
+
+        void set_data(InvertStrategy::data_t data)
+        {
+            m_list->set_data(data);
+        }
+
+        int32_t first()
+        {
+            m_pos = m_num = 0;
+            if (m_probe && -1 == m_probe->first())
+            {
+                return (m_curr = -1);
+            }
+            const int32_t docid = m_list->first();
+            if (-1 == docid) { return (m_curr = -1); }
+            return (m_curr = this->seek(docid));
+        }
+        int32_t next()
+        {
+            if (-1 == m_curr) { return -1; }
+            const int32_t docid = m_list->next();
+            if (-1 == docid) { return (m_curr = -1); }
+            return (m_curr = this->seek(docid));
+        }
+        int32_t curr()
+        {
+            return m_curr;
+        }
+        int32_t find(int32_t docid)
+        {
+            if (-1 == m_curr) { return -1; }
+            if (m_curr >= docid) /* 只往前走 */ { return m_curr; }
+            docid = m_list->find(docid);
+            if (-1 == docid) { return (m_curr = -1); }
+            return (m_curr = this->seek(docid));
+        }
+        uint32_t cost() const
+        {
+            return m_list->cost();
+        }
+
+        InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
+        {
+            if (-1 == m_curr) { return NULL; }
+            return m_list->get_strategy_data(st);
+        }
+    private:
+        /* m_list当前在docid上，找到第一个>=docid且满足条件的doc */
+        int32_t seek(int32_t docid)
+        {
+            while (-1 != docid)
+            {
+                int32_t id = docid;
+                if (NULL == m_probe)
+                {
+                    if (m_filter.filter(&id, 1) > 0)
+                    {
+                        return docid;
+                    }
+                    docid = m_list->next();
+                    continue;
+                }
+                id = this->next_accepted(docid);
+                if (-1 == id)
+                {
+                    return -1;
+                }
+                docid = m_list->find(id);
+                if (docid == id)
+                {
+                    return docid;
+                }
+            }
+            return -1;
+        }
+        /* 从probe批量过滤的结果中取第一个>=docid的doc */
+        int32_t next_accepted(int32_t docid)
+        {
+            for (;;)
+            {
+                while (m_pos < m_num && m_ids[m_pos] < docid)
+                {
+                    ++m_pos;
+                }
+                if (m_pos < m_num)
+                {
+                    return m_ids[m_pos];
+                }
+                int32_t id = m_probe->curr();
+                if (-1 != id && id < docid)
+                {
+                    id = m_probe->find(docid);
+                }
+                if (-1 == id)
+                {
+                    return -1;
+                }
+                size_t num = 0;
+                while (-1 != id && num < (size_t)BATCH_SIZE)
+                {
+                    m_ids[num++] = id;
+                    id = m_probe->next();
+                }
+                m_num = m_filter.filter(m_ids, num);
+                m_pos = 0;
+            }
+        }
+    private:
+        DocList *m_list;
+        DocList *m_probe;
+        FieldFilter m_filter;
+
+        int32_t m_curr;
+        size_t m_pos;
+        size_t m_num;
+        int32_t m_ids[BATCH_SIZE];
+};
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef __AGILE_SE_LIVELIST_H__
+#define __AGILE_SE_LIVELIST_H__
+
+#include "search/biglist.h"
+#include "index/segment_array.h"
+
+// =====================================================================================
+//        Class:  LiveList
+//  Description:  不可变段中的拉链，docid的生效代数(live)为0或大于段的代数时跳过
+//                即doc在该段写成之后被删除或整体重写过
+// =====================================================================================
+class LiveList: public BigList
+{
+    public:
+        LiveList(uint32_t sign, void *data, uint32_t id, const SegmentArray<uint32_t> &live)
+            : BigList(sign, data), m_id(id), m_live(live) { }
+
+        int32_t first() { return this->skip(BigList::first()); }
+        int32_t next() { return this->skip(BigList::next()); }
+        int32_t find(int32_t docid) { return this->skip(BigList::find(docid)); }
+        DocList *clone() const
+        {
+            return new (std::nothrow) LiveList(this->sign(), this->data(), m_id, m_live);
+        }
+    private:
+        int32_t skip(int32_t docid)
+        {
+            while (-1 != docid)
+            {
+                const uint32_t *gen = m_live.at(docid);
+                if (gen && 0 != *gen && *gen <= m_id)
+                {
+                    return docid;
+                }
+                docid = BigList::next();
+            }
+            return -1;
+        }
+    private:
+        const uint32_t m_id;
+        const SegmentArray<uint32_t> &m_live;
+};
+
+#endif
@@ -18,6 +18,12 @@ class TSOrListImpl /* Big | Add */
             m_sign = sign;
             m_curr = -1;
         }
+        TSOrListImpl(uint32_t sign, const big_iterator &big, const add_iterator &add)
+            : m_big(big), m_add(add), m_add_c(add)
+        {
+            m_sign = sign;
+            m_curr = -1;
+        }
 
         inline int32_t curr() const { return m_curr; }
 
@@ -132,16 +138,26 @@ class TSOrListImpl /* Big | Add */
 template<typename CowBtree, typename SkipList>
 class TSOrList: public DocList
 {
+    public:
+        typedef typename CowBtree::iterator big_iterator;
+        typedef typename SkipList::iterator add_iterator;
     public:
         TSOrList(uint32_t sign, const CowBtree &big, const SkipList &add)
             : m_impl(sign, big, add)
         { }
+        TSOrList(uint32_t sign, const big_iterator &big, const add_iterator &add)
+            : m_impl(sign, big, add)
+        { }
 
         int32_t curr() { return m_impl.curr(); }
         int32_t first() { return m_impl.first(); }
         int32_t next() { return m_impl.next(); }
         int32_t find(int32_t docid) { return m_impl.find(docid); }
         uint32_t cost() const { return m_impl.cost(); }
+        DocList *clone() const
+        {
+            return new (std::nothrow) TSOrList(m_impl.m_sign, m_impl.m_big, m_impl.m_add_c);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -168,6 +184,9 @@ class TSMergeList: public DocList
         TSMergeList(uint32_t sign, const CowBtree &big, const SkipList &add, const SkipList &del)
             : m_impl(sign, big, add), m_del(del.begin()), m_del_c(m_del)
         { }
+        TSMergeList(uint32_t sign, const big_iterator &big, const add_iterator &add, const del_iterator &del)
+            : m_impl(sign, big, add), m_del(del), m_del_c(del)
+        { }
 
         int32_t curr() { return m_impl.curr(); }
 
@@ -213,6 +232,10 @@ class TSMergeList: public DocList
             return m_impl.curr();
         }
         uint32_t cost() const { return m_impl.cost(); }
+        DocList *clone() const
+        {
+            return new (std::nothrow) TSMergeList(m_impl.m_sign, m_impl.m_big, m_impl.m_add_c, m_del_c);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -243,6 +266,12 @@ class TSBigDiffList: public DocList
             m_sign = sign;
             m_curr = -1;
         }
+        TSBigDiffList(uint32_t sign, const big_iterator &big, const del_iterator &del)
+            : m_big(big), m_del(del), m_del_c(del)
+        {
+            m_sign = sign;
+            m_curr = -1;
+        }
 
         int32_t curr() { return m_curr; }
 
@@ -285,6 +314,10 @@ class TSBigDiffList: public DocList
             return this->check(*m_big);
         }
         uint32_t cost() const { return m_big.size(); }
+        DocList *clone() const
+        {
+            return new (std::nothrow) TSBigDiffList(m_sign, m_big, m_del_c);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -320,6 +353,12 @@ class TSAddDiffList: public DocList
             m_sign = sign;
             m_curr = -1;
         }
+        TSAddDiffList(uint32_t sign, const add_iterator &add, const del_iterator &del)
+            : m_add(add), m_add_c(add), m_del(del), m_del_c(del)
+        {
+            m_sign = sign;
+            m_curr = -1;
+        }
 
         int32_t curr() { return m_curr; }
 
@@ -362,6 +401,10 @@ class TSAddDiffList: public DocList
             return this->check(*m_add);
         }
         uint32_t cost() const { return m_add.size(); }
+        DocList *clone() const
+        {
+            return new (std::nothrow) TSAddDiffList(m_sign, m_add_c, m_del_c);
+        }
 
         InvertStrategy::info_t *get_strategy_data(InvertStrategy &st)
         {
@@ -47,6 +47,18 @@ class OrList: public DualList
         {
             return m_left->cost() + m_right->cost();
         }
+        DocList *clone() const
+        {
+            DocList *left = m_left->clone();
+            DocList *right = left ? m_right->clone() : NULL;
+            DocList *list = right ? new (std::nothrow) OrList(left, right) : NULL;
+            if (NULL == list)
+            {
+                delete left;
+                delete right;
+            }
+            return list;
+        }
 };
 
 #endif
@@ -0,0 +1,962 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include <algorithm>
+#include "str_utils.h"
+#include "fast_timer.h"
+#include "log_utils.h"
+#include "search/biglist.h"
+#include "inc/base_builder.h"
+#include "inc/inc_record.h"
+
+namespace inc
+{
+    /* 归并时一条拉链上的一个doc */
+    struct posting_t
+    {
+        int32_t docid;
+        int32_t oid;
+        std::string payload;
+
+        bool operator <(const posting_t &o) const
+        {
+            return docid < o.docid;
+        }
+    };
+
+    RunSorter::RunSorter()
+    {
+        m_slot_bytes = 0;
+        m_cur = 0;
+        m_size = 0;
+        m_merging = false;
+        m_last = (size_t)-1;
+    }
+
+    RunSorter::~RunSorter()
+    {
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            this->wait(m_slots[i]);
+        }
+        this->clear();
+    }
+
+    int RunSorter::init(const std::string &prefix, uint32_t slot_num, uint64_t slot_bytes)
+    {
+        if (0 == slot_num || slot_bytes < 1024*1024)
+        {
+            P_WARNING("invalid args: slot_num=%u, slot_bytes=%lu", slot_num, slot_bytes);
+            return -1;
+        }
+        if (slot_bytes > 0x7FFFFFFFu) /* entry_t::offset是32位的 */
+        {
+            slot_bytes = 0x7FFFFFFFu;
+        }
+        m_prefix = prefix;
+        m_slot_bytes = slot_bytes;
+        m_slots.resize(slot_num);
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            m_slots[i].busy = false;
+            m_slots[i].ok = true;
+        }
+        m_cur = 0;
+        m_size = 0;
+        return 0;
+    }
+
+    bool RunSorter::add(uint32_t key, uint32_t id, uint64_t seq, const void *payload, uint16_t payload_len)
+    {
+        slot_t &slot = m_slots[m_cur];
+        entry_t entry;
+        entry.key = key;
+        entry.id = id;
+        entry.seq = seq;
+        entry.offset = slot.payloads.size();
+        entry.payload_len = payload_len;
+        slot.entries.push_back(entry);
+        if (payload_len > 0)
+        {
+            slot.payloads.append((const char *)payload, payload_len);
+        }
+        ++m_size;
+        if (slot.entries.size() * sizeof(entry_t) + slot.payloads.size() >= m_slot_bytes)
+        {
+            return this->flush();
+        }
+        return true;
+    }
+
+    bool RunSorter::flush()
+    {
+        slot_t &slot = m_slots[m_cur];
+        if (slot.entries.empty())
+        {
+            return true;
+        }
+        char tmpbuf[32];
+        ::snprintf(tmpbuf, sizeof tmpbuf, ".%lu", (uint64_t)m_paths.size());
+        slot.path = m_prefix + tmpbuf;
+        m_paths.push_back(slot.path);
+
+        slot.busy = true;
+        int ret = ::pthread_create(&slot.tid, NULL, sort_thread, &slot);
+        if (ret != 0)
+        {
+            P_WARNING("failed to create sort thread, ret=%d, sort in current thread", ret);
+            slot.busy = false;
+            slot.ok = write_run(slot);
+            slot.entries.clear();
+            slot.payloads.clear();
+            if (!slot.ok)
+            {
+                return false;
+            }
+        }
+        m_cur = (m_cur + 1) % m_slots.size();
+        return this->wait(m_slots[m_cur]);
+    }
+
+    bool RunSorter::wait(slot_t &slot)
+    {
+        if (slot.busy)
+        {
+            ::pthread_join(slot.tid, NULL);
+            slot.busy = false;
+            slot.entries.clear();
+            slot.payloads.clear();
+        }
+        return slot.ok;
+    }
+
+    void *RunSorter::sort_thread(void *args)
+    {
+        slot_t *slot = (slot_t *)args;
+        slot->ok = write_run(*slot);
+        return NULL;
+    }
+
+    bool RunSorter::write_run(slot_t &slot)
+    {
+        std::sort(slot.entries.begin(), slot.entries.end());
+
+        FILE *fp = ::fopen(slot.path.c_str(), "wb");
+        if (NULL == fp)
+        {
+            P_WARNING("failed to open file[%s] for write", slot.path.c_str());
+            return false;
+        }
+        const size_t buffer_size = 1024*1024;
+        char *buffer = new (std::nothrow) char[buffer_size];
+        if (buffer)
+        {
+            ::setvbuf(fp, buffer, _IOFBF, buffer_size);
+        }
+        bool ok = true;
+        for (size_t i = 0; ok && i < slot.entries.size(); ++i)
+        {
+            const entry_t &entry = slot.entries[i];
+            ok = ::fwrite(&entry.key, sizeof(entry.key), 1, fp) == 1
+                && ::fwrite(&entry.id, sizeof(entry.id), 1, fp) == 1
+                && ::fwrite(&entry.seq, sizeof(entry.seq), 1, fp) == 1
+                && ::fwrite(&entry.payload_len, sizeof(entry.payload_len), 1, fp) == 1
+                && (0 == entry.payload_len || ::fwrite(slot.payloads.data() + entry.offset,
+                            entry.payload_len, 1, fp) == 1);
+        }
+        if (::fclose(fp) != 0)
+        {
+            ok = false;
+        }
+        if (buffer)
+        {
+            delete [] buffer;
+        }
+        if (!ok)
+        {
+            P_WARNING("failed to write run[%s]", slot.path.c_str());
+        }
+        return ok;
+    }
+
+    bool RunSorter::finish()
+    {
+        bool ok = this->flush();
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            ok = this->wait(m_slots[i]) && ok;
+            std::vector<entry_t>().swap(m_slots[i].entries);
+            std::string().swap(m_slots[i].payloads);
+        }
+        if (!ok)
+        {
+            return false;
+        }
+        const size_t buffer_size = 64*1024;
+        run_t empty;
+        empty.fp = NULL;
+        empty.buffer = NULL;
+        m_runs.resize(m_paths.size(), empty);
+        for (size_t i = 0; i < m_runs.size(); ++i)
+        {
+            run_t &run = m_runs[i];
+            run.fp = ::fopen(m_paths[i].c_str(), "rb");
+            if (NULL == run.fp)
+            {
+                P_WARNING("failed to open file[%s] for read", m_paths[i].c_str());
+                return false;
+            }
+            run.buffer = new (std::nothrow) char[buffer_size];
+            if (run.buffer)
+            {
+                ::setvbuf(run.fp, run.buffer, _IOFBF, buffer_size);
+            }
+        }
+        run_greater_t greater;
+        greater.runs = &m_runs;
+        m_heap.clear();
+        for (size_t i = 0; i < m_runs.size(); ++i)
+        {
+            const int ret = read_record(m_runs[i]);
+            if (ret < 0)
+            {
+                P_WARNING("failed to read run[%s]", m_paths[i].c_str());
+                return false;
+            }
+            if (ret > 0)
+            {
+                m_heap.push_back(i);
+                std::push_heap(m_heap.begin(), m_heap.end(), greater);
+            }
+        }
+        m_merging = true;
+        m_last = (size_t)-1;
+        return true;
+    }
+
+    bool RunSorter::run_greater_t::operator()(size_t a, size_t b) const
+    {
+        const record_t &x = (*runs)[a].record;
+        const record_t &y = (*runs)[b].record;
+        if (x.key != y.key) {
+            return x.key > y.key;
+        } else if (x.id != y.id) {
+            return x.id > y.id;
+        } else {
+            return x.seq > y.seq;
+        }
+    }
+
+    int RunSorter::read_record(run_t &run)
+    {
+        record_t &record = run.record;
+        if (::fread(&record.key, sizeof(record.key), 1, run.fp) != 1)
+        {
+            return ::feof(run.fp) ? 0 : -1;
+        }
+        if (::fread(&record.id, sizeof(record.id), 1, run.fp) != 1
+                || ::fread(&record.seq, sizeof(record.seq), 1, run.fp) != 1
+                || ::fread(&record.payload_len, sizeof(record.payload_len), 1, run.fp) != 1)
+        {
+            return -1;
+        }
+        record.payload = NULL;
+        if (record.payload_len > 0)
+        {
+            run.payload.resize(record.payload_len);
+            if (::fread(&run.payload[0], record.payload_len, 1, run.fp) != 1)
+            {
+                return -1;
+            }
+            record.payload = run.payload.data();
+        }
+        return 1;
+    }
+
+    int RunSorter::next(record_t &record)
+    {
+        if (!m_merging)
+        {
+            P_WARNING("must call finish first");
+            return -1;
+        }
+        run_greater_t greater;
+        greater.runs = &m_runs;
+        if (m_last != (size_t)-1)
+        {
+            const int ret = read_record(m_runs[m_last]);
+            if (ret < 0)
+            {
+                P_WARNING("failed to read run[%s]", m_paths[m_last].c_str());
+                return -1;
+            }
+            if (ret > 0)
+            {
+                m_heap.push_back(m_last);
+                std::push_heap(m_heap.begin(), m_heap.end(), greater);
+            }
+            m_last = (size_t)-1;
+        }
+        if (m_heap.empty())
+        {
+            return 0;
+        }
+        std::pop_heap(m_heap.begin(), m_heap.end(), greater);
+        m_last = m_heap.back();
+        m_heap.pop_back();
+        record = m_runs[m_last].record;
+        return 1;
+    }
+
+    void RunSorter::clear()
+    {
+        for (size_t i = 0; i < m_runs.size(); ++i)
+        {
+            if (m_runs[i].fp)
+            {
+                ::fclose(m_runs[i].fp);
+            }
+            if (m_runs[i].buffer)
+            {
+                delete [] m_runs[i].buffer;
+            }
+        }
+        m_runs.clear();
+        m_heap.clear();
+        for (size_t i = 0; i < m_paths.size(); ++i)
+        {
+            ::unlink(m_paths[i].c_str());
+        }
+        m_paths.clear();
+        m_merging = false;
+        m_last = (size_t)-1;
+        m_size = 0;
+    }
+
+    BaseBuilder::BaseBuilder(Index &index)
+        : m_index(index)
+    {
+        m_threads = 0;
+        m_max_bytes = 0;
+        m_seq = 0;
+        m_line_count = 0;
+        m_invalid_count = 0;
+        m_forward_count = 0;
+        m_invert_count = 0;
+        m_delete_count = 0;
+    }
+
+    BaseBuilder::~BaseBuilder()
+    {
+        for (size_t i = 0; i < m_levels.size(); ++i)
+        {
+            if (m_levels[i])
+            {
+                delete m_levels[i]->parser;
+                delete m_levels[i];
+            }
+        }
+        m_levels.clear();
+    }
+
+    int BaseBuilder::init(uint32_t threads, uint64_t max_bytes, const char *tmp_path)
+    {
+        if (0 == threads || NULL == tmp_path || '\0' == tmp_path[0])
+        {
+            P_WARNING("invalid args: threads=%u, tmp_path=%p", threads, tmp_path);
+            return -1;
+        }
+        m_threads = threads;
+        m_max_bytes = max_bytes;
+        m_tmp_path = tmp_path;
+        if (!mk_dir(m_tmp_path))
+        {
+            P_WARNING("failed to mkdir[%s]", m_tmp_path.c_str());
+            return -1;
+        }
+        size_t invert_num = 0;
+        for (size_t i = 0; i < m_index.level_num(); ++i)
+        {
+            const LevelIndex *lx = m_index.get_level_index(i);
+            if (lx && lx->has_invert())
+            {
+                ++invert_num;
+            }
+        }
+        /* 读入时各层的lists同时在用，归并时words在lists释放之后才用 */
+        const uint64_t slot_bytes = invert_num > 0 ? max_bytes / invert_num / threads : 0;
+
+        m_levels.resize(m_index.level_num(), NULL);
+        for (size_t i = 0; i < m_levels.size(); ++i)
+        {
+            LevelIndex *lx = m_index.get_level_index(i);
+            if (NULL == lx)
+            {
+                continue;
+            }
+            level_t *lv = new (std::nothrow) level_t;
+            if (NULL == lv)
+            {
+                P_WARNING("failed to new level_t");
+                return -1;
+            }
+            m_levels[i] = lv;
+            lv->builder = this;
+            lv->level = i;
+            lv->index = lx;
+            lv->parser = new (std::nothrow) EventParser();
+            lv->doc_num = 0;
+            lv->list_num = 0;
+            lv->total_len = 0;
+            lv->ok = true;
+            if (NULL == lv->parser || lv->parser->init(lx) < 0)
+            {
+                P_WARNING("failed to init event parser, level=%lu", (uint64_t)i);
+                return -1;
+            }
+            if (!lx->has_invert())
+            {
+                continue;
+            }
+            char tmpbuf[256];
+            ::snprintf(tmpbuf, sizeof tmpbuf, "%s/L%lu", m_tmp_path.c_str(), (uint64_t)i);
+            if (lv->dict.init(1000000, 1024*1024) < 0
+                    || lv->lists.init(std::string(tmpbuf) + ".lists", threads, slot_bytes) < 0
+                    || lv->words.init(std::string(tmpbuf) + ".words", threads, slot_bytes) < 0)
+            {
+                P_WARNING("failed to init sorter or sign dict, level=%lu", (uint64_t)i);
+                return -1;
+            }
+            lv->types.push_back(0xFF); /* sign id从1开始 */
+        }
+        P_WARNING("init base builder ok, threads[%u], max_bytes[%lu], tmp_path[%s]",
+                threads, max_bytes, tmp_path);
+        return 0;
+    }
+
+    bool BaseBuilder::add_invert(level_t &lv, int32_t oid, uint8_t type, uint64_t sign,
+            const char *word, uint32_t word_len, const void *payload)
+    {
+        uint32_t id = 0;
+        if (!lv.dict.find_or_insert(sign, word, word_len, id) || 0 == id)
+        {
+            P_WARNING("failed to record sign[%lu], type[%d]", sign, int(type));
+            return true; /* 与InvertIndex::insert一致，只丢掉这一个词 */
+        }
+        if (id >= lv.types.size())
+        {
+            lv.types.resize(id + 1, 0xFF);
+            lv.types[id] = type;
+        }
+        else if (lv.types[id] != type)
+        {
+            P_WARNING("conflicting hash value[%.*s:%d]", int(word_len), word, int(type));
+            return true;
+        }
+        return lv.lists.add(id, (uint32_t)oid, m_seq++, payload, lv.index->get_payload_len(type));
+    }
+
+    bool BaseBuilder::add_inverts(level_t &lv, int32_t oid, const std::vector<invert_data_t> &inverts)
+    {
+        for (size_t i = 0; i < inverts.size(); ++i)
+        {
+            const invert_data_t &data = inverts[i];
+            if (!lv.index->is_valid_type(data.type))
+            {
+                P_WARNING("invalid parameter: keystr[%s], type[%d] is unregisterd", data.key, data.type);
+                continue;
+            }
+            char buffer[256];
+            uint32_t len = sizeof buffer;
+            uint64_t sign = 0;
+            if (!lv.index->create_sign(data.key, data.type, buffer, len, sign))
+            {
+                P_WARNING("failed to sign word[%s], type[%d]", data.key, data.type);
+                continue;
+            }
+            const void *payload = NULL;
+            if (lv.index->get_payload_len(data.type) > 0)
+            {
+                payload = lv.index->parse_payload(data.type, data.value);
+                if (NULL == payload)
+                {
+                    P_WARNING("failed to parse payload for invert type[%d]", data.type);
+                    continue;
+                }
+            }
+            if (!this->add_invert(lv, oid, data.type, sign, buffer, len, payload))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool BaseBuilder::add_inverts(level_t &lv, int32_t oid, const std::vector<invert_sign_t> &signs)
+    {
+        for (size_t i = 0; i < signs.size(); ++i)
+        {
+            const invert_sign_t &data = signs[i];
+            if (data.type < 0 || data.type >= 0xFF || !lv.index->is_valid_type(data.type))
+            {
+                P_WARNING("invalid parameter: sign[%lu], type[%d] is unregisterd", data.sign, data.type);
+                continue;
+            }
+            if (lv.index->get_payload_len(data.type) != data.payload_len
+                    || (data.payload_len > 0 && NULL == data.payload))
+            {
+                P_WARNING("invalid payload for invert type[%d], payload_len[%hu]", data.type, data.payload_len);
+                continue;
+            }
+            if (!this->add_invert(lv, oid, data.type, data.sign, data.word, data.word_len, data.payload))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool BaseBuilder::read()
+    {
+        IncReader &reader = m_index.m_inc_reader;
+        const size_t log_buffer_length = 4096;
+        char log_buffer[log_buffer_length];
+
+        IncReader::column_t columns[IncReader::MAX_COLUMNS];
+        std::vector<forward_value_t> values;
+        std::vector<invert_data_t> inverts;
+        record_head_t head;
+        std::vector<invert_sign_t> signs;
+        FastTimer timer;
+        timer.start();
+        while (1)
+        {
+            const int ret = reader.next();
+            if (0 == ret)
+            {
+                P_WARNING("meeting end of base file");
+                break;
+            }
+            else if (ret < 0)
+            {
+                P_FATAL("disk file error");
+                return false;
+            }
+            if (++m_line_count % 1000000 == 0)
+            {
+                timer.stop();
+                P_WARNING("base builder has read %lu lines, cost %ld ms", m_line_count, timer.timeInMs());
+            }
+            size_t column_num = 0;
+            uint32_t level = 0;
+            uint32_t optype = 0;
+            uint64_t oid = 0;
+            if (reader.is_binary()) {
+                if (!decode_record(reader.line(), reader.line_len(), head, values, signs))
+                {
+                    P_MYLOG("invalid binary record");
+                    ++m_invalid_count;
+                    continue;
+                }
+                level = head.level;
+                optype = head.optype;
+                oid = head.oid;
+            } else {
+                column_num = reader.split(columns, IncReader::MAX_COLUMNS, '\t');
+                if (column_num < 3)
+                {
+                    P_MYLOG("must has {[eventid] level, optype, oid}");
+                    ++m_invalid_count;
+                    continue;
+                }
+                if (!IncReader::parse_uint32(columns[0], level)
+                        || !IncReader::parse_uint32(columns[1], optype)
+                        || !IncReader::parse_uint64(columns[2], oid))
+                {
+                    P_MYLOG("invalid level, optype, oid");
+                    ++m_invalid_count;
+                    continue;
+                }
+            }
+            level_t *lv = level < m_levels.size() ? m_levels[level] : NULL;
+            if (NULL == lv)
+            {
+                P_MYLOG("invalid level=%u, LevelIndex is NULL", level);
+                ++m_invalid_count;
+                continue;
+            }
+            LevelIndex *lx = lv->index;
+            bool ok = true;
+            switch (optype)
+            {
+                case OP_INSERT:
+                case OP_UPDATE:
+                    if (reader.is_binary()) {
+                        if (!(head.flags & RECORD_FLAG_INVERT)) {
+                            lx->forward_update(oid, values);
+                            ++m_forward_count;
+                        } else if (lx->forward_update(oid, values)) {
+                            if (lx->has_invert()) {
+                                lv->starts[oid] = m_seq;
+                                ok = this->add_inverts(*lv, oid, signs);
+                            }
+                            ++m_invert_count;
+                        }
+                        break;
+                    }
+                    lv->parser->reset();
+                    if (column_num < 4) {
+                        P_MYLOG("must has forward json");
+                    } else if (!lv->parser->parse_forward(columns[3].ptr, values)) {
+                        P_MYLOG("failed to parse forward json");
+                    } else if (column_num <= 4) {
+                        lx->forward_update(oid, values);
+                        ++m_forward_count;
+                    } else if (!lv->parser->parse_invert(columns[4].ptr, inverts)) {
+                        P_MYLOG("failed to parse invert json");
+                    } else if (lx->forward_update(oid, values)) {
+                        /* 倒排是空的，forward_update与update的正排部分一致，倒排整体替换 */
+                        if (lx->has_invert()) {
+                            lv->starts[oid] = m_seq;
+                            ok = this->add_inverts(*lv, oid, inverts);
+                        }
+                        ++m_invert_count;
+                    }
+                    break;
+                case OP_DELETE:
+                    lx->remove(oid);
+                    if (lx->has_invert()) {
+                        lv->starts[oid] = m_seq;
+                    }
+                    ++m_delete_count;
+                    break;
+                default:
+                    P_MYLOG("invalid optype=%u", optype);
+                    ++m_invalid_count;
+                    break;
+            }
+            if (!ok)
+            {
+                P_FATAL("failed to add inverts to sorter");
+                return false;
+            }
+        }
+        timer.stop();
+        P_WARNING("base builder read ok, lines=%lu, invalid=%lu, forward=%lu, invert=%lu, delete=%lu,"
+                " postings=%lu, cost %ld ms", m_line_count, m_invalid_count, m_forward_count,
+                m_invert_count, m_delete_count, m_seq, timer.timeInMs());
+        return true;
+    }
+
+    bool BaseBuilder::write_lists(level_t &lv)
+    {
+        typedef FSInterface::File File;
+        FSInterface *fs = &DefaultFS::s_default;
+        if (!lv.lists.finish())
+        {
+            P_WARNING("failed to sort lists");
+            return false;
+        }
+        P_WARNING("level[%u] has %lu postings in %lu runs", lv.level, lv.lists.size(), (uint64_t)lv.lists.run_num());
+        const std::string path = lv.dir + "/";
+        File idx = fs->fopen((path + "invert.idx").c_str(), "wb");
+        File data = fs->fopen((path + "invert.data").c_str(), "wb");
+        File meta = fs->fopen((path + "invert_list.meta").c_str(), "w");
+        bool ok = (NULL != idx && NULL != data && NULL != meta);
+        if (!ok)
+        {
+            P_WARNING("failed to open invert files in dir[%s] for write", path.c_str());
+        }
+
+        std::vector<posting_t> items;
+        std::string word;
+        size_t offset = 0;
+        RunSorter::record_t record;
+        int ret = ok ? lv.lists.next(record) : 0;
+        while (ok && ret > 0)
+        {
+            const uint32_t sign = record.key;
+            items.clear();
+            /* 同一个sign的记录按(oid, seq)有序，只保留oid当前倒排中的最后一条 */
+            for (; ret > 0 && record.key == sign; ret = lv.lists.next(record))
+            {
+                const int32_t oid = (int32_t)record.id;
+                StartMap::const_iterator it = lv.starts.find(oid);
+                if (it == lv.starts.end() || record.seq < it->second)
+                {
+                    continue;
+                }
+                if (!items.empty() && items.back().oid == oid)
+                {
+                    items.back().payload.assign((const char *)record.payload, record.payload_len);
+                    continue;
+                }
+                const int32_t docid = lv.index->get_id_by_oid(oid);
+                if (docid < 0)
+                {
+                    continue;
+                }
+                items.push_back(posting_t());
+                items.back().docid = docid;
+                items.back().oid = oid;
+                items.back().payload.assign((const char *)record.payload, record.payload_len);
+            }
+            if (ret < 0 || items.empty())
+            {
+                continue;
+            }
+            std::sort(items.begin(), items.end());
+
+            bl_head_t head;
+            head.type = lv.types[sign];
+            head.payload_len = lv.index->get_payload_len(head.type);
+            head.doc_num = items.size();
+            const uint32_t length = (sizeof(bl_head_t) + (sizeof(int32_t) + head.payload_len) * head.doc_num);
+            ok = fs->fwrite(&head, sizeof(head), 1, data) == 1;
+            for (size_t i = 0; ok && i < items.size(); ++i)
+            {
+                ok = fs->fwrite(&items[i].docid, sizeof(items[i].docid), 1, data) == 1
+                    && (0 == head.payload_len || fs->fwrite(items[i].payload.data(), head.payload_len, 1, data) == 1)
+                    && lv.words.add(items[i].docid, sign, 0, NULL, 0);
+            }
+            ok = ok && fs->fwrite(&sign, sizeof(sign), 1, idx) == 1
+                && fs->fwrite(&offset, sizeof(offset), 1, idx) == 1
+                && fs->fwrite(&length, sizeof(length), 1, idx) == 1;
+            if (!ok)
+            {
+                P_WARNING("failed to write list, sign=%u", sign);
+                break;
+            }
+            lv.dict.find(sign, word);
+            fs->fprintf(meta, "%s : %d\n", word.c_str(), head.doc_num);
+
+            offset += length;
+            lv.total_len += head.doc_num;
+            ++lv.list_num;
+        }
+        if (ret < 0)
+        {
+            P_WARNING("failed to merge runs of lists");
+            ok = false;
+        }
+        if (meta)
+        {
+            fs->fprintf(meta, "total_len : %lu\n", (uint64_t)lv.total_len);
+            fs->fclose(meta);
+        }
+        if (data)
+        {
+            fs->fclose(data);
+        }
+        if (idx)
+        {
+            fs->fclose(idx);
+        }
+        lv.lists.clear();
+        return ok;
+    }
+
+    bool BaseBuilder::write_words_bag(level_t &lv)
+    {
+        typedef FSInterface::File File;
+        FSInterface *fs = &DefaultFS::s_default;
+        if (!lv.words.finish())
+        {
+            P_WARNING("failed to sort words bag");
+            return false;
+        }
+        const std::string path = lv.dir + "/";
+        File idx = fs->fopen((path + "words_bag.idx").c_str(), "wb");
+        File data = fs->fopen((path + "words_bag.data").c_str(), "wb");
+        bool ok = (NULL != idx && NULL != data);
+        if (!ok)
+        {
+            P_WARNING("failed to open words_bag files in dir[%s] for write", path.c_str());
+        }
+        size_t offset = 0;
+        RunSorter::record_t record;
+        int ret = ok ? lv.words.next(record) : 0;
+        while (ok && ret > 0)
+        {
+            /* 与IDList一样按sign升序 */
+            const uint32_t docid = record.key;
+            uint32_t length = 0;
+            for (; ok && ret > 0 && record.key == docid; ret = lv.words.next(record))
+            {
+                ok = fs->fwrite(&record.id, sizeof(record.id), 1, data) == 1;
+                length += sizeof(record.id);
+            }
+            ok = ok && fs->fwrite(&docid, sizeof(docid), 1, idx) == 1
+                && fs->fwrite(&offset, sizeof(offset), 1, idx) == 1
+                && fs->fwrite(&length, sizeof(length), 1, idx) == 1;
+            offset += length;
+            ++lv.doc_num;
+        }
+        if (!ok || ret < 0)
+        {
+            P_WARNING("failed to write words bag");
+            ok = false;
+        }
+        if (data)
+        {
+            fs->fclose(data);
+        }
+        if (idx)
+        {
+            fs->fclose(idx);
+        }
+        lv.words.clear();
+        return ok;
+    }
+
+    void *BaseBuilder::write_thread(void *args)
+    {
+        level_t *lv = (level_t *)args;
+        FastTimer timer;
+        timer.start();
+        lv->ok = lv->builder->write_lists(*lv)
+            && lv->builder->write_words_bag(*lv)
+            && lv->dict.dump(lv->dir.c_str());
+        timer.stop();
+        if (lv->ok)
+        {
+            P_WARNING("write invert index of level[%u] ok, lists=%lu, total_len=%lu, doc_num=%lu, cost %ld ms",
+                    lv->level, lv->list_num, lv->total_len, lv->doc_num, timer.timeInMs());
+        }
+        return NULL;
+    }
+
+    int BaseBuilder::dump()
+    {
+        const std::string path = m_index.writeable_path();
+        P_WARNING("start to dump base index at: %s", path.c_str());
+        /* 先按原来的方式dump正排(倒排是空的，只写出invert.meta和空的add/del)，再覆盖倒排文件 */
+        for (size_t i = 0; i < m_levels.size(); ++i)
+        {
+            level_t *lv = m_levels[i];
+            if (NULL == lv)
+            {
+                continue;
+            }
+            lv->dir = path + "/" + m_index.level_dirname(i);
+            if (!mk_dir(lv->dir) || lv->index->dump(lv->dir.c_str()) < 0)
+            {
+                P_WARNING("failed to dump at: %s", lv->dir.c_str());
+                return -1;
+            }
+            lv->doc_num = lv->index->doc_num();
+        }
+        /* 各层的倒排互不相关，每层一个线程归并 */
+        std::vector<level_t *> writers;
+        bool ok = true;
+        for (size_t i = 0; i < m_levels.size(); ++i)
+        {
+            level_t *lv = m_levels[i];
+            if (NULL == lv || !lv->index->has_invert())
+            {
+                continue;
+            }
+            lv->doc_num = 0;
+            lv->ok = false;
+            const int ret = ::pthread_create(&lv->tid, NULL, write_thread, lv);
+            if (ret != 0)
+            {
+                P_WARNING("failed to create write thread, ret=%d, write in current thread", ret);
+                write_thread(lv);
+                ok = lv->ok && ok;
+                continue;
+            }
+            writers.push_back(lv);
+        }
+        for (size_t i = 0; i < writers.size(); ++i)
+        {
+            ::pthread_join(writers[i]->tid, NULL);
+            ok = writers[i]->ok && ok;
+        }
+        if (!ok)
+        {
+            return -1;
+        }
+
+        if (m_index.m_inc_reader.dumpMeta(path.c_str(), m_index.index_meta_file().c_str()) < 0)
+        {
+            P_WARNING("failed to dump increment reader meta");
+            return -1;
+        }
+        FILE *fp = ::fopen((path + "/" + m_index.index_meta_file()).c_str(), "a+");
+        if (fp)
+        {
+            ::fprintf(fp, "\n");
+            for (size_t i = 0; i < m_levels.size(); ++i)
+            {
+                if (m_levels[i])
+                {
+                    ::fprintf(fp, "doc num of %s: %d\n",
+                            m_index.level_dirname(i).c_str(), int(m_levels[i]->doc_num));
+                }
+            }
+            ::fclose(fp);
+        }
+        if (m_index.switch_using() < 0)
+        {
+            P_WARNING("failed to switch using file");
+        }
+        P_WARNING("dump base index ok");
+        return 0;
+    }
+
+    int BaseBuilder::build()
+    {
+        FastTimer timer;
+        timer.start();
+        if (!this->read())
+        {
+            P_WARNING("failed to read base file");
+            return -1;
+        }
+        if (this->dump() < 0)
+        {
+            P_WARNING("failed to dump base index");
+            return -1;
+        }
+        timer.stop();
+        P_WARNING("build base index ok, cost %ld ms", timer.timeInMs());
+        return 0;
+    }
+
+    /* 成功返回NULL，失败返回非NULL，供tools/base_build判断 */
+    void *base_build_processor(void *args)
+    {
+        Index &idx = *(Index *)args;
+        if (!idx.is_base_mode())
+        {
+            P_FATAL("inc::base_build_processor must be used in base mode");
+            return args;
+        }
+        /* 分段倒排的dump只写segments.meta，builder写的倒排文件不会被加载 */
+        for (size_t i = 0; i < idx.level_num(); ++i)
+        {
+            const LevelIndex *lx = idx.get_level_index(i);
+            if (lx && lx->is_segmented())
+            {
+                P_FATAL("inc::base_build_processor does not support segment_path, level=%lu", (uint64_t)i);
+                return args;
+            }
+        }
+        BaseBuilder builder(idx);
+        if (builder.init(idx.base_build_threads(), uint64_t(idx.base_build_memory()) << 20,
+                    idx.base_build_tmp_path().c_str()) < 0)
+        {
+            P_FATAL("failed to init base builder");
+            return args;
+        }
+        if (builder.build() < 0)
+        {
+            P_FATAL("failed to build base index");
+            return args;
+        }
+        return NULL;
+    }
+}
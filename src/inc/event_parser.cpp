@@ -0,0 +1,556 @@
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include "log_utils.h"
+#include "inc/event_parser.h"
+
+namespace inc
+{
+    int EventParser::init(const LevelIndex *level)
+    {
+        if (NULL == level)
+        {
+            P_WARNING("level is NULL");
+            return -1;
+        }
+        this->reset();
+        m_level = level;
+        m_slots.clear();
+        for (size_t i = 0; i < level->field_slot_num(); ++i)
+        {
+            slot_t slot;
+            slot.name = level->get_field_slot_name(i);
+            slot.slot = i;
+            slot.type = level->get_field_slot_type(i);
+            m_slots.push_back(slot);
+        }
+        for (int type = 0; type < 256; ++type)
+        {
+            m_has_payload[type] = (type < 0xFF && level->get_payload_len(type) > 0);
+        }
+        return 0;
+    }
+
+    void EventParser::reset()
+    {
+        for (size_t i = 0; i < m_trees.size(); ++i)
+        {
+            cJSON_Delete(m_trees[i]);
+        }
+        m_trees.clear();
+        for (size_t i = 0; i < m_copies.size(); ++i)
+        {
+            delete [] m_copies[i];
+        }
+        m_copies.clear();
+    }
+
+    char *EventParser::copy(const char *json)
+    {
+        const size_t len = ::strlen(json);
+        char *buf = new (std::nothrow) char[len + 1];
+        if (NULL == buf)
+        {
+            P_WARNING("failed to alloc %lu bytes to copy json", (uint64_t)len + 1);
+            return NULL;
+        }
+        ::memcpy(buf, json, len + 1);
+        m_copies.push_back(buf);
+        return buf;
+    }
+
+    bool EventParser::parse_forward(const char *json, std::vector<forward_value_t> &values)
+    {
+        values.clear();
+        if (NULL == json)
+        {
+            P_WARNING("json is NULL");
+            return false;
+        }
+        char *buf = this->copy(json);
+        return buf && this->parse_forward_inplace(buf, values);
+    }
+
+    bool EventParser::parse_invert(const char *json, std::vector<invert_data_t> &values)
+    {
+        values.clear();
+        if (NULL == json)
+        {
+            P_WARNING("json is NULL");
+            return false;
+        }
+        char *buf = this->copy(json);
+        return buf && this->parse_invert_inplace(buf, values);
+    }
+
+    int EventParser::find_slot(const char *name, int len) const
+    {
+        for (size_t i = 0; i < m_slots.size(); ++i)
+        {
+            if ((int)m_slots[i].name.length() == len
+                    && ::memcmp(m_slots[i].name.c_str(), name, len) == 0)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    char *EventParser::skip_ws(char *p)
+    {
+        while (' ' == *p || '\t' == *p || '\r' == *p || '\n' == *p)
+        {
+            ++p;
+        }
+        return p;
+    }
+
+    static int hex4(const char *p)
+    {
+        int v = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            const char c = p[i];
+            v <<= 4;
+            if (c >= '0' && c <= '9') {
+                v |= c - '0';
+            } else if (c >= 'a' && c <= 'f') {
+                v |= c - 'a' + 10;
+            } else if (c >= 'A' && c <= 'F') {
+                v |= c - 'A' + 10;
+            } else {
+                return -1;
+            }
+        }
+        return v;
+    }
+
+    char *EventParser::parse_string(char *p, char **str, int *len)
+        /* p指向'"'，原地反转义，返回'"'之后的位置 */
+    {
+        char *r = p + 1;
+        char *w = r;
+        *str = w;
+        while (1)
+        {
+            const char c = *r;
+            if ('"' == c)
+            {
+                *w = '\0';
+                *len = w - *str;
+                return r + 1;
+            }
+            if ('\0' == c)
+            {
+                return NULL;
+            }
+            if ('\\' != c)
+            {
+                *w++ = c;
+                ++r;
+                continue;
+            }
+            switch (r[1])
+            {
+                case '"': case '\\': case '/':
+                    *w++ = r[1];
+                    break;
+                case 'b': *w++ = '\b'; break;
+                case 'f': *w++ = '\f'; break;
+                case 'n': *w++ = '\n'; break;
+                case 'r': *w++ = '\r'; break;
+                case 't': *w++ = '\t'; break;
+                case 'u':
+                    {
+                        int code = hex4(r + 2);
+                        if (code < 0)
+                        {
+                            return NULL;
+                        }
+                        if (code >= 0xD800 && code <= 0xDBFF && '\\' == r[6] && 'u' == r[7])
+                        {
+                            const int low = hex4(r + 8);
+                            if (low >= 0xDC00 && low <= 0xDFFF) /* surrogate pair */
+                            {
+                                code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+                                r += 6;
+                            }
+                        }
+                        if (code < 0x80) {
+                            *w++ = code;
+                        } else if (code < 0x800) {
+                            *w++ = 0xC0 | (code >> 6);
+                            *w++ = 0x80 | (code & 0x3F);
+                        } else if (code < 0x10000) {
+                            *w++ = 0xE0 | (code >> 12);
+                            *w++ = 0x80 | ((code >> 6) & 0x3F);
+                            *w++ = 0x80 | (code & 0x3F);
+                        } else {
+                            *w++ = 0xF0 | (code >> 18);
+                            *w++ = 0x80 | ((code >> 12) & 0x3F);
+                            *w++ = 0x80 | ((code >> 6) & 0x3F);
+                            *w++ = 0x80 | (code & 0x3F);
+                        }
+                        r += 4;
+                    }
+                    break;
+                default:
+                    return NULL;
+            }
+            r += 2;
+        }
+    }
+
+    char *EventParser::skip_number(char *p)
+        /* -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?，不合法时返回NULL */
+    {
+        if ('-' == *p)
+        {
+            ++p;
+        }
+        if ('0' == *p)
+        {
+            ++p;
+        }
+        else if (*p >= '1' && *p <= '9')
+        {
+            while (*p >= '0' && *p <= '9') { ++p; }
+        }
+        else
+        {
+            return NULL;
+        }
+        if ('.' == *p)
+        {
+            ++p;
+            if (*p < '0' || *p > '9')
+            {
+                return NULL;
+            }
+            while (*p >= '0' && *p <= '9') { ++p; }
+        }
+        if ('e' == *p || 'E' == *p)
+        {
+            ++p;
+            if ('+' == *p || '-' == *p)
+            {
+                ++p;
+            }
+            if (*p < '0' || *p > '9')
+            {
+                return NULL;
+            }
+            while (*p >= '0' && *p <= '9') { ++p; }
+        }
+        return p;
+    }
+
+    char *EventParser::skip_value(char *p)
+        /* 跳过一个值，不修改buffer */
+    {
+        if ('"' == *p)
+        {
+            for (++p; *p && '"' != *p; ++p)
+            {
+                if ('\\' == *p && '\0' == *++p)
+                {
+                    return NULL;
+                }
+            }
+            return *p ? p + 1 : NULL;
+        }
+        if ('{' == *p || '[' == *p)
+        {
+            int depth = 0;
+            for (; *p; ++p)
+            {
+                if ('"' == *p)
+                {
+                    p = skip_value(p);
+                    if (NULL == p)
+                    {
+                        return NULL;
+                    }
+                    --p;
+                }
+                else if ('{' == *p || '[' == *p)
+                {
+                    ++depth;
+                }
+                else if ('}' == *p || ']' == *p)
+                {
+                    if (--depth == 0)
+                    {
+                        return p + 1;
+                    }
+                }
+            }
+            return NULL;
+        }
+        char *begin = p;
+        while (*p && NULL == ::strchr(",}] \t\r\n", *p))
+        {
+            ++p;
+        }
+        return p == begin ? NULL : p;
+    }
+
+    cJSON *EventParser::parse_subtree(char *begin, char *end)
+    {
+        const char saved = *end;
+        *end = '\0';
+        cJSON *tree = cJSON_Parse(begin);
+        *end = saved;
+        if (tree)
+        {
+            m_trees.push_back(tree);
+        }
+        return tree;
+    }
+
+    bool EventParser::parse_forward_inplace(char *json, std::vector<forward_value_t> &values)
+    {
+        values.clear();
+        if (NULL == json)
+        {
+            P_WARNING("json is NULL");
+            return false;
+        }
+        char *p = skip_ws(json);
+        if ('{' != *p)
+        {
+            P_WARNING("invalid forward json<%s>, must be an Object", json);
+            return false;
+        }
+        p = skip_ws(p + 1);
+        if ('}' == *p)
+        {
+            return true;
+        }
+        while (1)
+        {
+            char *name = NULL;
+            int len = 0;
+            if ('"' != *p || NULL == (p = parse_string(p, &name, &len)))
+            {
+                P_WARNING("invalid forward json, bad key at offset[%d]", int(p ? p - json : -1));
+                goto FAIL;
+            }
+            if (0 == len)
+            {
+                P_WARNING("invalid key");
+                goto FAIL;
+            }
+            p = skip_ws(p);
+            if (':' != *p)
+            {
+                P_WARNING("invalid forward json, expect ':' after key<%s>", name);
+                goto FAIL;
+            }
+            p = skip_ws(p + 1);
+            if ('[' == *p)
+            {
+                P_WARNING("invalid forward json, value of <%s> cannot be an Array", name);
+                goto FAIL;
+            }
+            const int i = this->find_slot(name, len);
+            if (i < 0) /* 本层没有这个字段 */
+            {
+                p = skip_value(p);
+            }
+            else
+            {
+                forward_value_t value;
+                value.slot = m_slots[i].slot;
+                value.number = 0;
+                value.str = NULL;
+                value.len = 0;
+                value.json = NULL;
+                if ('"' == *p)
+                {
+                    char *str = NULL;
+                    value.kind = forward_value_t::STRING;
+                    p = parse_string(p, &str, &value.len);
+                    value.str = str;
+                }
+                else if ('{' == *p)
+                {
+                    char *end = skip_value(p);
+                    value.kind = forward_value_t::OBJECT;
+                    if (end && ForwardIndex::PROTO_TYPE == m_slots[i].type
+                            && NULL == (value.json = this->parse_subtree(p, end)))
+                    {
+                        P_WARNING("failed to parse object of field<%s>", name);
+                        goto FAIL;
+                    }
+                    p = end;
+                }
+                else if ('t' == *p || 'f' == *p || 'n' == *p)
+                {
+                    value.kind = forward_value_t::OTHER;
+                    char *end = skip_value(p);
+                    const int n = end ? end - p : 0;
+                    if (!(4 == n && (::strncmp(p, "true", 4) == 0 || ::strncmp(p, "null", 4) == 0))
+                            && !(5 == n && ::strncmp(p, "false", 5) == 0))
+                    {
+                        end = NULL;
+                    }
+                    p = end;
+                }
+                else
+                {
+                    char *end = skip_number(p);
+                    char *parsed = NULL;
+                    value.kind = forward_value_t::NUMBER;
+                    if (end)
+                    {
+                        value.number = ::strtod(p, &parsed);
+                    }
+                    p = (end && parsed == end) ? end : NULL;
+                }
+                if (p)
+                {
+                    values.push_back(value);
+                }
+            }
+            if (NULL == p)
+            {
+                P_WARNING("invalid forward json, bad value of <%s>", name);
+                goto FAIL;
+            }
+            p = skip_ws(p);
+            if (',' == *p)
+            {
+                p = skip_ws(p + 1);
+                continue;
+            }
+            if ('}' == *p)
+            {
+                return true;
+            }
+            P_WARNING("invalid forward json, expect ',' or '}' at offset[%d]", int(p - json));
+            goto FAIL;
+        }
+FAIL:
+        values.clear();
+        return false;
+    }
+
+    bool EventParser::parse_invert_inplace(char *json, std::vector<invert_data_t> &values)
+    {
+        values.clear();
+        if (NULL == json)
+        {
+            P_WARNING("json is NULL");
+            return false;
+        }
+        char *p = skip_ws(json);
+        if ('{' != *p)
+        {
+            P_WARNING("invalid invert json<%s>, must be an Object", json);
+            return false;
+        }
+        p = skip_ws(p + 1);
+        if ('}' == *p)
+        {
+            return true;
+        }
+        while (1)
+        {
+            char *key = NULL;
+            int len = 0;
+            if ('"' != *p || NULL == (p = parse_string(p, &key, &len)))
+            {
+                P_WARNING("invalid invert json, bad type at offset[%d]", int(p ? p - json : -1));
+                goto FAIL;
+            }
+            int type = 0;
+            for (int i = 0; i < len && type < 0xFF; ++i)
+            {
+                type = (key[i] >= '0' && key[i] <= '9') ? type * 10 + key[i] - '0' : 0xFF;
+            }
+            if (0 == len || type >= 0xFF)
+            {
+                P_WARNING("invalid invert json, invert type<%s> must be an uint8_t[0, 0xFF)", key);
+                goto FAIL;
+            }
+            p = skip_ws(p);
+            if (':' != *p)
+            {
+                P_WARNING("invalid invert json, expect ':' after type<%d>", type);
+                goto FAIL;
+            }
+            p = skip_ws(p + 1);
+            if ('{' != *p && '[' != *p)
+            {
+                P_WARNING("invalid invert json, inverts[%d] must be an Object or Array", type);
+                goto FAIL;
+            }
+            const bool is_object = ('{' == *p);
+            const char close = is_object ? '}' : ']';
+            p = skip_ws(p + 1);
+            while (close != *p)
+            {
+                invert_data_t data;
+                char *word = NULL;
+                int word_len = 0;
+                if ('"' != *p || NULL == (p = parse_string(p, &word, &word_len)) || 0 == word_len)
+                {
+                    P_WARNING("invalid key");
+                    goto FAIL;
+                }
+                data.type = type;
+                data.key = word;
+                data.value = NULL;
+                if (is_object)
+                {
+                    p = skip_ws(p);
+                    if (':' != *p)
+                    {
+                        P_WARNING("invalid invert json, expect ':' after word<%s>", word);
+                        goto FAIL;
+                    }
+                    p = skip_ws(p + 1);
+                    char *end = skip_value(p);
+                    if (NULL == end)
+                    {
+                        P_WARNING("invalid invert json, bad value of word<%s>", word);
+                        goto FAIL;
+                    }
+                    if (m_has_payload[type] && NULL == (data.value = this->parse_subtree(p, end)))
+                    {
+                        P_WARNING("failed to parse payload of word<%s>, type[%d]", word, type);
+                        goto FAIL;
+                    }
+                    p = end;
+                }
+                values.push_back(data);
+                p = skip_ws(p);
+                if (',' == *p)
+                {
+                    p = skip_ws(p + 1);
+                }
+                else if (close != *p)
+                {
+                    P_WARNING("invalid invert json, expect ',' or '%c' at offset[%d]", close, int(p - json));
+                    goto FAIL;
+                }
+            }
+            p = skip_ws(p + 1);
+            if (',' == *p)
+            {
+                p = skip_ws(p + 1);
+                continue;
+            }
+            if ('}' == *p)
+            {
+                return true;
+            }
+            P_WARNING("invalid invert json, expect ',' or '}' at offset[%d]", int(p - json));
+            goto FAIL;
+        }
+FAIL:
+        values.clear();
+        return false;
+    }
+}
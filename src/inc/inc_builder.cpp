@@ -5,6 +5,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <new>
 #include <string>
 #include <vector>
 #include "str_utils.h"
@@ -13,10 +14,11 @@
 #include "cJSON.h"
 #include "log_utils.h"
 #include "index/index.h"
+#include "inc/event_parser.h"
+#include "inc/inc_record.h"
 
 namespace inc
 {
-    enum { OP_INSERT = 0, OP_DELETE = 1, OP_UPDATE = 2 };
     void *das_processor(void *args)
     {
         Index &idx = *(Index *)args; 
@@ -32,9 +34,12 @@ namespace inc
         uint32_t update_invert_count = 0;
         uint32_t delete_count = 0;
 
-        std::vector<std::string> columns;
-        std::vector<forward_data_t> fields;
+        IncReader::column_t columns[IncReader::MAX_COLUMNS];
+        std::vector<forward_value_t> values;
         std::vector<invert_data_t> inverts;
+        std::vector<EventParser *> parsers(idx.level_num(), NULL); /* 每层一个，字段slot按层预先解析 */
+        record_head_t head;
+        std::vector<invert_sign_t> signs;
         while (1)
         {
             if (now != g_now_time)
@@ -45,6 +50,7 @@ namespace inc
 
                 idx.recycle();
                 idx.try2merge();
+                idx.try2compact();
                 idx.try2dump();
                 idx.try_exc_cmd();
                 idx.try_print_meta();
@@ -76,26 +82,39 @@ namespace inc
                     P_WARNING("meeting end of base file");
                     idx.dump();
 
+                    for (size_t i = 0; i < parsers.size(); ++i) { delete parsers[i]; }
                     delete [] log_buffer;
                     return NULL;
                 }
                 ::usleep(1000); /* sleep 1 ms */
             } else if (1 == ret) {
-                reader.split(columns, "\t");
-                if (columns.size() < 3)
-                {
-                    P_MYLOG("must has {[eventid] level, optype, oid}");
-                    continue;
-                }
+                size_t column_num = 0;
                 uint32_t level = 0;
                 uint32_t optype = 0;
                 uint64_t oid = 0;
-                if (!parseUInt32(columns[0], level)
-                        || !parseUInt32(columns[1], optype)
-                        || !parseUInt64(columns[2], oid))
-                {
-                    P_MYLOG("invalid level, optype, oid");
-                    continue;
+                if (reader.is_binary()) { /* 二进制record，字段和倒排已经预先解析好 */
+                    if (!decode_record(reader.line(), reader.line_len(), head, values, signs))
+                    {
+                        P_MYLOG("invalid binary record");
+                        continue;
+                    }
+                    level = head.level;
+                    optype = head.optype;
+                    oid = head.oid;
+                } else {
+                    column_num = reader.split(columns, IncReader::MAX_COLUMNS, '\t');
+                    if (column_num < 3)
+                    {
+                        P_MYLOG("must has {[eventid] level, optype, oid}");
+                        continue;
+                    }
+                    if (!IncReader::parse_uint32(columns[0], level)
+                            || !IncReader::parse_uint32(columns[1], optype)
+                            || !IncReader::parse_uint64(columns[2], oid))
+                    {
+                        P_MYLOG("invalid level, optype, oid");
+                        continue;
+                    }
                 }
                 LevelIndex *lx = idx.get_level_index(level);
                 if (NULL == lx)
@@ -103,38 +122,48 @@ namespace inc
                     P_MYLOG("invalid level=%u, LevelIndex is NULL", level);
                     continue;
                 }
-                fields.clear();
-                inverts.clear();
                 switch (optype)
                 {
                     case OP_INSERT:
                     case OP_UPDATE:
-                        if (columns.size() <= 4) {
-                            cJSON *fjson = NULL;
-                            if (NULL == (fjson = parse_forward_json(columns[3], fields))) {
-                                P_MYLOG("failed to parse forward json");
+                        if (reader.is_binary()) {
+                            if (head.flags & RECORD_FLAG_INVERT) {
+                                lx->update(oid, values, signs);
+                                ++update_invert_count;
                             } else {
-                                lx->forward_update(oid, fields);
-                                P_TRACE("%s forward ok, level=%u, oid=%lu",
-                                        OP_UPDATE == optype ? "update": "insert", level, oid);
+                                lx->forward_update(oid, values);
                                 ++update_forward_count;
                             }
-                            cJSON_Delete(fjson);
-                        } else if (columns.size() <= 5) {
-                            cJSON *fjson = NULL;
-                            cJSON *ijson = NULL;
-                            if (NULL == (fjson = parse_forward_json(columns[3], fields))) {
-                                P_MYLOG("failed to parse forward json");
-                            } else if (NULL == (ijson = parse_invert_json(columns[4], inverts))) {
-                                P_MYLOG("failed to parse invert json");
-                            } else {
-                                lx->update(oid, fields, inverts);
-                                P_TRACE("%s ok, level=%u, oid=%lu",
-                                        OP_UPDATE == optype ? "update": "insert", level, oid);
-                                ++update_invert_count;
+                            P_TRACE("%s ok, level=%u, oid=%lu",
+                                    OP_UPDATE == optype ? "update": "insert", level, oid);
+                            break;
+                        }
+                        if (NULL == parsers[level]) {
+                            parsers[level] = new (std::nothrow) EventParser();
+                            if (NULL == parsers[level] || parsers[level]->init(lx) < 0) {
+                                P_FATAL("failed to init event parser, level=%u", level);
+                                delete parsers[level];
+                                parsers[level] = NULL;
+                                break;
                             }
-                            cJSON_Delete(fjson);
-                            cJSON_Delete(ijson);
+                        }
+                        parsers[level]->reset();
+                        if (column_num < 4) {
+                            P_MYLOG("must has forward json");
+                        } else if (!parsers[level]->parse_forward(columns[3].ptr, values)) {
+                            P_MYLOG("failed to parse forward json");
+                        } else if (column_num <= 4) {
+                            lx->forward_update(oid, values);
+                            P_TRACE("%s forward ok, level=%u, oid=%lu",
+                                    OP_UPDATE == optype ? "update": "insert", level, oid);
+                            ++update_forward_count;
+                        } else if (!parsers[level]->parse_invert(columns[4].ptr, inverts)) {
+                            P_MYLOG("failed to parse invert json");
+                        } else {
+                            lx->update(oid, values, inverts);
+                            P_TRACE("%s ok, level=%u, oid=%lu",
+                                    OP_UPDATE == optype ? "update": "insert", level, oid);
+                            ++update_invert_count;
                         }
                         break;
                     case OP_DELETE:
@@ -151,6 +180,7 @@ namespace inc
                 break;
             }
         }
+        for (size_t i = 0; i < parsers.size(); ++i) { delete parsers[i]; }
         delete [] log_buffer;
         return NULL;
     }
@@ -0,0 +1,987 @@
+#ifndef __STDC_LIMIT_MACROS
+#define __STDC_LIMIT_MACROS
+#endif
+
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <new>
+#include "str_utils.h"
+#include "meminfo.h"
+#include "log_utils.h"
+#include "inc/inc_pipeline.h"
+#include "inc/inc_record.h"
+
+#define P_OPLOG(op, _fmt_, args...) \
+    P_WARNING("file_no[%u] line_no[%u] eventid[%lu]: " _fmt_, (op).file_no, (op).line_no, (op).eventid, ##args)
+
+namespace inc
+{
+    IncPipeline::IncPipeline(Index &index)
+        : m_index(index)
+    {
+        m_ops = NULL;
+        m_mask = 0;
+        m_max_bytes = 0;
+        m_read_seq = m_parse_seq = m_apply_seq = 0;
+        m_inflight_bytes = 0;
+        m_reader_status = READER_RUNNING;
+        m_stop = false;
+        m_reader_started = false;
+        m_parser_started = 0;
+        m_writer_started = 0;
+        m_pause = false;
+        m_barrier_seq = UINT64_MAX;
+        m_coalesce_window = 0;
+        m_coalesce_ms = 0;
+        m_window.seq = UINT64_MAX;
+        ::memset(&m_stat, 0, sizeof m_stat);
+        ::memset(&m_last_stat, 0, sizeof m_last_stat);
+    }
+
+    IncPipeline::~IncPipeline()
+    {
+        this->stop();
+        if (m_ops)
+        {
+            for (uint64_t i = 0; i <= m_mask; ++i)
+            {
+                this->release(m_ops[i]);
+                delete [] m_ops[i].buf;
+            }
+            delete [] m_ops;
+            m_ops = NULL;
+        }
+    }
+
+    int IncPipeline::init(uint32_t parse_threads, uint32_t queue_size, uint64_t max_bytes, bool level_writers)
+    {
+        if (0 == parse_threads || 0 == queue_size)
+        {
+            P_WARNING("invalid parse_threads[%u] or queue_size[%u]", parse_threads, queue_size);
+            return -1;
+        }
+        uint64_t size = 1;
+        while (size < queue_size)
+        {
+            size <<= 1;
+        }
+        m_ops = new (std::nothrow) op_t[size];
+        if (NULL == m_ops)
+        {
+            P_WARNING("failed to alloc %lu ops", size);
+            return -1;
+        }
+        m_mask = size - 1;
+        m_max_bytes = max_bytes;
+        m_parser_tids.resize(parse_threads);
+        if (level_writers)
+        {
+            for (size_t level = 0; level < m_index.level_num(); ++level)
+            {
+                if (m_index.get_level_index(level))
+                {
+                    writer_t writer;
+                    writer.pipeline = this;
+                    writer.level = level;
+                    writer.seq = 0;
+                    writer.paused = false;
+                    writer.apply_count = 0;
+                    writer.last_count = 0;
+                    writer.window.seq = UINT64_MAX;
+                    m_writers.push_back(writer);
+                }
+            }
+        }
+        P_WARNING("init inc pipeline ok, parse_threads[%u], queue_size[%lu], max_bytes[%lu], writers[%lu]",
+                parse_threads, size, max_bytes, (uint64_t)m_writers.size());
+        return 0;
+    }
+
+    void IncPipeline::set_coalesce(uint32_t window, uint32_t max_ms)
+    {
+        if (m_ops && window > m_mask) /* 窗口不能超过队列，否则永远凑不满 */
+        {
+            P_WARNING("coalesce window[%u] is larger than queue, use %lu", window, m_mask);
+            window = m_mask;
+        }
+        m_coalesce_window = window;
+        m_coalesce_ms = max_ms;
+        P_WARNING("coalesce window[%u], max_ms[%u]", m_coalesce_window, m_coalesce_ms);
+    }
+
+    void *IncPipeline::reader_thread(void *args)
+    {
+        ((IncPipeline *)args)->read_loop();
+        return NULL;
+    }
+
+    void *IncPipeline::parser_thread(void *args)
+    {
+        ((IncPipeline *)args)->parse_loop();
+        return NULL;
+    }
+
+    bool IncPipeline::memory_panic(long &check_count)
+    {
+        Meminfo mi;
+        if (mi.free() + mi.buffers() + mi.cached() <= long(mi.total() * 0.1))
+        {
+            P_WARNING("memory panic, free: %ld KB, buffers: %ld KB, cached: %ld KB, total: %ld KB",
+                    mi.free(), mi.buffers(), mi.cached(), mi.total());
+            if (check_count++ % 360 == 0) { /* log fatal every 3 minutes */
+                P_FATAL("inc reader is suspending now");
+            }
+            return true;
+        }
+        check_count = 0;
+        return false;
+    }
+
+    void IncPipeline::read_loop()
+    {
+        IncReader &reader = m_index.m_inc_reader;
+        uint32_t now = g_now_time;
+        long check_count = 0;
+        while (!m_stop)
+        {
+            if (now != g_now_time)
+            {
+                now = g_now_time;
+                /* 只暂停读入，已经在队列中的事件照常应用，应用线程照常回收内存 */
+                while (!m_stop && this->memory_panic(check_count))
+                {
+                    ::usleep(500*1000); /* sleep 500ms */
+                }
+            }
+            const uint64_t seq = m_read_seq;
+            if (seq - m_apply_seq > m_mask
+                    || (m_inflight_bytes > m_max_bytes && seq != m_apply_seq))
+            {
+                __sync_fetch_and_add(&m_stat.read_wait, 1);
+                ::usleep(100);
+                continue;
+            }
+            const int ret = reader.next();
+            if (0 == ret)
+            {
+                if (reader.is_base_mode())
+                {
+                    P_WARNING("meeting end of base file");
+                    m_reader_status = READER_EOF;
+                    return ;
+                }
+                ::usleep(1000); /* sleep 1 ms */
+                continue;
+            }
+            else if (ret < 0)
+            {
+                P_FATAL("disk file error");
+                m_reader_status = READER_ERROR;
+                return ;
+            }
+            __sync_synchronize();
+            op_t &op = m_ops[seq & m_mask];
+            const uint32_t len = reader.line_len();
+            if (op.capacity < len + 1)
+            {
+                delete [] op.buf;
+                op.capacity = 0;
+                while (NULL == (op.buf = new (std::nothrow) char[len + 1]))
+                {
+                    P_FATAL("failed to alloc %u bytes for line", len + 1);
+                    ::usleep(500*1000);
+                }
+                op.capacity = len + 1;
+            }
+            ::memcpy(op.buf, reader.line(), len);
+            op.buf[len] = '\0';
+            op.len = len;
+            op.file_no = reader.get_file_no();
+            op.line_no = reader.get_line_no();
+            op.eventid = reader.get_eventid();
+            op.binary = reader.is_binary();
+            op.state = OP_READ;
+            __sync_fetch_and_add(&m_inflight_bytes, len);
+            __sync_synchronize();
+            m_read_seq = seq + 1;
+
+            __sync_fetch_and_add(&m_stat.read_count, 1);
+            __sync_fetch_and_add(&m_stat.read_bytes, len);
+        }
+    }
+
+    void IncPipeline::parse_loop()
+    {
+        std::vector<EventParser *> parsers(m_index.level_num(), NULL); /* 每个线程每层一个 */
+        std::vector<invert_data_t> inverts;
+        while (!m_stop)
+        {
+            const uint64_t seq = m_parse_seq;
+            if (seq >= m_read_seq)
+            {
+                ::usleep(100);
+                continue;
+            }
+            if (!__sync_bool_compare_and_swap(&m_parse_seq, seq, seq + 1))
+            {
+                continue;
+            }
+            __sync_synchronize();
+            op_t &op = m_ops[seq & m_mask];
+            op.valid = op.binary ? this->parse_binary(op) : this->parse_text(op, parsers, inverts);
+            if (!op.valid)
+            {
+                __sync_fetch_and_add(&m_stat.parse_fail, 1);
+            }
+            __sync_fetch_and_add(&m_stat.parse_count, 1);
+            __sync_synchronize();
+            op.state = OP_PARSED;
+        }
+        for (size_t i = 0; i < parsers.size(); ++i)
+        {
+            delete parsers[i];
+        }
+    }
+
+    bool IncPipeline::parse_binary(op_t &op)
+    {
+        record_head_t head;
+        if (!decode_record(op.buf, op.len, head, op.values, op.signs))
+        {
+            P_OPLOG(op, "invalid binary record");
+            return false;
+        }
+        op.level = head.level;
+        op.optype = head.optype;
+        op.oid = head.oid;
+        op.has_invert = (head.flags & RECORD_FLAG_INVERT) != 0;
+        if (NULL == m_index.get_level_index(op.level))
+        {
+            P_OPLOG(op, "invalid level=%u, LevelIndex is NULL", op.level);
+            return false;
+        }
+        return true;
+    }
+
+    bool IncPipeline::parse_text(op_t &op, std::vector<EventParser *> &parsers,
+            std::vector<invert_data_t> &inverts)
+    {
+        IncReader::column_t columns[IncReader::MAX_COLUMNS];
+        const size_t column_num = IncReader::split(op.buf, op.len, m_index.is_base_mode(),
+                columns, IncReader::MAX_COLUMNS, '\t');
+        if (column_num < 3)
+        {
+            P_OPLOG(op, "must has {[eventid] level, optype, oid}");
+            return false;
+        }
+        if (!IncReader::parse_uint32(columns[0], op.level)
+                || !IncReader::parse_uint32(columns[1], op.optype)
+                || !IncReader::parse_uint64(columns[2], op.oid))
+        {
+            P_OPLOG(op, "invalid level, optype, oid");
+            return false;
+        }
+        const LevelIndex *lx = m_index.get_level_index(op.level);
+        if (NULL == lx)
+        {
+            P_OPLOG(op, "invalid level=%u, LevelIndex is NULL", op.level);
+            return false;
+        }
+        if (OP_INSERT != op.optype && OP_UPDATE != op.optype)
+        {
+            return true;
+        }
+        if (NULL == parsers[op.level])
+        {
+            parsers[op.level] = new (std::nothrow) EventParser();
+            if (NULL == parsers[op.level] || parsers[op.level]->init(lx) < 0)
+            {
+                P_FATAL("failed to init event parser, level=%u", op.level);
+                delete parsers[op.level];
+                parsers[op.level] = NULL;
+                return false;
+            }
+        }
+        EventParser &parser = *parsers[op.level];
+        bool ok = false;
+        if (column_num < 4) {
+            P_OPLOG(op, "must has forward json");
+        } else if (!parser.parse_forward_inplace(columns[3].ptr, op.values)) {
+            P_OPLOG(op, "failed to parse forward json");
+        } else if (column_num <= 4) {
+            ok = true;
+        } else if (!parser.parse_invert_inplace(columns[4].ptr, inverts)) {
+            P_OPLOG(op, "failed to parse invert json");
+        } else {
+            /* 签名在这里算好，payload的解析器不是线程安全的，留到应用时 */
+            for (size_t i = 0; i < inverts.size(); ++i)
+            {
+                const invert_data_t &data = inverts[i];
+                invert_sign_t sign;
+                char buffer[256];
+                uint32_t len = sizeof buffer;
+                if (!lx->create_sign(data.key, data.type, buffer, len, sign.sign))
+                {
+                    P_OPLOG(op, "failed to sign word[%s], type[%d]", data.key, data.type);
+                    continue;
+                }
+                op.words.append(buffer, len);
+                op.words.push_back('\0');
+                sign.type = data.type;
+                sign.word = NULL;
+                sign.word_len = len;
+                sign.payload_len = lx->get_payload_len(data.type);
+                sign.payload = NULL;
+                op.signs.push_back(sign);
+                op.payloads.push_back(data.value);
+            }
+            size_t offset = 0;
+            for (size_t i = 0; i < op.signs.size(); ++i)
+            {
+                op.signs[i].word = op.words.data() + offset;
+                offset += op.signs[i].word_len + 1;
+            }
+            op.has_invert = true;
+            ok = true;
+        }
+        parser.detach(op.trees);
+        return ok;
+    }
+
+    bool IncPipeline::mergeable(const op_t &op) const
+    {
+        if (!op.valid || op.absorbed)
+        {
+            return false;
+        }
+        if (OP_DELETE == op.optype)
+        {
+            return true;
+        }
+        if (OP_INSERT != op.optype && OP_UPDATE != op.optype)
+        {
+            return false;
+        }
+        /* 明显不合法的binary/pb值不参与合并，解码失败的在apply时退回逐个应用 */
+        const LevelIndex *lx = m_index.get_level_index(op.level);
+        for (size_t i = 0; i < op.values.size(); ++i)
+        {
+            const forward_value_t &value = op.values[i];
+            if (value.slot < 0 || value.slot >= (int)lx->field_slot_num())
+            {
+                continue;
+            }
+            const int type = lx->get_field_slot_type(value.slot);
+            if (ForwardIndex::BINARY_TYPE == type)
+            {
+                if ((forward_value_t::STRING != value.kind && forward_value_t::RAW != value.kind) || NULL == value.str)
+                {
+                    return false;
+                }
+            }
+            else if (ForwardIndex::PROTO_TYPE == type)
+            {
+                if (forward_value_t::NUMBER == value.kind || forward_value_t::OTHER == value.kind)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    void IncPipeline::merge(op_t &head, const op_t &op) const
+    {
+        if (OP_DELETE == op.optype)
+        {
+            head.optype = OP_DELETE;
+            head.remove_first = false;
+            head.has_invert = false;
+            head.values.clear();
+            head.signs.clear();
+            head.payloads.clear();
+            return ;
+        }
+        if (OP_DELETE == head.optype)
+        {
+            head.remove_first = true;
+            head.values.clear();
+        }
+        head.optype = op.optype;
+        /* 后面的字段覆盖前面的，数值字段上的非数值会被忽略，不覆盖 */
+        const LevelIndex *lx = m_index.get_level_index(op.level);
+        for (size_t i = 0; i < op.values.size(); ++i)
+        {
+            const forward_value_t &value = op.values[i];
+            if (value.slot < 0 || value.slot >= (int)lx->field_slot_num())
+            {
+                continue;
+            }
+            const int type = lx->get_field_slot_type(value.slot);
+            if ((ForwardIndex::INT_TYPE == type || ForwardIndex::FLOAT_TYPE == type)
+                    && forward_value_t::NUMBER != value.kind)
+            {
+                continue;
+            }
+            size_t j = 0;
+            while (j < head.values.size() && head.values[j].slot != value.slot)
+            {
+                ++j;
+            }
+            if (j < head.values.size())
+            {
+                head.values[j] = value;
+            }
+            else
+            {
+                head.values.push_back(value);
+            }
+        }
+        /* 倒排是整体替换，最后一次带倒排的操作生效 */
+        if (op.has_invert)
+        {
+            head.has_invert = true;
+            head.signs = op.signs;
+            head.payloads = op.payloads;
+        }
+    }
+
+    bool IncPipeline::window_ready(uint64_t seq, window_t &window)
+    {
+        /* 窗口不越过barrier；队列满了reader读不进来，也不再等 */
+        uint64_t end = seq + 1 + m_coalesce_window;
+        if (end > m_barrier_seq)
+        {
+            end = m_barrier_seq;
+        }
+        const uint64_t read_seq = m_read_seq;
+        if (READER_RUNNING != m_reader_status || read_seq >= end
+                || read_seq - m_apply_seq > m_mask || m_inflight_bytes > m_max_bytes)
+        {
+            return true;
+        }
+        if (window.seq != seq)
+        {
+            window.seq = seq;
+            window.timer.start();
+            return false;
+        }
+        window.timer.stop();
+        return window.timer.timeInMs() >= m_coalesce_ms;
+    }
+
+    void IncPipeline::coalesce(uint64_t seq, op_t &head)
+    {
+        uint64_t end = seq + 1 + m_coalesce_window;
+        if (end > m_barrier_seq)
+        {
+            end = m_barrier_seq;   /* barrier之后的操作不能提前应用到dump里 */
+        }
+        for (uint64_t i = seq + 1; i < end && i < m_read_seq; ++i)
+        {
+            op_t &op = m_ops[i & m_mask];
+            if (OP_PARSED != op.state)
+            {
+                break;
+            }
+            __sync_synchronize();
+            if (!op.valid || op.absorbed || op.level != head.level || op.oid != head.oid)
+            {
+                continue;
+            }
+            if (!this->mergeable(op))
+            {
+                break;
+            }
+            if (head.merged.empty())
+            {
+                head.origin_optype = head.optype;
+                head.origin_invert = head.has_invert;
+                head.origin_values = head.values;
+                head.origin_signs = head.signs;
+                head.origin_payloads = head.payloads;
+            }
+            this->merge(head, op);
+            head.merged.push_back(i);
+            op.absorbed = true;
+            __sync_fetch_and_add(&m_stat.coalesced, 1);
+        }
+    }
+
+    bool IncPipeline::prepare(uint64_t seq, op_t &op, window_t &window)
+    {
+        if (0 == m_coalesce_window || !this->mergeable(op))
+        {
+            return true;
+        }
+        if (!this->window_ready(seq, window))
+        {
+            return false;
+        }
+        this->coalesce(seq, op);
+        return true;
+    }
+
+    void IncPipeline::apply(op_t &op)
+    {
+        if (!op.valid || op.absorbed)
+        {
+            return ;
+        }
+        if (this->apply_one(op) || op.merged.empty())
+        {
+            return ;
+        }
+        /* 合并后整体失败(比如后面某个操作的binary/pb字段不合法)，恢复原来的内容逐个应用，前面合法的修改不丢 */
+        P_OPLOG(op, "failed to apply %lu coalesced ops, apply them one by one", (uint64_t)op.merged.size() + 1);
+        op.optype = op.origin_optype;
+        op.has_invert = op.origin_invert;
+        op.remove_first = false;
+        op.values.swap(op.origin_values);
+        op.signs.swap(op.origin_signs);
+        op.payloads.swap(op.origin_payloads);
+        this->apply_one(op);
+        for (size_t i = 0; i < op.merged.size(); ++i)
+        {
+            this->apply_one(m_ops[op.merged[i] & m_mask]);
+        }
+    }
+
+    bool IncPipeline::apply_one(op_t &op)
+    {
+        bool ok = true;
+        LevelIndex *lx = m_index.get_level_index(op.level);
+        switch (op.optype)
+        {
+            case OP_INSERT:
+            case OP_UPDATE:
+                if (op.remove_first) {
+                    lx->remove(op.oid);
+                }
+                if (!op.has_invert) {
+                    ok = lx->forward_update(op.oid, op.values);
+                    __sync_fetch_and_add(&m_stat.forward_count, 1);
+                } else {
+                    if (!op.payloads.empty()) {
+                        size_t total = 0;
+                        for (size_t i = 0; i < op.signs.size(); ++i)
+                        {
+                            total += op.signs[i].payload_len;
+                        }
+                        op.payload_buf.resize(total);
+                        size_t offset = 0;
+                        for (size_t i = 0; i < op.signs.size(); ++i)
+                        {
+                            invert_sign_t &sign = op.signs[i];
+                            if (0 == sign.payload_len)
+                            {
+                                continue;
+                            }
+                            const void *payload = lx->parse_payload(sign.type, op.payloads[i]);
+                            if (NULL == payload)
+                            {
+                                P_OPLOG(op, "failed to parse payload of word[%s], type[%d]", sign.word, sign.type);
+                                continue;
+                            }
+                            ::memcpy(&op.payload_buf[offset], payload, sign.payload_len);
+                            sign.payload = &op.payload_buf[offset];
+                            offset += sign.payload_len;
+                        }
+                    }
+                    ok = lx->update(op.oid, op.values, op.signs);
+                    __sync_fetch_and_add(&m_stat.invert_count, 1);
+                }
+                P_TRACE("%s ok, level=%u, oid=%lu",
+                        OP_UPDATE == op.optype ? "update": "insert", op.level, op.oid);
+                break;
+            case OP_DELETE:
+                lx->remove(op.oid);
+                P_TRACE("delete ok, level=%u, oid=%lu", op.level, op.oid);
+                __sync_fetch_and_add(&m_stat.delete_count, 1);
+                break;
+            case RECORD_OP_INVALID: /* 转换失败的行，转换时已经报过 */
+                break;
+            default:
+                P_OPLOG(op, "invalid optype=%u", op.optype);
+                break;
+        };
+        return ok;
+    }
+
+    void IncPipeline::release(op_t &op)
+    {
+        for (size_t i = 0; i < op.trees.size(); ++i)
+        {
+            cJSON_Delete(op.trees[i]);
+        }
+        op.trees.clear();
+        op.values.clear();
+        op.signs.clear();
+        op.payloads.clear();
+        op.words.clear();
+        op.payload_buf.clear();
+        op.merged.clear();
+        op.origin_values.clear();
+        op.origin_signs.clear();
+        op.origin_payloads.clear();
+        if (op.len > 0)
+        {
+            __sync_fetch_and_sub(&m_inflight_bytes, op.len);
+            op.len = 0;
+        }
+        if (op.capacity > MAX_KEPT_BUFFER)
+        {
+            delete [] op.buf;
+            op.buf = NULL;
+            op.capacity = 0;
+        }
+        op.valid = false;
+        op.has_invert = false;
+        op.absorbed = false;
+        op.remove_first = false;
+    }
+
+    void IncPipeline::report(uint32_t seconds)
+    {
+        if (0 == seconds)
+        {
+            return ;
+        }
+        const stat_t cur = m_stat;
+        const stat_t &last = m_last_stat;
+        P_WARNING("inc pipeline in %us: read %lu/s (%lu KB/s, wait %lu), parse %lu/s (failed %lu), "
+                "apply %lu/s (forward %lu, invert %lu, delete %lu, coalesced %lu, wait %lu), queue[%lu/%lu], inflight %lu KB",
+                seconds,
+                (cur.read_count - last.read_count) / seconds,
+                (cur.read_bytes - last.read_bytes) / seconds / 1024,
+                cur.read_wait - last.read_wait,
+                (cur.parse_count - last.parse_count) / seconds,
+                cur.parse_fail - last.parse_fail,
+                (cur.apply_count - last.apply_count) / seconds,
+                cur.forward_count - last.forward_count,
+                cur.invert_count - last.invert_count,
+                cur.delete_count - last.delete_count,
+                cur.coalesced - last.coalesced,
+                cur.apply_wait - last.apply_wait,
+                (uint64_t)(m_read_seq - m_apply_seq), m_mask + 1,
+                (uint64_t)m_inflight_bytes / 1024);
+        m_last_stat = cur;
+        for (size_t i = 0; i < m_writers.size(); ++i)
+        {
+            writer_t &writer = m_writers[i];
+            const uint64_t count = writer.apply_count;
+            P_WARNING("inc pipeline writer of level[%u]: apply %lu/s, seq[%lu]",
+                    writer.level, (count - writer.last_count) / seconds, (uint64_t)writer.seq);
+            writer.last_count = count;
+        }
+    }
+
+    void IncPipeline::stop()
+    {
+        m_stop = true;
+        if (m_reader_started)
+        {
+            ::pthread_join(m_reader_tid, NULL);
+            m_reader_started = false;
+        }
+        for (size_t i = 0; i < m_parser_started; ++i)
+        {
+            ::pthread_join(m_parser_tids[i], NULL);
+        }
+        m_parser_started = 0;
+        for (size_t i = 0; i < m_writer_started; ++i)
+        {
+            ::pthread_join(m_writers[i].tid, NULL);
+        }
+        m_writer_started = 0;
+    }
+
+    void *IncPipeline::writer_thread(void *args)
+    {
+        writer_t *writer = (writer_t *)args;
+        writer->pipeline->write_loop(*writer);
+        return NULL;
+    }
+
+    void IncPipeline::apply_loop()
+    {
+        IncReader &reader = m_index.m_inc_reader;
+        uint32_t now = g_now_time;
+        uint32_t last_report = now;
+        while (1)
+        {
+            if (now != g_now_time)
+            {
+                now = g_now_time;
+                m_index.recycle();
+                m_index.try2merge();
+                m_index.try2compact();
+                m_index.try2dump();
+                m_index.try_exc_cmd();
+                m_index.try_print_meta();
+                m_index.try_print_list();
+                if (now - last_report >= STAT_INTERVAL)
+                {
+                    this->report(now - last_report);
+                    last_report = now;
+                }
+            }
+            const uint64_t seq = m_apply_seq;
+            op_t &op = m_ops[seq & m_mask];
+            if (seq < m_read_seq && OP_PARSED == op.state
+                    && this->prepare(seq, op, m_window))
+            {
+                __sync_synchronize();
+                this->apply(op);
+                reader.set_checkpoint(op.file_no, op.line_no);
+                this->release(op);
+                op.state = OP_FREE;
+                __sync_synchronize();
+                m_apply_seq = seq + 1;
+                ++m_stat.apply_count;
+                continue;
+            }
+            if (READER_RUNNING != m_reader_status && seq == m_read_seq)
+            {
+                break;
+            }
+            ++m_stat.apply_wait;
+            ::usleep(100);
+        }
+        this->report(g_now_time > last_report ? g_now_time - last_report : 1);
+    }
+
+    void IncPipeline::write_loop(writer_t &writer)
+    {
+        LevelIndex *lx = m_index.get_level_index(writer.level);
+        uint32_t now = g_now_time;
+        while (!m_stop)
+        {
+            if (m_pause)
+            {
+                writer.paused = true;
+                while (m_pause && !m_stop)
+                {
+                    ::usleep(100);
+                }
+                writer.paused = false;
+                continue;
+            }
+            /* 本层的维护操作只能在本层的写线程里做，停在barrier上时可能正在dump，不做 */
+            if (now != g_now_time && writer.seq < m_barrier_seq)
+            {
+                now = g_now_time;
+                lx->recycle();
+                lx->try2merge();
+                lx->try2compact();
+                lx->try_exc_cmd();
+                lx->try_print_meta();
+                lx->try_print_list();
+            }
+            const uint64_t seq = writer.seq;
+            if (seq < m_barrier_seq && seq < m_read_seq && OP_PARSED == m_ops[seq & m_mask].state)
+            {
+                __sync_synchronize();
+                op_t &op = m_ops[seq & m_mask];
+                if (op.valid && op.level == writer.level)
+                {
+                    if (!this->prepare(seq, op, writer.window))
+                    {
+                        ::usleep(100);
+                        continue;
+                    }
+                    this->apply(op);
+                    ++writer.apply_count;
+                }
+                __sync_synchronize();
+                writer.seq = seq + 1;
+                continue;
+            }
+            ::usleep(100);
+        }
+    }
+
+    uint64_t IncPipeline::release_applied()
+    {
+        IncReader &reader = m_index.m_inc_reader;
+        uint64_t low = m_writers[0].seq;
+        for (size_t i = 1; i < m_writers.size(); ++i)
+        {
+            if (m_writers[i].seq < low)
+            {
+                low = m_writers[i].seq;
+            }
+        }
+        __sync_synchronize();
+        uint64_t num = 0;
+        for (uint64_t seq = m_apply_seq; seq < low; ++seq, ++num)
+        {
+            op_t &op = m_ops[seq & m_mask];
+            reader.set_checkpoint(op.file_no, op.line_no);
+            this->release(op);
+            op.state = OP_FREE;
+        }
+        __sync_synchronize();
+        m_apply_seq = low;
+        m_stat.apply_count += num;
+        return num;
+    }
+
+    void IncPipeline::pause_writers()
+    {
+        m_pause = true;
+        __sync_synchronize();
+        for (size_t i = 0; i < m_writers.size(); ++i)
+        {
+            while (!m_writers[i].paused)
+            {
+                ::usleep(100);
+            }
+        }
+        uint64_t barrier = 0;
+        for (size_t i = 0; i < m_writers.size(); ++i)
+        {
+            if (m_writers[i].seq > barrier)
+            {
+                barrier = m_writers[i].seq;
+            }
+        }
+        m_barrier_seq = barrier;
+        __sync_synchronize();
+        m_pause = false;
+        /* 落后的写线程追到barrier，之后所有层都恰好应用到同一个位置 */
+        for (size_t i = 0; i < m_writers.size(); ++i)
+        {
+            while (m_writers[i].seq < barrier)
+            {
+                ::usleep(100);
+            }
+        }
+        this->release_applied();
+    }
+
+    void IncPipeline::resume_writers()
+    {
+        __sync_synchronize();
+        m_barrier_seq = UINT64_MAX;
+    }
+
+    void IncPipeline::coordinate_loop()
+    {
+        uint32_t now = g_now_time;
+        uint32_t last_report = now;
+        while (1)
+        {
+            if (now != g_now_time)
+            {
+                now = g_now_time;
+                if (m_index.check_dump_flag())
+                {
+                    this->pause_writers();
+                    m_index.dump();
+                    this->resume_writers();
+                }
+                if (now - last_report >= STAT_INTERVAL)
+                {
+                    this->report(now - last_report);
+                    last_report = now;
+                }
+            }
+            if (this->release_applied() > 0)
+            {
+                continue;
+            }
+            if (READER_RUNNING != m_reader_status && m_apply_seq == m_read_seq)
+            {
+                break;
+            }
+            ++m_stat.apply_wait;
+            ::usleep(100);
+        }
+        this->report(g_now_time > last_report ? g_now_time - last_report : 1);
+    }
+
+    int IncPipeline::run()
+    {
+        if (NULL == m_ops)
+        {
+            P_WARNING("must be inited first");
+            return -1;
+        }
+        IncReader &reader = m_index.m_inc_reader;
+        reader.set_checkpoint(reader.get_file_no(), reader.get_line_no());
+
+        for (size_t i = 0; i < m_parser_tids.size(); ++i)
+        {
+            int ret = ::pthread_create(&m_parser_tids[i], NULL, parser_thread, this);
+            if (ret != 0)
+            {
+                P_WARNING("failed to create parser thread, ret=%d", ret);
+                this->stop();
+                return -1;
+            }
+            ++m_parser_started;
+        }
+        for (size_t i = 0; i < m_writers.size(); ++i)
+        {
+            int ret = ::pthread_create(&m_writers[i].tid, NULL, writer_thread, &m_writers[i]);
+            if (ret != 0)
+            {
+                P_WARNING("failed to create writer thread of level[%u], ret=%d", m_writers[i].level, ret);
+                this->stop();
+                return -1;
+            }
+            ++m_writer_started;
+        }
+        int ret = ::pthread_create(&m_reader_tid, NULL, reader_thread, this);
+        if (ret != 0)
+        {
+            P_WARNING("failed to create reader thread, ret=%d", ret);
+            this->stop();
+            return -1;
+        }
+        m_reader_started = true;
+
+        if (m_writers.empty())
+        {
+            this->apply_loop();
+        }
+        else
+        {
+            this->coordinate_loop();
+        }
+        this->stop();
+        if (READER_EOF != m_reader_status)
+        {
+            return -1;
+        }
+        m_index.dump();
+        return 0;
+    }
+
+    static void *run_pipeline(Index &idx, bool level_writers)
+    {
+        IncPipeline pipeline(idx);
+        if (pipeline.init(idx.inc_parse_threads(), idx.inc_queue_size(),
+                    uint64_t(idx.inc_queue_memory()) << 20, level_writers) < 0)
+        {
+            P_FATAL("failed to init inc pipeline");
+            return NULL;
+        }
+        pipeline.set_coalesce(idx.inc_coalesce_window(), idx.inc_coalesce_ms());
+        pipeline.run();
+        return NULL;
+    }
+
+    void *pipeline_processor(void *args)
+    {
+        return run_pipeline(*(Index *)args, false);
+    }
+
+    /* 每个LevelIndex一个写线程，层与层之间没有共享的可变状态 */
+    void *level_pipeline_processor(void *args)
+    {
+        return run_pipeline(*(Index *)args, true);
+    }
+}
@@ -1,8 +1,16 @@
+#ifndef __STDC_LIMIT_MACROS
+#define __STDC_LIMIT_MACROS
+#endif
+
+#include <new>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
 #include <fstream>
 #include "inc/inc_reader.h"
+#include "inc/inc_record.h"
 #include "log_utils.h"
 #include "str_utils.h"
 #include "fast_timer.h"
@@ -35,6 +43,20 @@ namespace inc
                 ret = false;
             }
             _inc_name = conf["inc_name"];
+            std::string read_mode;
+            _chunk_mode = false;
+            if (conf.get("read_mode", read_mode))
+            {
+                if ("chunk" == read_mode)
+                {
+                    _chunk_mode = true;
+                }
+                else if ("line" != read_mode)
+                {
+                    P_WARNING("invalid read_mode[%s], must be line or chunk", read_mode.c_str());
+                    ret = false;
+                }
+            }
 
             if (!ret)
             {
@@ -53,23 +75,21 @@ namespace inc
             ::fclose(_fp);
             _fp = NULL;
         }
+        this->close_chunk_file();
         ::snprintf(_filepath, sizeof(_filepath) - sizeof(".xxxxxxxxxx"), "%s", fp.c_str());
         _path_len = ::strlen(_filepath);
     
-        ::sprintf(_filepath + _path_len, ".%d", _file_no);
-        _fp = ::fopen(_filepath, "r");
-    
-        if (NULL == _fp)
+        if (this->open_file(_file_no) < 0)
         {
             P_FATAL("failed to open file[%s].", _filepath);
-            return -1;
+            goto ERROR;
         }
         if (_line_no > 0)
         {
             int ret;
             for (uint32_t i = 0; i < _line_no; ++i)
             {
-                ret = readline(_fp, _line_buf, sizeof _line_buf, true);
+                ret = this->read_line();
                 if (ret <= 0)
                 {
                     if (ret < 0)
@@ -82,27 +102,266 @@ namespace inc
                     }
                     goto ERROR;
                 }
-                else if (ret >= (int)sizeof _line_buf)
+                else if (NULL != _fp && ret >= (int)sizeof _line_buf)
                 {
                     P_WARNING("line[%u] too long in file[%s].", i + 1, _filepath);
                 }
             }
-            char *end = ::strchr(_line_buf, '\t');
-            if (end)
+            if (FORMAT_BINARY != _format)
             {
-                *end = '\0';
+                char *end = ::strchr(_line, '\t');
+                if (end)
+                {
+                    *end = '\0';
+                }
             }
         }
-        P_WARNING("init inc_reader[%s] ok, filepath[%s] fileno[%u] lineno[%u] max_lineno[%u] partition[%u:%u]%s.",
+        P_WARNING("init inc_reader[%s] ok, filepath[%s] fileno[%u] lineno[%u] max_lineno[%u] partition[%u:%u]%s%s%s.",
                 _inc_name.c_str(), fp.c_str(), _file_no, _line_no, _max_line_no, _partition_cur, _partition_num,
-                _base_mode ? " base" : "");
+                _base_mode ? " base" : "", _chunk_mode ? " chunk" : "", FORMAT_BINARY == _format ? " binary" : "");
         return 0;
 ERROR:
-        ::fclose(_fp);
-        _fp = NULL;
+        if (_fp)
+        {
+            ::fclose(_fp);
+            _fp = NULL;
+        }
+        this->close_chunk_file();
         return -1;
     }
 
+    int IncReader::open_file(uint32_t file_no)
+    {
+        ::sprintf(_filepath + _path_len, ".%d", file_no);
+        int fd = this->open_chunk_file(_filepath);
+        if (fd < 0)
+        {
+            return -1;
+        }
+        if (_fp)
+        {
+            ::fclose(_fp);
+            _fp = NULL;
+        }
+        this->close_chunk_file();
+        _fd = fd;
+        _format = FORMAT_UNKNOWN;
+        this->reset_chunk(0);
+        return this->detect_format() < 0 ? -1 : 0;
+    }
+
+    int IncReader::detect_format() /* 文件头还没写完整时返回0，下次读的时候再识别 */
+    {
+        if (FORMAT_UNKNOWN != _format)
+        {
+            return 1;
+        }
+        char magic[INC_BINARY_MAGIC_LEN];
+        ssize_t n;
+        do
+        {
+            n = ::pread(_fd, magic, sizeof magic, 0);
+        } while (n < 0 && EINTR == errno);
+        if (n < 0)
+        {
+            P_WARNING("failed to read file[%s], errno[%d].", _filepath, errno);
+            return -1;
+        }
+        if (n < (ssize_t)sizeof magic && ::memcmp(magic, INC_BINARY_MAGIC, n) == 0)
+        {
+            return 0;
+        }
+        if (n == (ssize_t)sizeof magic && ::memcmp(magic, INC_BINARY_MAGIC, n) == 0)
+        {
+            _format = FORMAT_BINARY;
+        }
+        else if (!_chunk_mode)
+        {
+            FILE *fp = ::fdopen(_fd, "r");
+            if (NULL == fp)
+            {
+                P_WARNING("failed to fdopen file[%s], errno[%d].", _filepath, errno);
+                return -1;
+            }
+            _fp = fp;
+            _fd = -1;
+            _format = FORMAT_TEXT;
+            return 1;
+        }
+        else
+        {
+            _format = FORMAT_TEXT;
+        }
+        if (NULL == _chunk)
+        {
+            _chunk = new (std::nothrow) char[CHUNK_SIZE + 1];
+            if (NULL == _chunk)
+            {
+                P_FATAL("failed to alloc chunk buffer");
+                _format = FORMAT_UNKNOWN;
+                return -1;
+            }
+        }
+        this->reset_chunk(FORMAT_BINARY == _format ? INC_BINARY_MAGIC_LEN : 0);
+        return 1;
+    }
+
+    int IncReader::open_chunk_file(const char *path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return -1;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); /* 加大内核预读窗口 */
+#endif
+        return fd;
+    }
+
+    void IncReader::close_chunk_file()
+    {
+        if (_fd >= 0)
+        {
+            ::close(_fd);
+            _fd = -1;
+        }
+    }
+
+    int IncReader::read_line()
+    {
+        if (FORMAT_UNKNOWN == _format)
+        {
+            const int ret = this->detect_format();
+            if (ret <= 0)
+            {
+                return ret;
+            }
+        }
+        if (FORMAT_BINARY == _format)
+        {
+            return this->read_record();
+        }
+        if (_fd >= 0)
+        {
+            return this->read_chunk_line();
+        }
+        int ret = readline(_fp, _line_buf, sizeof _line_buf, true);
+        _line = _line_buf;
+        _line_len = ret > 0 ? ::strlen(_line_buf) : 0;
+        return ret;
+    }
+
+    int IncReader::read_chunk_line()
+    {
+        while (1)
+        {
+            char *begin = _chunk + _chunk_begin;
+            char *nl = (char *)::memchr(begin, '\n', _chunk_end - _chunk_begin);
+            if (nl)
+            {
+                size_t len = nl - begin;
+                _chunk_begin += len + 1;
+                if (_skip_tail)
+                {
+                    _skip_tail = false;
+                    continue;
+                }
+                *nl = '\0';
+                while (len > 0 && ('\r' == begin[len - 1] || '\n' == begin[len - 1]))
+                {
+                    begin[--len] = '\0';
+                }
+                _line = begin;
+                _line_len = len;
+                return len + 1;
+            }
+            if (_skip_tail)
+            {
+                _chunk_begin = _chunk_end;
+            }
+            if (_chunk_end - _chunk_begin >= (size_t)CHUNK_SIZE) /* 此时_chunk_begin为0 */
+            {
+                P_WARNING("too long line at file[%s], line_no[%u], truncated to %d bytes.",
+                        _filepath, _line_no + 1, int(CHUNK_SIZE));
+                _chunk[CHUNK_SIZE] = '\0';
+                _line = _chunk;
+                _line_len = CHUNK_SIZE;
+                _chunk_begin = _chunk_end;
+                _skip_tail = true;
+                return CHUNK_SIZE;
+            }
+            const int n = this->fill_chunk();
+            if (n <= 0)
+            {
+                return n; /* 不完整的行留在buffer中，等待追加 */
+            }
+        }
+    }
+
+    int IncReader::read_record()
+    {
+        while (1)
+        {
+            const size_t avail = _chunk_end - _chunk_begin;
+            if (avail >= sizeof(uint32_t))
+            {
+                uint32_t length = 0;
+                ::memcpy(&length, _chunk + _chunk_begin, sizeof length);
+                if (length < sizeof(record_head_t) || length > (uint32_t)CHUNK_SIZE)
+                {
+                    P_WARNING("invalid record length[%u] at file[%s], line_no[%u], offset[%ld].",
+                            length, _filepath, _line_no + 1, (long)this->consumed_pos());
+                    return -1;
+                }
+                if (avail >= length)
+                {
+                    _line = _chunk + _chunk_begin;
+                    _line_len = length;
+                    _chunk_begin += length;
+                    return length;
+                }
+            }
+            const int n = this->fill_chunk();
+            if (n <= 0)
+            {
+                return n; /* 不完整的record留在buffer中，等待追加 */
+            }
+        }
+    }
+
+    int IncReader::fill_chunk() /* 把剩余数据挪到头部后接着读，返回读到的字节数 */
+    {
+        if (_chunk_begin > 0)
+        {
+            ::memmove(_chunk, _chunk + _chunk_begin, _chunk_end - _chunk_begin);
+            _chunk_end -= _chunk_begin;
+            _chunk_begin = 0;
+        }
+        while (1)
+        {
+            ssize_t n = ::pread(_fd, _chunk + _chunk_end, CHUNK_SIZE - _chunk_end, _read_pos);
+            if (n < 0)
+            {
+                if (EINTR == errno)
+                {
+                    continue;
+                }
+                P_WARNING("failed to read file[%s], errno[%d].", _filepath, errno);
+                return -1;
+            }
+            if (n > 0)
+            {
+                _read_pos += n;
+                _chunk_end += n;
+#ifdef POSIX_FADV_WILLNEED
+                ::posix_fadvise(_fd, _read_pos, CHUNK_SIZE, POSIX_FADV_WILLNEED); /* 提前读下一块 */
+#endif
+            }
+            return n;
+        }
+    }
+
     int IncReader::dumpMeta(const char *path, const char *meta)
     {
         std::string p(path);
@@ -110,39 +369,37 @@ ERROR:
         std::ofstream fout(p.c_str());
         fout << "inc_name: " << _inc_name << std::endl;
         fout << "inc_file_prefix: " << std::string(_filepath, _path_len) << std::endl;
-        fout << "file_no: " << _file_no << std::endl;
-        fout << "line_no: " << _line_no << std::endl;
+        fout << "file_no: " << (_use_checkpoint ? _ckpt_file_no : _file_no) << std::endl;
+        fout << "line_no: " << (_use_checkpoint ? _ckpt_line_no : _line_no) << std::endl;
         fout << "max_line_no: " << _max_line_no << std::endl;
         fout << "partition_cur: " << _partition_cur << std::endl;
         fout << "partition_num: " << _partition_num << std::endl;
+        if (_chunk_mode)
+        {
+            fout << "read_mode: chunk" << std::endl;
+        }
         fout.close();
         return fout ? 0 : -1;
     }
     
     int IncReader::next()
     {
-        if (NULL == _fp)
+        if (NULL == _fp && _fd < 0)
         {
             P_FATAL("_fp is NULL");
             return -1;
         }
         if (_line_no >= _max_line_no)
         {
-            ::sprintf(_filepath + _path_len, ".%d", _file_no + 1);
-            FILE *fp = ::fopen(_filepath, "r");
-    
-            if (NULL == fp)
+            if (this->open_file(_file_no + 1) < 0)
             {
                 P_WARNING("failed to open file[%s].", _filepath);
                 return 0; /* try again at some later time */
             }
-            ::fclose(_fp);
-    
-            _fp = fp;
             ++_file_no;
             _line_no = 0;
         }
-        int ret = readline(_fp, _line_buf, sizeof _line_buf, true);
+        int ret = this->read_line();
         if (ret < 0)
         {
             P_FATAL("error occured when reading file[%s], line_no[%u].", _filepath, _line_no);
@@ -152,7 +409,7 @@ ERROR:
         {
             return 0; /* try again at some later time */
         }
-        else if (ret >= (int)sizeof _line_buf)
+        else if (NULL != _fp && ret >= (int)sizeof _line_buf)
         {
             P_WARNING("too long line at file[%s], line_no[%u], length = %d.", _filepath, _line_no, ret);
         }
@@ -160,7 +417,16 @@ ERROR:
         _eventid = 0;
         if (!_base_mode)
         {
-            _eventid = ::strtoul(_line_buf, NULL, 10);
+            if (FORMAT_BINARY == _format)
+            {
+                record_head_t head;
+                ::memcpy(&head, _line, sizeof head);
+                _eventid = head.eventid;
+            }
+            else
+            {
+                _eventid = ::strtoul(_line, NULL, 10);
+            }
         }
         return 1;
     }
@@ -168,70 +434,148 @@ ERROR:
     void IncReader::split(std::vector<std::string> &columns, const std::string &sep)
     {
         columns.clear();
-        ::split(_line_buf, sep, columns);
+        if (FORMAT_BINARY == _format)
+        {
+            return ;
+        }
+        ::split(_line, sep, columns);
         if (_base_mode && columns.size() > 1)
         {
             columns.erase(columns.begin());
         }
     }
+
+    size_t IncReader::split(column_t *columns, size_t max_num, char sep)
+    {
+        if (FORMAT_BINARY == _format)
+        {
+            return 0;
+        }
+        return split(_line, _line_len, _base_mode, columns, max_num, sep);
+    }
+
+    size_t IncReader::split(char *line, uint32_t len, bool base_mode,
+            column_t *columns, size_t max_num, char sep)
+    {
+        if (0 == max_num)
+        {
+            return 0;
+        }
+        char *p = line;
+        char *end = line + len;
+        if (base_mode) /* 与split(vector)一致，有多列时去掉第一列 */
+        {
+            char *q = (char *)::memchr(p, sep, end - p);
+            if (q)
+            {
+                p = q + 1;
+            }
+        }
+        size_t num = 0;
+        while (1)
+        {
+            char *q = (num + 1 < max_num) ? (char *)::memchr(p, sep, end - p) : NULL;
+            columns[num].ptr = p;
+            if (NULL == q)
+            {
+                columns[num++].len = end - p;
+                break;
+            }
+            *q = '\0';
+            columns[num++].len = q - p;
+            p = q + 1;
+        }
+        return num;
+    }
+
+    bool IncReader::parse_uint64(const column_t &column, uint64_t &value)
+    {
+        if (0 == column.len || column.len > 20)
+        {
+            return false;
+        }
+        uint64_t v = 0;
+        for (uint32_t i = 0; i < column.len; ++i)
+        {
+            const uint32_t d = (uint8_t)column.ptr[i] - '0';
+            if (d > 9 || v > (UINT64_MAX - d) / 10)
+            {
+                return false;
+            }
+            v = v * 10 + d;
+        }
+        value = v;
+        return true;
+    }
+
+    bool IncReader::parse_uint32(const column_t &column, uint32_t &value)
+    {
+        uint64_t v = 0;
+        if (!parse_uint64(column, v) || v > UINT32_MAX)
+        {
+            return false;
+        }
+        value = (uint32_t)v;
+        return true;
+    }
     
     int IncReader::snapshot()
     {
-        _ss_file_no = _file_no;
-        _ss_line_no = _line_no;
-        if (NULL == _fp)
+        if (_fp)
         {
-            P_WARNING("_fp is NULL, failed to make snapshot.");
-            return -1;
+            _ss_pos = ::ftello(_fp);
+            if (-1 == _ss_pos)
+            {
+                P_WARNING("ftello return -1, errno[%d].", errno);
+                return -1;
+            }
+        }
+        else if (_fd >= 0)
+        {
+            _ss_pos = FORMAT_UNKNOWN == _format ? 0 : this->consumed_pos();
         }
-        _ss_pos = ::ftello(_fp);
-        if (-1 == _ss_pos)
+        else
         {
-            P_WARNING("ftello return -1, errno[%d].", errno);
+            P_WARNING("no file is opened, failed to make snapshot.");
             return -1;
         }
+        _ss_file_no = _file_no;
+        _ss_line_no = _line_no;
         _snapshot = true;
         return 0;
     }
     
     int IncReader::rollback()
     {
-        if (_snapshot)
+        if (!_snapshot)
         {
-            if (_ss_file_no == _file_no)
-            {
-                if (::fseeko(_fp, _ss_pos, SEEK_SET) < 0)
-                {
-                    P_WARNING("failed to seek file[%s], line no[%u]", _filepath, _ss_line_no);
-                    return -1;
-                }
-            }
-            else
+            return 0;
+        }
+        if (_ss_file_no != _file_no && this->open_file(_ss_file_no) < 0)
+        {
+            P_WARNING("failed to open file[%s].", _filepath);
+            ::sprintf(_filepath + _path_len, ".%d", _file_no);
+            return -1;
+        }
+        if (_fp)
+        {
+            if (::fseeko(_fp, _ss_pos, SEEK_SET) < 0)
             {
-                ::sprintf(_filepath + _path_len, ".%d", _ss_file_no);
-                FILE *fp = ::fopen(_filepath, "r");
-    
-                if (NULL == fp)
-                {
-                    P_WARNING("failed to open file[%s].", _filepath);
-                    ::sprintf(_filepath + _path_len, ".%d", _file_no);
-                    return -1;
-                }
-                if (::fseeko(fp, _ss_pos, SEEK_SET) < 0)
-                {
-                    P_WARNING("failed to seek file[%s], line no[%u]", _filepath, _ss_line_no);
-                    ::sprintf(_filepath + _path_len, ".%d", _file_no);
-                    ::fclose(fp);
-                    return -1;
-                }
-    
-                ::fclose(_fp);
-                _fp = fp;
+                P_WARNING("failed to seek file[%s], line no[%u]", _filepath, _ss_line_no);
+                return -1;
             }
-            _file_no = _ss_file_no;
-            _line_no = _ss_line_no;
-            _snapshot = false;
         }
+        else if (FORMAT_BINARY == _format && _ss_pos < (off_t)INC_BINARY_MAGIC_LEN)
+        {
+            this->reset_chunk(INC_BINARY_MAGIC_LEN); /* 做快照时文件头还没写完整 */
+        }
+        else if (FORMAT_UNKNOWN != _format)
+        {
+            this->reset_chunk(_ss_pos); /* pread按偏移读，不需要seek */
+        }
+        _file_no = _ss_file_no;
+        _line_no = _ss_line_no;
+        _snapshot = false;
         return 0;
     }
     
@@ -0,0 +1,179 @@
+#include <string.h>
+#include "log_utils.h"
+#include "inc/inc_record.h"
+
+namespace inc
+{
+    template <typename T>
+        static void append(std::string &out, const T &value)
+        {
+            out.append((const char *)&value, sizeof value);
+        }
+
+    bool encode_record(std::string &out, const record_head_t &head,
+            const std::vector<forward_value_t> &fields, const std::vector<invert_sign_t> &inverts)
+    {
+        const size_t begin = out.size();
+        record_head_t h = head;
+        h.length = 0;
+        h.field_num = 0;
+        h.invert_num = 0;
+        h.reserved = 0;
+        append(out, h);
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            const forward_value_t &field = fields[i];
+            field_head_t fh;
+            fh.slot = field.slot;
+            fh.kind = field.kind;
+            fh.reserved = 0;
+            if (forward_value_t::NUMBER == field.kind)
+            {
+                append(out, fh);
+                append(out, field.number);
+            }
+            else if (forward_value_t::RAW == field.kind)
+            {
+                const uint32_t len = field.len;
+                append(out, fh);
+                append(out, len);
+                out.append(field.str, len);
+            }
+            else
+            {
+                continue;
+            }
+            ++h.field_num;
+        }
+        for (size_t i = 0; i < inverts.size(); ++i)
+        {
+            const invert_sign_t &invert = inverts[i];
+            invert_head_t ih;
+            ih.type = invert.type;
+            ih.reserved = 0;
+            ih.word_len = invert.word_len;
+            ih.payload_len = invert.payload ? invert.payload_len : 0;
+            ih.reserved2 = 0;
+            ih.sign = invert.sign;
+            append(out, ih);
+            out.append(invert.word, ih.word_len);
+            out.push_back('\0');
+            if (ih.payload_len > 0)
+            {
+                out.append((const char *)invert.payload, ih.payload_len);
+            }
+            ++h.invert_num;
+        }
+        if (out.size() - begin > (size_t)MAX_RECORD_LENGTH)
+        {
+            P_WARNING("too long record, length=%lu, oid=%lu", (unsigned long)(out.size() - begin), h.oid);
+            out.resize(begin);
+            return false;
+        }
+        h.length = out.size() - begin;
+        ::memcpy(&out[begin], &h, sizeof h);
+        return true;
+    }
+
+    bool decode_record(const char *record, uint32_t len, record_head_t &head,
+            std::vector<forward_value_t> &fields, std::vector<invert_sign_t> &inverts)
+    {
+        fields.clear();
+        inverts.clear();
+        if (len < sizeof head)
+        {
+            P_WARNING("too short record, len=%u", len);
+            return false;
+        }
+        ::memcpy(&head, record, sizeof head);
+        const char *p = record + sizeof head;
+        const char *end = record + len;
+        if (head.length != len)
+        {
+            P_WARNING("invalid record length[%u] != %u", head.length, len);
+            return false;
+        }
+        for (uint16_t i = 0; i < head.field_num; ++i)
+        {
+            field_head_t fh;
+            if (size_t(end - p) < sizeof fh)
+            {
+                goto FAIL;
+            }
+            ::memcpy(&fh, p, sizeof fh);
+            p += sizeof fh;
+
+            forward_value_t field;
+            field.slot = fh.slot;
+            field.kind = fh.kind;
+            field.number = 0;
+            field.str = NULL;
+            field.len = 0;
+            field.json = NULL;
+            if (forward_value_t::NUMBER == fh.kind)
+            {
+                if (size_t(end - p) < sizeof field.number)
+                {
+                    goto FAIL;
+                }
+                ::memcpy(&field.number, p, sizeof field.number);
+                p += sizeof field.number;
+            }
+            else if (forward_value_t::RAW == fh.kind)
+            {
+                uint32_t size = 0;
+                if (size_t(end - p) < sizeof size)
+                {
+                    goto FAIL;
+                }
+                ::memcpy(&size, p, sizeof size);
+                p += sizeof size;
+                if (size_t(end - p) < size)
+                {
+                    goto FAIL;
+                }
+                field.str = p;
+                field.len = size;
+                p += size;
+            }
+            else
+            {
+                P_WARNING("invalid field kind[%d], slot[%d]", int(fh.kind), int(fh.slot));
+                goto FAIL;
+            }
+            fields.push_back(field);
+        }
+        for (uint16_t i = 0; i < head.invert_num; ++i)
+        {
+            invert_head_t ih;
+            if (size_t(end - p) < sizeof ih)
+            {
+                goto FAIL;
+            }
+            ::memcpy(&ih, p, sizeof ih);
+            p += sizeof ih;
+            if (size_t(end - p) < size_t(ih.word_len) + 1 + ih.payload_len || '\0' != p[ih.word_len])
+            {
+                goto FAIL;
+            }
+            invert_sign_t invert;
+            invert.type = ih.type;
+            invert.sign = ih.sign;
+            invert.word = p;
+            invert.word_len = ih.word_len;
+            invert.payload_len = ih.payload_len;
+            invert.payload = ih.payload_len > 0 ? p + ih.word_len + 1 : NULL;
+            p += ih.word_len + 1 + ih.payload_len;
+            inverts.push_back(invert);
+        }
+        if (p == end)
+        {
+            return true;
+        }
+FAIL:
+        P_WARNING("corrupted record, oid=%lu, length=%u", head.oid, len);
+        fields.clear();
+        inverts.clear();
+        return false;
+    }
+}
@@ -0,0 +1,253 @@
+#include <new>
+#include <sched.h>
+#include <string.h>
+#include <algorithm>
+#include "log_utils.h"
+#include "index/bsi.h"
+
+BitSlicedIndex::~BitSlicedIndex()
+{
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        delete m_fields[i];
+    }
+    m_fields.clear();
+}
+
+int BitSlicedIndex::init(uint32_t capacity)
+{
+    m_capacity = capacity;
+    if (m_exist.init((uint32_t)this->word_num()) < 0 || m_version.init((uint32_t)this->word_num()) < 0)
+    {
+        P_WARNING("failed to init exist bitmap, capacity=%u", capacity);
+        m_capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+int BitSlicedIndex::add_field(const std::string &name, int type, int array_offset)
+{
+    field_t *field = new (std::nothrow) field_t;
+    if (NULL == field)
+    {
+        P_WARNING("failed to new field_t");
+        return -1;
+    }
+    for (int i = 0; i < SLICE_NUM; ++i)
+    {
+        if (field->slices[i].init((uint32_t)this->word_num()) < 0)
+        {
+            P_WARNING("failed to init slice[%d] of field[%s]", i, name.c_str());
+            delete field;
+            return -1;
+        }
+    }
+    field->name = name;
+    field->type = type;
+    field->array_offset = array_offset;
+    m_fields.push_back(field);
+    return m_fields.size() - 1;
+}
+
+const BitSlicedIndex::field_t *BitSlicedIndex::get_field(const char *name) const
+{
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        if (m_fields[i]->name == name)
+        {
+            return m_fields[i];
+        }
+    }
+    return NULL;
+}
+
+void BitSlicedIndex::set_bit(Bitmap &bitmap, uint32_t id, bool on)
+{
+    const uint64_t bit = ((uint64_t)1) << (id & 63);
+    uint64_t *word = on ? bitmap.alloc_at(id >> 6) : bitmap.at(id >> 6);
+    if (NULL == word)
+    {
+        return ;
+    }
+    const uint64_t value = on ? (*word | bit) : (*word & ~bit);
+    if (value != *word)
+    {
+        *(volatile uint64_t *)word = value;
+    }
+}
+
+bool BitSlicedIndex::set_row(uint32_t id, const void *info)
+{
+    if (id >= m_capacity)
+    {
+        P_WARNING("id[%u] exceeds bsi capacity[%u]", id, m_capacity);
+        return false;
+    }
+    uint32_t *version = m_version.alloc_at(id >> 6);
+    if (NULL == version)
+    {
+        P_WARNING("failed to alloc version for id[%u]", id);
+        return false;
+    }
+    const uint64_t *exist = m_exist.at(id >> 6);
+    const bool existed = exist && ((*exist >> (id & 63)) & 0x1);
+    /* 改写时存在位保持不变，只在删除时清除，读线程不会漏掉已有的doc */
+    *(volatile uint32_t *)version = *version + 1;
+    __sync_synchronize();
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        field_t &field = *m_fields[i];
+        const uint32_t raw = ((const uint32_t *)info)[field.array_offset];
+        uint32_t value;
+        if (INT_FIELD == field.type)
+        {
+            value = encode_int((int32_t)raw);
+        }
+        else
+        {
+            union { uint32_t u; float f; } tmp;
+            tmp.u = raw;
+            value = encode_float(tmp.f);
+        }
+        for (int b = 0; b < SLICE_NUM; ++b)
+        {
+            set_bit(field.slices[b], id, (value >> b) & 0x1);
+        }
+    }
+    __sync_synchronize(); /* 切片先于存在位写入 */
+    if (!existed)
+    {
+        set_bit(m_exist, id, true);
+    }
+    __sync_synchronize();
+    *(volatile uint32_t *)version = *version + 1;
+    if (!existed)
+    {
+        if (NULL == m_exist.at(id >> 6))
+        {
+            P_WARNING("failed to alloc exist bitmap for id[%u]", id);
+            return false;
+        }
+        ++m_exist_num;
+    }
+    return true;
+}
+
+void BitSlicedIndex::clear_row(uint32_t id)
+{
+    const uint64_t *exist = m_exist.at(id >> 6);
+    if (exist && ((*exist >> (id & 63)) & 0x1))
+    {
+        set_bit(m_exist, id, false);
+        --m_exist_num;
+    }
+}
+
+uint64_t BitSlicedIndex::eval_word(const uint64_t *const *slices, size_t i,
+        uint64_t e, uint32_t lo, uint32_t hi)
+{
+    uint64_t gt = 0;                    /* > lo */
+    uint64_t lt = 0;                    /* < hi */
+    uint64_t eq_lo = e;                 /* 高位与lo相同 */
+    uint64_t eq_hi = e;                 /* 高位与hi相同 */
+    for (int b = SLICE_NUM - 1; b >= 0 && (eq_lo | eq_hi); --b)
+    {
+        const uint64_t s = slices[b] ? *(const volatile uint64_t *)&slices[b][i] : 0;
+        if ((lo >> b) & 0x1)
+        {
+            eq_lo &= s;
+        }
+        else
+        {
+            gt |= eq_lo & s;
+            eq_lo &= ~s;
+        }
+        if ((hi >> b) & 0x1)
+        {
+            lt |= eq_hi & ~s;
+            eq_hi &= s;
+        }
+        else
+        {
+            eq_hi &= ~s;
+        }
+    }
+    return (lo > hi) ? 0 : ((gt | eq_lo) & (lt | eq_hi));
+}
+
+size_t BitSlicedIndex::range(const field_t *field, uint32_t lo, uint32_t hi, bool negate,
+        uint64_t *bits, size_t nwords) const
+{
+    const size_t WORDS = Bitmap::SEGMENT_SIZE;
+    size_t total = 0;
+    nwords = std::min(nwords, this->word_num());
+    for (size_t seg = 0; seg * WORDS < nwords; ++seg)
+    {
+        const size_t n = std::min(WORDS, nwords - seg * WORDS);
+        uint64_t *out = bits + seg * WORDS;
+        const uint64_t *exist = m_exist.segment(seg);
+        if (NULL == exist)
+        {
+            ::memset(out, 0, n * sizeof(uint64_t));
+            continue;
+        }
+        const uint64_t *slices[SLICE_NUM];
+        for (int b = 0; b < SLICE_NUM; ++b)
+        {
+            slices[b] = field ? field->slices[b].segment(seg) : NULL;
+        }
+        for (size_t i = 0; i < n; ++i)
+        {
+            for (int retry = 0; ; ++retry) /* 同一个字的所有切片在同一版本下计算 */
+            {
+                const uint32_t *versions = m_version.segment(seg);
+                const uint32_t version = versions ? *(const volatile uint32_t *)&versions[i] : 0;
+                if (version & 0x1)
+                {
+                    ::sched_yield();
+                    continue;
+                }
+                if (retry > 0 && field) /* 期间可能分配了新的切片段 */
+                {
+                    for (int b = 0; b < SLICE_NUM; ++b)
+                    {
+                        slices[b] = field->slices[b].segment(seg);
+                    }
+                }
+                __sync_synchronize();
+                const uint64_t e = *(const volatile uint64_t *)&exist[i];
+                if (0 == e || NULL == field)   /* field为NULL时只取exist */
+                {
+                    out[i] = (NULL == field && !negate) ? e : 0;
+                }
+                else
+                {
+                    const uint64_t in = eval_word(slices, i, e, lo, hi);
+                    out[i] = negate ? (e & ~in) : in;
+                }
+                __sync_synchronize();
+                versions = m_version.segment(seg);
+                if (version == (versions ? *(const volatile uint32_t *)&versions[i] : 0))
+                {
+                    break;
+                }
+            }
+            total += __builtin_popcountll(out[i]);
+        }
+    }
+    return total;
+}
+
+size_t BitSlicedIndex::mem_used() const
+{
+    size_t mem = sizeof(*this) + m_exist.mem_used() + m_version.mem_used();
+    for (size_t i = 0; i < m_fields.size(); ++i)
+    {
+        for (int b = 0; b < SLICE_NUM; ++b)
+        {
+            mem += m_fields[i]->slices[b].mem_used();
+        }
+    }
+    return mem;
+}
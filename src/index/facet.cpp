@@ -0,0 +1,248 @@
+#include <pthread.h>
+#include <algorithm>
+#include "log_utils.h"
+#include "index/facet.h"
+
+bool FacetCounter::init(const ForwardIndex *forward, const char *field)
+{
+    if (NULL == forward || NULL == field)
+    {
+        P_WARNING("invalid parameter");
+        return false;
+    }
+    if (ForwardIndex::INT_TYPE != forward->get_type_by_name(field))
+    {
+        P_WARNING("field[%s] is not int", field);
+        return false;
+    }
+    m_forward = forward;
+    m_column = forward->columns() ? forward->columns()->get_column(field) : NULL;
+    m_array_offset = forward->get_array_offset_by_name(field);
+    this->clear();
+    return true;
+}
+
+void FacetCounter::clear()
+{
+    m_doc_num = 0;
+    m_dense.clear();
+    m_sparse.clear();
+}
+
+void FacetCounter::add_slow(int32_t value)
+{
+    if (value >= 0 && value < DENSE_LIMIT)
+    {
+        size_t size = std::max(m_dense.size() * 2, (size_t)1024);
+        while (size <= (size_t)value)
+        {
+            size *= 2;
+        }
+        m_dense.resize(std::min(size, (size_t)DENSE_LIMIT), 0);
+        ++m_dense[value];
+    }
+    else
+    {
+        ++m_sparse[value];
+    }
+}
+
+void FacetCounter::count_column(const int32_t *ids, size_t num)
+{
+    const ColumnStore &columns = *m_forward->columns();
+    const ColumnStore::Data &data = m_column->data;
+    const size_t PREFETCH_DISTANCE = 16;
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < num)
+        {
+            data.prefetch((uint32_t)ids[i + PREFETCH_DISTANCE]);
+        }
+        if (columns.is_live((uint32_t)ids[i]))
+        {
+            this->add((int32_t)*data.at((uint32_t)ids[i]));
+            ++m_doc_num;
+        }
+    }
+}
+
+void FacetCounter::count_rows(const int32_t *ids, size_t num)
+{
+    void *infos[BATCH_SIZE];
+    for (size_t off = 0; off < num; off += BATCH_SIZE)
+    {
+        const size_t n = std::min(num - off, (size_t)BATCH_SIZE);
+        m_forward->get_infos_by_ids(ids + off, n, infos);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (infos[i])
+            {
+                this->add(((const int32_t *)infos[i])[m_array_offset]);
+                ++m_doc_num;
+            }
+        }
+    }
+}
+
+void FacetCounter::count(const int32_t *ids, size_t num)
+{
+    if (NULL == m_forward)
+    {
+        P_WARNING("counter is not inited");
+        return ;
+    }
+    if (m_column)
+    {
+        this->count_column(ids, num);
+    }
+    else
+    {
+        this->count_rows(ids, num);
+    }
+}
+
+namespace
+{
+    struct count_arg_t
+    {
+        FacetCounter *counter;
+        const int32_t *ids;
+        size_t num;
+    };
+}
+
+void *FacetCounter::count_thread(void *arg)
+{
+    count_arg_t *ca = (count_arg_t *)arg;
+    ca->counter->count(ca->ids, ca->num);
+    return NULL;
+}
+
+void FacetCounter::count(const int32_t *ids, size_t num, int thread_num)
+{
+    if (thread_num <= 1 || num < (size_t)MIN_PARALLEL_NUM)
+    {
+        this->count(ids, num);
+        return ;
+    }
+    const size_t part = (num + thread_num - 1) / thread_num;
+    std::vector<FacetCounter> counters(thread_num);
+    std::vector<count_arg_t> args(thread_num);
+    std::vector<pthread_t> tids(thread_num);
+    std::vector<bool> started(thread_num, false);
+    for (int i = 0; i < thread_num; ++i)
+    {
+        counters[i].m_forward = m_forward;
+        counters[i].m_column = m_column;
+        counters[i].m_array_offset = m_array_offset;
+        args[i].counter = &counters[i];
+        args[i].ids = ids + std::min(num, part * i);
+        args[i].num = std::min(num, part * (i + 1)) - std::min(num, part * i);
+    }
+    for (int i = 1; i < thread_num; ++i)
+    {
+        if (::pthread_create(&tids[i], NULL, count_thread, &args[i]) == 0)
+        {
+            started[i] = true;
+        }
+        else
+        {
+            P_WARNING("failed to create count thread[%d], count in current thread", i);
+            count_thread(&args[i]);
+        }
+    }
+    count_thread(&args[0]);
+    for (int i = 0; i < thread_num; ++i)
+    {
+        if (started[i])
+        {
+            ::pthread_join(tids[i], NULL);
+        }
+        this->merge(counters[i]);
+    }
+}
+
+size_t FacetCounter::count(DocList *list)
+{
+    if (NULL == list)
+    {
+        return 0;
+    }
+    int32_t ids[BATCH_SIZE];
+    size_t num = 0;
+    size_t total = 0;
+    for (int32_t docid = list->first(); docid != -1; docid = list->next())
+    {
+        ids[num++] = docid;
+        if (num == (size_t)BATCH_SIZE)
+        {
+            this->count(ids, num);
+            total += num;
+            num = 0;
+        }
+    }
+    this->count(ids, num);
+    return total + num;
+}
+
+void FacetCounter::merge(const FacetCounter &other)
+{
+    if (m_dense.size() < other.m_dense.size())
+    {
+        m_dense.resize(other.m_dense.size(), 0);
+    }
+    for (size_t i = 0; i < other.m_dense.size(); ++i)
+    {
+        m_dense[i] += other.m_dense[i];
+    }
+    for (Map::const_iterator it = other.m_sparse.begin(); it != other.m_sparse.end(); ++it)
+    {
+        m_sparse[it->first] += it->second;
+    }
+    m_doc_num += other.m_doc_num;
+}
+
+namespace
+{
+    struct FacetCompare
+    {
+        bool operator() (const facet_t &left, const facet_t &right) const
+        {
+            if (left.count != right.count)
+            {
+                return left.count > right.count;
+            }
+            return left.value < right.value;
+        }
+    };
+}
+
+void FacetCounter::top(size_t n, std::vector<facet_t> &result) const
+{
+    result.clear();
+    facet_t facet;
+    for (size_t i = 0; i < m_dense.size(); ++i)
+    {
+        if (m_dense[i] > 0)
+        {
+            facet.value = (int32_t)i;
+            facet.count = m_dense[i];
+            result.push_back(facet);
+        }
+    }
+    for (Map::const_iterator it = m_sparse.begin(); it != m_sparse.end(); ++it)
+    {
+        facet.value = it->first;
+        facet.count = it->second;
+        result.push_back(facet);
+    }
+    if (0 == n || n >= result.size())
+    {
+        std::sort(result.begin(), result.end(), FacetCompare());
+    }
+    else
+    {
+        std::partial_sort(result.begin(), result.begin() + n, result.end(), FacetCompare());
+        result.resize(n);
+    }
+}
@@ -0,0 +1,647 @@
+#include <math.h>
+#include <limits.h>
+#include <string.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "log_utils.h"
+#include "index/field_filter.h"
+
+static int32_t clamp_int32(double value)
+{
+    if (value <= (double)INT_MIN)
+    {
+        return INT_MIN;
+    }
+    if (value >= (double)INT_MAX)
+    {
+        return INT_MAX;
+    }
+    return (int32_t)value;
+}
+
+/* 不小于value的最小float */
+static float float_ceil(double value)
+{
+    float f = (float)value;
+    while ((double)f < value)
+    {
+        f = ::nextafterf(f, HUGE_VALF);
+    }
+    return f;
+}
+
+/* 不大于value的最大float */
+static float float_floor(double value)
+{
+    float f = (float)value;
+    while ((double)f > value)
+    {
+        f = ::nextafterf(f, -HUGE_VALF);
+    }
+    return f;
+}
+
+bool FieldFilter::resolve(const char *field, clause_t &clause) const
+{
+    if (NULL == m_forward || NULL == field)
+    {
+        P_WARNING("filter is not inited");
+        return false;
+    }
+    clause.type = m_forward->get_type_by_name(field);
+    if (ForwardIndex::INT_TYPE != clause.type && ForwardIndex::FLOAT_TYPE != clause.type)
+    {
+        P_WARNING("field[%s] is not int/float, type=%d", field, clause.type);
+        return false;
+    }
+    clause.array_offset = m_forward->get_array_offset_by_name(field);
+    clause.column = m_forward->columns() ? m_forward->columns()->get_column(field) : NULL;
+    clause.bsi = m_forward->bsi() ? m_forward->bsi()->get_field(field) : NULL;
+    clause.negate = false;
+    clause.is_in = false;
+    clause.ilo = INT_MIN;
+    clause.ihi = INT_MAX;
+    clause.flo = -HUGE_VALF;
+    clause.fhi = HUGE_VALF;
+    return true;
+}
+
+bool FieldFilter::add(const char *field, int op, double value)
+{
+    clause_t clause;
+    if (!this->resolve(field, clause))
+    {
+        return false;
+    }
+    bool empty = false;
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+        const double fl = ::floor(value);
+        const double ce = ::ceil(value);
+        switch (op)
+        {
+            case OP_EQ:
+            case OP_NE:
+                if (fl != value || fl < (double)INT_MIN || fl > (double)INT_MAX)
+                    /* 非int32值，EQ全不满足，NE全满足 */
+                {
+                    empty = (OP_EQ == op);
+                }
+                else
+                {
+                    clause.ilo = clause.ihi = clamp_int32(fl);
+                    clause.negate = (OP_NE == op);
+                }
+                break;
+            case OP_LT:
+                empty = (ce - 1 < (double)INT_MIN);
+                clause.ihi = clamp_int32(ce - 1);
+                break;
+            case OP_LE:
+                empty = (fl < (double)INT_MIN);
+                clause.ihi = clamp_int32(fl);
+                break;
+            case OP_GT:
+                empty = (fl + 1 > (double)INT_MAX);
+                clause.ilo = clamp_int32(fl + 1);
+                break;
+            case OP_GE:
+                empty = (ce > (double)INT_MAX);
+                clause.ilo = clamp_int32(ce);
+                break;
+            default:
+                P_WARNING("invalid op=%d, field[%s]", op, field);
+                return false;
+        }
+        if (empty) /* [1, 0] */
+        {
+            clause.ilo = 1;
+            clause.ihi = 0;
+        }
+    }
+    else
+    {
+        switch (op)
+        {
+            case OP_EQ:
+            case OP_NE:
+                if ((double)(float)value != value)
+                {
+                    empty = (OP_EQ == op);
+                }
+                else
+                {
+                    clause.flo = clause.fhi = (float)value;
+                    clause.negate = (OP_NE == op);
+                }
+                break;
+            case OP_LT:
+                clause.fhi = float_floor(value);
+                if ((double)clause.fhi == value)
+                {
+                    clause.fhi = ::nextafterf(clause.fhi, -HUGE_VALF);
+                }
+                break;
+            case OP_LE:
+                clause.fhi = float_floor(value);
+                break;
+            case OP_GT:
+                clause.flo = float_ceil(value);
+                if ((double)clause.flo == value)
+                {
+                    clause.flo = ::nextafterf(clause.flo, HUGE_VALF);
+                }
+                break;
+            case OP_GE:
+                clause.flo = float_ceil(value);
+                break;
+            default:
+                P_WARNING("invalid op=%d, field[%s]", op, field);
+                return false;
+        }
+        if (empty)
+        {
+            clause.flo = 1;
+            clause.fhi = 0;
+        }
+    }
+    m_columnar = m_columnar && clause.column;
+    m_bitmap = m_bitmap && (clause.column || clause.bsi);
+    m_clauses.push_back(clause);
+    return true;
+}
+
+bool FieldFilter::add_between(const char *field, double lo, double hi)
+{
+    clause_t clause;
+    if (!this->resolve(field, clause))
+    {
+        return false;
+    }
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+        const double ce = ::ceil(lo);
+        const double fl = ::floor(hi);
+        if (ce > fl || ce > (double)INT_MAX || fl < (double)INT_MIN)
+        {
+            clause.ilo = 1;
+            clause.ihi = 0;
+        }
+        else
+        {
+            clause.ilo = clamp_int32(ce);
+            clause.ihi = clamp_int32(fl);
+        }
+    }
+    else
+    {
+        clause.flo = float_ceil(lo);
+        clause.fhi = float_floor(hi);
+    }
+    m_columnar = m_columnar && clause.column;
+    m_bitmap = m_bitmap && (clause.column || clause.bsi);
+    m_clauses.push_back(clause);
+    return true;
+}
+
+bool FieldFilter::add_in(const char *field, const std::vector<int32_t> &values)
+{
+    clause_t clause;
+    if (!this->resolve(field, clause))
+    {
+        return false;
+    }
+    if (ForwardIndex::INT_TYPE != clause.type)
+    {
+        P_WARNING("IN only supports int field, field[%s]", field);
+        return false;
+    }
+    clause.is_in = true;
+    clause.in = values;
+    std::sort(clause.in.begin(), clause.in.end());
+    clause.in.erase(std::unique(clause.in.begin(), clause.in.end()), clause.in.end());
+    m_columnar = m_columnar && clause.column;
+    m_bitmap = m_bitmap && (clause.column || clause.bsi);
+    m_clauses.push_back(clause);
+    return true;
+}
+
+static inline bool test_int(int32_t value, int32_t lo, int32_t hi, bool negate)
+{
+    return (value >= lo && value <= hi) != negate;
+}
+
+static inline bool test_float(float value, float lo, float hi, bool negate)
+{
+    return (value >= lo && value <= hi) != negate;
+}
+
+bool FieldFilter::match_value(const clause_t &clause, const void *info) const
+{
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+        const int32_t value = ((const int32_t *)info)[clause.array_offset];
+        if (clause.is_in)
+        {
+            return std::binary_search(clause.in.begin(), clause.in.end(), value);
+        }
+        return test_int(value, clause.ilo, clause.ihi, clause.negate);
+    }
+    return test_float(((const float *)info)[clause.array_offset],
+            clause.flo, clause.fhi, clause.negate);
+}
+
+bool FieldFilter::match(const void *info) const
+{
+    if (NULL == info)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < m_clauses.size(); ++i)
+    {
+        if (!this->match_value(m_clauses[i], info))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool FieldFilter::match_column(const clause_t &clause, uint32_t value)
+{
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+        if (clause.is_in)
+        {
+            return std::binary_search(clause.in.begin(), clause.in.end(), (int32_t)value);
+        }
+        return test_int((int32_t)value, clause.ilo, clause.ihi, clause.negate);
+    }
+    union { uint32_t u; float f; } tmp;
+    tmp.u = value;
+    return test_float(tmp.f, clause.flo, clause.fhi, clause.negate);
+}
+
+size_t FieldFilter::filter_columns(int32_t *ids, size_t num) const
+    /* 每个docid在同一版本下算完所有列存条件，满足的docid原地压缩到ids前部 */
+{
+    const ColumnStore &columns = *m_forward->columns();
+    const size_t PREFETCH_DISTANCE = 16;
+    size_t k = 0;
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (i + PREFETCH_DISTANCE < num)
+        {
+            for (size_t j = 0; j < m_clauses.size(); ++j)
+            {
+                if (m_clauses[j].column)
+                {
+                    m_clauses[j].column->data.prefetch((uint32_t)ids[i + PREFETCH_DISTANCE]);
+                }
+            }
+        }
+        const uint32_t id = (uint32_t)ids[i];
+        bool pass;
+        uint32_t version;
+        do
+        {
+            version = columns.row_version(id);
+            pass = columns.is_live(id);
+            for (size_t j = 0; pass && j < m_clauses.size(); ++j)
+            {
+                if (m_clauses[j].column)
+                {
+                    pass = match_column(m_clauses[j], *m_clauses[j].column->data.at(id));
+                }
+            }
+        } while (columns.row_changed(id, version));
+        ids[k] = ids[i];
+        k += pass;
+    }
+    return k;
+}
+
+size_t FieldFilter::filter_rows(int32_t *ids, size_t num) const
+    /* 按批取行存，get_infos_by_ids负责预取 */
+{
+    void *infos[BATCH_SIZE];
+    size_t k = 0;
+    for (size_t off = 0; off < num; off += BATCH_SIZE)
+    {
+        const size_t n = std::min(num - off, (size_t)BATCH_SIZE);
+        m_forward->get_infos_by_ids(ids + off, n, infos);
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (NULL == infos[i])
+            {
+                continue;
+            }
+            bool pass = true;
+            for (size_t j = 0; pass && j < m_clauses.size(); ++j)
+            {
+                if (NULL == m_clauses[j].column)
+                {
+                    pass = this->match_value(m_clauses[j], infos[i]);
+                }
+            }
+            ids[k] = ids[off + i];
+            k += pass;
+        }
+    }
+    return k;
+}
+
+size_t FieldFilter::filter(int32_t *ids, size_t num) const
+{
+    if (NULL == m_forward)
+    {
+        return 0;
+    }
+    bool has_column_clause = false;
+    bool has_row_clause = false;
+    for (size_t i = 0; i < m_clauses.size(); ++i)
+    {
+        if (m_clauses[i].column)
+        {
+            has_column_clause = true;
+        }
+        else
+        {
+            has_row_clause = true;
+        }
+    }
+    if (has_column_clause && num > 0) /* 先过列存条件，行存只读剩下的 */
+    {
+        num = this->filter_columns(ids, num);
+    }
+    if (num > 0 && (has_row_clause || m_clauses.empty()))
+    {
+        num = this->filter_rows(ids, num);
+    }
+    return num;
+}
+
+uint64_t FieldFilter::eval64(const clause_t &clause, const uint32_t *values)
+    /* 计算连续64个值的结果位图 */
+{
+    uint64_t mask = 0;
+    if (clause.is_in)
+    {
+#ifdef __SSE2__
+        if (clause.in.size() <= 8)
+        {
+            for (int i = 0; i < 64; i += 4)
+            {
+                const __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+                __m128i eq = _mm_setzero_si128();
+                for (size_t j = 0; j < clause.in.size(); ++j)
+                {
+                    eq = _mm_or_si128(eq, _mm_cmpeq_epi32(v, _mm_set1_epi32(clause.in[j])));
+                }
+                mask |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(eq)) << i;
+            }
+            return mask;
+        }
+#endif
+        for (int i = 0; i < 64; ++i)
+        {
+            if (std::binary_search(clause.in.begin(), clause.in.end(), (int32_t)values[i]))
+            {
+                mask |= ((uint64_t)1) << i;
+            }
+        }
+        return mask;
+    }
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+#ifdef __SSE2__
+        const __m128i lo = _mm_set1_epi32(clause.ilo);
+        const __m128i hi = _mm_set1_epi32(clause.ihi);
+        for (int i = 0; i < 64; i += 4)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+            const __m128i out = _mm_or_si128(_mm_cmplt_epi32(v, lo), _mm_cmpgt_epi32(v, hi));
+            mask |= (uint64_t)(_mm_movemask_ps(_mm_castsi128_ps(out)) ^ 0xF) << i;
+        }
+#else
+        for (int i = 0; i < 64; ++i)
+        {
+            mask |= (uint64_t)test_int((int32_t)values[i], clause.ilo, clause.ihi, false) << i;
+        }
+#endif
+    }
+    else
+    {
+#ifdef __SSE2__
+        const __m128 lo = _mm_set1_ps(clause.flo);
+        const __m128 hi = _mm_set1_ps(clause.fhi);
+        for (int i = 0; i < 64; i += 4)
+        {
+            const __m128 v = _mm_loadu_ps((const float *)(values + i));
+            const __m128 in = _mm_and_ps(_mm_cmpge_ps(v, lo), _mm_cmple_ps(v, hi));
+            mask |= (uint64_t)_mm_movemask_ps(in) << i;
+        }
+#else
+        for (int i = 0; i < 64; ++i)
+        {
+            mask |= (uint64_t)test_float(((const float *)values)[i], clause.flo, clause.fhi, false) << i;
+        }
+#endif
+    }
+    return clause.negate ? ~mask : mask;
+}
+
+size_t FieldFilter::scan(uint32_t begin, uint32_t end, uint64_t *bits) const
+{
+    const ColumnStore *columns = m_forward ? m_forward->columns() : NULL;
+    if (NULL == columns || !m_columnar)
+    {
+        P_WARNING("filter has non-columnar field, cannot scan");
+        return 0;
+    }
+    if (begin & 63)
+    {
+        P_WARNING("begin[%u] must be aligned to 64", begin);
+        return 0;
+    }
+    if (end > columns->capacity())
+    {
+        end = columns->capacity();
+    }
+    const uint32_t SEGMENT_SIZE = ColumnStore::Data::SEGMENT_SIZE;
+    size_t total = 0;
+    for (uint32_t base = begin; base < end; base += 64)
+    {
+        const uint32_t seg_no = base / SEGMENT_SIZE;
+        const uint32_t pos = base % SEGMENT_SIZE;
+        const uint64_t *live = columns->live_segment(seg_no);
+        uint64_t mask;
+        uint32_t version;
+        do
+        {
+            version = columns->row_version(base);
+            mask = live ? *(const volatile uint64_t *)&live[pos >> 6] : 0;
+            for (size_t i = 0; mask && i < m_clauses.size(); ++i)
+            {
+                const uint32_t *values = m_clauses[i].column->data.segment(seg_no);
+                mask = values ? (mask & eval64(m_clauses[i], values + pos)) : 0;
+            }
+        } while (columns->row_changed(base, version));
+        if (end - base < 64)
+        {
+            mask &= (((uint64_t)1) << (end - base)) - 1;
+        }
+        bits[(base - begin) >> 6] = mask;
+        total += __builtin_popcountll(mask);
+    }
+    return total;
+}
+
+size_t FieldFilter::eval_bsi(const clause_t &clause, uint64_t *bits, size_t nwords) const
+{
+    const BitSlicedIndex &bsi = *m_forward->bsi();
+    if (ForwardIndex::INT_TYPE == clause.type)
+    {
+        if (!clause.is_in)
+        {
+            return bsi.range(clause.bsi, BitSlicedIndex::encode_int(clause.ilo),
+                    BitSlicedIndex::encode_int(clause.ihi), clause.negate, bits, nwords);
+        }
+        ::memset(bits, 0, nwords * sizeof(uint64_t));
+        std::vector<uint64_t> tmp(nwords);
+        for (size_t i = 0; i < clause.in.size(); ++i) /* IN按多个EQ求并 */
+        {
+            const uint32_t value = BitSlicedIndex::encode_int(clause.in[i]);
+            if (bsi.range(clause.bsi, value, value, false, &tmp[0], nwords) > 0)
+            {
+                for (size_t w = 0; w < nwords; ++w)
+                {
+                    bits[w] |= tmp[w];
+                }
+            }
+        }
+        size_t total = 0;
+        for (size_t w = 0; w < nwords; ++w)
+        {
+            total += __builtin_popcountll(bits[w]);
+        }
+        return total;
+    }
+    /* -0.0和+0.0相等，编码后却不同，区间端点取外侧 */
+    const float lo = (0 == clause.flo) ? -0.0f : clause.flo;
+    const float hi = (0 == clause.fhi) ? 0.0f : clause.fhi;
+    return bsi.range(clause.bsi, BitSlicedIndex::encode_float(lo),
+            BitSlicedIndex::encode_float(hi), clause.negate, bits, nwords);
+}
+
+size_t FieldFilter::to_bitmap(std::vector<uint64_t> &bits) const
+{
+    bits.clear();
+    if (!this->is_bitmap())
+    {
+        P_WARNING("filter has field without bsi or column, cannot make bitmap");
+        return 0;
+    }
+    const BitSlicedIndex *bsi = m_forward->bsi();
+    const ColumnStore *columns = m_forward->columns();
+    const size_t nwords = bsi ? bsi->word_num() : ((size_t)columns->capacity() + 63) >> 6;
+    if (0 == nwords)
+    {
+        return 0;
+    }
+    bits.resize(nwords, 0);
+
+    std::vector<uint64_t> tmp;
+    bool inited = false;
+    for (size_t i = 0; i < m_clauses.size(); ++i)
+    {
+        const clause_t &clause = m_clauses[i];
+        if (NULL == clause.bsi || (clause.is_in && clause.column && clause.in.size() > 8))
+        {
+            continue;
+        }
+        if (!inited)
+        {
+            this->eval_bsi(clause, &bits[0], nwords);
+            inited = true;
+            continue;
+        }
+        tmp.resize(nwords);
+        this->eval_bsi(clause, &tmp[0], nwords);
+        for (size_t w = 0; w < nwords; ++w)
+        {
+            bits[w] &= tmp[w];
+        }
+    }
+    if (!inited) /* 没有BSI条件，从存在的doc开始 */
+    {
+        if (columns)
+        {
+            const size_t WORDS = ColumnStore::Bitmap::SEGMENT_SIZE;
+            for (size_t seg = 0; seg * WORDS < nwords; ++seg)
+            {
+                const uint64_t *live = columns->live_segment((uint32_t)seg);
+                if (live)
+                {
+                    ::memcpy(&bits[seg * WORDS], live,
+                            std::min(WORDS, nwords - seg * WORDS) * sizeof(uint64_t));
+                }
+            }
+        }
+        else
+        {
+            bsi->range(NULL, 0, ~(uint32_t)0, false, &bits[0], nwords);
+        }
+    }
+
+    std::vector<const clause_t *> column_clauses;
+    for (size_t i = 0; i < m_clauses.size(); ++i)
+    {
+        const clause_t &clause = m_clauses[i];
+        if (NULL == clause.bsi || (clause.is_in && clause.column && clause.in.size() > 8))
+        {
+            column_clauses.push_back(&clause);
+        }
+    }
+    const uint32_t SEGMENT_SIZE = ColumnStore::Data::SEGMENT_SIZE;
+    for (size_t w = 0; !column_clauses.empty() && w < nwords; ++w) /* 只对还有候选的字读列存 */
+    {
+        if (0 == bits[w])
+        {
+            continue;
+        }
+        const uint32_t base = (uint32_t)(w << 6);
+        uint64_t mask;
+        uint32_t version;
+        do /* 同一个字的所有列存条件在同一版本下计算 */
+        {
+            version = columns->row_version(base);
+            mask = bits[w];
+            for (size_t i = 0; mask && i < column_clauses.size(); ++i)
+            {
+                const uint32_t *values = column_clauses[i]->column->data.segment(base / SEGMENT_SIZE);
+                mask = values ? (mask & eval64(*column_clauses[i], values + base % SEGMENT_SIZE)) : 0;
+            }
+        } while (columns->row_changed(base, version));
+        bits[w] = mask;
+    }
+    size_t total = 0;
+    for (size_t w = 0; w < nwords; ++w)
+    {
+        total += __builtin_popcountll(bits[w]);
+    }
+    return total;
+}
+
+DocList *FieldFilter::to_list(int8_t type) const
+{
+    std::vector<uint64_t> bits;
+    this->to_bitmap(bits);
+    if (bits.empty())
+    {
+        return NULL;
+    }
+    return new (std::nothrow) BitmapList(type, bits);
+}
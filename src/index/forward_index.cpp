@@ -1,3 +1,5 @@
+#include <new>
+#include <limits.h>
 #include <string>
 #include <sstream>
 #include <fstream>
@@ -13,20 +15,25 @@ std::map<std::string, IDMapper_creater> g_id_mappers;
 
 using namespace google::protobuf;
 
-cJSON *parse_forward_json(const std::string &json, std::vector<forward_data_t> &values)
+cJSON *parse_forward_json(const char *json, std::vector<forward_data_t> &values)
 {
     values.clear();
+    if (NULL == json)
+    {
+        P_WARNING("json is NULL");
+        return NULL;
+    }
 
-    cJSON *object = cJSON_Parse(json.c_str());
+    cJSON *object = cJSON_Parse(json);
     if (NULL == object)
     {
-        P_WARNING("failed to parse json<%s>", json.c_str());
+        P_WARNING("failed to parse json<%s>", json);
         return NULL;
     }
     forward_data_t data;
     if (cJSON_Object != object->type)
     {
-        P_WARNING("invalid json<%s>, must be an Object", json.c_str());
+        P_WARNING("invalid json<%s>, must be an Object", json);
         goto FAIL;
     }
     for (cJSON *c = object->child; c; c = c->next)
@@ -39,7 +46,7 @@ cJSON *parse_forward_json(const std::string &json, std::vector<forward_data_t> &
             }
         } else {
             P_WARNING("invalid json<%s>, value of <%s> cannot be an Array",
-                    json.c_str(), c->string);
+                    json, c->string);
             goto FAIL;
         }
     }
@@ -50,6 +57,11 @@ FAIL:
     return NULL;
 }
 
+cJSON *parse_forward_json(const std::string &json, std::vector<forward_data_t> &values)
+{
+    return parse_forward_json(json.c_str(), values);
+}
+
 bool FieldIterator::next(std::string &field_name, value_t &value)
 {
     ::bzero(&value, sizeof(value));
@@ -137,11 +149,35 @@ void ForwardIndex::cleanup(Hash::node_t *node, intptr_t arg)
     ptr->m_delayed_list.pop_front();
 }
 
+void ForwardIndex::cleanup_direct(void *mem, intptr_t arg)
+    /* info本身由m_pool在回调之后释放 */
+{
+    ForwardIndex *ptr = (ForwardIndex *)arg;
+    if (NULL == ptr || ptr->m_delayed_list.size() == 0)
+    {
+        P_FATAL("should not run to here");
+        ::abort();
+    }
+    cleanup_data_t &cd = ptr->m_delayed_list.front();
+    if (mem != cd.mem)
+    {
+        P_FATAL("should not run to here");
+        ::abort();
+    }
+    cd.clean(&ptr->m_pool);
+    ptr->m_delayed_list.pop_front();
+}
+
 ForwardIndex::ForwardIndex()
 {
     m_idmap = NULL;
     m_dict = NULL;
+    m_direct = NULL;
+    m_direct_num = 0;
+    m_columns = NULL;
+    m_bsi = NULL;
     m_map = NULL;
+    m_memory_image = false;
     /* supported binary size, hard code */
     m_binary_size.push_back(256);
     m_binary_size.push_back(512);
@@ -174,6 +210,28 @@ ForwardIndex::~ForwardIndex()
         delete m_dict;
         m_dict = NULL;
     }
+    if (m_direct)
+    {
+        cleanup_data_t cd(m_cleanup_data);
+        iterator it = this->begin();
+        while (it.next_id(NULL, NULL, &cd.mem))
+        {
+            cd.clean(&m_pool);
+        }
+        delete m_direct;
+        m_direct = NULL;
+        m_direct_num = 0;
+    }
+    if (m_columns)
+    {
+        delete m_columns;
+        m_columns = NULL;
+    }
+    if (m_bsi)
+    {
+        delete m_bsi;
+        m_bsi = NULL;
+    }
     if (m_map)
     {
         delete m_map;
@@ -190,6 +248,8 @@ struct FieldConfig
     int type;
     int offset;
     int size;
+    int columnar;
+    int bsi;
     double default_value;
 };
 
@@ -254,6 +314,8 @@ int ForwardIndex::init(const char *path, const char *file)
             }
 
             field.default_value = 0;
+            field.columnar = 0;
+            field.bsi = 0;
             if (PROTO_TYPE == field.type)
             {
                 ::snprintf(tmpbuf, sizeof tmpbuf, "field_%d_pb_name", i);
@@ -270,6 +332,20 @@ int ForwardIndex::init(const char *path, const char *file)
                     return -1;
                 }
                 oss << "default: " << field.default_value << std::endl;
+
+                ::snprintf(tmpbuf, sizeof tmpbuf, "field_%d_columnar", i);
+                if (conf.get(tmpbuf, ds) && !parseInt32(ds, field.columnar))
+                {
+                    P_WARNING("invalid columnar value[%s]", tmpbuf);
+                    return -1;
+                }
+
+                ::snprintf(tmpbuf, sizeof tmpbuf, "field_%d_bsi", i);
+                if (conf.get(tmpbuf, ds) && !parseInt32(ds, field.bsi))
+                {
+                    P_WARNING("invalid bsi value[%s]", tmpbuf);
+                    return -1;
+                }
             }
 
             field.offset = ((max_size + field.size - 1) & (~(field.size - 1)));
@@ -330,6 +406,7 @@ int ForwardIndex::init(const char *path, const char *file)
                 P_WARNING("duplicate field name[%s]", fields[i].name.c_str());
                 return -1;
             }
+            fd.slot = -1;
             fd.offset = fields[i].offset;
             fd.array_offset = fields[i].offset / fields[i].size;
             fd.type = fields[i].type;
@@ -421,14 +498,121 @@ int ForwardIndex::init(const char *path, const char *file)
             goto FAIL;
         }
         m_idmap->set_pool(&m_id_pool);
-        m_dict = new Hash(bucket_size);
-        if (NULL == m_dict)
         {
-            P_WARNING("failed to init hash dict");
-            goto FAIL;
+            int32_t direct_address = 0;
+            uint32_t max_docid = max_items_num;
+            std::string tmp;
+            if (conf.get("direct_address", tmp) && !parseInt32(tmp, direct_address))
+            {
+                P_WARNING("direct_address must be int32_t");
+                goto FAIL;
+            }
+            if (conf.get("max_docid", tmp) && !parseUInt32(tmp, max_docid))
+            {
+                P_WARNING("max_docid must be uint32_t");
+                goto FAIL;
+            }
+            int32_t memory_image = 0;
+            if (conf.get("memory_image", tmp) && !parseInt32(tmp, memory_image))
+            {
+                P_WARNING("memory_image must be int32_t");
+                goto FAIL;
+            }
+            if (memory_image)
+            {
+                for (size_t i = 0; i < fields.size(); ++i)
+                {
+                    if (PROTO_TYPE == fields[i].type) /* info中存的是Message指针 */
+                    {
+                        P_WARNING("memory_image cannot be used with proto field[%s]", fields[i].name.c_str());
+                        goto FAIL;
+                    }
+                }
+                m_memory_image = true;
+                P_WARNING("using memory image for dump/load");
+            }
+            if (direct_address)
+            {
+                m_direct = new (std::nothrow) DirectArray;
+                if (NULL == m_direct || m_direct->init(max_docid + 1) < 0)
+                {
+                    P_WARNING("failed to init direct array, max_docid=%u", max_docid);
+                    goto FAIL;
+                }
+                P_WARNING("using direct address storage, max_docid[%u]", max_docid);
+            }
+            /* 列存和BSI按docid定长分配，只有docid稠密(direct_address或id_mapper)时才建 */
+            const bool dense_id = m_direct || m_map;
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (!fields[i].columnar)
+                {
+                    continue;
+                }
+                if (!dense_id)
+                {
+                    P_WARNING("field[%s] ignores columnar, need direct_address or id_mapper", fields[i].name.c_str());
+                    continue;
+                }
+                if (NULL == m_columns)
+                {
+                    m_columns = new (std::nothrow) ColumnStore;
+                    if (NULL == m_columns || m_columns->init(max_docid + 1) < 0)
+                    {
+                        P_WARNING("failed to init column store, max_docid=%u", max_docid);
+                        goto FAIL;
+                    }
+                }
+                if (m_columns->add_column(fields[i].name, INT_TYPE == fields[i].type
+                            ? ColumnStore::INT_COLUMN : ColumnStore::FLOAT_COLUMN,
+                            fields[i].offset / fields[i].size) < 0)
+                {
+                    P_WARNING("failed to add column[%s]", fields[i].name.c_str());
+                    goto FAIL;
+                }
+                P_WARNING("field[%s] is columnar", fields[i].name.c_str());
+            }
+            for (size_t i = 0; i < fields.size(); ++i)
+            {
+                if (!fields[i].bsi || (INT_TYPE != fields[i].type && FLOAT_TYPE != fields[i].type))
+                {
+                    continue;
+                }
+                if (!dense_id)
+                {
+                    P_WARNING("field[%s] ignores bsi, need direct_address or id_mapper", fields[i].name.c_str());
+                    continue;
+                }
+                if (NULL == m_bsi)
+                {
+                    m_bsi = new (std::nothrow) BitSlicedIndex;
+                    if (NULL == m_bsi || m_bsi->init(max_docid + 1) < 0)
+                    {
+                        P_WARNING("failed to init bsi, max_docid=%u", max_docid);
+                        goto FAIL;
+                    }
+                }
+                if (m_bsi->add_field(fields[i].name, INT_TYPE == fields[i].type
+                            ? BitSlicedIndex::INT_FIELD : BitSlicedIndex::FLOAT_FIELD,
+                            fields[i].offset / fields[i].size) < 0)
+                {
+                    P_WARNING("failed to add bsi field[%s]", fields[i].name.c_str());
+                    goto FAIL;
+                }
+                P_WARNING("field[%s] has bsi", fields[i].name.c_str());
+            }
+        }
+        if (NULL == m_direct)
+        {
+            m_dict = new Hash(bucket_size);
+            if (NULL == m_dict)
+            {
+                P_WARNING("failed to init hash dict");
+                goto FAIL;
+            }
+            m_dict->set_pool(&m_node_pool);
+            m_dict->set_cleanup(cleanup, (intptr_t)this);
         }
-        m_dict->set_pool(&m_node_pool);
-        m_dict->set_cleanup(cleanup, (intptr_t)this);
         {
             __gnu_cxx::hash_map<std::string, FieldDes>::iterator it = m_fields.begin();
             while (it != m_fields.end())
@@ -461,6 +645,13 @@ int ForwardIndex::init(const char *path, const char *file)
             std::sort(m_cleanup_data.protobuf_fields.begin(), m_cleanup_data.protobuf_fields.end());
             std::sort(m_default_values.begin(), m_default_values.end());
             std::sort(m_field_names.begin(), m_field_names.end());
+            m_slots.clear();
+            for (size_t i = 0; i < m_field_names.size(); ++i) /* slot按offset排序 */
+            {
+                FieldDes &fd = m_fields[m_field_names[i].second];
+                fd.slot = i;
+                m_slots.push_back(fd);
+            }
         }
         m_meta = oss.str();
         {
@@ -487,6 +678,21 @@ FAIL:
         delete m_dict;
         m_dict = NULL;
     }
+    if (m_direct)
+    {
+        delete m_direct;
+        m_direct = NULL;
+    }
+    if (m_columns)
+    {
+        delete m_columns;
+        m_columns = NULL;
+    }
+    if (m_bsi)
+    {
+        delete m_bsi;
+        m_bsi = NULL;
+    }
     if (m_map)
     {
         delete m_map;
@@ -515,20 +721,181 @@ int ForwardIndex::get_array_offset_by_name(const char *name) const
     return it->second.array_offset;
 }
 
+int ForwardIndex::get_slot_by_name(const char *name) const
+{
+    __gnu_cxx::hash_map<std::string, FieldDes>::const_iterator it = m_fields.find(name);
+    if (it == m_fields.end())
+    {
+        return -1;
+    }
+    return it->second.slot;
+}
+
+int ForwardIndex::get_type_by_name(const char *name) const
+{
+    __gnu_cxx::hash_map<std::string, FieldDes>::const_iterator it = m_fields.find(name);
+    if (it == m_fields.end())
+    {
+        return -1;
+    }
+    return it->second.type;
+}
+
 void *ForwardIndex::get_info_by_id(int32_t id, int32_t *oid) const
 {
-    value_t *value = m_dict->find(id);
-    if (value)
+    value_t value;
+    if (this->get_value(id, value))
     {
         if (oid)
         {
-            *oid = value->oid;
+            *oid = value.oid;
         }
-        return m_pool.addr(value->addr);
+        return m_pool.addr(value.addr);
     }
     return NULL;
 }
 
+size_t ForwardIndex::get_infos_by_ids(const int32_t *ids, size_t num,
+        void **infos, int32_t *oids) const
+{
+    const size_t PREFETCH_DISTANCE = 8;
+    size_t found = 0;
+    value_t value;
+    if (m_direct)
+    {
+        for (size_t i = 0; i < num && i < PREFETCH_DISTANCE; ++i)
+        {
+            m_direct->prefetch((uint32_t)ids[i]);
+        }
+    }
+    for (size_t i = 0; i < num; ++i)
+    {
+        if (m_direct && i + PREFETCH_DISTANCE < num)
+        {
+            m_direct->prefetch((uint32_t)ids[i + PREFETCH_DISTANCE]);
+        }
+        if (this->get_value(ids[i], value))
+        {
+            infos[i] = m_pool.addr(value.addr);
+            if (oids)
+            {
+                oids[i] = value.oid;
+            }
+            ++found;
+        }
+        else
+        {
+            infos[i] = NULL;
+            if (oids)
+            {
+                oids[i] = -1;
+            }
+        }
+    }
+    return found;
+}
+
+bool ForwardIndex::insert_value(int32_t id, const value_t &value)
+{
+    if (m_columns && (id < 0 || (uint32_t)id >= m_columns->capacity()))
+    {
+        P_WARNING("id[%d] exceeds max_docid[%u] of column store", id, m_columns->capacity() - 1);
+        return false;
+    }
+    if (m_bsi && (id < 0 || (uint32_t)id >= m_bsi->capacity()))
+    {
+        P_WARNING("id[%d] exceeds max_docid[%u] of bsi", id, m_bsi->capacity() - 1);
+        return false;
+    }
+    if (NULL == m_direct)
+    {
+        if (!m_dict->insert(id, value))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        if (id < 0)
+        {
+            P_WARNING("invalid id[%d] for direct address storage", id);
+            return false;
+        }
+        value_t *slot = m_direct->alloc_at((uint32_t)id);
+        if (NULL == slot)
+        {
+            P_WARNING("id[%d] exceeds max_docid[%u]", id, m_direct->capacity() - 1);
+            return false;
+        }
+        if (0 == slot->addr)
+        {
+            ++m_direct_num;
+        }
+        union { uint64_t u; value_t v; } tmp;
+        tmp.v = value;
+        *(volatile uint64_t *)slot = tmp.u;
+    }
+    if (m_columns && !m_columns->set_row((uint32_t)id, m_pool.addr(value.addr)))
+    {
+        P_FATAL("failed to set columns of id[%d]", id);
+    }
+    if (m_bsi && !m_bsi->set_row((uint32_t)id, m_pool.addr(value.addr)))
+    {
+        P_FATAL("failed to set bsi of id[%d]", id);
+    }
+    return true;
+}
+
+bool ForwardIndex::remove_value(int32_t id, value_t *value)
+{
+    if (m_columns && id >= 0)
+    {
+        m_columns->clear_row((uint32_t)id);
+    }
+    if (m_bsi && id >= 0)
+    {
+        m_bsi->clear_row((uint32_t)id);
+    }
+    if (NULL == m_direct)
+    {
+        return m_dict->remove(id, value);
+    }
+    value_t *slot = m_direct->at((uint32_t)id);
+    if (NULL == slot || 0 == slot->addr)
+    {
+        return false;
+    }
+    if (value)
+    {
+        *value = *slot;
+    }
+    *(volatile uint64_t *)slot = 0;
+    --m_direct_num;
+    return true;
+}
+
+bool ForwardIndex::next_direct(uint32_t &pos, int32_t &id, value_t &value) const
+{
+    const uint32_t capacity = m_direct->capacity();
+    while (pos < capacity)
+    {
+        const value_t *seg = m_direct->segment(pos / DirectArray::SEGMENT_SIZE);
+        if (NULL == seg) /* 跳过整个未分配的段 */
+        {
+            pos = (pos / DirectArray::SEGMENT_SIZE + 1) * DirectArray::SEGMENT_SIZE;
+            continue;
+        }
+        const uint32_t cur = pos++;
+        if (0 != seg[cur % DirectArray::SEGMENT_SIZE].addr)
+        {
+            id = cur;
+            value = seg[cur % DirectArray::SEGMENT_SIZE];
+            return true;
+        }
+    }
+    return false;
+}
+
 int32_t ForwardIndex::get_id_by_oid(int32_t oid) const
 {
     int32_t *value = m_idmap->find(oid);
@@ -540,6 +907,43 @@ int32_t ForwardIndex::get_id_by_oid(int32_t oid) const
 }
 
 bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields, ids_t *p_ids)
+{
+    m_update_values.resize(fields.size());
+    for (size_t i = 0; i < fields.size(); ++i)
+    {
+        forward_value_t &value = m_update_values[i];
+        cJSON *json = fields[i].value;
+        __gnu_cxx::hash_map<std::string, FieldDes>::const_iterator it
+            = m_fields.find(fields[i].key);
+        value.slot = (it == m_fields.end()) ? -1 : it->second.slot;
+        value.number = 0;
+        value.str = NULL;
+        value.len = 0;
+        value.json = json;
+        if (cJSON_Number == json->type)
+        {
+            value.kind = forward_value_t::NUMBER;
+            value.number = json->valuedouble;
+        }
+        else if (cJSON_String == json->type)
+        {
+            value.kind = forward_value_t::STRING;
+            value.str = json->valuestring;
+            value.len = json->valuestring ? ::strlen(json->valuestring) : 0;
+        }
+        else if (cJSON_Object == json->type)
+        {
+            value.kind = forward_value_t::OBJECT;
+        }
+        else
+        {
+            value.kind = forward_value_t::OTHER;
+        }
+    }
+    return this->update(oid, m_update_values, p_ids);
+}
+
+bool ForwardIndex::update(int32_t oid, const std::vector<forward_value_t> &values, ids_t *p_ids)
 {
     vaddr_t vnew = m_pool.alloc(m_info_size);
     void *mem = m_pool.addr(vnew);
@@ -559,10 +963,10 @@ bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields
         if (p_old_id)
         {
             old_id = *p_old_id;
-            const value_t *pv = m_dict->find(old_id);
-            if (pv)
+            value_t old_value;
+            if (this->get_value(old_id, old_value))
             {
-                vold = pv->addr;
+                vold = old_value.addr;
                 old = m_pool.addr(vold);
                 if (NULL == old)
                 {
@@ -603,41 +1007,46 @@ bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields
     cleanup_data_t cd;
     cd.mem = NULL;
     cd.addr = 0;
-    for (size_t i = 0; i < fields.size(); ++i)
+    for (size_t i = 0; i < values.size(); ++i)
     {
-        const forward_data_t &field = fields[i];
-        __gnu_cxx::hash_map<std::string, FieldDes>::const_iterator it
-            = m_fields.find(field.key);
-        if (it == m_fields.end())
+        const forward_value_t &field = values[i];
+        if (field.slot < 0 || field.slot >= (int)m_slots.size())
         {
             continue;
         }
-        const int array_offset = it->second.array_offset;
-        const int type = it->second.type;
+        const char *field_name = m_field_names[field.slot].second.c_str();
+        const int array_offset = m_slots[field.slot].array_offset;
+        const int type = m_slots[field.slot].type;
         if (INT_TYPE == type)
         {
-            if (cJSON_Number == field.value->type)
+            if (forward_value_t::NUMBER == field.kind)
             {
-                ((int *)mem)[array_offset] = field.value->valueint;
+                ((int *)mem)[array_offset] = field.number <= (double)INT_MIN ? INT_MIN
+                    : (field.number >= (double)INT_MAX ? INT_MAX : (int)field.number);
             }
         }
         else if (FLOAT_TYPE == type)
         {
-            if (cJSON_Number == field.value->type)
+            if (forward_value_t::NUMBER == field.kind)
             {
-                ((float *)mem)[array_offset] = field.value->valuedouble;
+                ((float *)mem)[array_offset] = field.number;
             }
         }
         else if (BINARY_TYPE == type)
         {
-            if (cJSON_String == field.value->type && field.value->valuestring)
+            if ((forward_value_t::STRING == field.kind || forward_value_t::RAW == field.kind) && field.str)
             {
-                const int inlen = ::strlen(field.value->valuestring);
+                const char *bytes = m_binary_buffer;
                 int outlen = sizeof(m_binary_buffer);
-                if (::std_base64_decode(m_binary_buffer, &outlen, field.value->valuestring, inlen) != 0)
+                if (forward_value_t::RAW == field.kind) /* 二进制事件中已经是解码后的内容 */
+                {
+                    bytes = field.str;
+                    outlen = field.len;
+                }
+                else if (::std_base64_decode(m_binary_buffer, &outlen, field.str, field.len) != 0)
                 {
                     P_WARNING("failed to decode binary[%s], field_name[%s]",
-                            field.value->valuestring, field.key);
+                            field.str, field_name);
                     goto FAIL;
                 }
                 uint32_t binary_size = 0;
@@ -651,7 +1060,7 @@ bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields
                 }
                 if (0 == binary_size)
                 {
-                    P_WARNING("too long binary length=%d, field_name[%s]", outlen, field.key);
+                    P_WARNING("too long binary length=%d, field_name[%s]", outlen, field_name);
                     goto FAIL;
                 }
                 vaddr_t vbinary = m_pool.alloc(binary_size);
@@ -663,45 +1072,53 @@ bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields
                 }
                 binary[0] = outlen; /* real length */
                 binary[1] = binary_size; /* alloced length */
-                ::memcpy(binary + 2, m_binary_buffer, outlen);
+                ::memcpy(binary + 2, bytes, outlen);
                 ((vaddr_t *)mem)[array_offset] = vbinary;
                 cd.binary_fields.push_back(array_offset);
             }
             else
             {
-                P_WARNING("invalid json type, field_name[%s]", field.key);
+                P_WARNING("invalid json type, field_name[%s]", field_name);
                 goto FAIL;
             }
         }
         else
         {
-            Message *ptr = it->second.default_message->New();
+            Message *ptr = m_slots[field.slot].default_message->New();
             if (NULL == ptr)
             {
-                P_WARNING("failed to new protobuf from default message, field_name[%s]", field.key);
+                P_WARNING("failed to new protobuf from default message, field_name[%s]", field_name);
                 goto FAIL;
             }
             ((void **)mem)[array_offset] = ptr;
             cd.protobuf_fields.push_back(array_offset);
-            if (cJSON_String == field.value->type)
+            if (forward_value_t::STRING == field.kind)
             {
-                if (!json2pb(*ptr, field.value->valuestring))
+                if (!json2pb(*ptr, field.str))
                 {
-                    P_WARNING("failed to parse from json, field_name[%s]", field.key);
+                    P_WARNING("failed to parse from json, field_name[%s]", field_name);
                     goto FAIL;
                 }
             }
-            else if (cJSON_Object == field.value->type)
+            else if (forward_value_t::OBJECT == field.kind)
             {
-                if (!json2pb(*ptr, field.value))
+                if (!json2pb(*ptr, field.json))
                 {
-                    P_WARNING("failed to parse from json, field_name[%s]", field.key);
+                    P_WARNING("failed to parse from json, field_name[%s]", field_name);
+                    goto FAIL;
+                }
+            }
+            else if (forward_value_t::RAW == field.kind)
+            {
+                if (!ptr->ParseFromArray(field.str, field.len))
+                {
+                    P_WARNING("failed to parse from bytes, field_name[%s]", field_name);
                     goto FAIL;
                 }
             }
             else
             {
-                P_WARNING("invalid json type, field_name[%s]", field.key);
+                P_WARNING("invalid json type, field_name[%s]", field_name);
                 goto FAIL;
             }
         }
@@ -720,7 +1137,7 @@ bool ForwardIndex::update(int32_t oid, const std::vector<forward_data_t> &fields
         P_WARNING("failed to map oid[%d] => id[%d]", oid, id);
         goto FAIL;
     }
-    if (!m_dict->insert(id, value))
+    if (!this->insert_value(id, value))
     {
         if (old_id != id) /* rollback m_idmap */
         {
@@ -747,12 +1164,17 @@ FAIL:
     {
         if (old_id != id)
         {
-            m_dict->remove(old_id);
+            this->remove_value(old_id, NULL);
         }
         cd.mem = old;
         cd.addr = vold;
         m_delayed_list.push_back(cd);
+        if (m_direct) /* m_dict通过节点回调释放，直接寻址需自己延迟释放 */
+        {
+            m_pool.delay_free(vold, m_info_size, cleanup_direct, (intptr_t)this);
+        }
     }
+    m_dirty.mark(oid);
     if (p_ids)
     {
         p_ids->old_id = old_id;
@@ -762,12 +1184,26 @@ FAIL:
 }
 
 bool ForwardIndex::remove(int32_t oid, int32_t *p_id)
+{
+    if (!this->remove_oid(oid, p_id))
+    {
+        return false;
+    }
+    if (m_map)
+    {
+        m_map->remove(oid);
+    }
+    m_dirty.mark(oid);
+    return true;
+}
+
+bool ForwardIndex::remove_oid(int32_t oid, int32_t *p_id)
 {
     int32_t id;
     if (m_idmap->remove(oid, &id)) /* remove & get inertnal id from oid */
     {
         value_t value;
-        if (m_dict->remove(id, &value))
+        if (this->remove_value(id, &value))
         {
             if (value.oid != oid)
             {
@@ -776,13 +1212,13 @@ bool ForwardIndex::remove(int32_t oid, int32_t *p_id)
             m_cleanup_data.mem = m_pool.addr(value.addr);
             m_cleanup_data.addr = value.addr;
             m_delayed_list.push_back(m_cleanup_data);
-            if (p_id)
+            if (m_direct)
             {
-                *p_id = id;
+                m_pool.delay_free(value.addr, m_info_size, cleanup_direct, (intptr_t)this);
             }
-            if (m_map)
+            if (p_id)
             {
-                m_map->remove(oid);
+                *p_id = id;
             }
             return true;
         }
@@ -794,33 +1230,430 @@ bool ForwardIndex::remove(int32_t oid, int32_t *p_id)
     return false;
 }
 
-void ForwardIndex::print_meta() const
-{
-    m_pool.print_meta();
-
-    P_WARNING("m_dict:");
-    P_WARNING("    size=%lu", (uint64_t)m_dict->size());
-    P_WARNING("    mem=%lu", (uint64_t)m_dict->mem_used());
-    P_WARNING("    total_mem=%lu", (uint64_t)m_dict->size() * m_info_size);
-
-    P_WARNING("m_idmap:");
-    P_WARNING("    size=%lu", (uint64_t)m_idmap->size());
-    P_WARNING("    mem=%lu", (uint64_t)m_idmap->mem_used());
-}
-
-bool ForwardIndex::dump(const char *dir, FSInterface *fs) const
+size_t ForwardIndex::compact(uint32_t sparse_percent)
 {
-    typedef FSInterface::File File;
-    if (NULL == fs)
+    const size_t released = m_pool.trim(sparse_percent);
+    if (0 == sparse_percent)
     {
-        fs = &DefaultFS::s_default;
+        return released;
     }
-
-    if (NULL == dir || '\0' == *dir)
+    /* m_id_pool和m_node_pool都分配自m_pool，哈希节点随m_pool的页搬迁；flat哈希表不在pool里，删空时缩表 */
+    const size_t moved_ids = m_idmap->compact();
+    size_t moved_nodes = 0;
+    size_t moved_infos = 0;
+    union { uint64_t u; value_t v; } tmp; /* 和读线程一样8字节整体读写 */
+    if (m_direct)
     {
-        P_WARNING("empty dir error");
-        return false;
-    }
+        uint32_t pos = 0;
+        int32_t id;
+        value_t value;
+        while (this->next_direct(pos, id, value))
+        {
+            if (this->move_info(value))
+            {
+                tmp.v = value;
+                *(volatile uint64_t *)m_direct->at((uint32_t)id) = tmp.u;
+                ++moved_infos;
+            }
+        }
+    }
+    else
+    {
+        moved_nodes = m_dict->compact();
+        Hash::iterator it = m_dict->begin();
+        while (it)
+        {
+            tmp.v = it.value();
+            if (this->move_info(tmp.v))
+            {
+                *(volatile uint64_t *)&it.value() = tmp.u;
+                ++moved_infos;
+            }
+            ++it;
+        }
+    }
+    P_WARNING("compact forward: released=%lu, moved ids=%lu, moved nodes=%lu, moved infos=%lu",
+            (uint64_t)released, (uint64_t)moved_ids, (uint64_t)moved_nodes, (uint64_t)moved_infos);
+    return released;
+}
+
+bool ForwardIndex::move_info(value_t &value)
+{
+    const std::vector<int> &binary_fields = m_cleanup_data.binary_fields;
+    const void *mem = m_pool.addr(value.addr);
+    bool move = m_pool.need_move(value.addr);
+    for (size_t i = 0; !move && i < binary_fields.size(); ++i)
+    {
+        move = m_pool.need_move(((const vaddr_t *)mem)[binary_fields[i]]);
+    }
+    if (!move)
+    {
+        return false;
+    }
+    const vaddr_t vnew = m_pool.alloc(m_info_size);
+    void *add = m_pool.addr(vnew);
+    if (NULL == add)
+    {
+        P_WARNING("failed to alloc info, size=%lu", (uint64_t)m_info_size);
+        return false;
+    }
+    ::memcpy(add, mem, m_info_size);
+    for (size_t i = 0; i < binary_fields.size(); ++i)
+    {
+        vaddr_t &vbinary = ((vaddr_t *)add)[binary_fields[i]];
+        if (!m_pool.need_move(vbinary))
+        {
+            continue;
+        }
+        const uint32_t size = ((const uint32_t *)m_pool.addr(vbinary))[1];
+        const vaddr_t vb = m_pool.alloc(size);
+        void *binary = m_pool.addr(vb);
+        if (NULL == binary)
+        {
+            P_WARNING("failed to alloc binary, size=%u", size);
+            continue; /* 留在原页上 */
+        }
+        ::memcpy(binary, m_pool.addr(vbinary), size);
+        m_pool.delay_free(vbinary, size);
+        vbinary = vb;
+    }
+    /* pb字段的Message和binary字段已经转给新info，旧info不调用cleanup */
+    m_pool.delay_free(value.addr, m_info_size);
+    value.addr = vnew;
+    return true;
+}
+
+void ForwardIndex::print_meta() const
+{
+    m_pool.print_meta();
+
+    if (m_direct)
+    {
+        P_WARNING("m_direct:");
+        P_WARNING("    size=%lu", (uint64_t)m_direct_num);
+        P_WARNING("    capacity=%u", m_direct->capacity());
+        P_WARNING("    segments=%u/%u", m_direct->alloced_segment_num(), m_direct->segment_num());
+        P_WARNING("    mem=%lu", (uint64_t)m_direct->mem_used());
+        P_WARNING("    total_mem=%lu", (uint64_t)m_direct_num * m_info_size);
+    }
+    else
+    {
+        P_WARNING("m_dict:");
+        P_WARNING("    size=%lu", (uint64_t)m_dict->size());
+        P_WARNING("    mem=%lu", (uint64_t)m_dict->mem_used());
+        P_WARNING("    total_mem=%lu", (uint64_t)m_dict->size() * m_info_size);
+    }
+    if (m_columns)
+    {
+        P_WARNING("m_columns:");
+        P_WARNING("    columns=%lu", (uint64_t)m_columns->column_num());
+        P_WARNING("    live=%lu", (uint64_t)m_columns->live_num());
+        P_WARNING("    mem=%lu", (uint64_t)m_columns->mem_used());
+    }
+    if (m_bsi)
+    {
+        P_WARNING("m_bsi:");
+        P_WARNING("    fields=%lu", (uint64_t)m_bsi->field_num());
+        P_WARNING("    exist=%lu", (uint64_t)m_bsi->exist_num());
+        P_WARNING("    mem=%lu", (uint64_t)m_bsi->mem_used());
+    }
+
+    P_WARNING("m_idmap:");
+    P_WARNING("    size=%lu", (uint64_t)m_idmap->size());
+    P_WARNING("    mem=%lu", (uint64_t)m_idmap->mem_used());
+}
+
+void ForwardIndex::mem_stats(MemStats &stats, const std::string &prefix, bool detail) const
+{
+    uint64_t attributed = add_hash_stats(stats, prefix + "/idmap", *m_idmap);
+    size_t info_num = 0;
+    if (m_direct)
+    {
+        stats.add(prefix + "/direct", m_direct->mem_used());
+        info_num = m_direct_num;
+    }
+    else
+    {
+        attributed += add_hash_stats(stats, prefix + "/dict", *m_dict);
+        info_num = m_dict->size();
+    }
+    stats.add(prefix + "/infos", (uint64_t)info_num * m_info_size);
+    attributed += (uint64_t)info_num * m_info_size;
+    if (m_columns)
+    {
+        stats.add(prefix + "/columns", m_columns->mem_used());
+    }
+    if (m_bsi)
+    {
+        stats.add(prefix + "/bsi", m_bsi->mem_used());
+    }
+
+    const std::vector<int> &binaries = m_cleanup_data.binary_fields;
+    const std::vector<int> &protos = m_cleanup_data.protobuf_fields;
+    if (detail && (binaries.size() > 0 || protos.size() > 0))
+    {
+        std::vector<uint64_t> binary_bytes(binaries.size(), 0);
+        std::vector<uint64_t> proto_bytes(protos.size(), 0);
+        uint32_t pos = 0;
+        int32_t id;
+        value_t value;
+        Hash::iterator it(m_direct ? NULL : m_dict);
+        while (m_direct ? this->next_direct(pos, id, value) : bool(it))
+        {
+            if (NULL == m_direct)
+            {
+                value = it.value();
+                ++it;
+            }
+            const void *mem = m_pool.addr(value.addr);
+            for (size_t i = 0; i < binaries.size(); ++i)
+            {
+                const uint32_t *binary = (const uint32_t *)m_pool.addr(((const vaddr_t *)mem)[binaries[i]]);
+                if (binary)
+                {
+                    binary_bytes[i] += binary[1];
+                }
+            }
+            for (size_t i = 0; i < protos.size(); ++i)
+            {
+                const Message *message = ((Message * const *)mem)[protos[i]];
+                if (message)
+                {
+                    proto_bytes[i] += message->SpaceUsedLong();
+                }
+            }
+        }
+        std::map<int, std::string> names; /* array_offset => 字段名 */
+        for (__gnu_cxx::hash_map<std::string, FieldDes>::const_iterator fit = m_fields.begin();
+                fit != m_fields.end(); ++fit)
+        {
+            names[fit->second.array_offset] = fit->first;
+        }
+        for (size_t i = 0; i < binaries.size(); ++i)
+        {
+            stats.add(prefix + "/binary/" + names[binaries[i]], binary_bytes[i]);
+            attributed += binary_bytes[i];
+        }
+        for (size_t i = 0; i < protos.size(); ++i)
+        {
+            stats.add(prefix + "/protobuf/" + names[protos[i]], proto_bytes[i]);
+        }
+    }
+    add_pool_stats(stats, prefix + "/pool", m_pool, attributed);
+}
+
+bool ForwardIndex::pack(const void *mem, char *&buffer, size_t &buffer_size, uint32_t &length) const
+{
+    const std::vector<int> &binaries = m_cleanup_data.binary_fields;
+    const std::vector<int> &protos = m_cleanup_data.protobuf_fields;
+    Message *message = NULL;
+
+    length = m_info_size;
+    for (size_t i = 0; i < protos.size(); ++i)
+    {
+        message = ((Message **)mem)[protos[i]];
+        if (message)
+        {
+            length += message->ByteSize();
+        }
+    }
+    for (size_t i = 0; i < binaries.size(); ++i)
+    {
+        vaddr_t vbinary = ((vaddr_t *)mem)[binaries[i]];
+        if (vbinary)
+        {
+            uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
+            length += binary[0];
+        }
+    }
+    if (length > buffer_size)
+    {
+        char *new_buffer = new char[length];
+        if (NULL == new_buffer)
+        {
+            P_WARNING("failed to new buffer, length=%u", length);
+            return false;
+        }
+        delete [] buffer;
+        buffer = new_buffer;
+        buffer_size = length;
+    }
+    ::memcpy(buffer, mem, m_info_size);
+    length = m_info_size;
+    for (size_t i = 0; i < protos.size(); ++i)
+    {
+        message = ((Message **)buffer)[protos[i]];
+        if (message)
+        {
+            if (!message->SerializeToArray(buffer + length, buffer_size - length))
+            {
+                P_WARNING("failed to serialize self define field to bytes");
+                return false;
+            }
+            uint32_t len = message->ByteSize();
+            ((Message **)buffer)[protos[i]] = (Message *)(intptr_t)len;
+            length += len;
+        }
+    }
+    for (size_t i = 0; i < binaries.size(); ++i)
+    {
+        vaddr_t vbinary = ((vaddr_t *)mem)[binaries[i]];
+        if (vbinary)
+        {
+            uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
+            ::memcpy(buffer + length, binary + 2, binary[0]);
+            ((vaddr_t *)buffer)[binaries[i]] = (vaddr_t)binary[0];
+            length += binary[0];
+        }
+    }
+    return true;
+}
+
+bool ForwardIndex::unpack(int32_t oid, int32_t id, const char *buffer, uint32_t length, uint32_t info_size)
+{
+    const std::vector<int> &binaries = m_cleanup_data.binary_fields;
+    const std::vector<int> &protos = m_cleanup_data.protobuf_fields;
+    Message *message = NULL;
+
+    vaddr_t vnew = m_pool.alloc(m_info_size);
+    void *mem = m_pool.addr(vnew);
+    if (NULL == mem)
+    {
+        P_WARNING("failed to alloc mem, oid=%d", oid);
+        return false;
+    }
+    const value_t value = { oid, vnew };
+    ::memcpy(mem, buffer, info_size);
+    if (m_info_size > info_size)
+    {
+        ::memset(((char *)mem) + info_size, 0, m_info_size - info_size);
+    }
+    uint32_t len = info_size;
+    bool fail = false;
+    for (size_t n = 0; n < protos.size(); ++n)
+    {
+        if ((protos[n] + 1) * sizeof(void *) > info_size)
+        {
+            break;
+        }
+        uint32_t tmp_len = (uint32_t)(intptr_t)((void **)mem)[protos[n]];
+        if (tmp_len > 0)
+        {
+            message = m_default_messages[protos[n]]->New();
+            if (NULL == message)
+            {
+                P_WARNING("failed to create message");
+                fail = true;
+            }
+            else if (!message->ParseFromArray(buffer + len, tmp_len))
+            {
+                P_WARNING("failed to deserialize message");
+                fail = true;
+            }
+        }
+        else
+        {
+            message = NULL;
+        }
+        ((Message **)mem)[protos[n]] = message;
+        len += tmp_len;
+    }
+    for (size_t n = 0; n < binaries.size(); ++n)
+    {
+        if ((binaries[n] + 1) * sizeof(vaddr_t) > info_size)
+        {
+            break;
+        }
+        vaddr_t vbinary = 0;
+        uint32_t tmp_len = (uint32_t)((vaddr_t *)mem)[binaries[n]];
+        if (tmp_len > 0)
+        {
+            uint32_t binary_size = 0;
+            for (size_t k = 0; k < m_binary_size.size(); ++k)
+            {
+                if (m_binary_size[k] >= tmp_len + sizeof(uint32_t) + sizeof(uint32_t))
+                {
+                    binary_size = m_binary_size[k];
+                    break;
+                }
+            }
+            if (0 == binary_size)
+            {
+                P_WARNING("too long binary length=%d", tmp_len);
+                fail = true;
+            }
+            else
+            {
+                vbinary = m_pool.alloc(binary_size);
+                uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
+                if (NULL == binary)
+                {
+                    P_WARNING("failed to alloc binary, size=%u", binary_size);
+                    fail = true;
+                }
+                else
+                {
+                    binary[0] = tmp_len;
+                    binary[1] = binary_size;
+                    ::memcpy(binary + 2, buffer + len, tmp_len);
+                }
+            }
+        }
+        ((vaddr_t *)mem)[binaries[n]] = vbinary;
+        len += tmp_len;
+    }
+    for (size_t n = 0; n < m_default_values.size(); ++n)
+    {
+        uint32_t f = m_default_values[n].first;
+        if ((f & ~0x3) < info_size)
+        {
+            continue;
+        }
+        if (f & 0x1)
+        {
+            ((float *)mem)[f >> 2] = m_default_values[n].second;
+        }
+        else
+        {
+            ((int *)mem)[f >> 2] = int(m_default_values[n].second);
+        }
+    }
+    if (len != length)
+    {
+        m_cleanup_data.mem = mem;
+        m_cleanup_data.addr = vnew;
+        m_cleanup_data.clean(&m_pool);
+        P_WARNING("corrupted data, oid=%d", oid);
+        return false;
+    }
+    if (fail || !m_idmap->insert(oid, id) || !this->insert_value(id, value))
+    {
+        m_cleanup_data.mem = mem;
+        m_cleanup_data.addr = vnew;
+        m_cleanup_data.clean(&m_pool);
+        P_WARNING("failed to insert id=%d, oid=%d", id, oid);
+        return false;
+    }
+    return true;
+}
+
+bool ForwardIndex::dump(const char *dir, FSInterface *fs) const
+{
+    typedef FSInterface::File File;
+    if (NULL == fs)
+    {
+        fs = &DefaultFS::s_default;
+    }
+
+    if (NULL == dir || '\0' == *dir)
+    {
+        P_WARNING("empty dir error");
+        return false;
+    }
+    if (m_memory_image)
+    {
+        return this->dump_image(dir, fs);
+    }
     P_WARNING("start to write dir[%s]", dir);
     std::string path(dir);
     if ('/' != path[path.length() - 1])
@@ -843,12 +1676,12 @@ bool ForwardIndex::dump(const char *dir, FSInterface *fs) const
     }
     bool ret = true;
     size_t offset = 0;
-    size_t size = m_dict->size();
+    size_t size = this->doc_num();
     uint32_t length = 0;
-    Message *message = NULL;
-    Hash::iterator it = m_dict->begin();
-    const std::vector<int> &binaries = m_cleanup_data.binary_fields;
-    const std::vector<int> &protos = m_cleanup_data.protobuf_fields;
+    int32_t oid;
+    int32_t id;
+    void *mem;
+    iterator it = this->begin();
 
     size_t buffer_size = 1024*1024;
     char *buffer = new char[buffer_size];
@@ -879,68 +1712,11 @@ bool ForwardIndex::dump(const char *dir, FSInterface *fs) const
         P_WARNING("failed to write m_info_size");
         goto FAIL;
     }
-    while (it)
+    while (it.next_id(&id, &oid, &mem))
     {
-        int32_t oid = it.value().oid;
-        int32_t id = it.key();
-        void *mem = m_pool.addr(it.value().addr);
-        length = m_info_size;
-        for (size_t i = 0; i < protos.size(); ++i)
-        {
-            message = ((Message **)mem)[protos[i]];
-            if (message)
-            {
-                length += message->ByteSize();
-            }
-        }
-        for (size_t i = 0; i < binaries.size(); ++i)
-        {
-            vaddr_t vbinary = ((vaddr_t *)mem)[binaries[i]];
-            if (vbinary)
-            {
-                uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
-                length += binary[0];
-            }
-        }
-        if (length > buffer_size)
-        {
-            char *new_buffer = new char[length];
-            if (NULL == new_buffer)
-            {
-                P_WARNING("failed to new buffer, length=%u", length);
-                goto FAIL;
-            }
-            delete [] buffer;
-            buffer = new_buffer;
-            buffer_size = length;
-        }
-        ::memcpy(buffer, mem, m_info_size);
-        length = m_info_size;
-        for (size_t i = 0; i < protos.size(); ++i)
-        {
-            message = ((Message **)buffer)[protos[i]];
-            if (message)
-            {
-                if (!message->SerializeToArray(buffer + length, buffer_size - length))
-                {
-                    P_WARNING("failed to serialize self define field to bytes");
-                    goto FAIL;
-                }
-                uint32_t len = message->ByteSize();
-                ((Message **)buffer)[protos[i]] = (Message *)(intptr_t)len;
-                length += len;
-            }
-        }
-        for (size_t i = 0; i < binaries.size(); ++i)
+        if (!this->pack(mem, buffer, buffer_size, length))
         {
-            vaddr_t vbinary = ((vaddr_t *)mem)[binaries[i]];
-            if (vbinary)
-            {
-                uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
-                ::memcpy(buffer + length, binary + 2, binary[0]);
-                ((vaddr_t *)buffer)[binaries[i]] = (vaddr_t)binary[0];
-                length += binary[0];
-            }
+            goto FAIL;
         }
         if (fs->fwrite(buffer, length, 1, data) != 1)
         {
@@ -968,7 +1744,6 @@ bool ForwardIndex::dump(const char *dir, FSInterface *fs) const
             goto FAIL;
         }
         offset += length;
-        ++it;
     }
     if (m_map)
     {
@@ -994,7 +1769,7 @@ FAIL:
     return ret;
 }
 
-bool ForwardIndex::load(const char *dir, FSInterface *fs)
+bool ForwardIndex::load(const char *dir, FSInterface *fs, const char *map_dir)
 {
     typedef FSInterface::File File;
     if (NULL == fs)
@@ -1015,6 +1790,7 @@ bool ForwardIndex::load(const char *dir, FSInterface *fs)
     }
     uint32_t total = 0;
     uint32_t info_size = 0;
+    int32_t image = 0;
     TRY
     {
         Config conf(std::string(path.c_str(), path.length() - 1).c_str(), "forward.meta");
@@ -1039,8 +1815,28 @@ bool ForwardIndex::load(const char *dir, FSInterface *fs)
             P_WARNING("m_info_size is smaller, error");
             return false;
         }
-    }
+        std::string tmp;
+        if (conf.get("image", tmp) && !parseInt32(tmp, image))
+        {
+            P_WARNING("failed to parse image");
+            return false;
+        }
+        if (image && 2 != image)
+        {
+            P_WARNING("dir[%s] is a memory image of unsupported version[%d]", dir, image);
+            return false;
+        }
+        if (image && (!m_memory_image || m_info_size != info_size))
+        {
+            P_WARNING("dir[%s] is a memory image, but memory_image is not configured or info_size changed", dir);
+            return false;
+        }
+    }
     WARNING_CATCH_EXC(return false, "failed to get total & info_size from forward.meta");
+    if (image)
+    {
+        return this->load_image(dir, fs, map_dir, total);
+    }
     File idx = fs->fopen((path + "forward.idx").c_str(), "rb");
     if (NULL == idx)
     {
@@ -1057,9 +1853,6 @@ bool ForwardIndex::load(const char *dir, FSInterface *fs)
     }
     bool ret = true;
     size_t offset = 0;
-    Message *message = NULL;
-    const std::vector<int> &binaries = m_cleanup_data.binary_fields;
-    const std::vector<int> &protos = m_cleanup_data.protobuf_fields;
 
     size_t buffer_size = 1024*1024;
     buffer_size = buffer_size > info_size ? buffer_size : info_size;
@@ -1143,136 +1936,287 @@ bool ForwardIndex::load(const char *dir, FSInterface *fs)
             goto FAIL;
         }
         offset += length;
-        vaddr_t vnew = m_pool.alloc(m_info_size);
-        void *mem = m_pool.addr(vnew);
-        if (NULL == mem)
+        if (!this->unpack(oid, id, buffer, length, info_size))
         {
-            P_WARNING("failed to alloc mem, i=%u", i);
+            P_WARNING("failed to load record, i=%u", i);
             goto FAIL;
         }
-        const value_t value = { oid, vnew };
-        ::memcpy(mem, buffer, info_size);
-        if (m_info_size > info_size)
+    }
+    if (m_map)
+    {
+        if (!m_map->load(map_dir ? map_dir : dir, fs))
         {
-            ::memset(((char *)mem) + info_size, 0, m_info_size - info_size);
+            P_WARNING("failed to load id mapper");
+            goto FAIL;
         }
-        uint32_t len = info_size;
-        bool fail = false;
-        for (size_t n = 0; n < protos.size(); ++n)
+        P_WARNING("load id mapper ok");
+    }
+    P_WARNING("read dir[%s] ok", dir);
+    if (0)
+    {
+FAIL:
+        ret = false;
+    }
+    fs->fclose(data);
+    fs->fclose(idx);
+    if (buffer)
+    {
+        delete [] buffer;
+    }
+    return ret;
+}
+
+bool ForwardIndex::dump_image(const char *dir, FSInterface *fs) const
+{
+    typedef FSInterface::File File;
+
+    P_WARNING("start to write image to dir[%s]", dir);
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    File meta = fs->fopen((path + "forward.meta").c_str(), "w+");
+    if (NULL == meta)
+    {
+        P_WARNING("failed to open file[%sforward.meta] for write", path.c_str());
+        return false;
+    }
+    if (fs->fprintf(meta, "total:%lu\n"
+                "info_size:%lu\n"
+                "image:2\n\n"
+                "%s\n",
+                this->doc_num(), m_info_size, m_meta.c_str()) < 0)
+    {
+        fs->fclose(meta);
+
+        P_WARNING("failed to write meta info");
+        return false;
+    }
+    fs->fclose(meta);
+    File fp = fs->fopen((path + "forward.image").c_str(), "wb");
+    if (NULL == fp)
+    {
+        P_WARNING("failed to open file[%sforward.image] for write", path.c_str());
+        return false;
+    }
+    bool ret = true;
+    if (!m_pool.dump_image(fs, fp))
+    {
+        P_WARNING("failed to dump mempool image");
+        goto FAIL;
+    }
+    if (!m_idmap->dump_image(fs, fp))
+    {
+        P_WARNING("failed to dump id map image");
+        goto FAIL;
+    }
+    if (m_direct ? !m_direct->dump_image(fs, fp) : !m_dict->dump_image(fs, fp))
+    {
+        P_WARNING("failed to dump dict image");
+        goto FAIL;
+    }
+    if (m_map)
+    {
+        if (!m_map->dump(dir, fs))
         {
-            if ((protos[n] + 1) * sizeof(void *) > info_size)
-            {
-                break;
-            }
-            uint32_t tmp_len = (uint32_t)(intptr_t)((void **)mem)[protos[n]];
-            if (tmp_len > 0)
-            {
-                message = m_default_messages[protos[n]]->New();
-                if (NULL == message)
-                {
-                    P_WARNING("failed to create message");
-                    fail = true;
-                }
-                else if (!message->ParseFromArray(buffer + len, tmp_len))
-                {
-                    P_WARNING("failed to deserialize message");
-                    fail = true;
-                }
-            }
-            else
-            {
-                message = NULL;
-            }
-            ((Message **)mem)[protos[n]] = message;
-            len += tmp_len;
+            P_WARNING("failed to dump id mapper");
+            goto FAIL;
         }
-        for (size_t n = 0; n < binaries.size(); ++n)
+        P_WARNING("dump id mapper ok");
+    }
+    P_WARNING("write image to dir[%s] ok", dir);
+    if (0)
+    {
+FAIL:
+        ret = false;
+    }
+    fs->fclose(fp);
+    return ret;
+}
+
+bool ForwardIndex::load_image(const char *dir, FSInterface *fs, const char *map_dir, uint32_t total)
+{
+    typedef FSInterface::File File;
+
+    P_WARNING("start to read image from dir[%s]", dir);
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    File fp = fs->fopen((path + "forward.image").c_str(), "rb");
+    if (NULL == fp)
+    {
+        P_WARNING("failed to open file[%sforward.image] for read", path.c_str());
+        return false;
+    }
+    bool ret = true;
+    uint32_t num = 0;
+    if (!m_pool.load_image(fs, fp))
+    {
+        P_WARNING("failed to load mempool image");
+        goto FAIL;
+    }
+    if (!m_idmap->load_image(fs, fp))
+    {
+        P_WARNING("failed to load id map image");
+        goto FAIL;
+    }
+    if (m_direct ? !m_direct->load_image(fs, fp) : !m_dict->load_image(fs, fp))
+    {
+        P_WARNING("failed to load dict image");
+        goto FAIL;
+    }
+    {
+        /* 列存和bsi不在pool中，按正排重建 */
+        int32_t id;
+        void *mem;
+        iterator it = this->begin();
+        while (it.next_id(&id, NULL, &mem))
         {
-            if ((binaries[n] + 1) * sizeof(vaddr_t) > info_size)
+            if (m_columns && !m_columns->set_row((uint32_t)id, mem))
             {
-                break;
+                P_WARNING("failed to set columns of id[%d]", id);
+                goto FAIL;
             }
-            vaddr_t vbinary = 0;
-            uint32_t tmp_len = (uint32_t)((vaddr_t *)mem)[binaries[n]];
-            if (tmp_len > 0)
+            if (m_bsi && !m_bsi->set_row((uint32_t)id, mem))
             {
-                uint32_t binary_size = 0;
-                for (size_t k = 0; k < m_binary_size.size(); ++k)
-                {
-                    if (m_binary_size[k] >= tmp_len + sizeof(uint32_t) + sizeof(uint32_t))
-                    {
-                        binary_size = m_binary_size[k];
-                        break;
-                    }
-                }
-                if (0 == binary_size)
-                {
-                    P_WARNING("too long binary length=%d", tmp_len);
-                    fail = true;
-                }
-                else
-                {
-                    vbinary = m_pool.alloc(binary_size);
-                    uint32_t *binary = (uint32_t *)m_pool.addr(vbinary);
-                    if (NULL == binary)
-                    {
-                        P_WARNING("failed to alloc binary, size=%u", binary_size);
-                        fail = true;
-                    }
-                    else
-                    {
-                        binary[0] = tmp_len;
-                        binary[1] = binary_size;
-                        ::memcpy(binary + 2, buffer + len, tmp_len);
-                    }
-                }
+                P_WARNING("failed to set bsi of id[%d]", id);
+                goto FAIL;
             }
-            ((vaddr_t *)mem)[binaries[n]] = vbinary;
-            len += tmp_len;
+            ++num;
         }
-        for (size_t n = 0; n < m_default_values.size(); ++n)
+    }
+    if (m_direct)
+    {
+        m_direct_num = num;
+    }
+    if (num != total)
+    {
+        P_WARNING("meta show total=%u, but image has %u", total, num);
+        goto FAIL;
+    }
+    if (m_map)
+    {
+        if (!m_map->load(map_dir ? map_dir : dir, fs))
         {
-            uint32_t f = m_default_values[n].first;
-            if ((f & ~0x3) < info_size)
-            {
-                continue;
-            }
-            if (f & 0x1)
+            P_WARNING("failed to load id mapper");
+            goto FAIL;
+        }
+        P_WARNING("load id mapper ok");
+    }
+    P_WARNING("read image from dir[%s] ok, total=%u", dir, total);
+    if (0)
+    {
+FAIL:
+        ret = false;
+    }
+    fs->fclose(fp);
+    return ret;
+}
+
+bool ForwardIndex::dump_delta(const char *dir, uint32_t checkpoint, FSInterface *fs) const
+{
+    typedef FSInterface::File File;
+    if (NULL == fs)
+    {
+        fs = &DefaultFS::s_default;
+    }
+
+    if (NULL == dir || '\0' == *dir)
+    {
+        P_WARNING("empty dir error");
+        return false;
+    }
+    P_WARNING("start to write delta dir[%s], checkpoint=%u", dir, checkpoint);
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    std::vector<uint32_t> oids;
+    m_dirty.collect(checkpoint, oids);
+    {
+        File meta = fs->fopen((path + "forward_delta.meta").c_str(), "w");
+        if (NULL == meta)
+        {
+            P_WARNING("failed to open file[%sforward_delta.meta] for write", path.c_str());
+            return false;
+        }
+        fs->fprintf(meta, "total:%lu\ninfo_size:%lu\n", (uint64_t)oids.size(), (uint64_t)m_info_size);
+        fs->fclose(meta);
+    }
+    File idx = fs->fopen((path + "forward_delta.idx").c_str(), "wb");
+    if (NULL == idx)
+    {
+        P_WARNING("failed to open file[%sforward_delta.idx] for write", path.c_str());
+        return false;
+    }
+    File data = fs->fopen((path + "forward_delta.data").c_str(), "wb");
+    if (NULL == data)
+    {
+        fs->fclose(idx);
+
+        P_WARNING("failed to open file[%sforward_delta.data] for write", path.c_str());
+        return false;
+    }
+    bool ret = true;
+    size_t offset = 0;
+    size_t size = oids.size();
+    size_t removed = 0;
+    size_t buffer_size = 1024*1024;
+    char *buffer = new char[buffer_size];
+    if (fs->fwrite(&size, sizeof(size), 1, idx) != 1
+            || fs->fwrite(&m_info_size, sizeof(m_info_size), 1, idx) != 1)
+    {
+        P_WARNING("failed to write size & info_size");
+        goto FAIL;
+    }
+    for (size_t i = 0; i < oids.size(); ++i)
+    {
+        /* 已经删除的oid写成id为-1、长度为0的记录 */
+        const int32_t oid = oids[i];
+        int32_t id = this->get_id_by_oid(oid);
+        uint32_t length = 0;
+        value_t value;
+        if (id >= 0 && this->get_value(id, value))
+        {
+            if (!this->pack(m_pool.addr(value.addr), buffer, buffer_size, length))
             {
-                ((float *)mem)[f >> 2] = m_default_values[n].second;
+                goto FAIL;
             }
-            else
+            if (fs->fwrite(buffer, length, 1, data) != 1)
             {
-                ((int *)mem)[f >> 2] = int(m_default_values[n].second);
+                P_WARNING("failed to write to data file");
+                goto FAIL;
             }
         }
-        if (len != length)
+        else
         {
-            m_cleanup_data.mem = mem;
-            m_cleanup_data.addr = vnew;
-            m_cleanup_data.clean(&m_pool);
-            P_WARNING("corrupted data file");
-            goto FAIL;
+            id = -1;
+            ++removed;
         }
-        if (fail || !m_idmap->insert(oid, id) || !m_dict->insert(id, value))
+        if (fs->fwrite(&oid, sizeof(oid), 1, idx) != 1
+                || fs->fwrite(&id, sizeof(id), 1, idx) != 1
+                || fs->fwrite(&offset, sizeof(offset), 1, idx) != 1
+                || fs->fwrite(&length, sizeof(length), 1, idx) != 1)
         {
-            m_cleanup_data.mem = mem;
-            m_cleanup_data.addr = vnew;
-            m_cleanup_data.clean(&m_pool);
-            P_WARNING("failed to insert id=%d, oid=%d, i=%u", id, oid, i);
+            P_WARNING("failed to write oid[%d] to idx file", oid);
             goto FAIL;
         }
+        offset += length;
     }
     if (m_map)
     {
-        if (!m_map->load(dir, fs))
+        if (!m_map->dump(dir, fs))
         {
-            P_WARNING("failed to load id mapper");
+            P_WARNING("failed to dump id mapper");
             goto FAIL;
         }
-        P_WARNING("load id mapper ok");
+        P_WARNING("dump id mapper ok");
     }
-    P_WARNING("read dir[%s] ok", dir);
+    P_WARNING("write delta dir[%s] ok, total=%lu, removed=%lu", dir, (uint64_t)size, (uint64_t)removed);
     if (0)
     {
 FAIL:
@@ -1280,9 +2224,138 @@ FAIL:
     }
     fs->fclose(data);
     fs->fclose(idx);
-    if (buffer)
+    delete [] buffer;
+    return ret;
+}
+
+bool ForwardIndex::load_delta(const char *dir, FSInterface *fs)
+{
+    typedef FSInterface::File File;
+    struct record_t
     {
-        delete [] buffer;
+        int32_t oid;
+        int32_t id;
+        uint32_t length;
+    };
+    if (NULL == fs)
+    {
+        fs = &DefaultFS::s_default;
+    }
+
+    if (NULL == dir || '\0' == *dir)
+    {
+        P_WARNING("empty dir error");
+        return false;
+    }
+    P_WARNING("start to read delta dir[%s]", dir);
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
     }
+    uint32_t total = 0;
+    uint32_t info_size = 0;
+    TRY
+    {
+        Config conf(std::string(path.c_str(), path.length() - 1).c_str(), "forward_delta.meta");
+        if (conf.parse() < 0)
+        {
+            P_WARNING("failed parse config[%sforward_delta.meta]", path.c_str());
+            return false;
+        }
+        if (!parseUInt32(conf["total"], total) || !parseUInt32(conf["info_size"], info_size))
+        {
+            P_WARNING("failed to parse total & info_size");
+            return false;
+        }
+        if (m_info_size < info_size)
+        {
+            P_WARNING("m_info_size is smaller, error");
+            return false;
+        }
+    }
+    WARNING_CATCH_EXC(return false, "failed to get total & info_size from forward_delta.meta");
+    File idx = fs->fopen((path + "forward_delta.idx").c_str(), "rb");
+    if (NULL == idx)
+    {
+        P_WARNING("failed to open file[%sforward_delta.idx] for read", path.c_str());
+        return false;
+    }
+    File data = fs->fopen((path + "forward_delta.data").c_str(), "rb");
+    if (NULL == data)
+    {
+        fs->fclose(idx);
+
+        P_WARNING("failed to open file[%sforward_delta.data] for read", path.c_str());
+        return false;
+    }
+    bool ret = true;
+    size_t offset = 0;
+    size_t removed = 0;
+    std::vector<record_t> records;
+    std::vector<char> buffer;
+    {
+        size_t size = 0;
+        size_t tmp = 0;
+        if (fs->fread(&size, sizeof(size), 1, idx) != 1 || size != total
+                || fs->fread(&tmp, sizeof(tmp), 1, idx) != 1 || tmp != info_size)
+        {
+            P_WARNING("failed to check total & info_size of idx");
+            goto FAIL;
+        }
+    }
+    records.resize(total);
+    for (uint32_t i = 0; i < total; ++i)
+    {
+        record_t &r = records[i];
+        size_t tmp;
+        if (fs->fread(&r.oid, sizeof(r.oid), 1, idx) != 1
+                || fs->fread(&r.id, sizeof(r.id), 1, idx) != 1
+                || fs->fread(&tmp, sizeof(tmp), 1, idx) != 1
+                || fs->fread(&r.length, sizeof(r.length), 1, idx) != 1)
+        {
+            P_WARNING("failed to read idx, i=%u", i);
+            goto FAIL;
+        }
+        if (tmp != offset || (r.id < 0 && r.length > 0))
+        {
+            P_WARNING("offset error, offset from idx=%lu, real offset=%lu, i=%u", (uint64_t)tmp, (uint64_t)offset, i);
+            goto FAIL;
+        }
+        offset += r.length;
+    }
+    /* 先删掉所有旧的内容再插入，oid换了id之后原来的id可能已经分给了别的oid */
+    for (uint32_t i = 0; i < total; ++i)
+    {
+        this->remove_oid(records[i].oid, NULL);
+    }
+    for (uint32_t i = 0; i < total; ++i)
+    {
+        const record_t &r = records[i];
+        if (r.id < 0)
+        {
+            ++removed;
+            continue;
+        }
+        buffer.resize(r.length > info_size ? r.length : info_size);
+        if (fs->fread(&buffer[0], r.length, 1, data) != 1)
+        {
+            P_WARNING("failed to get data, i=%u", i);
+            goto FAIL;
+        }
+        if (!this->unpack(r.oid, r.id, &buffer[0], r.length, info_size))
+        {
+            P_WARNING("failed to load record, i=%u", i);
+            goto FAIL;
+        }
+    }
+    P_WARNING("read delta dir[%s] ok, total=%u, removed=%lu", dir, total, (uint64_t)removed);
+    if (0)
+    {
+FAIL:
+        ret = false;
+    }
+    fs->fclose(data);
+    fs->fclose(idx);
     return ret;
 }
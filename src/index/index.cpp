@@ -5,6 +5,8 @@
 #include "index/index.h"
 #include "configure.h"
 #include "str_utils.h"
+#include "pool/epoch.h"
+#include "pool/page_alloc.h"
 
 std::map<std::string, thread_func_t> Index::s_inc_processors;
 
@@ -38,6 +40,55 @@ int Index::init(const char *path, const char *file)
     {
         m_conf.inc_das_warning_time = 60*60*24*3; /* 默认3天没更新则报警 */
     }
+    std::string tmp;
+    m_conf.inc_parse_threads = 4;
+    m_conf.inc_queue_size = 4096;
+    m_conf.inc_queue_memory = 256; /* MB */
+    m_conf.inc_coalesce_window = 0; /* 默认不合并 */
+    m_conf.inc_coalesce_ms = 100;
+    if ((conf.get("INC_PARSE_THREADS", tmp) && !parseInt32(tmp, m_conf.inc_parse_threads))
+            || (conf.get("INC_QUEUE_SIZE", tmp) && !parseInt32(tmp, m_conf.inc_queue_size))
+            || (conf.get("INC_QUEUE_MEMORY", tmp) && !parseInt32(tmp, m_conf.inc_queue_memory))
+            || m_conf.inc_parse_threads <= 0 || m_conf.inc_queue_size <= 0 || m_conf.inc_queue_memory <= 0)
+    {
+        P_WARNING("invalid INC_PARSE_THREADS, INC_QUEUE_SIZE or INC_QUEUE_MEMORY");
+        return -1;
+    }
+    if ((conf.get("INC_COALESCE_WINDOW", tmp) && !parseInt32(tmp, m_conf.inc_coalesce_window))
+            || (conf.get("INC_COALESCE_MS", tmp) && !parseInt32(tmp, m_conf.inc_coalesce_ms))
+            || m_conf.inc_coalesce_window < 0 || m_conf.inc_coalesce_ms < 0)
+    {
+        P_WARNING("invalid INC_COALESCE_WINDOW or INC_COALESCE_MS");
+        return -1;
+    }
+    m_conf.base_build_threads = 4;
+    m_conf.base_build_memory = 1024; /* MB */
+    m_conf.base_build_tmp_path = "./data/base_build_tmp";
+    conf.get("BASE_BUILD_TMP_PATH", m_conf.base_build_tmp_path);
+    if ((conf.get("BASE_BUILD_THREADS", tmp) && !parseInt32(tmp, m_conf.base_build_threads))
+            || (conf.get("BASE_BUILD_MEMORY", tmp) && !parseInt32(tmp, m_conf.base_build_memory))
+            || m_conf.base_build_threads <= 0 || m_conf.base_build_memory <= 0)
+    {
+        P_WARNING("invalid BASE_BUILD_THREADS or BASE_BUILD_MEMORY");
+        return -1;
+    }
+    m_conf.epoch_reclaim = 0;
+    if (conf.get("EPOCH_RECLAIM", tmp) && !parseInt32(tmp, m_conf.epoch_reclaim))
+    {
+        P_WARNING("invalid EPOCH_RECLAIM");
+        return -1;
+    }
+    m_conf.page_backend = "malloc";
+    m_conf.numa_policy = "none";
+    conf.get("PAGE_BACKEND", m_conf.page_backend);
+    conf.get("NUMA_POLICY", m_conf.numa_policy);
+    conf.get("NUMA_NODES", m_conf.numa_nodes);
+    page_alloc_conf_t page_conf;
+    if (page_alloc_parse(m_conf.page_backend, m_conf.numa_policy, m_conf.numa_nodes, page_conf) < 0)
+    {
+        P_WARNING("invalid PAGE_BACKEND, NUMA_POLICY or NUMA_NODES");
+        return -1;
+    }
 
     P_WARNING("Index Confs:");
     P_WARNING("    [INDEX_PATH]: %s", m_conf.index_path.c_str());
@@ -45,6 +96,31 @@ int Index::init(const char *path, const char *file)
     P_WARNING("    [DUMP_FLAG_FILE]: %s", m_conf.dump_flag_file.c_str());
     P_WARNING("    [INC_PROCESSOR]: %s", m_conf.inc_processor.c_str());
     P_WARNING("    [INC_DAS_WARNING_TIME]: %d ms", m_conf.inc_das_warning_time);
+    P_WARNING("    [INC_PARSE_THREADS]: %d", m_conf.inc_parse_threads);
+    P_WARNING("    [INC_QUEUE_SIZE]: %d", m_conf.inc_queue_size);
+    P_WARNING("    [INC_QUEUE_MEMORY]: %d MB", m_conf.inc_queue_memory);
+    P_WARNING("    [INC_COALESCE_WINDOW]: %d", m_conf.inc_coalesce_window);
+    P_WARNING("    [INC_COALESCE_MS]: %d ms", m_conf.inc_coalesce_ms);
+    P_WARNING("    [BASE_BUILD_THREADS]: %d", m_conf.base_build_threads);
+    P_WARNING("    [BASE_BUILD_MEMORY]: %d MB", m_conf.base_build_memory);
+    P_WARNING("    [BASE_BUILD_TMP_PATH]: %s", m_conf.base_build_tmp_path.c_str());
+    P_WARNING("    [EPOCH_RECLAIM]: %d", m_conf.epoch_reclaim);
+    P_WARNING("    [PAGE_BACKEND]: %s", m_conf.page_backend.c_str());
+    P_WARNING("    [NUMA_POLICY]: %s", m_conf.numa_policy.c_str());
+    P_WARNING("    [NUMA_NODES]: %s", m_conf.numa_nodes.c_str());
+
+    /* 页分配后端须在各层索引分配内存之前设置 */
+    if (page_alloc_init(page_conf) < 0)
+    {
+        P_WARNING("failed to init page backend");
+        return -1;
+    }
+
+    /* 须在各层索引加载和读线程开始查询之前开启 */
+    if (m_conf.epoch_reclaim)
+    {
+        enable_epoch_reclaim();
+    }
 
     thread_func_t proc = NULL;
     {
@@ -223,6 +299,7 @@ int Index::dump(const char *path)
 
 void Index::print_meta() const
 {
+    page_alloc_print_meta();
     for (size_t i = 0; i < m_index.size(); ++i)
     {
         if (m_index[i])
@@ -232,6 +309,20 @@ void Index::print_meta() const
     }
 }
 
+void Index::mem_stats(MemStats &stats, bool detail) const
+{
+    page_alloc_stats_t pstats;
+    page_alloc_stats(pstats);
+    stats.add("page_backend/unused", pstats.mapped_bytes - pstats.used_bytes);
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        if (m_index[i])
+        {
+            m_index[i]->mem_stats(stats, detail);
+        }
+    }
+}
+
 void Index::print_list() const
 {
     for (size_t i = 0; i < m_index.size(); ++i)
@@ -254,9 +345,14 @@ void Index::exc_cmd() const
     }
 }
 
+bool Index::check_dump_flag()
+{
+    return m_dump_fw.check_and_update_timestamp() > 0;
+}
+
 bool Index::try2dump()
 {
-    if (m_dump_fw.check_and_update_timestamp() > 0)
+    if (this->check_dump_flag())
     {
         this->dump();
         return true;
@@ -307,3 +403,14 @@ void Index::try2merge()
         }
     }
 }
+
+void Index::try2compact()
+{
+    for (size_t i = 0; i < m_index.size(); ++i)
+    {
+        if (m_index[i])
+        {
+            m_index[i]->try2compact();
+        }
+    }
+}
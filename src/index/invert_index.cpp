@@ -24,20 +24,25 @@
 #include "log_utils.h"
 #include "str_utils.h"
 
-cJSON *parse_invert_json(const std::string &json, std::vector<invert_data_t> &values)
+cJSON *parse_invert_json(const char *json, std::vector<invert_data_t> &values)
 {
     values.clear();
+    if (NULL == json)
+    {
+        P_WARNING("json is NULL");
+        return NULL;
+    }
 
-    cJSON *cjson = cJSON_Parse(json.c_str());
+    cJSON *cjson = cJSON_Parse(json);
     if (NULL == cjson)
     {
-        P_WARNING("failed to parse json<%s>", json.c_str());
+        P_WARNING("failed to parse json<%s>", json);
         return NULL;
     }
     invert_data_t data;
     if (cJSON_Object != cjson->type)
     {
-        P_WARNING("invalid json<%s>, must be an Object", json.c_str());
+        P_WARNING("invalid json<%s>, must be an Object", json);
         goto FAIL;
     }
     for (cJSON *c = cjson->child; c; c = c->next)
@@ -46,12 +51,12 @@ cJSON *parse_invert_json(const std::string &json, std::vector<invert_data_t> &va
         if (!parseInt32(c->string, type) || type >= UINT8_MAX || type < 0)
         {
             P_WARNING("invalid json<%s>, invert type<%s> must be an uint8_t[0, 0xFF)",
-                    json.c_str(), c->string);
+                    json, c->string);
             goto FAIL;
         }
         if (cJSON_Object != c->type && cJSON_Array != c->type)
         {
-            P_WARNING("invalid json<%s>, inverts[%d] must be an Object or Array", json.c_str(), (int)type);
+            P_WARNING("invalid json<%s>, inverts[%d] must be an Object or Array", json, (int)type);
             goto FAIL;
         }
         for (cJSON *cc = c->child; cc; cc = cc->next)
@@ -80,16 +85,25 @@ FAIL:
     return NULL;
 }
 
-typedef AddList<InvertIndex::SkipList> AddListImpl;
-typedef DeleteList<InvertIndex::SkipList> DeleteListImpl;
+cJSON *parse_invert_json(const std::string &json, std::vector<invert_data_t> &values)
+{
+    return parse_invert_json(json.c_str(), values);
+}
+
 
-InvertIndex::~InvertIndex()
+template<typename TMemoryPool>
+TInvertIndex<TMemoryPool>::~TInvertIndex()
 {
     /* 关闭延迟回收功能 */
     m_pool.set_delayed_time(0);
 #ifndef __NOT_USE_COWBTREE__
     m_rpool.set_delayed_time(0);
 #endif
+    if (m_segments)
+    {
+        delete m_segments;
+        m_segments = NULL;
+    }
     if (m_dict)
     {
         delete m_dict;
@@ -116,7 +130,8 @@ InvertIndex::~InvertIndex()
 #endif
 }
 
-int InvertIndex::init(const char *path, const char *file)
+template<typename TMemoryPool>
+int TInvertIndex<TMemoryPool>::init(const char *path, const char *file)
 {
     if (m_types.init(path, file) < 0)
     {
@@ -184,14 +199,9 @@ int InvertIndex::init(const char *path, const char *file)
         P_WARNING("failed to init m_vnode_pool");
         return -1;
     }
-    if (m_snode_pool.init(&m_pool) < 0)
+    if (m_wnode_pool.init(&m_pool) < 0)
     {
-        P_WARNING("failed to init m_snode_pool");
-        return -1;
-    }
-    if (m_inode_pool.init(&m_pool) < 0)
-    {
-        P_WARNING("failed to init m_inode_pool");
+        P_WARNING("failed to init m_wnode_pool");
         return -1;
     }
     if (m_skiplist_pool.init(&m_pool) < 0)
@@ -199,11 +209,6 @@ int InvertIndex::init(const char *path, const char *file)
         P_WARNING("failed to init m_skiplist_pool");
         return -1;
     }
-    if (m_idlist_pool.init(&m_pool) < 0)
-    {
-        P_WARNING("failed to init m_idlist_pool");
-        return -1;
-    }
     uint32_t max_items_num;
     if (!parseUInt32(conf["max_items_num"], max_items_num))
     {
@@ -243,11 +248,21 @@ int InvertIndex::init(const char *path, const char *file)
         P_WARNING("failed to get signdict_buffer_size");
         return -1;
     }
-    if (m_sign2id.init(&m_snode_pool, signdict_hash_size, signdict_buffer_size) < 0)
+    if (m_sign2id.init(signdict_hash_size, signdict_buffer_size) < 0)
     {
         P_WARNING("failed to init sign2id dict");
         return -1;
     }
+    uint32_t signdict_mmap = 0;
+    {
+        std::string tmp;
+        if (conf.get("signdict_mmap", tmp) && !parseUInt32(tmp, signdict_mmap))
+        {
+            P_WARNING("failed to get uint32 value for signdict_mmap");
+            return -1;
+        }
+    }
+    m_sign2id.set_mmap_load(signdict_mmap != 0);
     uint32_t dict_hash_size;
     if (!parseUInt32(conf["dict_hash_size"], dict_hash_size))
     {
@@ -300,23 +315,48 @@ int InvertIndex::init(const char *path, const char *file)
         P_WARNING("failed to get words_bag_hash_size");
         return -1;
     }
-    m_words_bag = new VHash(words_bag_hash_size);
+    m_words_bag = new WHash(words_bag_hash_size);
     if (NULL == m_words_bag)
     {
         P_WARNING("failed to new m_words_bag");
         return -1;
     }
-    m_words_bag->set_pool(&m_vnode_pool);
+    m_words_bag->set_pool(&m_wnode_pool);
     m_words_bag->set_cleanup(cleanup_id_node, (intptr_t)this);
 
     m_types.set_sign_dict(&m_sign2id);
 
+    std::string segment_path;
+    if (conf.get("segment_path", segment_path) && !segment_path.empty())
+    {
+        SegmentInvert::conf_t sc;
+        sc.path = segment_path;
+        sc.max_items_num = max_items_num;
+        sc.hash_size = add_dict_hash_size;
+        sc.seal_size = 1000000;
+        sc.merge_factor = 4;
+        std::string tmp;
+        if ((conf.get("segment_seal_size", tmp) && !parseUInt32(tmp, sc.seal_size))
+                || (conf.get("segment_merge_factor", tmp) && !parseUInt32(tmp, sc.merge_factor)))
+        {
+            P_WARNING("failed to get uint32 value for segment_seal_size, segment_merge_factor");
+            return -1;
+        }
+        m_segments = new (std::nothrow) SegmentInvert();
+        if (NULL == m_segments || m_segments->init(m_types, sc) < 0)
+        {
+            P_WARNING("failed to init segments at[%s]", segment_path.c_str());
+            return -1;
+        }
+    }
+
     P_WARNING("merge_threshold=%u", m_merge_threshold);
     P_WARNING("merge_all_threshold=%u", m_merge_all_threshold);
     P_WARNING("merge_speed=%u", m_merge_speed);
     P_WARNING("merge_sleep=%u", m_merge_sleep);
     P_WARNING("signdict_hash_size=%u", signdict_hash_size);
     P_WARNING("signdict_buffer_size=%u", signdict_buffer_size);
+    P_WARNING("signdict_mmap=%u", signdict_mmap);
     P_WARNING("dict_hash_size=%u", dict_hash_size);
     P_WARNING("add_dict_hash_size=%u", add_dict_hash_size);
     P_WARNING("del_dict_hash_size=%u", del_dict_hash_size);
@@ -325,7 +365,8 @@ int InvertIndex::init(const char *path, const char *file)
     return 0;
 }
 
-DocList *InvertIndex::trigger(const char *keystr, uint8_t type) const
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::trigger(const char *keystr, uint8_t type) const
 {
     if (NULL == keystr || !m_types.is_valid_type(type))
     {
@@ -343,8 +384,13 @@ DocList *InvertIndex::trigger(const char *keystr, uint8_t type) const
 #endif
 
 #ifdef __USE_OLD_TRIGGER_FLAG__
-DocList *InvertIndex::trigger(uint32_t sign) const
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::trigger(uint32_t sign) const
 {
+    if (m_segments)
+    {
+        return m_segments->trigger(sign);
+    }
 #ifdef __NOT_USE_COWBTREE__
     void **big = m_dict->find(sign);
 #else
@@ -395,13 +441,13 @@ DocList *InvertIndex::trigger(uint32_t sign) const
         }
     }
 #endif
-    AddListImpl *al = NULL;
+    AddList<SkipList> *al = NULL;
     if (add)
     {
-        al = new(std::nothrow) AddListImpl(sign, add->begin());
+        al = new(std::nothrow) AddList<SkipList>(sign, add->begin());
         if (NULL == al)
         {
-            P_WARNING("failed to new AddListImpl");
+            P_WARNING("failed to new AddList");
             if (bl)
             {
                 delete bl;
@@ -409,13 +455,13 @@ DocList *InvertIndex::trigger(uint32_t sign) const
             return NULL;
         }
     }
-    DeleteListImpl *dl = NULL;
+    DeleteList<SkipList> *dl = NULL;
     if (del)
     {
-        dl = new(std::nothrow) DeleteListImpl(del->begin());
+        dl = new(std::nothrow) DeleteList<SkipList>(del->begin());
         if (NULL == dl)
         {
-            P_WARNING("failed to new DeleteListImpl");
+            P_WARNING("failed to new DeleteList");
             if (bl)
             {
                 delete bl;
@@ -447,8 +493,13 @@ DocList *InvertIndex::trigger(uint32_t sign) const
     return NULL;
 }
 #else
-DocList *InvertIndex::trigger(uint32_t sign) const
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::trigger(uint32_t sign) const
 {
+    if (m_segments)
+    {
+        return m_segments->trigger(sign);
+    }
     vaddr_t *vbig = m_dict->find(sign);
     Btree *big = NULL;
     if (vbig)
@@ -488,32 +539,30 @@ DocList *InvertIndex::trigger(uint32_t sign) const
     {
         return new(std::nothrow) CowBtreeList<Btree>(sign, big->begin(false));
     }
-    return new(std::nothrow) AddListImpl(sign, add->begin());
+    return new(std::nothrow) AddList<SkipList>(sign, add->begin());
 }
 #endif
 
-bool InvertIndex::get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const
 {
+    if (m_segments)
+    {
+        return m_segments->get_signs_by_docid(docid, signs);
+    }
     signs.clear();
 
-    vaddr_t *vlist = m_words_bag->find(docid);
-    if (NULL == vlist)
+    void **ptv = m_words_bag->find(docid);
+    if (NULL == ptv)
     {
         return false;
     }
-    IDList *list = m_idlist_pool.addr(*vlist);
-    signs.reserve(list->size());
-    IDList::iterator it = list->begin();
-    IDList::iterator end = list->end();
-    while (it != end)
-    {
-        signs.push_back(*it);
-        ++it;
-    }
+    TermVector::decode(*ptv, signs);
     return true;
 }
 
-bool InvertIndex::insert(const char *keystr, uint8_t type, int32_t docid, const cJSON *json)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::insert(const char *keystr, uint8_t type, int32_t docid, const cJSON *json)
 {
     if (NULL == keystr)
     {
@@ -546,8 +595,44 @@ bool InvertIndex::insert(const char *keystr, uint8_t type, int32_t docid, const
     }
 }
 
-bool InvertIndex::insert(uint32_t sign, int32_t docid, void *payload, const char *keystr, uint8_t type)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::insert(int32_t docid, const invert_sign_t &data)
 {
+    if (data.type < 0 || data.type >= 0xFF || !m_types.is_valid_type(data.type))
+    {
+        P_WARNING("invalid parameter: sign[%lu], type[%d] is unregisterd", data.sign, data.type);
+        return false;
+    }
+    if (m_types.types[data.type].payload_len != data.payload_len
+            || (data.payload_len > 0 && NULL == data.payload))
+    {
+        P_WARNING("invalid payload for invert type[%d], payload_len[%hu] != %hu",
+                data.type, data.payload_len, m_types.types[data.type].payload_len);
+        return false;
+    }
+    const uint32_t sign = m_types.record_sign(data.sign, data.word, data.word_len);
+    if (0 == sign)
+    {
+        P_WARNING("failed to record sign[%lu], type[%d]", data.sign, data.type);
+        return false;
+    }
+    return this->insert(sign, docid, (void *)data.payload, data.word, data.type);
+}
+
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::insert(uint32_t sign, int32_t docid, void *payload, const char *keystr, uint8_t type)
+{
+    if (m_segments)
+    {
+        if (0 == sign)
+        {
+            P_WARNING("failed to record sign of hash value[%s:%d]", keystr, int(type));
+            return false;
+        }
+        return m_segments->insert(sign, type, docid, payload);
+    }
+    m_dirty_signs.mark(sign);
+    m_dirty_docs.mark(docid);
     uint16_t payload_len = m_types.types[type].payload_len;
     SkipList *add_list = NULL;
     vaddr_t *vadd_list = m_add_dict->find(sign);
@@ -598,42 +683,77 @@ bool InvertIndex::insert(uint32_t sign, int32_t docid, void *payload, const char
             m_del_dict->remove(sign);
         }
     }
-    IDList *idlist = NULL;
-    vaddr_t *vidlist = m_words_bag->find(docid);
-    if (vidlist)
+    if (m_doc_batch)
     {
-        idlist = m_idlist_pool.addr(*vidlist);
+        m_doc_signs.push_back(sign);
+        return true;
     }
-    if (idlist)
+    /* 生成新的TermVector替换旧的，旧的由cleanup_id_node延迟释放 */
+    void **ptv = m_words_bag->find(docid);
+    void *tv = NULL;
+    const int ret = TermVector::insert(ptv ? *ptv : NULL, sign, tv);
+    if (ret < 0 || (ret > 0 && !m_words_bag->insert(docid, tv)))
     {
-        if (!idlist->insert(sign))
-        {
-            P_WARNING("failed to insert sign[%u] of hash value[%s:%d] for docid[%d]", sign, keystr, int(type), docid);
-            return false;
-        }
+        TermVector::destroy(tv);
+        P_WARNING("failed to insert sign[%u] of hash value[%s:%d] for docid[%d]", sign, keystr, int(type), docid);
+        return false;
     }
-    else
+    return true;
+}
+
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::add_terms(int32_t docid)
+{
+    if (m_doc_signs.empty())
     {
-        vaddr_t vlist = m_idlist_pool.alloc(&m_inode_pool);
-        IDList *tmp = m_idlist_pool.addr(vlist);
-        if (NULL == tmp)
-        {
-            P_WARNING("failed to alloc IDList");
-            return false;
-        }
-        if (!tmp->insert(sign) || !m_words_bag->insert(docid, vlist))
-        {
-            m_idlist_pool.free(vlist);
-            P_WARNING("failed to insert sign[%u] of hash value[%s:%d] for docid[%d]", sign, keystr, int(type), docid);
-            return false;
-        }
+        return true;
+    }
+    void **ptv = m_words_bag->find(docid);
+    const uint32_t old_size = TermVector::size(ptv ? *ptv : NULL);
+    TermVector::iterator it(ptv ? *ptv : NULL);
+    uint32_t sign;
+    while (it.next(sign))
+    {
+        m_doc_signs.push_back(sign);
+    }
+    std::sort(m_doc_signs.begin(), m_doc_signs.end());
+    m_doc_signs.erase(std::unique(m_doc_signs.begin(), m_doc_signs.end()), m_doc_signs.end());
+    if (m_doc_signs.size() == old_size) /* 都已经在里面了 */
+    {
+        return true;
+    }
+    /* 生成新的TermVector替换旧的，旧的由cleanup_id_node延迟释放 */
+    void *tv = TermVector::create(&m_doc_signs[0], m_doc_signs.size());
+    if (NULL == tv || !m_words_bag->insert(docid, tv))
+    {
+        TermVector::destroy(tv);
+        P_WARNING("failed to insert %lu signs for docid[%d]", (uint64_t)m_doc_signs.size(), docid);
+        return false;
     }
     return true;
 }
 
-bool InvertIndex::remove(const char *keystr, uint8_t type, int32_t docid)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::remove(const char *keystr, uint8_t type, int32_t docid)
 {
     uint32_t sign = m_types.record_sign(keystr, type);
+    if (m_segments)
+    {
+        return m_segments->remove(sign, docid);
+    }
+    m_dirty_signs.mark(sign);
+    m_dirty_docs.mark(docid);
+    /* 先从add_list摘掉，del_list超长触发的merge才不会把它并回大拉链 */
+    vaddr_t *vadd_list = m_add_dict->find(sign);
+    if (vadd_list)
+    {
+        SkipList *add_list = m_skiplist_pool.addr(*vadd_list);
+        add_list->remove(docid);
+        if (add_list->size() == 0)
+        {
+            m_add_dict->remove(sign);
+        }
+    }
     SkipList *del_list = NULL;
     vaddr_t *vdel_list = m_del_dict->find(sign);
     if (vdel_list)
@@ -668,42 +788,54 @@ bool InvertIndex::remove(const char *keystr, uint8_t type, int32_t docid)
             return false;
         }
     }
-    vaddr_t *vadd_list = m_add_dict->find(sign);
-    if (vadd_list)
+    void **ptv = m_words_bag->find(docid);
+    if (ptv)
     {
-        SkipList *add_list = m_skiplist_pool.addr(*vadd_list);
-        add_list->remove(docid);
-        if (add_list->size() == 0)
+        void *tv = NULL;
+        const int ret = TermVector::remove(*ptv, sign, tv);
+        if (ret > 0 && NULL == tv)
         {
-            m_add_dict->remove(sign);
+            m_words_bag->remove(docid);
         }
-    }
-    vaddr_t *vidlist = m_words_bag->find(docid);
-    if (vidlist)
-    {
-        IDList *idlist = m_idlist_pool.addr(*vidlist);
-        idlist->remove(sign);
-        if (idlist->size() == 0)
+        else if (ret < 0 || (ret > 0 && !m_words_bag->insert(docid, tv)))
         {
-            m_words_bag->remove(docid);
+            TermVector::destroy(tv);
+            P_WARNING("failed to remove sign[%u] of hash value[%s:%d] for docid[%d]", sign, keystr, int(type), docid);
+            return false;
         }
     }
     return true;
 }
 
-bool InvertIndex::remove(int32_t docid)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::remove(int32_t docid)
 {
-    vaddr_t *vidlist = m_words_bag->find(docid);
-    if (NULL == vidlist)
+    if (m_segments)
+    {
+        return m_segments->remove(docid);
+    }
+    void **ptv = m_words_bag->find(docid);
+    if (NULL == ptv)
     {
         return true;
     }
-    IDList *idlist = m_idlist_pool.addr(*vidlist);
-    IDList::iterator it = idlist->begin();
-    IDList::iterator end = idlist->end();
-    while (it != end)
+    m_dirty_docs.mark(docid);
+    TermVector::iterator it(*ptv);
+    uint32_t sign;
+    while (it.next(sign))
     {
-        uint32_t sign = *it;
+        m_dirty_signs.mark(sign);
+        /* 先从add_list摘掉，del_list超长触发的merge才不会把它并回大拉链 */
+        vaddr_t *vadd_list = m_add_dict->find(sign);
+        if (vadd_list)
+        {
+            SkipList *add_list = m_skiplist_pool.addr(*vadd_list);
+            add_list->remove(docid);
+            if (add_list->size() == 0)
+            {
+                m_add_dict->remove(sign);
+            }
+        }
         SkipList *del_list = NULL;
         vaddr_t *vdel_list = m_del_dict->find(sign);
         if (vdel_list)
@@ -738,41 +870,35 @@ bool InvertIndex::remove(int32_t docid)
                 return false;
             }
         }
-        vaddr_t *vadd_list = m_add_dict->find(sign);
-        if (vadd_list)
-        {
-            SkipList *add_list = m_skiplist_pool.addr(*vadd_list);
-            add_list->remove(docid);
-            if (add_list->size() == 0)
-            {
-                m_add_dict->remove(sign);
-            }
-        }
-        ++it;
     }
     m_words_bag->remove(docid);
     return true;
 }
 
-bool InvertIndex::update_docid(int32_t from, int32_t to)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::update_docid(int32_t from, int32_t to)
 {
+    if (m_segments)
+    {
+        return m_segments->update_docid(from, to);
+    }
     if (from == to) /* not changed */
     {
         return true;
     }
-    vaddr_t *vidlist = m_words_bag->find(from);
-    if (NULL == vidlist) /* from doesn't have words */
+    void **ptv = m_words_bag->find(from);
+    if (NULL == ptv) /* from doesn't have words */
     {
         return true;
     }
-    IDList *idlist = m_idlist_pool.addr(*vidlist);
-    IDList::iterator it = idlist->begin();
-    IDList::iterator end = idlist->end();
+    /* 插入to时只替换to的TermVector，from的保持不变 */
+    TermVector::iterator it(*ptv);
+    uint32_t sign;
     DummyStrategy dummy;
-    while (it != end)
+    while (it.next(sign))
     {
         bool ok = false;
-        DocList *list = this->trigger(*it);
+        DocList *list = this->trigger(sign);
         if (list)
         {
             list->first();
@@ -780,9 +906,9 @@ bool InvertIndex::update_docid(int32_t from, int32_t to)
             if (id == from) /* matched */
             {
                 InvertStrategy::info_t *info = list->get_strategy_data(dummy);
-                if (!this->insert(*it, to, info->result, "update docid", info->type))
+                if (!this->insert(sign, to, info->result, "update docid", info->type))
                 {
-                    P_WARNING("failed to update sign[%u] from[%d] to[%d]", *it, from, to);
+                    P_WARNING("failed to update sign[%u] from[%d] to[%d]", sign, from, to);
                     return false;
                 }
                 ok = true;
@@ -793,12 +919,12 @@ bool InvertIndex::update_docid(int32_t from, int32_t to)
         {
             P_FATAL("index has been corrupted");
         }
-        ++it;
     }
     return this->remove(from);
 }
 
-uint32_t InvertIndex::merge(uint32_t sign)
+template<typename TMemoryPool>
+uint32_t TInvertIndex<TMemoryPool>::merge(uint32_t sign)
 {
     long us = 0;
     uint32_t docnum = 0;
@@ -897,7 +1023,7 @@ uint32_t InvertIndex::merge(uint32_t sign)
                     vaddr_t *vbig = m_dict->find(sign);
                     if (NULL == vbig)
                     {
-                        vaddr_t new_big = m_btree_pool.alloc<RPool *, uint8_t, uint16_t>
+                        vaddr_t new_big = m_btree_pool.template alloc<RPool *, uint8_t, uint16_t>
                             (&m_rpool, type, payload_len);
                         if (0 == new_big)
                         {
@@ -932,8 +1058,8 @@ uint32_t InvertIndex::merge(uint32_t sign)
                     if (NULL != vdel)
                     {
                         SkipList *del = m_skiplist_pool.addr(*vdel);
-                        SkipList::iterator it = del->begin();
-                        SkipList::iterator end = del->end();
+                        typename SkipList::iterator it = del->begin();
+                        typename SkipList::iterator end = del->end();
                         while (it != end)
                         {
                             big->remove(*it);
@@ -945,8 +1071,8 @@ uint32_t InvertIndex::merge(uint32_t sign)
                     if (NULL != vadd)
                     {
                         SkipList *add = m_skiplist_pool.addr(*vadd);
-                        SkipList::iterator it = add->begin();
-                        SkipList::iterator end = add->end();
+                        typename SkipList::iterator it = add->begin();
+                        typename SkipList::iterator end = add->end();
                         if (0 == payload_len)
                         {
                             while (it != end)
@@ -1118,9 +1244,10 @@ uint32_t InvertIndex::merge(uint32_t sign)
     return docnum;
 }
 
-void InvertIndex::cleanup_node(Hash::node_t *node, intptr_t arg)
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::cleanup_node(typename Hash::node_t *node, intptr_t arg)
 {
-    InvertIndex *ptr = (InvertIndex *)arg;
+    TInvertIndex *ptr = (TInvertIndex *)arg;
     if (NULL == ptr)
     {
         P_FATAL("should not run to here");
@@ -1136,9 +1263,10 @@ void InvertIndex::cleanup_node(Hash::node_t *node, intptr_t arg)
     }
 }
 
-void InvertIndex::cleanup_diff_node(VHash::node_t *node, intptr_t arg)
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::cleanup_diff_node(typename VHash::node_t *node, intptr_t arg)
 {
-    InvertIndex *ptr = (InvertIndex *)arg;
+    TInvertIndex *ptr = (TInvertIndex *)arg;
     if (NULL == ptr)
     {
         P_FATAL("should not run to here");
@@ -1150,21 +1278,20 @@ void InvertIndex::cleanup_diff_node(VHash::node_t *node, intptr_t arg)
     }
 }
 
-void InvertIndex::cleanup_id_node(VHash::node_t *node, intptr_t arg)
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::cleanup_id_node(typename WHash::node_t *node, intptr_t arg)
 {
-    InvertIndex *ptr = (InvertIndex *)arg;
+    TInvertIndex *ptr = (TInvertIndex *)arg;
     if (NULL == ptr)
     {
         P_FATAL("should not run to here");
         ::abort();
     }
-    if (node->value)
-    {
-        ptr->m_idlist_pool.free(node->value);
-    }
+    TermVector::destroy(node->value);
 }
 
-DocList *InvertIndex::parse(const std::string &query, const std::vector<term_t> &terms) const
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::parse(const std::string &query, const std::vector<term_t> &terms) const
 {
     if(0 == query.length())
     {
@@ -1403,7 +1530,8 @@ std::string InvertIndex::print_node(const node_t &node)
     return result;
 }
 
-DocList *InvertIndex::trigger(const node_t &node, const std::vector<term_t> &terms) const
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::trigger(const node_t &node, const std::vector<term_t> &terms) const
 {
     switch (node.op)
     {
@@ -1521,7 +1649,8 @@ CLEANUP:
     }
 }
 
-DocList *InvertIndex::parse_hp(const std::string &query, const std::vector<term_t> &terms,
+template<typename TMemoryPool>
+DocList *TInvertIndex<TMemoryPool>::parse_hp(const std::string &query, const std::vector<term_t> &terms,
         std::string *new_query) const
 {
     if(0 == query.length())
@@ -1594,8 +1723,14 @@ DocList *InvertIndex::parse_hp(const std::string &query, const std::vector<term_
     return this->trigger(node_stack.top(), terms);
 }
 
-void InvertIndex::print_meta() const
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::print_meta() const
 {
+    if (m_segments)
+    {
+        m_segments->print_meta();
+        return ;
+    }
     m_pool.print_meta();
 #ifndef __NOT_USE_COWBTREE__
     m_rpool.print_meta();
@@ -1615,7 +1750,7 @@ void InvertIndex::print_meta() const
 
 #ifdef __NOT_USE_COWBTREE__
         bl_head_t *ph;
-        Hash::iterator it = m_dict->begin();
+        typename Hash::iterator it = m_dict->begin();
         while (it)
         {
             ph = (bl_head_t *)it.value();
@@ -1624,7 +1759,7 @@ void InvertIndex::print_meta() const
             ++it;
         }
 #else
-        Hash::iterator it = m_dict->begin();
+        typename Hash::iterator it = m_dict->begin();
         while (it)
         {
             Btree *big = m_btree_pool.addr(it.value());
@@ -1657,7 +1792,7 @@ void InvertIndex::print_meta() const
         size_t total_count = 0;
 
         SkipList *list;
-        VHash::iterator it = m_add_dict->begin();
+        typename VHash::iterator it = m_add_dict->begin();
         while (it)
         {
             list = m_skiplist_pool.addr(it.value());
@@ -1677,7 +1812,7 @@ void InvertIndex::print_meta() const
         size_t total_count = 0;
 
         SkipList *list;
-        VHash::iterator it = m_del_dict->begin();
+        typename VHash::iterator it = m_del_dict->begin();
         while (it)
         {
             list = m_skiplist_pool.addr(it.value());
@@ -1696,13 +1831,11 @@ void InvertIndex::print_meta() const
         size_t total_mem = 0;
         size_t total_count = 0;
 
-        IDList *list;
-        VHash::iterator it = m_words_bag->begin();
+        typename WHash::iterator it = m_words_bag->begin();
         while (it)
         {
-            list = m_idlist_pool.addr(it.value());
-            total_mem += list->mem_used();
-            total_count += list->size();
+            total_mem += TermVector::mem_used(it.value());
+            total_count += TermVector::size(it.value());
             ++it;
         }
         P_WARNING("    total_mem=%lu", (uint64_t)total_mem);
@@ -1712,6 +1845,81 @@ void InvertIndex::print_meta() const
     m_sign2id.print_meta();
 }
 
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::mem_stats(MemStats &stats, const std::string &prefix, bool detail) const
+{
+    if (m_segments)
+    {
+        m_segments->mem_stats(stats, prefix, detail);
+        return ;
+    }
+    uint64_t attributed = add_hash_stats(stats, prefix + "/dict", *m_dict);
+    attributed += add_hash_stats(stats, prefix + "/add_dict", *m_add_dict);
+    attributed += add_hash_stats(stats, prefix + "/del_dict", *m_del_dict);
+    attributed += add_hash_stats(stats, prefix + "/words_bag", *m_words_bag);
+    attributed += m_sign2id.mem_stats(stats, prefix + "/sign_dict");
+#ifndef __NOT_USE_COWBTREE__
+    uint64_t rattributed = 0;
+#endif
+    if (detail)
+    {
+        char type[32];
+#ifdef __NOT_USE_COWBTREE__
+        typename Hash::iterator it = m_dict->begin();
+        while (it)
+        {
+            const bl_head_t *ph = (const bl_head_t *)it.value();
+            ::snprintf(type, sizeof type, "/type[%d]", int(ph->type));
+            stats.add(prefix + type + "/lists", sizeof(bl_head_t) + sizeof(int32_t) * ph->doc_num);
+            stats.add(prefix + type + "/payload", (uint64_t)ph->payload_len * ph->doc_num);
+            ++it;
+        }
+#else
+        typename Hash::iterator it = m_dict->begin();
+        while (it)
+        {
+            const Btree *big = m_btree_pool.addr(it.value());
+            const uint64_t nodes = big->count_nodes(false);
+            const uint64_t payload = (uint64_t)big->size() * big->payload_len();
+            ::snprintf(type, sizeof type, "/type[%d]", int(big->type()));
+            stats.add(prefix + type + "/btree_nodes", nodes > payload ? nodes - payload : 0);
+            stats.add(prefix + type + "/payload", nodes > payload ? payload : nodes);
+            stats.add(prefix + type + "/lists", sizeof(*big));
+            attributed += sizeof(*big);
+            rattributed += nodes;
+            ++it;
+        }
+#endif
+        const VHash *diffs[] = { m_add_dict, m_del_dict };
+        for (size_t i = 0; i < sizeof(diffs) / sizeof(diffs[0]); ++i)
+        {
+            typename VHash::iterator it = diffs[i]->begin();
+            while (it)
+            {
+                const SkipList *list = m_skiplist_pool.addr(it.value());
+                const uint64_t mem = list->mem_used();
+                const uint64_t payload = (uint64_t)list->size() * list->payload_len();
+                ::snprintf(type, sizeof type, "/type[%d]", int(list->type()));
+                stats.add(prefix + type + "/skiplist_nodes", mem - payload);
+                stats.add(prefix + type + "/payload", payload);
+                attributed += mem;
+                ++it;
+            }
+        }
+        /* TermVector在堆上，不计入attributed */
+        typename WHash::iterator wit = m_words_bag->begin();
+        while (wit)
+        {
+            stats.add(prefix + "/words_bag/lists", TermVector::mem_used(wit.value()));
+            ++wit;
+        }
+    }
+    add_pool_stats(stats, prefix + "/pool", m_pool, attributed);
+#ifndef __NOT_USE_COWBTREE__
+    add_pool_stats(stats, prefix + "/rpool", m_rpool, rattributed);
+#endif
+}
+
 struct sign_num_t
 {
     uint32_t sign;
@@ -1736,7 +1944,8 @@ struct sign_num_t
     }
 };
 
-void InvertIndex::print_list_length(const char *filename) const
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::print_list_length(const char *filename) const
 {
     FILE *fp = NULL;
     if (filename)
@@ -1798,8 +2007,13 @@ void InvertIndex::print_list_length(const char *filename) const
     }
 }
 
-void InvertIndex::mergeAll(uint32_t length)
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::mergeAll(uint32_t length)
 {
+    if (m_segments) /* 分段倒排在后台合并 */
+    {
+        return ;
+    }
 #ifndef __NOT_USE_COWBTREE__
     length = 0;
 #endif
@@ -1813,7 +2027,7 @@ void InvertIndex::mergeAll(uint32_t length)
     timer.start();
     {
         signs.reserve(m_dict->size());
-        Hash::iterator it = m_dict->begin();
+        typename Hash::iterator it = m_dict->begin();
         while (it)
         {
             signs.push_back(it.key());
@@ -1837,7 +2051,7 @@ void InvertIndex::mergeAll(uint32_t length)
     signs.clear();
     {
         signs.reserve(m_add_dict->size());
-        VHash::iterator it = m_add_dict->begin();
+        typename VHash::iterator it = m_add_dict->begin();
         while (it)
         {
             if (m_skiplist_pool.addr(it.value())->size() > length)
@@ -1876,7 +2090,7 @@ void InvertIndex::mergeAll(uint32_t length)
     signs.clear();
     {
         signs.reserve(m_del_dict->size());
-        VHash::iterator it = m_del_dict->begin();
+        typename VHash::iterator it = m_del_dict->begin();
         while (it)
         {
             if (m_skiplist_pool.addr(it.value())->size() > length)
@@ -1900,7 +2114,8 @@ void InvertIndex::mergeAll(uint32_t length)
     P_WARNING("merge del signs ok, all length=%lu, time=%ld ms", (uint64_t)len, timer.timeInMs());
 }
 
-bool InvertIndex::dump(const char *dir, FSInterface *fs)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::dump(const char *dir, FSInterface *fs)
 {
     typedef FSInterface::File File;
     if (NULL == fs)
@@ -1927,12 +2142,25 @@ bool InvertIndex::dump(const char *dir, FSInterface *fs)
             P_WARNING("failed to open file[%sinvert.meta] for write", path.c_str());
             return false;
         }
+        if (m_segments) {
+            fs->fprintf(meta, "segment: on\n\n");
+        } else {
 #ifndef __NOT_USE_COWBTREE__
-        fs->fprintf(meta, "cowbtree: on\n\n");
+            fs->fprintf(meta, "cowbtree: on\n\n");
 #endif
+        }
         fs->fprintf(meta, "%s", m_types.m_meta.c_str());
         fs->fclose(meta);
     }
+    if (m_segments) /* 只写新封的段、段清单和live */
+    {
+        bool ret = m_segments->dump(dir, fs) && this->m_sign2id.dump(dir, fs);
+        if (ret)
+        {
+            P_WARNING("write dir[%s] ok", dir);
+        }
+        return ret;
+    }
     this->mergeAll(m_merge_all_threshold);
     {
         File idx = fs->fopen((path + "invert.idx").c_str(), "wb");
@@ -1961,7 +2189,7 @@ bool InvertIndex::dump(const char *dir, FSInterface *fs)
         std::string word;
         size_t total_len = 0;
         size_t offset = 0;
-        Hash::iterator it = m_dict->begin();
+        typename Hash::iterator it = m_dict->begin();
         while (it)
         {
 #ifdef __NOT_USE_COWBTREE__
@@ -1984,7 +2212,7 @@ bool InvertIndex::dump(const char *dir, FSInterface *fs)
             int32_t docid;
             const uint32_t length = (sizeof(bl_head_t) + (sizeof(int32_t) + head.payload_len) * head.doc_num);
             const int doc_num = head.doc_num;
-            Btree::iterator bt(big->begin(true));
+            typename Btree::iterator bt(big->begin(true));
 
             if (fs->fwrite(&head, sizeof(head), 1, data) != 1)
             {
@@ -2078,15 +2306,15 @@ FAIL0:
             return false;
         }
         size_t offset = 0;
-        VHash::iterator it = m_add_dict->begin();
+        typename VHash::iterator it = m_add_dict->begin();
         while (it)
         {
             uint32_t tmp = 0;
             uint32_t length = 0;
             int32_t docid = 0;
             SkipList *list = m_skiplist_pool.addr(it.value());
-            SkipList::iterator sit = list->begin();
-            SkipList::iterator end = list->end();
+            typename SkipList::iterator sit = list->begin();
+            typename SkipList::iterator end = list->end();
             if (sit == end)
             {
                 continue;
@@ -2169,14 +2397,14 @@ FAIL1:
             return false;
         }
         size_t offset = 0;
-        VHash::iterator it = m_del_dict->begin();
+        typename VHash::iterator it = m_del_dict->begin();
         while (it)
         {
             uint32_t length = 0;
             int32_t docid = 0;
             SkipList *list = m_skiplist_pool.addr(it.value());
-            SkipList::iterator sit = list->begin();
-            SkipList::iterator end = list->end();
+            typename SkipList::iterator sit = list->begin();
+            typename SkipList::iterator end = list->end();
             if (sit == end)
             {
                 continue;
@@ -2238,28 +2466,21 @@ FAIL2:
             return false;
         }
         size_t offset = 0;
-        VHash::iterator it = m_words_bag->begin();
+        typename WHash::iterator it = m_words_bag->begin();
         while (it)
         {
+            /* 文件中仍然是未压缩的升序sign数组，格式不变 */
             uint32_t length = 0;
             uint32_t sign = 0;
-            IDList *list = m_idlist_pool.addr(it.value());
-            IDList::iterator sit = list->begin();
-            IDList::iterator end = list->end();
-            if (sit == end)
+            TermVector::iterator sit(it.value());
+            while (sit.next(sign))
             {
-                continue;
-            }
-            while (sit != end)
-            {
-                sign = *sit;
                 if (fs->fwrite(&sign, sizeof(sign), 1, data) != 1)
                 {
                     P_WARNING("failed to write sign to data");
                     goto FAIL3;
                 }
                 length += sizeof(sign);
-                ++sit;
             }
             key = it.key();
             if (fs->fwrite(&key, sizeof(key), 1, idx) != 1)
@@ -2299,7 +2520,8 @@ FAIL3:
     return ret;
 }
 
-bool InvertIndex::load(const char *dir, FSInterface *fs)
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::load(const char *dir, FSInterface *fs, const char *dict_dir)
 {
     typedef FSInterface::File File;
     if (NULL == fs)
@@ -2321,6 +2543,7 @@ bool InvertIndex::load(const char *dir, FSInterface *fs)
     }
 #ifndef __NOT_USE_COWBTREE__
     bool cowbtree_on = false;
+#endif
     {
         Config conf(path.c_str(), "invert.meta");
         if (conf.parse() < 0)
@@ -2329,11 +2552,34 @@ bool InvertIndex::load(const char *dir, FSInterface *fs)
             return -1;
         }
         std::string on;
+#ifndef __NOT_USE_COWBTREE__
         conf.get("cowbtree", on);
         cowbtree_on = ("on" == on);
-    }
+        on.clear();
 #endif
-    if (!this->m_sign2id.load(dir, fs))
+        conf.get("segment", on);
+        if ("on" == on && NULL == m_segments)
+        {
+            P_WARNING("dir[%s] is dumped by segments, segment_path must be configured", dir);
+            return false;
+        }
+        if ("on" != on && NULL != m_segments)
+        {
+            P_WARNING("dir[%s] is not dumped by segments, rebuild index", dir);
+            return false;
+        }
+    }
+    if (m_segments)
+    {
+        if (!this->m_sign2id.load(dict_dir ? dict_dir : dir, fs) || !m_segments->load(dir, fs))
+        {
+            P_WARNING("failed to load segments");
+            return false;
+        }
+        P_WARNING("read dir[%s] ok", dir);
+        return true;
+    }
+    if (!this->m_sign2id.load(dict_dir ? dict_dir : dir, fs))
     {
         P_WARNING("failed to load signdict");
         return false;
@@ -2425,7 +2671,7 @@ bool InvertIndex::load(const char *dir, FSInterface *fs)
                     P_WARNING("failed to check length");
                     goto FAIL0;
                 }
-                new_big = m_btree_pool.alloc<RPool *, uint8_t, uint16_t>
+                new_big = m_btree_pool.template alloc<RPool *, uint8_t, uint16_t>
                     (&m_rpool, head.type, head.payload_len);
                 if (0 == new_big)
                 {
@@ -2756,8 +3002,7 @@ FAIL2:
         uint32_t length;
         uint32_t num;
         std::vector<uint32_t> signs;
-        vaddr_t vlist = 0;
-        IDList *list = NULL;
+        void *tv = NULL;
         while (1)
         {
             if (fs->fread(&key, sizeof(key), 1, idx) != 1)
@@ -2784,36 +3029,27 @@ FAIL2:
                 P_WARNING("offset check error");
                 goto FAIL3;
             }
-            vlist = m_idlist_pool.alloc(&m_inode_pool);
-            list = m_idlist_pool.addr(vlist);
-            if (NULL == list)
-            {
-                P_WARNING("failed to alloc idlist");
-                goto FAIL3;
-            }
-            if (!m_words_bag->insert(key, vlist))
-            {
-                m_idlist_pool.free(vlist);
-
-                P_WARNING("failed to insert idlist");
-                goto FAIL3;
-            }
             num = length / sizeof(uint32_t);
             if (num > 0)
             {
-                signs.reserve(num);
+                signs.resize(num);
                 if (fs->fread(&signs[0], length, 1, data) != 1)
                 {
                     P_WARNING("failed to read signs from data");
                     goto FAIL3;
                 }
-                for (uint32_t i = num; i >= 1; --i)
+                tv = TermVector::create(signs);
+                if (NULL == tv)
                 {
-                    if (!list->insert(signs[i - 1]))
-                    {
-                        P_WARNING("failed to insert sign to idlist");
-                        goto FAIL3;
-                    }
+                    P_WARNING("failed to create term vector, num=%u", num);
+                    goto FAIL3;
+                }
+                if (!m_words_bag->insert(key, tv))
+                {
+                    TermVector::destroy(tv);
+
+                    P_WARNING("failed to insert term vector");
+                    goto FAIL3;
                 }
             }
             offset += length;
@@ -2833,7 +3069,397 @@ FAIL3:
     return true;
 }
 
-void InvertIndex::try_exc_cmd()
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::dump_delta(const char *dir, uint32_t checkpoint, FSInterface *fs)
+{
+    typedef FSInterface::File File;
+    if (m_segments) /* 分段倒排dump时只写新封的段，本身就是增量的 */
+    {
+        return this->dump(dir, fs);
+    }
+    if (NULL == fs)
+    {
+        fs = &DefaultFS::s_default;
+    }
+
+    if (NULL == dir || '\0' == *dir)
+    {
+        P_WARNING("empty dir error");
+        return false;
+    }
+    P_WARNING("start to write delta dir[%s], checkpoint=%u", dir, checkpoint);
+    uint32_t key;
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    std::vector<uint32_t> keys;
+    {
+        m_dirty_signs.collect(checkpoint, keys);
+
+        File idx = fs->fopen((path + "invert_delta.idx").c_str(), "wb");
+        if (NULL == idx)
+        {
+            P_WARNING("failed to open file[%sinvert_delta.idx] for write", path.c_str());
+            return false;
+        }
+        File data = fs->fopen((path + "invert_delta.data").c_str(), "wb");
+        if (NULL == data)
+        {
+            fs->fclose(idx);
+
+            P_WARNING("failed to open file[%sinvert_delta.data] for write", path.c_str());
+            return false;
+        }
+        size_t offset = 0;
+        size_t total_len = 0;
+        std::vector<int32_t> docids;
+        std::string payloads;
+        DummyStrategy dummy;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            /* 写拉链当前的完整内容，doc_num为0表示拉链已经删除 */
+            bl_head_t head;
+            head.type = 0xFF;
+            head.payload_len = 0;
+            docids.clear();
+            payloads.clear();
+            key = keys[i];
+            DocList *list = this->trigger(key);
+            if (list)
+            {
+                for (int32_t docid = list->first(); docid != -1; docid = list->next())
+                {
+                    InvertStrategy::info_t *info = list->get_strategy_data(dummy);
+                    if (docids.empty())
+                    {
+                        head.type = info->type;
+                        head.payload_len = info->length;
+                    }
+                    docids.push_back(docid);
+                    if (head.payload_len > 0)
+                    {
+                        payloads.append((const char *)info->result, head.payload_len);
+                    }
+                }
+                delete list;
+            }
+            head.doc_num = docids.size();
+            const uint32_t length = sizeof(head) + sizeof(int32_t) * docids.size() + payloads.size();
+            if (fs->fwrite(&head, sizeof(head), 1, data) != 1
+                    || (docids.size() > 0 && fs->fwrite(&docids[0], sizeof(int32_t) * docids.size(), 1, data) != 1)
+                    || (payloads.size() > 0 && fs->fwrite(payloads.data(), payloads.size(), 1, data) != 1))
+            {
+                P_WARNING("failed to write list of sign[%u], length=%u", key, length);
+                goto FAIL0;
+            }
+            if (fs->fwrite(&key, sizeof(key), 1, idx) != 1
+                    || fs->fwrite(&offset, sizeof(offset), 1, idx) != 1
+                    || fs->fwrite(&length, sizeof(length), 1, idx) != 1)
+            {
+                P_WARNING("failed to write sign[%u] to idx", key);
+                goto FAIL0;
+            }
+            if (0)
+            {
+FAIL0:
+                fs->fclose(data);
+                fs->fclose(idx);
+                return false;
+            }
+            offset += length;
+            total_len += docids.size();
+        }
+        fs->fclose(data);
+        fs->fclose(idx);
+        P_WARNING("write delta lists ok, lists=%lu, total_len=%lu", (uint64_t)keys.size(), (uint64_t)total_len);
+    }
+    {
+        m_dirty_docs.collect(checkpoint, keys);
+
+        File idx = fs->fopen((path + "words_delta.idx").c_str(), "wb");
+        if (NULL == idx)
+        {
+            P_WARNING("failed to open file[%swords_delta.idx] for write", path.c_str());
+            return false;
+        }
+        File data = fs->fopen((path + "words_delta.data").c_str(), "wb");
+        if (NULL == data)
+        {
+            fs->fclose(idx);
+
+            P_WARNING("failed to open file[%swords_delta.data] for write", path.c_str());
+            return false;
+        }
+        size_t offset = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            /* length为0表示doc已经没有倒排 */
+            uint32_t length = 0;
+            uint32_t sign = 0;
+            key = keys[i];
+            void **ptv = m_words_bag->find(key);
+            if (ptv)
+            {
+                TermVector::iterator sit(*ptv);
+                while (sit.next(sign))
+                {
+                    if (fs->fwrite(&sign, sizeof(sign), 1, data) != 1)
+                    {
+                        P_WARNING("failed to write sign to data");
+                        goto FAIL1;
+                    }
+                    length += sizeof(sign);
+                }
+            }
+            if (fs->fwrite(&key, sizeof(key), 1, idx) != 1
+                    || fs->fwrite(&offset, sizeof(offset), 1, idx) != 1
+                    || fs->fwrite(&length, sizeof(length), 1, idx) != 1)
+            {
+                P_WARNING("failed to write docid[%d] to idx", int32_t(key));
+                goto FAIL1;
+            }
+            if (0)
+            {
+FAIL1:
+                fs->fclose(data);
+                fs->fclose(idx);
+                return false;
+            }
+            offset += length;
+        }
+        fs->fclose(data);
+        fs->fclose(idx);
+        P_WARNING("write delta docid=>signs ok, docs=%lu", (uint64_t)keys.size());
+    }
+    bool ret = this->m_sign2id.dump(dir, fs);
+    if (ret)
+    {
+        P_WARNING("write delta dir[%s] ok", dir);
+    }
+    return ret;
+}
+
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::load_delta(const char *dir, FSInterface *fs)
+{
+    typedef FSInterface::File File;
+    if (m_segments) /* 分段倒排已经从最后一个目录的段清单加载 */
+    {
+        return true;
+    }
+    if (NULL == fs)
+    {
+        fs = &DefaultFS::s_default;
+    }
+
+    if (NULL == dir || '\0' == *dir)
+    {
+        P_WARNING("empty dir error");
+        return false;
+    }
+    P_WARNING("start to read delta dir[%s]", dir);
+    uint32_t key;
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    size_t list_num = 0;
+    size_t doc_num = 0;
+    std::vector<char> buffer;
+    {
+        File idx = fs->fopen((path + "invert_delta.idx").c_str(), "rb");
+        if (NULL == idx)
+        {
+            P_WARNING("failed to open file[%sinvert_delta.idx] for read", path.c_str());
+            return false;
+        }
+        File data = fs->fopen((path + "invert_delta.data").c_str(), "rb");
+        if (NULL == data)
+        {
+            fs->fclose(idx);
+
+            P_WARNING("failed to open file[%sinvert_delta.data] for read", path.c_str());
+            return false;
+        }
+        size_t offset = 0;
+        size_t tmp;
+        uint32_t length;
+        while (1)
+        {
+            if (fs->fread(&key, sizeof(key), 1, idx) != 1)
+            {
+                break;
+            }
+            if (fs->fread(&tmp, sizeof(tmp), 1, idx) != 1
+                    || fs->fread(&length, sizeof(length), 1, idx) != 1)
+            {
+                P_WARNING("failed to read offset & length from idx");
+                goto FAIL0;
+            }
+            if (tmp != offset || length < sizeof(bl_head_t))
+            {
+                P_WARNING("offset check error, offset=%lu, length=%u", (uint64_t)tmp, length);
+                goto FAIL0;
+            }
+            buffer.resize(length);
+            if (fs->fread(&buffer[0], length, 1, data) != 1)
+            {
+                P_WARNING("failed to read list of sign[%u]", key);
+                goto FAIL0;
+            }
+            {
+                const bl_head_t *head = (const bl_head_t *)&buffer[0];
+                const int32_t *docids = (const int32_t *)(head + 1);
+                if (head->doc_num < 0 || length != (uint32_t)(sizeof(bl_head_t)
+                            + (sizeof(int32_t) + head->payload_len) * head->doc_num))
+                {
+                    P_WARNING("failed to check length of sign[%u]", key);
+                    goto FAIL0;
+                }
+                if (!this->replace_list(key, *head, docids, docids + head->doc_num))
+                {
+                    P_WARNING("failed to replace list of sign[%u]", key);
+                    goto FAIL0;
+                }
+            }
+            if (0)
+            {
+FAIL0:
+                fs->fclose(data);
+                fs->fclose(idx);
+                return false;
+            }
+            offset += length;
+            ++list_num;
+        }
+        fs->fclose(data);
+        fs->fclose(idx);
+    }
+    {
+        File idx = fs->fopen((path + "words_delta.idx").c_str(), "rb");
+        if (NULL == idx)
+        {
+            P_WARNING("failed to open file[%swords_delta.idx] for read", path.c_str());
+            return false;
+        }
+        File data = fs->fopen((path + "words_delta.data").c_str(), "rb");
+        if (NULL == data)
+        {
+            fs->fclose(idx);
+
+            P_WARNING("failed to open file[%swords_delta.data] for read", path.c_str());
+            return false;
+        }
+        size_t offset = 0;
+        size_t tmp;
+        uint32_t length;
+        uint32_t sign;
+        std::vector<uint32_t> signs;
+        void *tv = NULL;
+        while (1)
+        {
+            if (fs->fread(&key, sizeof(key), 1, idx) != 1)
+            {
+                break;
+            }
+            if (fs->fread(&tmp, sizeof(tmp), 1, idx) != 1
+                    || fs->fread(&length, sizeof(length), 1, idx) != 1)
+            {
+                P_WARNING("failed to read offset & length from idx");
+                goto FAIL1;
+            }
+            if (tmp != offset || length % sizeof(sign) != 0)
+            {
+                P_WARNING("offset check error, offset=%lu, length=%u", (uint64_t)tmp, length);
+                goto FAIL1;
+            }
+            m_words_bag->remove(key);
+            if (length > 0)
+            {
+                signs.resize(length / sizeof(sign));
+                if (fs->fread(&signs[0], length, 1, data) != 1)
+                {
+                    P_WARNING("failed to read signs of docid[%d]", int32_t(key));
+                    goto FAIL1;
+                }
+                tv = TermVector::create(signs);
+                if (NULL == tv)
+                {
+                    P_WARNING("failed to create term vector of docid[%d]", int32_t(key));
+                    goto FAIL1;
+                }
+                if (!m_words_bag->insert(key, tv))
+                {
+                    TermVector::destroy(tv);
+
+                    P_WARNING("failed to insert docid[%d] to words bag", int32_t(key));
+                    goto FAIL1;
+                }
+            }
+            if (0)
+            {
+FAIL1:
+                fs->fclose(data);
+                fs->fclose(idx);
+                return false;
+            }
+            offset += length;
+            ++doc_num;
+        }
+        fs->fclose(data);
+        fs->fclose(idx);
+    }
+    P_WARNING("read delta dir[%s] ok, lists=%lu, docs=%lu", dir, (uint64_t)list_num, (uint64_t)doc_num);
+    return true;
+}
+
+template<typename TMemoryPool>
+bool TInvertIndex<TMemoryPool>::replace_list(uint32_t sign, const bl_head_t &head, const int32_t *docids, const void *payloads)
+{
+    m_dict->remove(sign);
+    m_add_dict->remove(sign);
+    m_del_dict->remove(sign);
+    if (0 == head.doc_num)
+    {
+        return true;
+    }
+    vaddr_t vlist = m_skiplist_pool.alloc(&m_pool, head.type, head.payload_len);
+    SkipList *list = m_skiplist_pool.addr(vlist);
+    if (NULL == list)
+    {
+        P_WARNING("failed to alloc SkipList");
+        return false;
+    }
+    for (int i = 0; i < head.doc_num; ++i)
+    {
+        void *payload = head.payload_len > 0 ? ((char *)payloads) + i * head.payload_len : NULL;
+        if (!list->insert(docids[i], payload))
+        {
+            m_skiplist_pool.free(vlist);
+
+            P_WARNING("failed to insert docid[%d] for sign[%u]", docids[i], sign);
+            return false;
+        }
+    }
+    if (!m_add_dict->insert(sign, vlist))
+    {
+        m_skiplist_pool.free(vlist);
+
+        P_WARNING("failed to insert SkipList for sign[%u]", sign);
+        return false;
+    }
+    if (list->size() > m_merge_threshold)
+    {
+        this->merge(sign);
+    }
+    return true;
+}
+
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::try_exc_cmd()
 {
     if (m_exc_cmd_fw.check_and_update_timestamp() > 0)
     {
@@ -2841,7 +3467,8 @@ void InvertIndex::try_exc_cmd()
     }
 }
 
-void InvertIndex::exc_cmd() const
+template<typename TMemoryPool>
+void TInvertIndex<TMemoryPool>::exc_cmd() const
 {
 #ifndef P_LOG_CMD
 #define P_LOG_CMD( _fmt_, args... )
@@ -2900,3 +3527,6 @@ void InvertIndex::exc_cmd() const
     in.close();
 #undef P_LOG_CMD
 }
+
+template class TInvertIndex<Mempool>;
+template class TInvertIndex<Mempool64>;
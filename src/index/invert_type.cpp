@@ -150,6 +150,13 @@ uint32_t InvertTypes::record_sign(const char *keystr, uint8_t type) /* 0 is inva
     return id;
 }
 
+uint32_t InvertTypes::record_sign(uint64_t sign, const char *word, uint32_t len) /* 0 is invalid */
+{
+    uint32_t id = 0;
+    sign2id_dict->find_or_insert(sign, word, len, id);
+    return id;
+}
+
 void InvertTypes::destroy()
 {
     for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); ++i)
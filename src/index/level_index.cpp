@@ -1,3 +1,7 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <unistd.h>
 #include <fstream>
 #include <string>
 #include "configure.h"
@@ -21,6 +25,7 @@ int LevelIndex::init(const char *path, const char *file)
 
     m_conf.dump_flag_file = conf["DUMP_FLAG_FILE"];
     m_conf.print_meta_flag_file = conf["PRINT_META_FLAG_FILE"];
+    conf.get("MEM_STATS_FILE", m_conf.mem_stats_file);
 
     if (!parseInt32(conf["REBUILD_INDEX"], m_conf.rebuild_index))
     {
@@ -30,13 +35,48 @@ int LevelIndex::init(const char *path, const char *file)
     {
         m_conf.merge_interval = 60*30; /* 默认半小时merge一次 */
     }
+    m_conf.delta_dump_num = 0;
+    {
+        std::string tmp;
+        if (conf.get("DELTA_DUMP_NUM", tmp) && !parseInt32(tmp, m_conf.delta_dump_num))
+        {
+            P_WARNING("invalid DELTA_DUMP_NUM[%s]", tmp.c_str());
+            return -1;
+        }
+        m_conf.trim_interval = 0;
+        m_conf.compact_sparse_percent = 0;
+        if ((conf.get("TRIM_INTERVAL", tmp) && !parseInt32(tmp, m_conf.trim_interval))
+                || (conf.get("COMPACT_SPARSE_PERCENT", tmp) && !parseInt32(tmp, m_conf.compact_sparse_percent))
+                || m_conf.trim_interval < 0 || m_conf.compact_sparse_percent < 0 || m_conf.compact_sparse_percent > 100)
+        {
+            P_WARNING("invalid TRIM_INTERVAL or COMPACT_SPARSE_PERCENT");
+            return -1;
+        }
+    }
 
     m_has_invert = false;
+    m_conf.invert_mem64 = 0;
     if (conf.get("INVERT_PATH", m_conf.invert_path))
     {
         m_conf.invert_file = conf["INVERT_FILE"];
         m_conf.print_list_flag_file = conf["PRINT_LIST_FLAG_FILE"];
         m_conf.print_list_file = conf["PRINT_LIST_FILE"];
+        std::string tmp;
+        if (conf.get("INVERT_MEM64", tmp) && !parseInt32(tmp, m_conf.invert_mem64))
+        {
+            P_WARNING("invalid INVERT_MEM64[%s]", tmp.c_str());
+            return -1;
+        }
+        if (m_conf.invert_mem64) {
+            m_invert = new (std::nothrow) InvertIndex64;
+        } else {
+            m_invert = new (std::nothrow) TInvertIndex<Mempool>;
+        }
+        if (NULL == m_invert)
+        {
+            P_WARNING("failed to new InvertIndex");
+            return -1;
+        }
         m_has_invert = true;
     }
 
@@ -49,9 +89,11 @@ int LevelIndex::init(const char *path, const char *file)
     {
         P_WARNING("    [INVERT_PATH]: %s", m_conf.invert_path.c_str());
         P_WARNING("    [INVERT_FILE]: %s", m_conf.invert_file.c_str());
+        P_WARNING("    [INVERT_MEM64]: %d", m_conf.invert_mem64);
     }
     P_WARNING("    [DUMP_FLAG_FILE]: %s", m_conf.dump_flag_file.c_str());
     P_WARNING("    [PRINT_META_FLAG_FILE]: %s", m_conf.print_meta_flag_file.c_str());
+    P_WARNING("    [MEM_STATS_FILE]: %s", m_conf.mem_stats_file.c_str());
     if (m_has_invert)
     {
         P_WARNING("    [PRINT_LIST_FLAG_FILE]: %s", m_conf.print_list_flag_file.c_str());
@@ -59,6 +101,9 @@ int LevelIndex::init(const char *path, const char *file)
     }
     P_WARNING("    [REBUILD_INDEX]: %d", m_conf.rebuild_index);
     P_WARNING("    [MERGE_INTERVAL]: %d s", m_conf.merge_interval);
+    P_WARNING("    [DELTA_DUMP_NUM]: %d", m_conf.delta_dump_num);
+    P_WARNING("    [TRIM_INTERVAL]: %d s", m_conf.trim_interval);
+    P_WARNING("    [COMPACT_SPARSE_PERCENT]: %d", m_conf.compact_sparse_percent);
 
     if (has_index_path && m_dual_dir.init(m_conf.index_path.c_str()) < 0)
     {
@@ -73,24 +118,45 @@ int LevelIndex::init(const char *path, const char *file)
     }
 
     std::string using_path = m_dual_dir.using_path();
+    checkpoint_t cp = { 0, 0 };
+    if (!m_conf.rebuild_index && !read_delta_meta(using_path, cp))
+    {
+        P_WARNING("failed to read delta meta of [%s]", using_path.c_str());
+        return -1;
+    }
+    /* 签名词典、IDMapper和分段倒排的段清单每次都是完整的，取最后一次dump的 */
+    const std::string last_path = cp.delta_num > 0 ? delta_dir(using_path, cp.delta_num) : using_path;
     if (m_has_invert)
     {
         P_WARNING("start to init invert index");
-        if (m_invert.init(m_conf.invert_path.c_str(), m_conf.invert_file.c_str()) < 0)
+        if (m_invert->init(m_conf.invert_path.c_str(), m_conf.invert_file.c_str()) < 0)
         {
             P_WARNING("failed to init invert index");
             return -1;
         }
         P_WARNING("init invert index ok");
+        if (m_conf.delta_dump_num > 0)
+        {
+            m_invert->enable_delta();
+        }
 
         if (!m_conf.rebuild_index)
         {
             P_WARNING("start to load invert index");
-            if (!m_invert.load(using_path.c_str()))
+            const std::string &invert_path = m_invert->is_segmented() ? last_path : using_path;
+            if (!m_invert->load(invert_path.c_str(), NULL, last_path.c_str()))
             {
                 P_WARNING("failed to load invert index");
                 return -1;
             }
+            for (uint32_t i = 1; i <= cp.delta_num; ++i)
+            {
+                if (!m_invert->load_delta(delta_dir(using_path, i).c_str()))
+                {
+                    P_WARNING("failed to load invert delta[%u]", i);
+                    return -1;
+                }
+            }
             P_WARNING("load invert index ok");
         }
     }
@@ -107,15 +173,39 @@ int LevelIndex::init(const char *path, const char *file)
         return -1;
     }
 
+    if (m_conf.delta_dump_num > 0)
+    {
+        m_forward.enable_delta();
+    }
+
     if (!m_conf.rebuild_index)
     {
         P_WARNING("start to load forward index");
-        if (!m_forward.load(using_path.c_str()))
+        if (!m_forward.load(using_path.c_str(), NULL, last_path.c_str()))
         {
             P_WARNING("failed to load forward index");
             return -1;
         }
+        for (uint32_t i = 1; i <= cp.delta_num; ++i)
+        {
+            if (!m_forward.load_delta(delta_dir(using_path, i).c_str()))
+            {
+                P_WARNING("failed to load forward delta[%u]", i);
+                return -1;
+            }
+        }
         P_WARNING("load forward index ok");
+        if (m_conf.delta_dump_num > 0 && cp.version > 0)
+        {
+            this->set_checkpoint(using_path, cp);
+            /* 重启后的改动要记在加载的版本之后，否则接着写进这个目录的增量会漏掉 */
+            m_delta_version = cp.version + 1;
+            if (m_has_invert)
+            {
+                m_invert->delta_checkpoint(m_delta_version, cp.version);
+            }
+            m_forward.delta_checkpoint(m_delta_version, cp.version);
+        }
     }
 
     P_WARNING("init Index ok");
@@ -132,10 +222,64 @@ int LevelIndex::dump(const char *path)
     } else {
         path2 = path;
     }
+    char real[PATH_MAX];
+    const std::string key = ::realpath(path2.c_str(), real) ? real : path2;
+    const uint32_t version = m_delta_version;
+
+    int ret = 0;
+    std::map<std::string, checkpoint_t>::const_iterator it = m_checkpoints.find(key);
+    if (m_conf.delta_dump_num > 0 && it != m_checkpoints.end()
+            && it->second.delta_num < (uint32_t)m_conf.delta_dump_num)
+    {
+        ret = this->dump_delta(path2, it->second, version);
+    }
+    else /* 目录中没有可以接着写增量的base，或者增量已经攒够了 */
+    {
+        ret = this->dump_full(path2, version);
+    }
+    if (ret < 0)
+    {
+        return -1;
+    }
+
+    if (m_conf.delta_dump_num > 0)
+    {
+        /* 所有目录都已经包含的改动不用再记 */
+        uint32_t synced = version;
+        for (it = m_checkpoints.begin(); it != m_checkpoints.end(); ++it)
+        {
+            synced = it->second.version < synced ? it->second.version : synced;
+        }
+        m_delta_version = version + 1;
+        if (m_has_invert)
+        {
+            m_invert->delta_checkpoint(m_delta_version, synced);
+        }
+        m_forward.delta_checkpoint(m_delta_version, synced);
+    }
+
+    if (NULL == path && m_dual_dir.switch_using() < 0)
+    {
+        P_WARNING("failed to switch using file");
+    }
+
+    P_WARNING("dump Index ok: %s", m_conf.index_name.c_str());
+    return 0;
+}
+
+int LevelIndex::dump_full(const std::string &dir, uint32_t version)
+{
+    char real[PATH_MAX];
+    m_checkpoints.erase(::realpath(dir.c_str(), real) ? real : dir);
+    /* 先删掉增量清单，base写到一半时不会再叠加旧的增量 */
+    if (::unlink((dir + "/delta.meta").c_str()) == 0)
+    {
+        P_WARNING("remove delta meta of [%s]", dir.c_str());
+    }
     if (m_has_invert)
     {
         P_WARNING("start to dump invert index");
-        if (m_invert.dump(path2.c_str()) < 0)
+        if (!m_invert->dump(dir.c_str()))
         {
             P_WARNING("failed to dump invert index");
             return -1;
@@ -144,18 +288,134 @@ int LevelIndex::dump(const char *path)
     }
 
     P_WARNING("start to dump forward index");
-    if (m_forward.dump(path2.c_str()) < 0)
+    if (!m_forward.dump(dir.c_str()))
     {
         P_WARNING("failed to dump forward index");
         return -1;
     }
     P_WARNING("dump forward index ok");
 
-    if (NULL == path && m_dual_dir.switch_using() < 0)
+    if (m_conf.delta_dump_num > 0)
     {
-        P_WARNING("failed to switch using file");
+        const checkpoint_t cp = { version, 0 };
+        if (!write_delta_meta(dir, cp))
+        {
+            return -1;
+        }
+        this->set_checkpoint(dir, cp);
     }
+    return 0;
+}
 
-    P_WARNING("dump Index ok: %s", m_conf.index_name.c_str());
+int LevelIndex::dump_delta(const std::string &dir, const checkpoint_t &cp, uint32_t version)
+{
+    const checkpoint_t next = { version, cp.delta_num + 1 };
+    const std::string path = delta_dir(dir, next.delta_num);
+    P_WARNING("start to dump delta[%u] since version[%u] at: %s", next.delta_num, cp.version, path.c_str());
+    if (!mk_dir(path))
+    {
+        P_WARNING("failed to create dir[%s]", path.c_str());
+        return -1;
+    }
+    if (m_has_invert && !m_invert->dump_delta(path.c_str(), cp.version))
+    {
+        P_WARNING("failed to dump invert delta");
+        return -1;
+    }
+    if (!m_forward.dump_delta(path.c_str(), cp.version))
+    {
+        P_WARNING("failed to dump forward delta");
+        return -1;
+    }
+    /* 写完delta.meta之后增量才生效 */
+    if (!write_delta_meta(dir, next))
+    {
+        return -1;
+    }
+    this->set_checkpoint(dir, next);
+    P_WARNING("dump delta[%u] ok at: %s", next.delta_num, path.c_str());
     return 0;
 }
+
+void LevelIndex::set_checkpoint(const std::string &dir, const checkpoint_t &cp)
+{
+    char real[PATH_MAX];
+    m_checkpoints[::realpath(dir.c_str(), real) ? real : dir] = cp;
+    /* 只记0/1两个目录，其它目录(比如指定路径的dump)挤掉版本最旧的 */
+    while (m_checkpoints.size() > 2)
+    {
+        std::map<std::string, checkpoint_t>::iterator oldest = m_checkpoints.begin();
+        for (std::map<std::string, checkpoint_t>::iterator it = m_checkpoints.begin();
+                it != m_checkpoints.end(); ++it)
+        {
+            if (it->second.version < oldest->second.version)
+            {
+                oldest = it;
+            }
+        }
+        m_checkpoints.erase(oldest);
+    }
+}
+
+std::string LevelIndex::delta_dir(const std::string &dir, uint32_t no)
+{
+    char buf[32];
+    ::snprintf(buf, sizeof buf, "/delta.%u", no);
+    return dir + buf;
+}
+
+bool LevelIndex::read_delta_meta(const std::string &dir, checkpoint_t &cp)
+{
+    cp.version = 0;
+    cp.delta_num = 0;
+    if (::access((dir + "/delta.meta").c_str(), F_OK) != 0)
+    {
+        return true;
+    }
+    Config conf(dir.c_str(), "delta.meta");
+    if (conf.parse() < 0)
+    {
+        P_WARNING("failed to parse [%s/delta.meta]", dir.c_str());
+        return false;
+    }
+    std::string version;
+    std::string delta_num;
+    if (!conf.get("version", version) || !parseUInt32(version, cp.version)
+            || !conf.get("delta_num", delta_num) || !parseUInt32(delta_num, cp.delta_num))
+    {
+        P_WARNING("invalid [%s/delta.meta]", dir.c_str());
+        return false;
+    }
+    P_WARNING("dir[%s] has %u delta(s), version=%u", dir.c_str(), cp.delta_num, cp.version);
+    return true;
+}
+
+bool LevelIndex::write_delta_meta(const std::string &dir, const checkpoint_t &cp)
+{
+    const std::string path = dir + "/delta.meta";
+    const std::string tmp_path = path + ".tmp";
+    FILE *fp = ::fopen(tmp_path.c_str(), "w");
+    if (NULL == fp)
+    {
+        P_WARNING("failed to open file[%s] for write", tmp_path.c_str());
+        return false;
+    }
+    ::fprintf(fp, "# base之后依次加载delta.1 ... delta.N\n");
+    ::fprintf(fp, "version: %u\n", cp.version);
+    ::fprintf(fp, "delta_num: %u\n", cp.delta_num);
+    if (::fflush(fp) != 0 || ::fsync(::fileno(fp)) != 0)
+    {
+        ::fclose(fp);
+        ::unlink(tmp_path.c_str());
+        P_WARNING("failed to write file[%s]", tmp_path.c_str());
+        return false;
+    }
+    ::fclose(fp);
+    if (::rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+        ::unlink(tmp_path.c_str());
+        P_WARNING("failed to rename [%s] to [%s]", tmp_path.c_str(), path.c_str());
+        return false;
+    }
+    return true;
+}
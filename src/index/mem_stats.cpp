@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <vector>
+#include "log_utils.h"
+#include "index/mem_stats.h"
+
+namespace
+{
+    struct node_t
+    {
+        uint64_t total;
+        bool leaf;
+        std::map<std::string, node_t> childs;
+
+        node_t(): total(0), leaf(false) { }
+    };
+
+    void append_string(std::string &out, const std::string &str)
+    {
+        out += '"';
+        for (size_t i = 0; i < str.size(); ++i)
+        {
+            const char c = str[i];
+            if ('"' == c || '\\' == c)
+            {
+                out += '\\';
+                out += c;
+            }
+            else if ((unsigned char)c < 0x20)
+            {
+                char buf[8];
+                ::snprintf(buf, sizeof buf, "\\u%04x", (unsigned char)c);
+                out += buf;
+            }
+            else
+            {
+                out += c;
+            }
+        }
+        out += '"';
+    }
+
+    void append_node(std::string &out, const node_t &node)
+    {
+        char buf[32];
+        if (node.childs.empty())
+        {
+            ::snprintf(buf, sizeof buf, "%lu", (unsigned long)node.total);
+            out += buf;
+            return ;
+        }
+        ::snprintf(buf, sizeof buf, "{\"total\":%lu", (unsigned long)node.total);
+        out += buf;
+        for (std::map<std::string, node_t>::const_iterator it = node.childs.begin();
+                it != node.childs.end(); ++it)
+        {
+            out += ',';
+            append_string(out, it->first);
+            out += ':';
+            append_node(out, it->second);
+        }
+        out += '}';
+    }
+}
+
+uint64_t MemStats::get(const std::string &path) const
+{
+    if (path.empty())
+    {
+        uint64_t sum = 0;
+        for (Map::const_iterator it = m_bytes.begin(); it != m_bytes.end(); ++it)
+        {
+            sum += it->second;
+        }
+        return sum;
+    }
+    uint64_t sum = 0;
+    for (Map::const_iterator it = m_bytes.lower_bound(path); it != m_bytes.end(); ++it)
+    {
+        if (it->first.compare(0, path.size(), path) != 0)
+        {
+            break;
+        }
+        if (it->first.size() == path.size() || '/' == it->first[path.size()])
+        {
+            sum += it->second;
+        }
+    }
+    return sum;
+}
+
+std::string MemStats::to_json() const
+{
+    node_t root;
+    for (Map::const_iterator it = m_bytes.begin(); it != m_bytes.end(); ++it)
+    {
+        node_t *node = &root;
+        node->total += it->second;
+        size_t begin = 0;
+        while (true)
+        {
+            const size_t end = it->first.find('/', begin);
+            node = &node->childs[it->first.substr(begin, end - begin)];
+            node->total += it->second;
+            if (std::string::npos == end)
+            {
+                break;
+            }
+            begin = end + 1;
+        }
+        node->leaf = true;
+    }
+    /* 既是叶子又有下级的路径，自身的字节记为self */
+    std::vector<node_t *> stack(1, &root);
+    while (!stack.empty())
+    {
+        node_t *node = stack.back();
+        stack.pop_back();
+        uint64_t childs = 0;
+        for (std::map<std::string, node_t>::iterator it = node->childs.begin(); it != node->childs.end(); ++it)
+        {
+            childs += it->second.total;
+            stack.push_back(&it->second);
+        }
+        if (node->leaf && !node->childs.empty())
+        {
+            node->childs["self"].total = node->total - childs;
+        }
+    }
+    std::string out;
+    append_node(out, root);
+    return out;
+}
+
+bool MemStats::dump_json(const char *file) const
+{
+    const std::string tmp = std::string(file) + ".tmp";
+    FILE *fp = ::fopen(tmp.c_str(), "w");
+    if (NULL == fp)
+    {
+        P_WARNING("failed to open file[%s]", tmp.c_str());
+        return false;
+    }
+    const std::string json = this->to_json();
+    const bool ok = ::fwrite(json.data(), 1, json.size(), fp) == json.size() && ::fputc('\n', fp) != EOF;
+    if (::fclose(fp) != 0 || !ok)
+    {
+        P_WARNING("failed to write file[%s]", tmp.c_str());
+        return false;
+    }
+    if (::rename(tmp.c_str(), file) != 0)
+    {
+        P_WARNING("failed to rename [%s] to [%s]", tmp.c_str(), file);
+        return false;
+    }
+    P_WARNING("dump mem stats to [%s] ok", file);
+    return true;
+}
@@ -0,0 +1,1567 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <new>
+#include <algorithm>
+#include "configure.h"
+#include "str_utils.h"
+#include "fast_timer.h"
+#include "log_utils.h"
+#include "index/segment_invert.h"
+#include "search/biglist.h"
+#include "search/livelist.h"
+#include "search/addlist.h"
+#include "search/orlist.h"
+
+typedef AddList<SegmentInvert::SkipList> MemListImpl;
+
+InvertSegment::InvertSegment()
+{
+    m_base = NULL;
+    m_head = NULL;
+    m_terms = NULL;
+    m_docs = NULL;
+    m_file_no = 0;
+}
+
+InvertSegment::~InvertSegment()
+{
+    if (m_base)
+    {
+        ::munmap(m_base, m_head->size);
+        m_base = NULL;
+    }
+}
+
+InvertSegment *InvertSegment::open(const std::string &path, uint32_t file_no)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        P_WARNING("failed to open segment[%s], errno=%d", path.c_str(), errno);
+        return NULL;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(head_t))
+    {
+        P_WARNING("invalid segment[%s]", path.c_str());
+        ::close(fd);
+        return NULL;
+    }
+    void *base = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == base)
+    {
+        P_WARNING("failed to mmap segment[%s], errno=%d", path.c_str(), errno);
+        return NULL;
+    }
+    const head_t *head = (const head_t *)base;
+    if (MAGIC != head->magic || VERSION != head->version || (uint64_t)st.st_size != head->size
+            || head->terms_offset + sizeof(term_t) * head->term_num > head->size
+            || head->docs_offset + sizeof(doc_t) * head->doc_num > head->size)
+    {
+        P_WARNING("invalid segment[%s], size=%lu", path.c_str(), (uint64_t)st.st_size);
+        ::munmap(base, st.st_size);
+        return NULL;
+    }
+    InvertSegment *segment = new (std::nothrow) InvertSegment();
+    if (NULL == segment)
+    {
+        P_WARNING("failed to new InvertSegment");
+        ::munmap(base, st.st_size);
+        return NULL;
+    }
+    segment->m_base = (int8_t *)base;
+    segment->m_head = head;
+    segment->m_terms = (const term_t *)(segment->m_base + head->terms_offset);
+    segment->m_docs = (const doc_t *)(segment->m_base + head->docs_offset);
+    segment->m_file_no = file_no;
+    return segment;
+}
+
+void *InvertSegment::find(uint32_t sign) const
+{
+    uint32_t beg = 0;
+    uint32_t end = m_head->term_num;
+    while (beg < end)
+    {
+        const uint32_t mid = beg + ((end - beg) >> 1);
+        if (m_terms[mid].sign < sign) {
+            beg = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    if (beg < m_head->term_num && m_terms[beg].sign == sign)
+    {
+        return m_base + m_terms[beg].offset;
+    }
+    return NULL;
+}
+
+const InvertSegment::doc_t *InvertSegment::find_doc(int32_t docid) const
+{
+    uint32_t beg = 0;
+    uint32_t end = m_head->doc_num;
+    while (beg < end)
+    {
+        const uint32_t mid = beg + ((end - beg) >> 1);
+        if (m_docs[mid].docid < docid) {
+            beg = mid + 1;
+        } else {
+            end = mid;
+        }
+    }
+    if (beg < m_head->doc_num && m_docs[beg].docid == docid)
+    {
+        return m_docs + beg;
+    }
+    return NULL;
+}
+
+bool InvertSegment::find_posting(uint32_t sign, int32_t docid, uint8_t &type, const void *&payload) const
+{
+    const void *data = this->find(sign);
+    if (NULL == data)
+    {
+        return false;
+    }
+    bl_head_t head;
+    ::memcpy(&head, data, sizeof head);
+    const int32_t *docids = (const int32_t *)(((const int8_t *)data) + sizeof head);
+    const int32_t *pos = std::lower_bound(docids, docids + head.doc_num, docid);
+    if (pos == docids + head.doc_num || *pos != docid)
+    {
+        return false;
+    }
+    type = head.type;
+    payload = ((const int8_t *)(docids + head.doc_num)) + (pos - docids) * head.payload_len;
+    return true;
+}
+
+/* 顺序写段文件：拉链，词表，doc的词，doc表，最后回写head，写完后改名 */
+struct segment_writer_t
+{
+    std::string path;
+    std::string tmp_path;
+    FILE *fp;
+    uint64_t offset;
+    InvertSegment::head_t head;
+    std::vector<InvertSegment::term_t> terms;
+    std::vector<InvertSegment::doc_t> docs;
+
+    segment_writer_t() : fp(NULL), offset(0) { }
+    ~segment_writer_t()
+    {
+        if (fp)
+        {
+            ::fclose(fp);
+            ::unlink(tmp_path.c_str());
+        }
+    }
+
+    bool open(const std::string &file)
+    {
+        path = file;
+        tmp_path = file + ".tmp";
+        fp = ::fopen(tmp_path.c_str(), "wb");
+        if (NULL == fp)
+        {
+            P_WARNING("failed to open file[%s] for write", tmp_path.c_str());
+            return false;
+        }
+        ::bzero(&head, sizeof head);
+        head.magic = InvertSegment::MAGIC;
+        head.version = InvertSegment::VERSION;
+        return this->write(&head, sizeof head);
+    }
+    bool write(const void *data, size_t len)
+    {
+        if (len > 0 && ::fwrite(data, len, 1, fp) != 1)
+        {
+            P_WARNING("failed to write file[%s]", tmp_path.c_str());
+            return false;
+        }
+        offset += len;
+        return true;
+    }
+    bool align()
+    {
+        static const char zeros[8] = { 0 };
+        return this->write(zeros, (8 - (offset & 7)) & 7);
+    }
+    bool add_list(uint32_t sign, uint8_t type, uint16_t payload_len,
+            const std::vector<int32_t> &docids, const std::string &payloads)
+    {
+        InvertSegment::term_t term;
+        term.sign = sign;
+        term.doc_num = docids.size();
+        term.offset = offset;
+        bl_head_t bl;
+        ::bzero(&bl, sizeof bl);
+        bl.type = type;
+        bl.payload_len = payload_len;
+        bl.doc_num = docids.size();
+        if (!this->write(&bl, sizeof bl)
+                || !this->write(&docids[0], sizeof(int32_t) * docids.size())
+                || !this->write(payloads.data(), payloads.length())
+                || !this->align())
+        {
+            return false;
+        }
+        terms.push_back(term);
+        head.posting_num += docids.size();
+        return true;
+    }
+    bool end_lists()
+    {
+        head.term_num = terms.size();
+        head.terms_offset = offset;
+        return terms.empty() || this->write(&terms[0], sizeof(terms[0]) * terms.size());
+    }
+    bool add_doc(int32_t docid, const std::vector<uint32_t> &signs)
+    {
+        InvertSegment::doc_t doc;
+        doc.docid = docid;
+        doc.word_num = signs.size();
+        doc.offset = offset;
+        if (!this->write(&signs[0], sizeof(uint32_t) * signs.size()))
+        {
+            return false;
+        }
+        docs.push_back(doc);
+        return true;
+    }
+    InvertSegment *finish(uint32_t id, uint32_t file_no)
+    {
+        if (!this->align())
+        {
+            return NULL;
+        }
+        head.id = id;
+        head.doc_num = docs.size();
+        head.docs_offset = offset;
+        if (!docs.empty() && !this->write(&docs[0], sizeof(docs[0]) * docs.size()))
+        {
+            return NULL;
+        }
+        head.size = offset;
+        if (::fseek(fp, 0, SEEK_SET) != 0 || ::fwrite(&head, sizeof head, 1, fp) != 1
+                || ::fflush(fp) != 0 || ::fsync(::fileno(fp)) != 0)
+        {
+            P_WARNING("failed to write head of file[%s]", tmp_path.c_str());
+            return NULL;
+        }
+        ::fclose(fp);
+        fp = NULL;
+        if (::rename(tmp_path.c_str(), path.c_str()) != 0)
+        {
+            P_WARNING("failed to rename[%s] to [%s]", tmp_path.c_str(), path.c_str());
+            ::unlink(tmp_path.c_str());
+            return NULL;
+        }
+        return InvertSegment::open(path, file_no);
+    }
+};
+
+/* 合并时一个输入段上的拉链游标 */
+struct merge_cursor_t
+{
+    bl_head_t head;
+    const int32_t *docids;
+    const int8_t *payloads;
+    int pos;
+    uint32_t id;
+};
+
+SegmentInvert::SegmentInvert()
+{
+    ::bzero(m_payload_lens, sizeof m_payload_lens);
+    m_snapshot = NULL;
+    m_max_docid = -1;
+    m_doc_num = 0;
+    m_next_file_no = 1;
+    m_merge_state = MERGE_IDLE;
+    m_merge_output = NULL;
+    m_merge_file_no = 0;
+    m_merge_retry_time = 0;
+    m_merge_count = 0;
+    m_seal_count = 0;
+}
+
+SegmentInvert::~SegmentInvert()
+{
+    if (MERGE_IDLE != m_merge_state)
+    {
+        ::pthread_join(m_merge_tid, NULL);
+        if (m_merge_output)
+        {
+            ::unlink(this->segment_path(m_merge_output->file_no()).c_str());
+            delete m_merge_output;
+            m_merge_output = NULL;
+        }
+        m_merge_state = MERGE_IDLE;
+    }
+    for (size_t i = 0; i < m_retired.size(); ++i)
+    {
+        delete m_retired[i].snapshot;
+        delete m_retired[i].segment;
+        this->delete_memtable(m_retired[i].memtable);
+    }
+    m_retired.clear();
+    if (m_snapshot)
+    {
+        for (size_t i = 0; i < m_snapshot->segments.size(); ++i)
+        {
+            delete m_snapshot->segments[i];
+        }
+        this->delete_memtable(m_snapshot->memtable);
+        delete m_snapshot;
+        m_snapshot = NULL;
+    }
+    /* 关闭延迟回收功能 */
+    m_pool.set_delayed_time(0);
+    m_pool.recycle();
+}
+
+int SegmentInvert::init(const InvertTypes &types, const conf_t &conf)
+{
+    if (m_snapshot)
+    {
+        P_WARNING("ignore duplicate init call");
+        return -1;
+    }
+    if (conf.path.empty() || 0 == conf.seal_size || conf.merge_factor < 2 || 0 == conf.hash_size)
+    {
+        P_WARNING("invalid conf: segment_path[%s], seal_size=%u, merge_factor=%u, hash_size=%u",
+                conf.path.c_str(), conf.seal_size, conf.merge_factor, conf.hash_size);
+        return -1;
+    }
+    m_conf = conf;
+    if (!mk_dir(m_conf.path))
+    {
+        P_WARNING("failed to mkdir[%s]", m_conf.path.c_str());
+        return -1;
+    }
+    if (SkipList::init_pool(&m_pool, 0) < 0)
+    {
+        P_WARNING("failed to register item for skiplist");
+        return -1;
+    }
+    for (int i = 0; i < 0xFF; ++i)
+    {
+        if (types.is_valid_type(i))
+        {
+            m_payload_lens[i] = types.types[i].payload_len;
+            if (SkipList::init_pool(&m_pool, m_payload_lens[i]) < 0)
+            {
+                P_WARNING("failed to register element size for invert type: %d", i);
+                return -1;
+            }
+        }
+    }
+    if (m_vnode_pool.init(&m_pool) < 0
+            || m_inode_pool.init(&m_pool) < 0
+            || m_skiplist_pool.init(&m_pool) < 0
+            || m_idlist_pool.init(&m_pool) < 0)
+    {
+        P_WARNING("failed to init object pools");
+        return -1;
+    }
+    if (m_pool.init(m_conf.max_items_num) < 0)
+    {
+        P_WARNING("failed to init mempool");
+        return -1;
+    }
+    if (m_live.init(0x7FFFFFFF) < 0)
+    {
+        P_WARNING("failed to init live docs");
+        return -1;
+    }
+    /* 段文件名不复用，避免覆盖0/1目录中清单还在引用的段 */
+    DIR *dir = ::opendir(m_conf.path.c_str());
+    if (dir)
+    {
+        struct dirent *ent;
+        while ((ent = ::readdir(dir)) != NULL)
+        {
+            uint32_t file_no;
+            char c;
+            if (::sscanf(ent->d_name, "seg.%u%c", &file_no, &c) == 1 && file_no >= m_next_file_no)
+            {
+                m_next_file_no = file_no + 1;
+            }
+        }
+        ::closedir(dir);
+    }
+    memtable_t *memtable = this->new_memtable(1);
+    snapshot_t *snapshot = new (std::nothrow) snapshot_t();
+    if (NULL == memtable || NULL == snapshot)
+    {
+        P_WARNING("failed to new memtable or snapshot");
+        this->delete_memtable(memtable);
+        delete snapshot;
+        return -1;
+    }
+    snapshot->memtable = memtable;
+    m_snapshot = snapshot;
+
+    P_WARNING("segment_path=%s", m_conf.path.c_str());
+    P_WARNING("segment_seal_size=%u", m_conf.seal_size);
+    P_WARNING("segment_merge_factor=%u", m_conf.merge_factor);
+    P_WARNING("segment_hash_size=%u", m_conf.hash_size);
+    P_WARNING("next segment file no=%u", m_next_file_no);
+    P_WARNING("init ok");
+    return 0;
+}
+
+void SegmentInvert::cleanup_list(VHash::node_t *node, intptr_t arg)
+{
+    SegmentInvert *ptr = (SegmentInvert *)arg;
+    if (node->value)
+    {
+        ptr->m_skiplist_pool.free(node->value);
+    }
+}
+
+void SegmentInvert::cleanup_words(VHash::node_t *node, intptr_t arg)
+{
+    SegmentInvert *ptr = (SegmentInvert *)arg;
+    if (node->value)
+    {
+        ptr->m_idlist_pool.free(node->value);
+    }
+}
+
+SegmentInvert::memtable_t *SegmentInvert::new_memtable(uint32_t id)
+{
+    memtable_t *memtable = new (std::nothrow) memtable_t();
+    if (NULL == memtable)
+    {
+        return NULL;
+    }
+    memtable->id = id;
+    memtable->posting_num = 0;
+    memtable->dict = new (std::nothrow) VHash(m_conf.hash_size);
+    memtable->words = new (std::nothrow) VHash(m_conf.hash_size);
+    if (NULL == memtable->dict || NULL == memtable->words)
+    {
+        this->delete_memtable(memtable);
+        return NULL;
+    }
+    memtable->dict->set_pool(&m_vnode_pool);
+    memtable->dict->set_cleanup(cleanup_list, (intptr_t)this);
+    memtable->words->set_pool(&m_vnode_pool);
+    memtable->words->set_cleanup(cleanup_words, (intptr_t)this);
+    return memtable;
+}
+
+void SegmentInvert::delete_memtable(memtable_t *memtable)
+{
+    if (memtable)
+    {
+        delete memtable->dict;
+        delete memtable->words;
+        delete memtable;
+    }
+}
+
+SegmentInvert::SkipList *SegmentInvert::mem_list(const memtable_t *memtable, uint32_t sign) const
+{
+    vaddr_t *vlist = memtable->dict->find(sign);
+    return vlist ? m_skiplist_pool.addr(*vlist) : NULL;
+}
+
+SegmentInvert::IDList *SegmentInvert::mem_words(const memtable_t *memtable, int32_t docid) const
+{
+    vaddr_t *vlist = memtable->words->find(docid);
+    return vlist ? m_idlist_pool.addr(*vlist) : NULL;
+}
+
+bool SegmentInvert::set_live(int32_t docid, uint32_t gen)
+{
+    uint32_t *ptr = m_live.alloc_at(docid);
+    if (NULL == ptr)
+    {
+        P_WARNING("failed to alloc live of docid[%d]", docid);
+        return false;
+    }
+    *(volatile uint32_t *)ptr = gen;
+    if (docid > m_max_docid)
+    {
+        m_max_docid = docid;
+    }
+    return true;
+}
+
+DocList *SegmentInvert::trigger(uint32_t sign) const
+{
+    const snapshot_t *snapshot = m_snapshot;
+    DocList *result = NULL;
+    for (size_t i = 0; i <= snapshot->segments.size(); ++i)
+    {
+        DocList *list = NULL;
+        if (i < snapshot->segments.size()) {
+            const InvertSegment *segment = snapshot->segments[i];
+            void *data = segment->find(sign);
+            if (NULL == data)
+            {
+                continue;
+            }
+            list = new (std::nothrow) LiveList(sign, data, segment->id(), m_live);
+        } else {
+            SkipList *add = this->mem_list(snapshot->memtable, sign);
+            if (NULL == add || 0 == add->size())
+            {
+                continue;
+            }
+            list = new (std::nothrow) MemListImpl(sign, add->begin());
+        }
+        if (NULL == list)
+        {
+            P_WARNING("failed to new list");
+            delete result;
+            return NULL;
+        }
+        if (result)
+        {
+            DocList *tmp = new (std::nothrow) OrList(result, list);
+            if (NULL == tmp)
+            {
+                P_WARNING("failed to new OrList");
+                delete result;
+                delete list;
+                return NULL;
+            }
+            list = tmp;
+        }
+        result = list;
+    }
+    return result;
+}
+
+bool SegmentInvert::get_signs_by_docid(int32_t docid, std::vector<uint32_t> &signs) const
+{
+    signs.clear();
+    const snapshot_t *snapshot = m_snapshot;
+    const uint32_t gen = this->live(docid);
+    if (0 == gen)
+    {
+        return false;
+    }
+    for (size_t i = 0; i < snapshot->segments.size(); ++i)
+    {
+        const InvertSegment *segment = snapshot->segments[i];
+        const InvertSegment::doc_t *doc = NULL;
+        if (segment->id() >= gen && (doc = segment->find_doc(docid)) != NULL)
+        {
+            const uint32_t *words = segment->words(*doc);
+            signs.insert(signs.end(), words, words + doc->word_num);
+        }
+    }
+    IDList *words = this->mem_words(snapshot->memtable, docid);
+    if (words)
+    {
+        for (IDList::iterator it = words->begin(); it != words->end(); ++it)
+        {
+            signs.push_back(*it);
+        }
+    }
+    std::sort(signs.begin(), signs.end());
+    signs.erase(std::unique(signs.begin(), signs.end()), signs.end());
+    return !signs.empty();
+}
+
+bool SegmentInvert::has_sign(int32_t docid, uint32_t sign) const
+{
+    const snapshot_t *snapshot = m_snapshot;
+    const uint32_t gen = this->live(docid);
+    for (size_t i = 0; 0 != gen && i < snapshot->segments.size(); ++i)
+    {
+        const InvertSegment *segment = snapshot->segments[i];
+        const InvertSegment::doc_t *doc = NULL;
+        if (segment->id() >= gen && (doc = segment->find_doc(docid)) != NULL)
+        {
+            const uint32_t *words = segment->words(*doc);
+            if (std::binary_search(words, words + doc->word_num, sign))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void SegmentInvert::collect(int32_t docid, std::vector<posting_t> &postings) const
+{
+    const snapshot_t *snapshot = m_snapshot;
+    const uint32_t gen = this->live(docid);
+    /* 代数大的段在后，同一个词以新段为准 */
+    for (size_t i = snapshot->segments.size(); 0 != gen && i > 0; --i)
+    {
+        const InvertSegment *segment = snapshot->segments[i - 1];
+        const InvertSegment::doc_t *doc = NULL;
+        if (segment->id() < gen || (doc = segment->find_doc(docid)) == NULL)
+        {
+            continue;
+        }
+        const uint32_t *words = segment->words(*doc);
+        for (uint32_t j = 0; j < doc->word_num; ++j)
+        {
+            size_t k = 0;
+            while (k < postings.size() && postings[k].sign != words[j])
+            {
+                ++k;
+            }
+            uint8_t type;
+            const void *payload;
+            if (k < postings.size() || !segment->find_posting(words[j], docid, type, payload))
+            {
+                continue;
+            }
+            postings.push_back(posting_t());
+            postings.back().sign = words[j];
+            postings.back().type = type;
+            postings.back().payload.assign((const char *)payload, m_payload_lens[type]);
+        }
+    }
+}
+
+bool SegmentInvert::insert_mem(memtable_t *memtable, uint32_t sign, uint8_t type,
+        int32_t docid, const void *payload)
+{
+    const uint16_t payload_len = m_payload_lens[type];
+    SkipList *list = this->mem_list(memtable, sign);
+    if (list)
+    {
+        if (list->payload_len() != payload_len)
+        {
+            P_WARNING("conflicting sign[%u], type[%d]", sign, int(type));
+            return false;
+        }
+        const uint32_t size = list->size();
+        if (!list->insert(docid, (void *)payload))
+        {
+            P_WARNING("failed to insert docid[%d] for sign[%u]", docid, sign);
+            return false;
+        }
+        memtable->posting_num += list->size() - size;
+    }
+    else
+    {
+        vaddr_t vlist = m_skiplist_pool.alloc(&m_pool, type, payload_len);
+        SkipList *tmp = m_skiplist_pool.addr(vlist);
+        if (NULL == tmp)
+        {
+            P_WARNING("failed to alloc SkipList");
+            return false;
+        }
+        if (!tmp->insert(docid, (void *)payload) || !memtable->dict->insert(sign, vlist))
+        {
+            m_skiplist_pool.free(vlist);
+            P_WARNING("failed to insert docid[%d] for sign[%u]", docid, sign);
+            return false;
+        }
+        ++memtable->posting_num;
+    }
+    IDList *words = this->mem_words(memtable, docid);
+    if (words)
+    {
+        if (!words->insert(sign))
+        {
+            P_WARNING("failed to insert sign[%u] for docid[%d]", sign, docid);
+            return false;
+        }
+    }
+    else
+    {
+        vaddr_t vlist = m_idlist_pool.alloc(&m_inode_pool);
+        IDList *tmp = m_idlist_pool.addr(vlist);
+        if (NULL == tmp)
+        {
+            P_WARNING("failed to alloc IDList");
+            return false;
+        }
+        if (!tmp->insert(sign) || !memtable->words->insert(docid, vlist))
+        {
+            m_idlist_pool.free(vlist);
+            P_WARNING("failed to insert sign[%u] for docid[%d]", sign, docid);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SegmentInvert::insert(uint32_t sign, uint8_t type, int32_t docid, const void *payload)
+{
+    if (docid < 0 || 0 == sign)
+    {
+        P_WARNING("invalid parameter: sign[%u], docid[%d]", sign, docid);
+        return false;
+    }
+    memtable_t *memtable = m_snapshot->memtable;
+    const uint32_t gen = this->live(docid);
+    /* 不可变段中已经有这个词，整个doc搬到可变段，避免同一posting在两个段中都有效 */
+    if (0 != gen && gen < memtable->id && this->has_sign(docid, sign) && !this->rewrite(docid, 0))
+    {
+        return false;
+    }
+    if (!this->insert_mem(memtable, sign, type, docid, payload))
+    {
+        return false;
+    }
+    if (0 == gen)
+    {
+        if (!this->set_live(docid, memtable->id))
+        {
+            return false;
+        }
+        ++m_doc_num;
+    }
+    return true;
+}
+
+bool SegmentInvert::rewrite(int32_t docid, uint32_t skip_sign)
+{
+    memtable_t *memtable = m_snapshot->memtable;
+    std::vector<posting_t> postings;
+    this->collect(docid, postings);
+    for (size_t i = 0; i < postings.size(); ++i)
+    {
+        const posting_t &p = postings[i];
+        SkipList *list = NULL;
+        if (p.sign == skip_sign || ((list = this->mem_list(memtable, p.sign)) != NULL
+                    && 0 != list->find(docid)))
+        {
+            continue;
+        }
+        if (!this->insert_mem(memtable, p.sign, p.type, docid, p.payload.data()))
+        {
+            return false;
+        }
+    }
+    /* 先写进可变段再改live，读线程最多看到重复的docid */
+    return this->set_live(docid, memtable->id);
+}
+
+void SegmentInvert::remove_mem_posting(memtable_t *memtable, uint32_t sign, int32_t docid)
+{
+    SkipList *list = this->mem_list(memtable, sign);
+    if (list)
+    {
+        const uint32_t size = list->size();
+        list->remove(docid);
+        memtable->posting_num -= size - list->size();
+        if (0 == list->size())
+        {
+            memtable->dict->remove(sign);
+        }
+    }
+    IDList *words = this->mem_words(memtable, docid);
+    if (words)
+    {
+        words->remove(sign);
+        if (0 == words->size())
+        {
+            memtable->words->remove(docid);
+        }
+    }
+}
+
+void SegmentInvert::remove_mem_doc(memtable_t *memtable, int32_t docid)
+{
+    IDList *words = this->mem_words(memtable, docid);
+    if (NULL == words)
+    {
+        return ;
+    }
+    for (IDList::iterator it = words->begin(); it != words->end(); ++it)
+    {
+        SkipList *list = this->mem_list(memtable, *it);
+        if (list)
+        {
+            const uint32_t size = list->size();
+            list->remove(docid);
+            memtable->posting_num -= size - list->size();
+            if (0 == list->size())
+            {
+                memtable->dict->remove(*it);
+            }
+        }
+    }
+    memtable->words->remove(docid);
+}
+
+bool SegmentInvert::remove(uint32_t sign, int32_t docid)
+{
+    if (0 == this->live(docid))
+    {
+        return true;
+    }
+    memtable_t *memtable = m_snapshot->memtable;
+    this->remove_mem_posting(memtable, sign, docid);
+    if (this->live(docid) < memtable->id && this->has_sign(docid, sign)
+            && !this->rewrite(docid, sign))
+    {
+        return false;
+    }
+    if (this->live(docid) == memtable->id && NULL == this->mem_words(memtable, docid))
+    {
+        this->set_live(docid, 0);
+        --m_doc_num;
+    }
+    return true;
+}
+
+bool SegmentInvert::remove(int32_t docid)
+{
+    if (0 == this->live(docid))
+    {
+        return true;
+    }
+    this->set_live(docid, 0);
+    this->remove_mem_doc(m_snapshot->memtable, docid);
+    --m_doc_num;
+    return true;
+}
+
+bool SegmentInvert::update_docid(int32_t from, int32_t to)
+{
+    if (from == to || 0 == this->live(from))
+    {
+        return true;
+    }
+    memtable_t *memtable = m_snapshot->memtable;
+    std::vector<posting_t> postings;
+    IDList *words = this->mem_words(memtable, from);
+    if (words)
+    {
+        for (IDList::iterator it = words->begin(); it != words->end(); ++it)
+        {
+            SkipList *list = this->mem_list(memtable, *it);
+            void *payload = NULL;
+            if (NULL == list || 0 == list->find(from, &payload))
+            {
+                P_FATAL("index has been corrupted");
+                continue;
+            }
+            postings.push_back(posting_t());
+            postings.back().sign = *it;
+            postings.back().type = list->type();
+            postings.back().payload.assign((const char *)payload, list->payload_len());
+        }
+    }
+    const size_t mem_num = postings.size();
+    this->collect(from, postings);
+    for (size_t i = 0; i < postings.size(); ++i)
+    {
+        /* 可变段中的比不可变段中的新 */
+        bool dup = false;
+        for (size_t j = 0; i >= mem_num && j < mem_num && !dup; ++j)
+        {
+            dup = (postings[j].sign == postings[i].sign);
+        }
+        if (!dup && !this->insert(postings[i].sign, postings[i].type, to, postings[i].payload.data()))
+        {
+            P_WARNING("failed to update sign[%u] from[%d] to[%d]", postings[i].sign, from, to);
+            return false;
+        }
+    }
+    return this->remove(from);
+}
+
+std::string SegmentInvert::segment_path(uint32_t file_no) const
+{
+    char buf[32];
+    ::snprintf(buf, sizeof buf, "/seg.%u", file_no);
+    return m_conf.path + buf;
+}
+
+InvertSegment *SegmentInvert::write_memtable(const memtable_t *memtable, uint32_t file_no)
+{
+    segment_writer_t writer;
+    if (!writer.open(this->segment_path(file_no)))
+    {
+        return NULL;
+    }
+    std::vector<std::pair<uint32_t, vaddr_t> > items;
+    items.reserve(memtable->dict->size());
+    for (VHash::iterator it = memtable->dict->begin(); it; ++it)
+    {
+        items.push_back(std::make_pair(it.key(), it.value()));
+    }
+    std::sort(items.begin(), items.end());
+    std::vector<int32_t> docids;
+    std::string payloads;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const SkipList *list = m_skiplist_pool.addr(items[i].second);
+        docids.clear();
+        payloads.clear();
+        for (SkipList::iterator it = list->begin(), end = list->end(); it != end; ++it)
+        {
+            docids.push_back(*it);
+            payloads.append((const char *)it.payload(), list->payload_len());
+        }
+        if (!docids.empty() && !writer.add_list(items[i].first, list->type(),
+                    list->payload_len(), docids, payloads))
+        {
+            return NULL;
+        }
+    }
+    if (!writer.end_lists())
+    {
+        return NULL;
+    }
+    items.clear();
+    for (VHash::iterator it = memtable->words->begin(); it; ++it)
+    {
+        items.push_back(std::make_pair((uint32_t)it.key(), it.value()));
+    }
+    std::sort(items.begin(), items.end());
+    std::vector<uint32_t> signs;
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        const IDList *words = m_idlist_pool.addr(items[i].second);
+        signs.clear();
+        for (IDList::iterator it = words->begin(); it != words->end(); ++it)
+        {
+            signs.push_back(*it);
+        }
+        if (!signs.empty() && !writer.add_doc(items[i].first, signs))
+        {
+            return NULL;
+        }
+    }
+    return writer.finish(memtable->id, file_no);
+}
+
+static bool segment_less(const InvertSegment *a, const InvertSegment *b)
+{
+    return a->id() < b->id();
+}
+
+void SegmentInvert::publish(const std::vector<InvertSegment *> &segments, memtable_t *memtable)
+{
+    snapshot_t *snapshot = new (std::nothrow) snapshot_t();
+    if (NULL == snapshot)
+    {
+        /* 内存不够时原地改，读线程可能看到不完整的段表，不会访问已释放的内存 */
+        P_FATAL("failed to new snapshot");
+        ::abort();
+    }
+    snapshot->segments = segments;
+    std::sort(snapshot->segments.begin(), snapshot->segments.end(), segment_less);
+    snapshot->memtable = memtable;
+    snapshot_t *old = m_snapshot;
+    __sync_synchronize();
+    m_snapshot = snapshot;
+    this->retire(old, NULL, old->memtable != memtable ? old->memtable : NULL);
+}
+
+void SegmentInvert::retire(snapshot_t *snapshot, InvertSegment *segment, memtable_t *memtable)
+{
+    retired_t item;
+    item.time = g_now_time;
+    item.epoch = epoch_retire();
+    item.snapshot = snapshot;
+    item.segment = segment;
+    item.memtable = memtable;
+    m_retired.push_back(item);
+}
+
+bool SegmentInvert::seal()
+{
+    memtable_t *memtable = m_snapshot->memtable;
+    if (0 == memtable->posting_num)
+    {
+        return true;
+    }
+    FastTimer timer;
+    timer.start();
+    const uint32_t file_no = m_next_file_no++;
+    InvertSegment *segment = this->write_memtable(memtable, file_no);
+    if (NULL == segment)
+    {
+        P_WARNING("failed to write memtable[%u] to segment[%u]", memtable->id, file_no);
+        return false;
+    }
+    memtable_t *fresh = this->new_memtable(memtable->id + 1);
+    if (NULL == fresh)
+    {
+        P_WARNING("failed to new memtable");
+        ::unlink(this->segment_path(file_no).c_str());
+        delete segment;
+        return false;
+    }
+    std::vector<InvertSegment *> segments(m_snapshot->segments);
+    segments.push_back(segment);
+    this->publish(segments, fresh);
+    ++m_seal_count;
+    timer.stop();
+    P_WARNING("seal memtable[%u] to segment[%u] ok, terms=%u, docs=%u, postings=%lu, size=%lu, cost %ld ms",
+            segment->id(), file_no, segment->term_num(), segment->doc_num(), segment->posting_num(),
+            segment->size(), timer.timeInMs());
+    return true;
+}
+
+uint32_t SegmentInvert::tier(const InvertSegment *segment) const
+{
+    uint64_t size = m_conf.seal_size;
+    uint32_t tier = 0;
+    while (tier < 32 && segment->posting_num() >= size * m_conf.merge_factor)
+    {
+        size *= m_conf.merge_factor;
+        ++tier;
+    }
+    return tier;
+}
+
+void SegmentInvert::try_merge()
+{
+    if (MERGE_IDLE != m_merge_state || g_now_time < m_merge_retry_time)
+    {
+        return ;
+    }
+    const std::vector<InvertSegment *> &segments = m_snapshot->segments;
+    if (segments.size() < m_conf.merge_factor)
+    {
+        return ;
+    }
+    std::vector<uint32_t> tiers(segments.size());
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        tiers[i] = this->tier(segments[i]);
+    }
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        m_merge_inputs.clear();
+        for (size_t j = 0; j < segments.size(); ++j)
+        {
+            if (tiers[j] == tiers[i])
+            {
+                m_merge_inputs.push_back(segments[j]);
+            }
+        }
+        if (m_merge_inputs.size() >= m_conf.merge_factor)
+        {
+            break;
+        }
+        m_merge_inputs.clear();
+    }
+    if (m_merge_inputs.empty())
+    {
+        return ;
+    }
+    m_merge_file_no = m_next_file_no++;
+    m_merge_output = NULL;
+    m_merge_state = MERGE_RUNNING;
+    int ret = ::pthread_create(&m_merge_tid, NULL, merge_thread, this);
+    if (ret != 0)
+    {
+        P_WARNING("failed to create merge thread, ret=%d", ret);
+        m_merge_inputs.clear();
+        m_merge_state = MERGE_IDLE;
+        return ;
+    }
+    P_WARNING("start to merge %lu segments to segment[%u]",
+            (uint64_t)m_merge_inputs.size(), m_merge_file_no);
+}
+
+void *SegmentInvert::merge_thread(void *args)
+{
+    SegmentInvert *self = (SegmentInvert *)args;
+    FastTimer timer;
+    timer.start();
+    InvertSegment *output = self->merge(self->m_merge_inputs, self->m_merge_file_no);
+    timer.stop();
+    if (output)
+    {
+        P_WARNING("merge segments to segment[%u] ok, terms=%u, docs=%u, postings=%lu, size=%lu, cost %ld ms",
+                self->m_merge_file_no, output->term_num(), output->doc_num(), output->posting_num(),
+                output->size(), timer.timeInMs());
+    }
+    self->m_merge_output = output;
+    __sync_synchronize();
+    self->m_merge_state = output ? MERGE_DONE : MERGE_FAILED;
+    return NULL;
+}
+
+void SegmentInvert::install_merge()
+{
+    if (MERGE_DONE != m_merge_state && MERGE_FAILED != m_merge_state)
+    {
+        return ;
+    }
+    ::pthread_join(m_merge_tid, NULL);
+    if (MERGE_FAILED == m_merge_state)
+    {
+        P_WARNING("failed to merge segments, retry later");
+        m_merge_retry_time = g_now_time + 60;
+    }
+    else
+    {
+        std::vector<InvertSegment *> segments;
+        const std::vector<InvertSegment *> &cur = m_snapshot->segments;
+        for (size_t i = 0; i < cur.size(); ++i)
+        {
+            if (std::find(m_merge_inputs.begin(), m_merge_inputs.end(), cur[i]) == m_merge_inputs.end())
+            {
+                segments.push_back(cur[i]);
+            }
+        }
+        segments.push_back(m_merge_output);
+        this->publish(segments, m_snapshot->memtable);
+        for (size_t i = 0; i < m_merge_inputs.size(); ++i)
+        {
+            this->retire(NULL, m_merge_inputs[i], NULL);
+        }
+        ++m_merge_count;
+    }
+    m_merge_inputs.clear();
+    m_merge_output = NULL;
+    m_merge_state = MERGE_IDLE;
+}
+
+InvertSegment *SegmentInvert::merge(const std::vector<InvertSegment *> &inputs, uint32_t file_no) const
+{
+    std::vector<InvertSegment *> segs(inputs);
+    std::sort(segs.begin(), segs.end(), segment_less);
+    const size_t k = segs.size();
+    const uint32_t id = segs[k - 1]->id();
+
+    segment_writer_t writer;
+    if (!writer.open(this->segment_path(file_no)))
+    {
+        return NULL;
+    }
+    /* 拉链：按sign多路归并，同一docid以代数大的段为准，丢掉失效的 */
+    std::vector<uint32_t> pos(k, 0);
+    std::vector<merge_cursor_t> cursors;
+    std::vector<int32_t> docids;
+    std::string payloads;
+    while (1)
+    {
+        uint32_t sign = 0;
+        bool found = false;
+        for (size_t i = 0; i < k; ++i)
+        {
+            if (pos[i] < segs[i]->term_num() && (!found || segs[i]->terms()[pos[i]].sign < sign))
+            {
+                sign = segs[i]->terms()[pos[i]].sign;
+                found = true;
+            }
+        }
+        if (!found)
+        {
+            break;
+        }
+        cursors.clear();
+        for (size_t i = 0; i < k; ++i)
+        {
+            if (pos[i] < segs[i]->term_num() && segs[i]->terms()[pos[i]].sign == sign)
+            {
+                const int8_t *data = (const int8_t *)segs[i]->list(segs[i]->terms()[pos[i]]);
+                merge_cursor_t cursor;
+                ::memcpy(&cursor.head, data, sizeof cursor.head);
+                cursor.docids = (const int32_t *)(data + sizeof cursor.head);
+                cursor.payloads = (const int8_t *)(cursor.docids + cursor.head.doc_num);
+                cursor.pos = 0;
+                cursor.id = segs[i]->id();
+                cursors.push_back(cursor);
+                ++pos[i];
+            }
+        }
+        docids.clear();
+        payloads.clear();
+        while (1)
+        {
+            int32_t docid = -1;
+            size_t last = 0;
+            for (size_t i = 0; i < cursors.size(); ++i)
+            {
+                const merge_cursor_t &c = cursors[i];
+                if (c.pos < c.head.doc_num && (-1 == docid || c.docids[c.pos] <= docid))
+                {
+                    docid = c.docids[c.pos];
+                    last = i;   /* 相同docid时取后面(代数大)的 */
+                }
+            }
+            if (-1 == docid)
+            {
+                break;
+            }
+            const uint32_t gen = this->live(docid);
+            if (0 != gen && gen <= cursors[last].id)
+            {
+                const merge_cursor_t &c = cursors[last];
+                docids.push_back(docid);
+                payloads.append((const char *)c.payloads + c.pos * c.head.payload_len, c.head.payload_len);
+            }
+            for (size_t i = 0; i < cursors.size(); ++i)
+            {
+                merge_cursor_t &c = cursors[i];
+                if (c.pos < c.head.doc_num && c.docids[c.pos] == docid)
+                {
+                    ++c.pos;
+                }
+            }
+        }
+        if (!docids.empty() && !writer.add_list(sign, cursors[0].head.type,
+                    cursors[0].head.payload_len, docids, payloads))
+        {
+            return NULL;
+        }
+    }
+    if (!writer.end_lists())
+    {
+        return NULL;
+    }
+    /* doc表：按docid多路归并，合并各有效段中的词 */
+    pos.assign(k, 0);
+    std::vector<uint32_t> signs;
+    while (1)
+    {
+        int32_t docid = -1;
+        for (size_t i = 0; i < k; ++i)
+        {
+            if (pos[i] < segs[i]->doc_num() && (-1 == docid || segs[i]->docs()[pos[i]].docid < docid))
+            {
+                docid = segs[i]->docs()[pos[i]].docid;
+            }
+        }
+        if (-1 == docid)
+        {
+            break;
+        }
+        const uint32_t gen = this->live(docid);
+        signs.clear();
+        for (size_t i = 0; i < k; ++i)
+        {
+            if (pos[i] < segs[i]->doc_num() && segs[i]->docs()[pos[i]].docid == docid)
+            {
+                const InvertSegment::doc_t &doc = segs[i]->docs()[pos[i]];
+                if (0 != gen && gen <= segs[i]->id())
+                {
+                    const uint32_t *words = segs[i]->words(doc);
+                    signs.insert(signs.end(), words, words + doc.word_num);
+                }
+                ++pos[i];
+            }
+        }
+        std::sort(signs.begin(), signs.end());
+        signs.erase(std::unique(signs.begin(), signs.end()), signs.end());
+        if (!signs.empty() && !writer.add_doc(docid, signs))
+        {
+            return NULL;
+        }
+    }
+    return writer.finish(id, file_no);
+}
+
+void SegmentInvert::recycle()
+{
+    this->install_merge();
+    if (m_snapshot->memtable->posting_num >= m_conf.seal_size)
+    {
+        this->seal();
+    }
+    this->try_merge();
+
+    const uint32_t now = g_now_time;
+    uint64_t min_epoch = 0;
+    if (g_epoch_reclaim && !m_retired.empty())
+    {
+        epoch_advance();
+        min_epoch = epoch_min_active();
+    }
+    size_t n = 0;
+    while (n < m_retired.size() && (g_epoch_reclaim ? m_retired[n].epoch < min_epoch
+                : m_retired[n].time + DELAYED_TIME < now))
+    {
+        delete m_retired[n].snapshot;
+        delete m_retired[n].segment;
+        this->delete_memtable(m_retired[n].memtable);
+        ++n;
+    }
+    if (n > 0)
+    {
+        m_retired.erase(m_retired.begin(), m_retired.begin() + n);
+    }
+    m_pool.recycle();
+}
+
+void SegmentInvert::remove_garbage(const std::vector<uint32_t> &keep)
+{
+    DIR *dir = ::opendir(m_conf.path.c_str());
+    if (NULL == dir)
+    {
+        P_WARNING("failed to open dir[%s]", m_conf.path.c_str());
+        return ;
+    }
+    struct dirent *ent;
+    while ((ent = ::readdir(dir)) != NULL)
+    {
+        uint32_t file_no;
+        char c;
+        if (::sscanf(ent->d_name, "seg.%u%c", &file_no, &c) != 1
+                || std::find(keep.begin(), keep.end(), file_no) != keep.end()
+                || (MERGE_IDLE != m_merge_state && file_no == m_merge_file_no))
+        {
+            continue;
+        }
+        /* 已经mmap的段unlink之后仍然可读 */
+        const std::string path = this->segment_path(file_no);
+        if (::unlink(path.c_str()) == 0) {
+            P_WARNING("remove segment[%s]", path.c_str());
+        } else {
+            P_WARNING("failed to remove segment[%s]", path.c_str());
+        }
+    }
+    ::closedir(dir);
+}
+
+bool SegmentInvert::dump(const char *dir, FSInterface *fs)
+{
+    typedef FSInterface::File File;
+    if (!this->seal())
+    {
+        P_WARNING("failed to seal memtable");
+        return false;
+    }
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    const snapshot_t *snapshot = m_snapshot;
+    std::vector<uint32_t> files;
+    {
+        File meta = fs->fopen((path + "segments.meta").c_str(), "w");
+        if (NULL == meta)
+        {
+            P_WARNING("failed to open file[%ssegments.meta] for write", path.c_str());
+            return false;
+        }
+        fs->fprintf(meta, "segment_path: %s\n", m_conf.path.c_str());
+        fs->fprintf(meta, "next_id: %u\n", snapshot->memtable->id);
+        fs->fprintf(meta, "max_docid: %d\n", m_max_docid);
+        fs->fprintf(meta, "doc_num: %lu\n", (uint64_t)m_doc_num);
+        fs->fprintf(meta, "segment_num: %lu\n", (uint64_t)snapshot->segments.size());
+        for (size_t i = 0; i < snapshot->segments.size(); ++i)
+        {
+            files.push_back(snapshot->segments[i]->file_no());
+            fs->fprintf(meta, "segment_%lu: %u\n", (uint64_t)i, files.back());
+        }
+        fs->fclose(meta);
+    }
+    {
+        File data = fs->fopen((path + "live.data").c_str(), "wb");
+        if (NULL == data)
+        {
+            P_WARNING("failed to open file[%slive.data] for write", path.c_str());
+            return false;
+        }
+        static const uint32_t zeros[SegmentArray<uint32_t>::SEGMENT_SIZE] = { 0 };
+        uint32_t left = m_max_docid + 1;
+        for (uint32_t i = 0; left > 0; ++i)
+        {
+            const uint32_t num = left < (uint32_t)SegmentArray<uint32_t>::SEGMENT_SIZE
+                ? left : (uint32_t)SegmentArray<uint32_t>::SEGMENT_SIZE;
+            const uint32_t *seg = m_live.segment(i);
+            if (fs->fwrite(seg ? seg : zeros, sizeof(uint32_t) * num, 1, data) != 1)
+            {
+                P_WARNING("failed to write live.data");
+                fs->fclose(data);
+                return false;
+            }
+            left -= num;
+        }
+        fs->fclose(data);
+    }
+    /* 另一个目录里上一次dump的清单还在引用它的段 */
+    std::vector<uint32_t> keep(files);
+    keep.insert(keep.end(), m_dumped.begin(), m_dumped.end());
+    this->remove_garbage(keep);
+    m_dumped.swap(files);
+    P_WARNING("dump segments ok, segment_num=%lu, doc_num=%lu",
+            (uint64_t)snapshot->segments.size(), (uint64_t)m_doc_num);
+    return true;
+}
+
+bool SegmentInvert::load(const char *dir, FSInterface *fs)
+{
+    typedef FSInterface::File File;
+    std::string path(dir);
+    if ('/' != path[path.length() - 1])
+    {
+        path += "/";
+    }
+    Config conf(path.c_str(), "segments.meta");
+    if (conf.parse() < 0)
+    {
+        P_WARNING("failed parse config[%s:segments.meta]", path.c_str());
+        return false;
+    }
+    uint32_t next_id;
+    int32_t max_docid;
+    uint32_t segment_num;
+    if (!parseUInt32(conf["next_id"], next_id) || 0 == next_id
+            || !parseInt32(conf["max_docid"], max_docid)
+            || !parseUInt32(conf["segment_num"], segment_num))
+    {
+        P_WARNING("invalid segments.meta");
+        return false;
+    }
+    std::vector<InvertSegment *> segments;
+    std::vector<uint32_t> files;
+    uint32_t left = max_docid + 1;
+    uint32_t docid = 0;
+    size_t doc_num = 0;
+    std::vector<uint32_t> buf;
+    File data = NULL;
+    for (uint32_t i = 0; i < segment_num; ++i)
+    {
+        char key[32];
+        uint32_t file_no;
+        ::snprintf(key, sizeof key, "segment_%u", i);
+        if (!parseUInt32(conf[key], file_no))
+        {
+            P_WARNING("invalid %s in segments.meta", key);
+            goto FAIL;
+        }
+        InvertSegment *segment = InvertSegment::open(this->segment_path(file_no), file_no);
+        if (NULL == segment)
+        {
+            goto FAIL;
+        }
+        segments.push_back(segment);
+        files.push_back(file_no);
+        if (segment->id() >= next_id)
+        {
+            P_WARNING("invalid id[%u] of segment[%u], next_id=%u", segment->id(), file_no, next_id);
+            goto FAIL;
+        }
+    }
+    data = fs->fopen((path + "live.data").c_str(), "rb");
+    if (NULL == data)
+    {
+        P_WARNING("failed to open file[%slive.data] for read", path.c_str());
+        goto FAIL;
+    }
+    buf.resize(SegmentArray<uint32_t>::SEGMENT_SIZE);
+    while (left > 0)
+    {
+        const uint32_t num = left < buf.size() ? left : buf.size();
+        if (fs->fread(&buf[0], sizeof(uint32_t) * num, 1, data) != 1)
+        {
+            P_WARNING("failed to read live.data");
+            goto FAIL;
+        }
+        for (uint32_t i = 0; i < num; ++i, ++docid)
+        {
+            if (0 == buf[i])
+            {
+                continue;
+            }
+            if (buf[i] >= next_id || !this->set_live(docid, buf[i]))
+            {
+                P_WARNING("invalid live[%u] of docid[%u]", buf[i], docid);
+                goto FAIL;
+            }
+            ++doc_num;
+        }
+        left -= num;
+    }
+    fs->fclose(data);
+    data = NULL;
+    {
+        memtable_t *memtable = this->new_memtable(next_id);
+        if (NULL == memtable)
+        {
+            P_WARNING("failed to new memtable");
+            goto FAIL;
+        }
+        this->publish(segments, memtable);
+    }
+    m_doc_num = doc_num;
+    m_dumped.swap(files);
+    P_WARNING("load segments ok, segment_num=%u, doc_num=%lu, next_id=%u",
+            segment_num, (uint64_t)m_doc_num, next_id);
+    return true;
+FAIL:
+    if (data)
+    {
+        fs->fclose(data);
+    }
+    for (size_t i = 0; i < segments.size(); ++i)
+    {
+        delete segments[i];
+    }
+    return false;
+}
+
+void SegmentInvert::print_meta() const
+{
+    const snapshot_t *snapshot = m_snapshot;
+    P_WARNING("segment doc num=%lu, max docid=%d", (uint64_t)m_doc_num, m_max_docid);
+    P_WARNING("memtable: id=%u, terms=%lu, docs=%lu, postings=%lu", snapshot->memtable->id,
+            (uint64_t)snapshot->memtable->dict->size(), (uint64_t)snapshot->memtable->words->size(),
+            snapshot->memtable->posting_num);
+    for (size_t i = 0; i < snapshot->segments.size(); ++i)
+    {
+        const InvertSegment *segment = snapshot->segments[i];
+        P_WARNING("segment[%u]: id=%u, tier=%u, terms=%u, docs=%u, postings=%lu, size=%lu",
+                segment->file_no(), segment->id(), this->tier(segment),
+                segment->term_num(), segment->doc_num(), segment->posting_num(), segment->size());
+    }
+    P_WARNING("seal count=%lu, merge count=%lu, merging=%d, retired=%lu",
+            m_seal_count, m_merge_count, int(m_merge_state), (uint64_t)m_retired.size());
+    m_pool.print_meta();
+    P_WARNING("live docs mem=%lu", (uint64_t)m_live.mem_used());
+}
+
+void SegmentInvert::mem_stats(MemStats &stats, const std::string &prefix, bool detail) const
+{
+    const snapshot_t *snapshot = m_snapshot;
+    const memtable_t *memtable = snapshot->memtable;
+    uint64_t attributed = add_hash_stats(stats, prefix + "/memtable/dict", *memtable->dict);
+    attributed += add_hash_stats(stats, prefix + "/memtable/words", *memtable->words);
+    if (detail)
+    {
+        char type[32];
+        VHash::iterator it = memtable->dict->begin();
+        while (it)
+        {
+            const SkipList *list = m_skiplist_pool.addr(it.value());
+            const uint64_t mem = list->mem_used();
+            const uint64_t payload = (uint64_t)list->size() * list->payload_len();
+            ::snprintf(type, sizeof type, "/type[%d]", int(list->type()));
+            stats.add(prefix + type + "/skiplist_nodes", mem - payload);
+            stats.add(prefix + type + "/payload", payload);
+            attributed += mem;
+            ++it;
+        }
+        VHash::iterator wit = memtable->words->begin();
+        while (wit)
+        {
+            const uint64_t mem = m_idlist_pool.addr(wit.value())->mem_used();
+            stats.add(prefix + "/memtable/words/lists", mem);
+            attributed += mem;
+            ++wit;
+        }
+    }
+    /* 段文件是mmap的，算在page cache里 */
+    for (size_t i = 0; i < snapshot->segments.size(); ++i)
+    {
+        stats.add(prefix + "/segments/mmap", snapshot->segments[i]->size());
+    }
+    stats.add(prefix + "/live", m_live.mem_used());
+    add_pool_stats(stats, prefix + "/pool", m_pool, attributed);
+}
@@ -1,99 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <new>
+#include "log_utils.h"
+#include "pool/delaypool.h"
+#include "pool/epoch.h"
 #include "index/signdict.h"
 
 SignDict::SignDict()
 {
-    m_dict = NULL;
-    m_buffer = NULL;
+    m_table = NULL;
+    ::memset((void *)&m_zero, 0, sizeof(m_zero));
     m_max_id = 1;
-    m_buffer_pos = 0;
-    m_buffer_size = 0;
+    pthread_rwlock_init(&m_lock, NULL);
+    ::memset((void *)m_words, 0, sizeof(m_words));
+    m_chunk = NULL;
+    m_big = NULL;
+    m_chunk_size = 0;
+    m_mmap_load = false;
+    m_map = NULL;
+    m_map_size = 0;
 }
 
 SignDict::~SignDict()
 {
-    if (m_dict)
+    this->reset();
+    pthread_rwlock_destroy(&m_lock);
+}
+
+void SignDict::reset()
+{
+    if (m_table)
     {
-        delete m_dict;
-        m_dict = NULL;
+        ::free(m_table);
+        m_table = NULL;
     }
-    if (m_buffer)
+    for (size_t i = 0; i < m_retired.size(); ++i)
     {
-        delete [] m_buffer;
-        m_buffer = NULL;
+        ::free(m_retired[i].table);
     }
+    m_retired.clear();
+    ::memset((void *)&m_zero, 0, sizeof(m_zero));
     m_max_id = 1;
-    m_buffer_pos = 0;
-    m_buffer_size = 0;
+    for (uint32_t i = 0; i < AGILE_SE_SIGNDICT_MAX_SEGS && m_words[i]; ++i)
+    {
+        delete [] m_words[i];
+        m_words[i] = NULL;
+    }
+    chunk_t *lists[2] = { m_chunk, m_big };
+    for (int i = 0; i < 2; ++i)
+    {
+        chunk_t *chunk = lists[i];
+        while (chunk)
+        {
+            chunk_t *prev = chunk->prev;
+            ::free(chunk);
+            chunk = prev;
+        }
+    }
+    m_chunk = NULL;
+    m_big = NULL;
+    if (m_map)
+    {
+        ::munmap(m_map, m_map_size);
+        m_map = NULL;
+        m_map_size = 0;
+    }
 }
 
-int SignDict::init(ObjectPool *pool, uint32_t bucket_size, uint32_t buffer_size)
+int SignDict::init(uint32_t bucket_size, uint32_t buffer_size)
 {
-    if (NULL == pool || 0 == bucket_size || 0 == buffer_size)
+    if (0 == bucket_size || 0 == buffer_size)
     {
-        P_WARNING("invalid args: pool=%p, bucket_size=%u, buffer_size=%u",
-                pool, bucket_size, buffer_size);
+        P_WARNING("invalid args: bucket_size=%u, buffer_size=%u", bucket_size, buffer_size);
         return -1;
     }
-    m_ids.reserve(bucket_size);
-    m_dict = new Hash(bucket_size);
-    if (NULL == m_dict)
+    this->reset();
+
+    uint64_t capacity = 1024;
+    while (capacity < bucket_size)
     {
-        P_WARNING("failed to new Hash, bucket_size=%u", bucket_size);
-        return -1;
+        capacity <<= 1;
     }
-    m_dict->set_pool(pool);
-    m_buffer = new char[buffer_size];
-    if (NULL == m_buffer)
+    m_table = alloc_table(capacity);
+    if (NULL == m_table)
     {
-        P_WARNING("failed to new buffer, size=%u", buffer_size);
-        delete m_dict;
-        m_dict = NULL;
+        P_WARNING("failed to alloc table, capacity=%lu", capacity);
         return -1;
     }
-    m_max_id = 1;
-    m_buffer_pos = 0;
-    m_buffer_size = buffer_size;
-    P_WARNING("init sign dict ok");
+    m_chunk_size = buffer_size;
+    P_WARNING("init sign dict ok, capacity=%lu, chunk_size=%u", capacity, buffer_size);
     return 0;
 }
 
+/* murmur3的fmix64，签名的低位可能分布不均 */
+uint64_t SignDict::mix(uint64_t sign)
+{
+    sign ^= sign >> 33;
+    sign *= 0xff51afd7ed558ccdULL;
+    sign ^= sign >> 33;
+    sign *= 0xc4ceb9fe1a85ec53ULL;
+    sign ^= sign >> 33;
+    return sign;
+}
+
+SignDict::table_t *SignDict::alloc_table(uint64_t capacity)
+{
+    table_t *t = (table_t *)::calloc(1, offsetof(table_t, slots) + sizeof(slot_t) * capacity);
+    if (t)
+    {
+        t->capacity = capacity;
+        t->mask = capacity - 1;
+        t->used = 0;
+    }
+    return t;
+}
+
+SignDict::slot_t *SignDict::lookup(const table_t *t, uint64_t sign) const
+{
+    uint64_t i = mix(sign) & t->mask;
+    while (true)
+    {
+        const uint64_t s = t->slots[i].sign;
+        if (s == sign)
+        {
+            return (slot_t *)&t->slots[i];
+        }
+        if (0 == s)
+        {
+            return NULL;
+        }
+        i = (i + 1) & t->mask;
+    }
+}
+
+SignDict::slot_t *SignDict::claim(table_t *t, uint64_t sign, bool &owner)
+{
+    if (0 == sign)
+    {
+        owner = __sync_bool_compare_and_swap(&m_zero.sign, 0, 1);
+        return &m_zero;
+    }
+    /* 至少留1/10的空槽，保证读线程的探测能遇到空槽结束 */
+    if (t->used >= t->capacity - t->capacity / 10)
+    {
+        return NULL;
+    }
+    uint64_t i = mix(sign) & t->mask;
+    while (true)
+    {
+        const uint64_t s = t->slots[i].sign;
+        if (s == sign)
+        {
+            owner = false;
+            return &t->slots[i];
+        }
+        if (0 == s)
+        {
+            if (__sync_bool_compare_and_swap(&t->slots[i].sign, 0, sign))
+            {
+                __sync_add_and_fetch(&t->used, 1);
+                owner = true;
+                return &t->slots[i];
+            }
+            continue;   /* 被抢占了，重新看这个槽 */
+        }
+        i = (i + 1) & t->mask;
+    }
+}
+
+void SignDict::sweep_retired()
+{
+    if (m_retired.empty())
+    {
+        return ;
+    }
+    const uint32_t now = g_now_time;
+    uint64_t min_epoch = 0;
+    if (g_epoch_reclaim)
+    {
+        epoch_advance();
+        min_epoch = epoch_min_active();
+    }
+    size_t num = 0;
+    while (num < m_retired.size() && (g_epoch_reclaim ? m_retired[num].epoch < min_epoch
+                : m_retired[num].time + DELAYED_TIME < now))
+    {
+        ::free(m_retired[num].table);
+        ++num;
+    }
+    if (num > 0)
+    {
+        m_retired.erase(m_retired.begin(), m_retired.begin() + num);
+    }
+}
+
+void SignDict::recycle()
+{
+    /* 有插入持读锁时拿不到写锁，下次再回收，不阻塞插入 */
+    if (0 != pthread_rwlock_trywrlock(&m_lock))
+    {
+        return ;
+    }
+    this->sweep_retired();
+    pthread_rwlock_unlock(&m_lock);
+}
+
+bool SignDict::grow(table_t *t)
+{
+    pthread_rwlock_wrlock(&m_lock);
+    if (m_table != t)
+    {
+        pthread_rwlock_unlock(&m_lock);
+        return true;
+    }
+    table_t *n = alloc_table(t->capacity << 1);
+    if (NULL == n)
+    {
+        pthread_rwlock_unlock(&m_lock);
+        P_WARNING("failed to alloc table, capacity=%lu", (uint64_t)(t->capacity << 1));
+        return false;
+    }
+    /* 持写锁，没有正在插入的槽，插入失败的槽不再搬迁 */
+    for (uint64_t i = 0; i < t->capacity; ++i)
+    {
+        const slot_t &slot = t->slots[i];
+        if (0 == slot.sign || 0 == slot.id || ID_FAILED == slot.id)
+        {
+            continue;
+        }
+        uint64_t j = mix(slot.sign) & n->mask;
+        while (0 != n->slots[j].sign)
+        {
+            j = (j + 1) & n->mask;
+        }
+        n->slots[j].sign = slot.sign;
+        n->slots[j].id = slot.id;
+        ++n->used;
+    }
+    __sync_synchronize();
+    m_table = n;
+
+    retired_t item;
+    item.table = t;
+    item.time = g_now_time;
+    item.epoch = epoch_retire();
+    m_retired.push_back(item);
+    this->sweep_retired();
+    pthread_rwlock_unlock(&m_lock);
+    P_WARNING("grow sign dict ok, size=%u, capacity=%lu", m_max_id - 1, (uint64_t)n->capacity);
+    return true;
+}
+
+void SignDict::push_chunk(chunk_t *chunk)
+{
+    chunk_t *head;
+    do
+    {
+        head = m_big;
+        chunk->prev = head;
+    } while (!__sync_bool_compare_and_swap(&m_big, head, chunk));
+}
+
+const char *SignDict::alloc_word(uint32_t len)
+{
+    if (len > m_chunk_size / 4)
+    {
+        chunk_t *chunk = (chunk_t *)::malloc(offsetof(chunk_t, data) + len);
+        if (NULL == chunk)
+        {
+            P_WARNING("failed to alloc chunk, size=%u", len);
+            return NULL;
+        }
+        chunk->size = len;
+        chunk->pos = len;
+        this->push_chunk(chunk);
+        return chunk->data;
+    }
+    while (true)
+    {
+        chunk_t *cur = m_chunk;
+        if (cur)
+        {
+            const uint32_t off = __sync_fetch_and_add(&cur->pos, len);
+            if (off + len <= cur->size)
+            {
+                return cur->data + off;
+            }
+        }
+        chunk_t *chunk = (chunk_t *)::malloc(offsetof(chunk_t, data) + m_chunk_size);
+        if (NULL == chunk)
+        {
+            P_WARNING("failed to alloc chunk, size=%u", m_chunk_size);
+            return NULL;
+        }
+        chunk->prev = cur;
+        chunk->size = m_chunk_size;
+        chunk->pos = 0;
+        if (!__sync_bool_compare_and_swap(&m_chunk, cur, chunk))
+        {
+            ::free(chunk);
+        }
+    }
+}
+
+/* 先保证id所在的段存在再占用id，失败时不会留下空洞 */
+bool SignDict::alloc_id(uint32_t &id)
+{
+    while (true)
+    {
+        const uint32_t cur = m_max_id;
+        const uint32_t seg = cur / SEG_SIZE;
+        if (seg >= AGILE_SE_SIGNDICT_MAX_SEGS)
+        {
+            P_WARNING("too many words, max_id=%u", cur);
+            return false;
+        }
+        if (NULL == m_words[seg])
+        {
+            word_t *words = new (std::nothrow) word_t[SEG_SIZE];
+            if (NULL == words)
+            {
+                P_WARNING("failed to alloc words segment[%u]", seg);
+                return false;
+            }
+            ::memset(words, 0, sizeof(word_t) * SEG_SIZE);
+            if (!__sync_bool_compare_and_swap(&m_words[seg], NULL, words))
+            {
+                delete [] words;
+            }
+        }
+        if (__sync_bool_compare_and_swap(&m_max_id, cur, cur + 1))
+        {
+            id = cur;
+            return true;
+        }
+    }
+}
+
+const SignDict::word_t *SignDict::get_word(uint32_t id) const
+{
+    if (0 == id || id >= m_max_id)
+    {
+        return NULL;
+    }
+    const word_t *words = m_words[id / SEG_SIZE];
+    if (NULL == words)
+    {
+        return NULL;
+    }
+    const word_t *word = &words[id % SEG_SIZE];
+    /* id已分配，词还没写好 */
+    return ((const char *volatile *)&word->ptr)[0] ? word : NULL;
+}
+
 void SignDict::print_meta() const
 {
+    pthread_rwlock_rdlock(&m_lock);
+    uint64_t buffer_size = 0;
+    const chunk_t *lists[2] = { m_chunk, m_big };
+    for (int i = 0; i < 2; ++i)
+    {
+        for (const chunk_t *chunk = lists[i]; chunk; chunk = chunk->prev)
+        {
+            buffer_size += chunk->size;
+        }
+    }
     P_WARNING("m_sign2id:");
-    P_WARNING("    size=%lu", (uint64_t)m_dict->size());
-    P_WARNING("    mem=%lu", (uint64_t)m_dict->mem_used());
-    P_WARNING("    buffer_size=%u", m_buffer_size);
-    P_WARNING("    ids_mem=%u", uint32_t(m_ids.capacity() * sizeof(std::pair<uint32_t, uint32_t>)));
+    P_WARNING("    size=%u", m_max_id - 1);
+    P_WARNING("    capacity=%lu", m_table ? (uint64_t)m_table->capacity : 0);
+    P_WARNING("    retired=%lu", (uint64_t)m_retired.size());
+    P_WARNING("    buffer_size=%lu", buffer_size);
+    P_WARNING("    mmap_size=%lu", (uint64_t)m_map_size);
+    pthread_rwlock_unlock(&m_lock);
 }
 
-bool SignDict::find(uint64_t sign, uint32_t &id) const /* thread safe */
+uint64_t SignDict::mem_stats(MemStats &stats, const std::string &path) const
 {
-    key_t key;
-    key.sign1 = sign >> 32;
-    key.sign2 = sign;
-    value_t *pv = m_dict->find(key);
-    if (pv)
+    pthread_rwlock_rdlock(&m_lock);
+    uint64_t dict = 0;
+    if (m_table)
     {
-        id = pv->id;
-        return true;
+        dict += offsetof(table_t, slots) + sizeof(slot_t) * m_table->capacity;
+    }
+    for (size_t i = 0; i < m_retired.size(); ++i)
+    {
+        dict += offsetof(table_t, slots) + sizeof(slot_t) * m_retired[i].table->capacity;
+    }
+    uint64_t buffer = 0;
+    const chunk_t *lists[2] = { m_chunk, m_big };
+    for (int i = 0; i < 2; ++i)
+    {
+        for (const chunk_t *chunk = lists[i]; chunk; chunk = chunk->prev)
+        {
+            buffer += offsetof(chunk_t, data) + chunk->size;
+        }
+    }
+    uint64_t ids = 0;
+    for (uint32_t i = 0; i < AGILE_SE_SIGNDICT_MAX_SEGS && m_words[i]; ++i)
+    {
+        ids += sizeof(word_t) * SEG_SIZE;
+    }
+    pthread_rwlock_unlock(&m_lock);
+
+    stats.add(path + "/dict", dict);
+    stats.add(path + "/buffer", buffer);
+    stats.add(path + "/ids", ids);
+    if (m_map_size > 0)
+    {
+        stats.add(path + "/mmap", m_map_size);
+    }
+    return 0;
+}
+
+bool SignDict::find(uint64_t sign, uint32_t &id) const /* thread safe, wait free */
+{
+    const slot_t *slot = NULL;
+    if (0 == sign)
+    {
+        slot = m_zero.sign ? &m_zero : NULL;
+    }
+    else
+    {
+        const table_t *t = m_table;
+        slot = t ? lookup(t, sign) : NULL;
+    }
+    if (slot)
+    {
+        const uint32_t v = slot->id;
+        if (0 != v && ID_FAILED != v)
+        {
+            id = v;
+            return true;
+        }
     }
     return false;
 }
 
 bool SignDict::find(uint32_t id, std::string &word) const /* do not use this func */
 {
-    --id;
-    if (id >= m_ids.size())
+    const word_t *pw = this->get_word(id);
+    if (NULL == pw)
     {
         word.clear();
         return false;
     }
-    word = std::string(m_buffer + m_ids[id].first, m_ids[id].second);
+    word.assign(pw->ptr, pw->len);
     return true;
 }
 
-bool SignDict::find_or_insert(uint64_t sign, const char *word, uint32_t len, uint32_t &id) /* not thread safe */
+bool SignDict::find_or_insert(uint64_t sign, const char *word, uint32_t len, uint32_t &id) /* thread safe */
 {
 #ifndef P_LOG_WORD
 #define P_LOG_WORD( _fmt_, args... )
@@ -103,49 +466,85 @@ bool SignDict::find_or_insert(uint64_t sign, const char *word, uint32_t len, uin
         P_WARNING("invalid args: word=%p, len=%u", word, len);
         return false;
     }
-    key_t key;
-    key.sign1 = sign >> 32;
-    key.sign2 = sign;
-    value_t *pv = m_dict->find(key);
-    if (pv)
+    if (g_epoch_reclaim)
+    {
+        /* 不持锁读表，读到的可能是刚换下的表，与读线程一样需要epoch保护 */
+        EpochGuard guard;
+        if (this->find(sign, id))
+        {
+            return true;
+        }
+    }
+    else if (this->find(sign, id))
     {
-        id = pv->id;
+        return true;
     }
-    else
+    if (NULL == m_table)
+    {
+        P_WARNING("sign dict is not inited");
+        return false;
+    }
+
+    table_t *t;
+    slot_t *slot;
+    bool owner = false;
+    pthread_rwlock_rdlock(&m_lock);
+    while (true)
     {
-        if (m_buffer_pos + len > m_buffer_size)
+        t = m_table;
+        slot = this->claim(t, sign, owner);
+        if (slot)
         {
-            char *buffer = new (std::nothrow) char[m_buffer_size << 1];
-            if (NULL == buffer)
-            {
-                P_WARNING("failed to alloc buffer, size=%u", (uint32_t)(m_buffer_size << 1));
-                return false;
-            }
-            if (m_buffer_pos > 0)
-            {
-                ::memcpy(buffer, m_buffer, m_buffer_pos);
-            }
-            delete [] m_buffer;
-            m_buffer = buffer;
-            m_buffer_size <<= 1;
+            break;
         }
-        m_ids.reserve(m_ids.size() + 1);
-
-        value_t value;
-        value.id = m_max_id;
-        value.offset = m_buffer_pos;
-        value.length = len;
-        if (!m_dict->insert(key, value))
+        pthread_rwlock_unlock(&m_lock);
+        if (!this->grow(t))
         {
-            P_WARNING("failed to insert word[%*s], sign=%lu", len, word, sign);
             return false;
         }
-        ::memcpy(m_buffer + m_buffer_pos, word, len);
-        m_buffer_pos += len;
-        id = m_max_id++;
-        m_ids.push_back(std::make_pair(value.offset, value.length));
-        P_LOG_WORD("insert word[%*s] ok, id=%u, sign=%lu", len, word, id, sign);
+        pthread_rwlock_rdlock(&m_lock);
     }
+    /* 别的线程正在插入同一个签名，等它发布id，它失败了就接手 */
+    while (!owner)
+    {
+        const uint32_t v = slot->id;
+        if (0 != v && ID_FAILED != v)
+        {
+            pthread_rwlock_unlock(&m_lock);
+            id = v;
+            return true;
+        }
+        if (ID_FAILED == v && __sync_bool_compare_and_swap(&slot->id, ID_FAILED, 0))
+        {
+            owner = true;
+            break;
+        }
+        ::sched_yield();
+    }
+
+    char *buf = (char *)this->alloc_word(len);
+    if (NULL == buf || !this->alloc_id(id))
+    {
+        slot->id = ID_FAILED;
+        pthread_rwlock_unlock(&m_lock);
+        P_WARNING("failed to insert word[%.*s], sign=%lu", (int)len, word, sign);
+        return false;
+    }
+    ::memcpy(buf, word, len);
+    word_t &entry = m_words[id / SEG_SIZE][id % SEG_SIZE];
+    entry.len = len;
+    __sync_synchronize();
+    entry.ptr = buf;
+    __sync_synchronize();
+    slot->id = id;
+
+    const bool need_grow = (t->used > t->capacity / 10 * 7);
+    pthread_rwlock_unlock(&m_lock);
+    if (need_grow)
+    {
+        this->grow(t);
+    }
+    P_LOG_WORD("insert word[%.*s] ok, id=%u, sign=%lu", (int)len, word, id, sign);
     return true;
 #undef P_LOG_WORD
 }
@@ -170,27 +569,68 @@ bool SignDict::dump(const char *dir, FSInterface *fs) const
         path += "/";
     }
     P_WARNING("start to dump signdict");
+
+    /* 持写锁，id连续且都已写好；词按id顺序拼起来，offset重新计算 */
+    pthread_rwlock_wrlock(&m_lock);
+    bool ret = false;
+    const size_t size = m_max_id - 1;
+    std::vector<std::pair<uint32_t, uint32_t> > ids;
+    try
+    {
+        ids.resize(size);
+    }
+    catch (...)
+    {
+        P_WARNING("failed to resize ids, size=%lu", (uint64_t)size);
+        pthread_rwlock_unlock(&m_lock);
+        return false;
+    }
+    uint64_t buffer_pos = 0;
+    for (size_t i = 0; i < size; ++i)
+    {
+        const word_t &word = m_words[(i + 1) / SEG_SIZE][(i + 1) % SEG_SIZE];
+        ids[i].first = buffer_pos;
+        ids[i].second = word.len;
+        buffer_pos += word.len;
+    }
+    if (buffer_pos > 0xFFFFFFFFu)
+    {
+        P_WARNING("words are too long to dump, total=%lu", buffer_pos);
+        pthread_rwlock_unlock(&m_lock);
+        return false;
+    }
+    const uint32_t buffer_size = buffer_pos;
     {
         P_WARNING("start to write %ssigndict.idx", path.c_str());
         File idx = fs->fopen((path + "signdict.idx").c_str(), "wb");
         if (NULL == idx)
         {
             P_WARNING("failed to open %ssigndict.idx for write", path.c_str());
-            return false;
+            goto FAIL;
         }
         key_t key;
         value_t value;
-        Hash::iterator it = m_dict->begin();
-        size_t size = m_dict->size();
+        size_t num = 0;
+        const table_t *t = m_table;
         if (fs->fwrite(&size, sizeof(size), 1, idx) != 1)
         {
             P_WARNING("failed to write size to idx");
             goto fail0;
         }
-        while (it)
+        for (uint64_t i = 0; t && i <= t->capacity; ++i)
         {
-            key = it.key();
-            value = it.value();
+            /* 最后一个是签名0 */
+            const slot_t &slot = i < t->capacity ? t->slots[i] : m_zero;
+            if (0 == slot.sign || 0 == slot.id || ID_FAILED == slot.id)
+            {
+                continue;
+            }
+            const uint64_t sign = i < t->capacity ? slot.sign : 0;
+            key.sign1 = sign >> 32;
+            key.sign2 = sign;
+            value.id = slot.id;
+            value.offset = ids[slot.id - 1].first;
+            value.length = ids[slot.id - 1].second;
             if (fs->fwrite(&key, sizeof(key), 1, idx) != 1)
             {
                 P_WARNING("failed to write key to idx");
@@ -198,12 +638,17 @@ bool SignDict::dump(const char *dir, FSInterface *fs) const
             }
             if (fs->fwrite(&value, sizeof(value), 1, idx) != 1)
             {
-                fs->fclose(idx);
+                P_WARNING("failed to write value to idx");
                 goto fail0;
             }
-            ++it;
+            ++num;
+        }
+        if (num != size)
+        {
+            P_WARNING("sign num[%lu] != id num[%lu]", (uint64_t)num, (uint64_t)size);
+            goto fail0;
         }
-        if (fs->fwrite(&m_ids[0], sizeof(m_ids[0]), m_ids.size(), idx) != m_ids.size())
+        if (size > 0 && fs->fwrite(&ids[0], sizeof(ids[0]), ids.size(), idx) != ids.size())
         {
             P_WARNING("failed to write m_ids to idx");
             goto fail0;
@@ -214,39 +659,51 @@ bool SignDict::dump(const char *dir, FSInterface *fs) const
         {
 fail0:
             fs->fclose(idx);
-            return false;
+            goto FAIL;
         }
     }
     {
-        P_WARNING("start to write %ssigndict.data", path.c_str());
-        File data = fs->fopen((path + "signdict.data").c_str(), "wb");
+        /* 词可能指向mmap进来的signdict.data，截断它会让读线程SIGBUS，先写临时文件再rename */
+        const std::string data_name = path + "signdict.data";
+        const std::string write_name = m_map && &DefaultFS::s_default == fs ? data_name + ".tmp" : data_name;
+        P_WARNING("start to write %s", write_name.c_str());
+        File data = fs->fopen(write_name.c_str(), "wb");
         if (NULL == data)
         {
-            P_WARNING("failed to open %ssigndict.data for write", path.c_str());
-            return false;
+            P_WARNING("failed to open %s for write", write_name.c_str());
+            goto FAIL;
         }
-        if (fs->fwrite(&m_buffer_pos, sizeof(m_buffer_pos), 1, data) != 1)
+        if (fs->fwrite(&buffer_size, sizeof(buffer_size), 1, data) != 1)
         {
-            P_WARNING("failed to write m_buffer_pos to %ssigndict.data", path.c_str());
+            P_WARNING("failed to write buffer_pos to %ssigndict.data", path.c_str());
             goto fail1;
         }
-        if (fs->fwrite(&m_buffer_size, sizeof(m_buffer_size), 1, data) != 1)
+        if (fs->fwrite(&buffer_size, sizeof(buffer_size), 1, data) != 1)
         {
-            P_WARNING("failed to write m_buffer_size to %ssigndict.data", path.c_str());
+            P_WARNING("failed to write buffer_size to %ssigndict.data", path.c_str());
             goto fail1;
         }
-        if (m_buffer_pos > 0 && fs->fwrite(m_buffer, 1, m_buffer_pos, data) != m_buffer_pos)
+        for (size_t i = 0; i < size; ++i)
         {
-            P_WARNING("failed to write m_buffer to %ssigndict.data", path.c_str());
-            goto fail1;
+            const word_t &word = m_words[(i + 1) / SEG_SIZE][(i + 1) % SEG_SIZE];
+            if (fs->fwrite(word.ptr, 1, word.len, data) != word.len)
+            {
+                P_WARNING("failed to write word[%lu] to %ssigndict.data", (uint64_t)i + 1, path.c_str());
+                goto fail1;
+            }
         }
         fs->fclose(data);
-        P_WARNING("write %ssigndict.data ok", path.c_str());
+        if (write_name != data_name && ::rename(write_name.c_str(), data_name.c_str()) < 0)
+        {
+            P_WARNING("failed to rename %s to %s, errno=%d", write_name.c_str(), data_name.c_str(), errno);
+            goto FAIL;
+        }
+        P_WARNING("write %s ok", data_name.c_str());
         if (0)
         {
 fail1:
             fs->fclose(data);
-            return false;
+            goto FAIL;
         }
     }
     {
@@ -255,16 +712,122 @@ fail1:
         if (NULL == meta)
         {
             P_WARNING("failed to open %ssigndict.meta for write", path.c_str());
-            return false;
+            goto FAIL;
         }
-        for (size_t i = 0; i < m_ids.size(); ++i)
+        for (size_t i = 0; i < size; ++i)
         {
-            fs->fprintf(meta, "%s\n", std::string(m_buffer + m_ids[i].first, m_ids[i].second).c_str());
+            const word_t &word = m_words[(i + 1) / SEG_SIZE][(i + 1) % SEG_SIZE];
+            fs->fprintf(meta, "%s\n", std::string(word.ptr, word.len).c_str());
         }
         fs->fclose(meta);
         P_WARNING("write %ssigndict.meta ok", path.c_str());
     }
+    ret = true;
     P_WARNING("dump signdict ok");
+FAIL:
+    pthread_rwlock_unlock(&m_lock);
+    return ret;
+}
+
+bool SignDict::load_words(const std::string &path, FSInterface *fs,
+        const std::vector<std::pair<uint32_t, uint32_t> > &ids)
+{
+    typedef FSInterface::File File;
+
+    const char *buffer = NULL;
+    uint32_t buffer_pos = 0;
+    const std::string name = path + "signdict.data";
+    if (m_mmap_load && &DefaultFS::s_default == fs)
+    {
+        P_WARNING("start to mmap %s", name.c_str());
+        int fd = ::open(name.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            P_WARNING("failed to open %s, errno=%d", name.c_str(), errno);
+            return false;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) < 0 || (size_t)st.st_size < 2 * sizeof(uint32_t))
+        {
+            P_WARNING("invalid %s", name.c_str());
+            ::close(fd);
+            return false;
+        }
+        void *base = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (MAP_FAILED == base)
+        {
+            P_WARNING("failed to mmap %s, errno=%d", name.c_str(), errno);
+            return false;
+        }
+        m_map = base;
+        m_map_size = st.st_size;
+        buffer_pos = *(const uint32_t *)base;
+        if (2 * sizeof(uint32_t) + (size_t)buffer_pos > m_map_size)
+        {
+            P_WARNING("invalid %s, buffer_pos=%u, size=%lu", name.c_str(), buffer_pos, (uint64_t)m_map_size);
+            return false;
+        }
+        buffer = (const char *)base + 2 * sizeof(uint32_t);
+        P_WARNING("mmap %s ok, size=%lu", name.c_str(), (uint64_t)m_map_size);
+    }
+    else
+    {
+        P_WARNING("start to read %s", name.c_str());
+        File data = fs->fopen(name.c_str(), "rb");
+        if (NULL == data)
+        {
+            P_WARNING("failed to open %s for read", name.c_str());
+            return false;
+        }
+        uint32_t buffer_size;
+        chunk_t *chunk = NULL;
+        if (fs->fread(&buffer_pos, sizeof(buffer_pos), 1, data) != 1)
+        {
+            P_WARNING("failed to read buffer_pos from %s", name.c_str());
+            goto fail;
+        }
+        if (fs->fread(&buffer_size, sizeof(buffer_size), 1, data) != 1)
+        {
+            P_WARNING("failed to read buffer_size from %s", name.c_str());
+            goto fail;
+        }
+        chunk = (chunk_t *)::malloc(offsetof(chunk_t, data) + buffer_pos);
+        if (NULL == chunk)
+        {
+            P_WARNING("failed to alloc mem for buffer, buffer_pos=%u", buffer_pos);
+            goto fail;
+        }
+        chunk->size = buffer_pos;
+        chunk->pos = buffer_pos;
+        this->push_chunk(chunk);
+        if (buffer_pos > 0 && fs->fread(chunk->data, 1, buffer_pos, data) != buffer_pos)
+        {
+            P_WARNING("failed to read buffer from %s", name.c_str());
+            goto fail;
+        }
+        fs->fclose(data);
+        buffer = chunk->data;
+        P_WARNING("read %s ok", name.c_str());
+        if (0)
+        {
+fail:
+            fs->fclose(data);
+            return false;
+        }
+    }
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        if ((uint64_t)ids[i].first + ids[i].second > buffer_pos)
+        {
+            P_WARNING("invalid word[%lu], offset=%u, len=%u, buffer_pos=%u",
+                    (uint64_t)i + 1, ids[i].first, ids[i].second, buffer_pos);
+            return false;
+        }
+        word_t &word = m_words[(i + 1) / SEG_SIZE][(i + 1) % SEG_SIZE];
+        word.ptr = buffer + ids[i].first;
+        word.len = ids[i].second;
+    }
     return true;
 }
 
@@ -276,9 +839,12 @@ bool SignDict::load(const char *dir, FSInterface *fs)
         fs = &DefaultFS::s_default;
     }
 
-    m_dict->clear();
-    m_buffer_pos = 0;
-    m_ids.clear();
+    const uint64_t min_capacity = m_table ? m_table->capacity : 1024;
+    this->reset();
+    if (0 == m_chunk_size)
+    {
+        m_chunk_size = 1024*1024;
+    }
 
     if (NULL == dir || '\0' == *dir)
     {
@@ -292,6 +858,7 @@ bool SignDict::load(const char *dir, FSInterface *fs)
         path += "/";
     }
     P_WARNING("start to read signdict");
+    std::vector<std::pair<uint32_t, uint32_t> > ids;
     {
         P_WARNING("start to read %ssigndict.idx", path.c_str());
         File idx = fs->fopen((path + "signdict.idx").c_str(), "rb");
@@ -306,6 +873,34 @@ bool SignDict::load(const char *dir, FSInterface *fs)
             P_WARNING("failed to read size from idx");
             goto fail0;
         }
+        if (size >= (uint64_t)AGILE_SE_SIGNDICT_MAX_SEGS * SEG_SIZE - 1)
+        {
+            P_WARNING("too many words, size=%lu", (uint64_t)size);
+            goto fail0;
+        }
+        {
+            uint64_t capacity = min_capacity;
+            while (capacity / 10 * 7 < size)
+            {
+                capacity <<= 1;
+            }
+            m_table = alloc_table(capacity);
+            if (NULL == m_table)
+            {
+                P_WARNING("failed to alloc table, capacity=%lu", capacity);
+                goto fail0;
+            }
+        }
+        for (uint32_t seg = 0; seg <= size / SEG_SIZE; ++seg)
+        {
+            m_words[seg] = new (std::nothrow) word_t[SEG_SIZE];
+            if (NULL == m_words[seg])
+            {
+                P_WARNING("failed to alloc words segment[%u]", seg);
+                goto fail0;
+            }
+            ::memset(m_words[seg], 0, sizeof(word_t) * SEG_SIZE);
+        }
         key_t key;
         value_t value;
         for (size_t i = 0; i < size; ++i)
@@ -320,22 +915,43 @@ bool SignDict::load(const char *dir, FSInterface *fs)
                 P_WARNING("failed to read value from idx");
                 goto fail0;
             }
-            if (!m_dict->insert(key, value))
+            if (0 == value.id || value.id > size)
             {
-                P_WARNING("failed to insert key=value to m_dict");
+                P_WARNING("invalid id[%u], size=%lu", value.id, (uint64_t)size);
                 goto fail0;
             }
+            const uint64_t sign = (uint64_t(key.sign1) << 32) | key.sign2;
+            slot_t *slot = &m_zero;
+            if (0 == sign)
+            {
+                m_zero.sign = 1;
+            }
+            else
+            {
+                uint64_t j = mix(sign) & m_table->mask;
+                while (0 != m_table->slots[j].sign && sign != m_table->slots[j].sign)
+                {
+                    j = (j + 1) & m_table->mask;
+                }
+                slot = &m_table->slots[j];
+                if (0 == slot->sign)
+                {
+                    slot->sign = sign;
+                    ++m_table->used;
+                }
+            }
+            slot->id = value.id;
         }
         try
         {
-            m_ids.resize(size);
+            ids.resize(size);
         }
         catch (...)
         {
             P_WARNING("failed to resize m_ids, size=%lu", (uint64_t)size);
             goto fail0;
         }
-        if (fs->fread(&m_ids[0], sizeof(m_ids[0]), m_ids.size(), idx) != m_ids.size())
+        if (size > 0 && fs->fread(&ids[0], sizeof(ids[0]), ids.size(), idx) != ids.size())
         {
             P_WARNING("failed to read m_ids from idx");
             goto fail0;
@@ -349,57 +965,13 @@ fail0:
             return false;
         }
     }
+    if (!this->load_words(path, fs, ids))
     {
-        P_WARNING("start to read %ssigndict.data", path.c_str());
-        File data = fs->fopen((path + "signdict.data").c_str(), "rb");
-        if (NULL == data)
-        {
-            P_WARNING("failed to open %ssigndict.data for read", path.c_str());
-            return false;
-        }
-        uint32_t buffer_pos;
-        uint32_t buffer_size;
-        char *buffer = NULL;
-        if (fs->fread(&buffer_pos, sizeof(buffer_pos), 1, data) != 1)
-        {
-            P_WARNING("failed to read buffer_pos from %ssigndict.data", path.c_str());
-            goto fail1;
-        }
-        if (fs->fread(&buffer_size, sizeof(buffer_size), 1, data) != 1)
-        {
-            P_WARNING("failed to read buffer_size from %ssigndict.data", path.c_str());
-            goto fail1;
-        }
-        buffer = new (std::nothrow) char[buffer_size];
-        if (NULL == buffer)
-        {
-            P_WARNING("failed to alloc mem for buffer, buffer_size=%u", buffer_size);
-            goto fail1;
-        }
-        if (buffer_pos > 0 && fs->fread(buffer, 1, buffer_pos, data) != buffer_pos)
-        {
-            delete [] buffer;
-
-            P_WARNING("failed to read m_buffer to %ssigndict.data", path.c_str());
-            goto fail1;
-        }
-        fs->fclose(data);
-        P_WARNING("read %ssigndict.data ok", path.c_str());
-        if (m_buffer)
-        {
-            delete [] m_buffer;
-        }
-        m_buffer = buffer;
-        m_buffer_pos = buffer_pos;
-        m_buffer_size = buffer_size;
-        if (0)
-        {
-fail1:
-            fs->fclose(data);
-            return false;
-        }
+        P_WARNING("failed to load words");
+        return false;
     }
-    m_max_id = m_ids.size() + 1;
-    P_WARNING("read signdict ok");
+    m_max_id = ids.size() + 1;
+    P_WARNING("read signdict ok, size=%lu, capacity=%lu, mmap=%d",
+            (uint64_t)ids.size(), (uint64_t)m_table->capacity, m_map ? 1 : 0);
     return true;
 }
@@ -8,6 +8,9 @@ void init_time_updater();
 namespace inc
 {
     DECLARE_INC_PROCESSOR(das_processor);
+    DECLARE_INC_PROCESSOR(pipeline_processor);
+    DECLARE_INC_PROCESSOR(level_pipeline_processor);
+    DECLARE_INC_PROCESSOR(base_build_processor);
 }
 
 void init_nbslib()
@@ -16,4 +19,7 @@ void init_nbslib()
     init_operator_priority();
 
     REGISTER_INC_PROCESSOR(inc::das_processor);
+    REGISTER_INC_PROCESSOR(inc::pipeline_processor);
+    REGISTER_INC_PROCESSOR(inc::level_pipeline_processor);
+    REGISTER_INC_PROCESSOR(inc::base_build_processor);
 }
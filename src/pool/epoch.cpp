@@ -0,0 +1,101 @@
+#include <stdlib.h>
+#include <pthread.h>
+#include "log_utils.h"
+#include "pool/epoch.h"
+
+volatile uint64_t g_epoch = 1;
+volatile bool g_epoch_reclaim = false;
+
+/* 每个读线程一个槽位，独占一个cache line */
+struct epoch_slot_t
+{
+    volatile uint64_t epoch;    /* 0为不在读 */
+    volatile uint32_t used;
+    uint32_t depth;
+    char padding[64 - 16];
+};
+
+static epoch_slot_t s_slots[AGILE_SE_EPOCH_MAX_READERS] __attribute__((aligned(64)));
+static volatile uint32_t s_slot_num = 0;    /* 用过的最大槽位 + 1，写线程只扫描这么多 */
+static pthread_key_t s_slot_key;
+static pthread_once_t s_key_once = PTHREAD_ONCE_INIT;
+static __thread epoch_slot_t *t_slot = NULL;
+
+static void release_slot(void *ptr) /* 线程退出时归还槽位 */
+{
+    epoch_slot_t *slot = (epoch_slot_t *)ptr;
+    slot->epoch = 0;
+    slot->depth = 0;
+    __sync_synchronize();
+    slot->used = 0;
+}
+
+static void create_slot_key()
+{
+    ::pthread_key_create(&s_slot_key, release_slot);
+}
+
+static epoch_slot_t *acquire_slot()
+{
+    ::pthread_once(&s_key_once, create_slot_key);
+    for (uint32_t i = 0; i < AGILE_SE_EPOCH_MAX_READERS; ++i)
+    {
+        if (0 == s_slots[i].used && __sync_bool_compare_and_swap(&s_slots[i].used, 0, 1))
+        {
+            uint32_t num = s_slot_num;
+            while (num < i + 1 && !__sync_bool_compare_and_swap(&s_slot_num, num, i + 1))
+            {
+                num = s_slot_num;
+            }
+            ::pthread_setspecific(s_slot_key, &s_slots[i]);
+            return &s_slots[i];
+        }
+    }
+    P_FATAL("too many reader threads, max=%d", AGILE_SE_EPOCH_MAX_READERS);
+    ::abort();
+    return NULL;
+}
+
+void enable_epoch_reclaim()
+{
+    g_epoch_reclaim = true;
+    P_WARNING("epoch based reclamation enabled");
+}
+
+void epoch_enter()
+{
+    epoch_slot_t *slot = t_slot;
+    if (NULL == slot)
+    {
+        slot = t_slot = acquire_slot();
+    }
+    if (0 == slot->depth++)
+    {
+        slot->epoch = g_epoch;
+        __sync_synchronize(); /* 先公开epoch，再读索引 */
+    }
+}
+
+void epoch_exit()
+{
+    epoch_slot_t *slot = t_slot;
+    if (slot && slot->depth > 0 && 0 == --slot->depth)
+    {
+        __sync_synchronize(); /* 读完索引，再清epoch */
+        slot->epoch = 0;
+    }
+}
+
+uint64_t epoch_min_active()
+{
+    uint64_t min = g_epoch;
+    for (uint32_t i = 0, num = s_slot_num; i < num; ++i)
+    {
+        const uint64_t epoch = s_slots[i].epoch;
+        if (0 != epoch && epoch < min)
+        {
+            min = epoch;
+        }
+    }
+    return min;
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <map>
+#include "log_utils.h"
+#include "str_utils.h"
+#include "pool/page_alloc.h"
+
+#ifndef MADV_HUGEPAGE
+#define MADV_HUGEPAGE   14
+#endif
+/* 不依赖libnuma，直接调用mbind */
+#define AGILE_SE_MPOL_BIND          2
+#define AGILE_SE_MPOL_INTERLEAVE    3
+#define AGILE_SE_MAX_NUMA_NODES     1024
+
+namespace
+{
+    struct chunk_t
+    {
+        size_t size;
+        size_t pos;     /* 下一次切分的位置 */
+        size_t live;    /* 未释放的字节数 */
+    };
+    typedef std::map<char *, chunk_t> ChunkMap;
+
+    page_alloc_conf_t s_conf;
+    unsigned long s_nodemask[AGILE_SE_MAX_NUMA_NODES / (8 * sizeof(unsigned long))];
+    unsigned long s_maxnode = 0;
+
+    pthread_mutex_t s_mutex = PTHREAD_MUTEX_INITIALIZER;
+    ChunkMap s_chunks;
+    char *s_cur = NULL;                 /* 当前切分的大块 */
+    volatile size_t s_chunk_num = 0;    /* 为0时page_free不用加锁查找 */
+    uint64_t s_mapped_bytes = 0;
+    uint64_t s_used_bytes = 0;
+    bool s_madvise_warned = false;
+
+    char *map_chunk(size_t size)
+    {
+        /* 多映射一个大页，截掉首尾得到2MB对齐的区域 */
+        const size_t len = size + AGILE_SE_HUGE_PAGE_SIZE;
+        char *raw = (char *)::mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MAP_FAILED == raw)
+        {
+            P_WARNING("failed to mmap %lu bytes", (uint64_t)len);
+            return NULL;
+        }
+        char *base = (char *)(((uintptr_t)raw + AGILE_SE_HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(AGILE_SE_HUGE_PAGE_SIZE - 1));
+        if (base > raw)
+        {
+            ::munmap(raw, base - raw);
+        }
+        if (raw + len > base + size)
+        {
+            ::munmap(base + size, raw + len - base - size);
+        }
+        if (::madvise(base, size, MADV_HUGEPAGE) != 0 && !s_madvise_warned)
+        {
+            s_madvise_warned = true;
+            P_WARNING("madvise(MADV_HUGEPAGE) failed, transparent huge page may be disabled");
+        }
+        if (NUMA_POLICY_NONE != s_conf.numa_policy)
+        {
+            const int mode = NUMA_POLICY_BIND == s_conf.numa_policy ? AGILE_SE_MPOL_BIND : AGILE_SE_MPOL_INTERLEAVE;
+            if (::syscall(SYS_mbind, base, size, mode, s_nodemask, s_maxnode, 0) != 0)
+            {
+                P_WARNING("mbind failed, policy=%d", s_conf.numa_policy);
+            }
+        }
+        return base;
+    }
+
+    void unmap_chunk(ChunkMap::iterator it)
+    {
+        ::munmap(it->first, it->second.size);
+        s_mapped_bytes -= it->second.size;
+        if (s_cur == it->first)
+        {
+            s_cur = NULL;
+        }
+        s_chunks.erase(it);
+        s_chunk_num = s_chunks.size();
+    }
+
+    void *huge_alloc(size_t size, size_t align)
+    {
+        if (align < sizeof(void *))
+        {
+            align = sizeof(void *);
+        }
+        if (size > AGILE_SE_HUGE_CHUNK_SIZE / 2) /* 大页面单独映射 */
+        {
+            const size_t chunk_size = (size + AGILE_SE_HUGE_PAGE_SIZE - 1) & ~(size_t)(AGILE_SE_HUGE_PAGE_SIZE - 1);
+            char *base = map_chunk(chunk_size);
+            if (NULL == base)
+            {
+                return NULL;
+            }
+            chunk_t &chunk = s_chunks[base];
+            chunk.size = chunk_size;
+            chunk.pos = chunk_size;
+            chunk.live = size;
+            s_chunk_num = s_chunks.size();
+            s_mapped_bytes += chunk_size;
+            s_used_bytes += size;
+            return base;
+        }
+        if (s_cur)
+        {
+            chunk_t &chunk = s_chunks[s_cur];
+            const size_t pos = (chunk.pos + align - 1) & ~(align - 1);
+            if (pos + size <= chunk.size)
+            {
+                chunk.pos = pos + size;
+                chunk.live += size;
+                s_used_bytes += size;
+                return s_cur + pos;
+            }
+            if (0 == chunk.live)
+            {
+                unmap_chunk(s_chunks.find(s_cur));
+            }
+            s_cur = NULL;
+        }
+        char *base = map_chunk(AGILE_SE_HUGE_CHUNK_SIZE);
+        if (NULL == base)
+        {
+            return NULL;
+        }
+        chunk_t &chunk = s_chunks[base];
+        chunk.size = AGILE_SE_HUGE_CHUNK_SIZE;
+        chunk.pos = size;
+        chunk.live = size;
+        s_chunk_num = s_chunks.size();
+        s_mapped_bytes += AGILE_SE_HUGE_CHUNK_SIZE;
+        s_used_bytes += size;
+        s_cur = base;
+        return base;
+    }
+
+    /* 已加锁，不是大块中的页返回false */
+    bool huge_free(void *ptr, size_t size)
+    {
+        ChunkMap::iterator it = s_chunks.upper_bound((char *)ptr);
+        if (it == s_chunks.begin())
+        {
+            return false;
+        }
+        --it;
+        if ((char *)ptr >= it->first + it->second.size)
+        {
+            return false;
+        }
+        it->second.live -= size;
+        s_used_bytes -= size;
+        if (0 == it->second.live)
+        {
+            if (s_cur == it->first)
+            {
+                it->second.pos = 0; /* 当前大块从头复用 */
+            }
+            else
+            {
+                unmap_chunk(it);
+            }
+        }
+        return true;
+    }
+}
+
+int page_alloc_parse(const std::string &backend, const std::string &policy,
+        const std::string &nodes, page_alloc_conf_t &conf)
+{
+    conf = page_alloc_conf_t();
+    if ("" == backend || "malloc" == backend)
+    {
+        conf.backend = PAGE_BACKEND_MALLOC;
+    }
+    else if ("huge" == backend)
+    {
+        conf.backend = PAGE_BACKEND_HUGE;
+    }
+    else
+    {
+        P_WARNING("invalid page backend[%s], must be malloc or huge", backend.c_str());
+        return -1;
+    }
+    if ("" == policy || "none" == policy)
+    {
+        conf.numa_policy = NUMA_POLICY_NONE;
+    }
+    else if ("bind" == policy)
+    {
+        conf.numa_policy = NUMA_POLICY_BIND;
+    }
+    else if ("interleave" == policy)
+    {
+        conf.numa_policy = NUMA_POLICY_INTERLEAVE;
+    }
+    else
+    {
+        P_WARNING("invalid numa policy[%s], must be none, bind or interleave", policy.c_str());
+        return -1;
+    }
+    std::vector<std::string> elems;
+    split(nodes, ",", elems);
+    for (size_t i = 0; i < elems.size(); ++i)
+    {
+        int32_t node;
+        if (elems[i].empty())
+        {
+            continue;
+        }
+        if (!parseInt32(elems[i], node) || node < 0 || node >= AGILE_SE_MAX_NUMA_NODES)
+        {
+            P_WARNING("invalid numa node[%s]", elems[i].c_str());
+            return -1;
+        }
+        conf.numa_nodes.push_back(node);
+    }
+    if (NUMA_POLICY_NONE != conf.numa_policy)
+    {
+        if (PAGE_BACKEND_HUGE != conf.backend)
+        {
+            P_WARNING("numa policy needs huge page backend");
+            return -1;
+        }
+        if (conf.numa_nodes.empty())
+        {
+            P_WARNING("numa policy needs numa nodes");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int page_alloc_init(const page_alloc_conf_t &conf)
+{
+    ::pthread_mutex_lock(&s_mutex);
+    s_conf = conf;
+    ::memset(s_nodemask, 0, sizeof(s_nodemask));
+    s_maxnode = 0;
+    for (size_t i = 0; i < conf.numa_nodes.size(); ++i)
+    {
+        const int node = conf.numa_nodes[i];
+        s_nodemask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+        if ((unsigned long)node + 2 > s_maxnode)
+        {
+            s_maxnode = node + 2; /* mbind的maxnode是位数+1 */
+        }
+    }
+    if (s_cur && 0 == s_chunks[s_cur].live)
+    {
+        unmap_chunk(s_chunks.find(s_cur));
+    }
+    s_cur = NULL; /* 之后切分的页使用新的配置 */
+    ::pthread_mutex_unlock(&s_mutex);
+    P_WARNING("page backend[%s], numa policy[%d], numa nodes[%d]",
+            PAGE_BACKEND_HUGE == conf.backend ? "huge" : "malloc",
+            conf.numa_policy, (int)conf.numa_nodes.size());
+    return 0;
+}
+
+void *page_alloc(size_t size, size_t align)
+{
+    if (PAGE_BACKEND_HUGE != s_conf.backend)
+    {
+        return align > 0 ? ::memalign(align, size) : ::malloc(size);
+    }
+    ::pthread_mutex_lock(&s_mutex);
+    void *ptr = huge_alloc(size, align);
+    ::pthread_mutex_unlock(&s_mutex);
+    return ptr;
+}
+
+void page_free(void *ptr, size_t size)
+{
+    if (NULL == ptr)
+    {
+        return ;
+    }
+    if (0 != s_chunk_num)
+    {
+        ::pthread_mutex_lock(&s_mutex);
+        const bool ok = huge_free(ptr, size);
+        ::pthread_mutex_unlock(&s_mutex);
+        if (ok)
+        {
+            return ;
+        }
+    }
+    ::free(ptr);
+}
+
+void page_alloc_stats(page_alloc_stats_t &stats)
+{
+    ::memset(&stats, 0, sizeof(stats));
+
+    std::vector<std::pair<char *, char *> > ranges;
+    ::pthread_mutex_lock(&s_mutex);
+    stats.chunk_num = s_chunks.size();
+    stats.mapped_bytes = s_mapped_bytes;
+    stats.used_bytes = s_used_bytes;
+    for (ChunkMap::const_iterator it = s_chunks.begin(); it != s_chunks.end(); ++it)
+    {
+        ranges.push_back(std::make_pair(it->first, it->first + it->second.size));
+    }
+    ::pthread_mutex_unlock(&s_mutex);
+    if (ranges.empty())
+    {
+        return ;
+    }
+    FILE *fp = ::fopen("/proc/self/smaps", "r");
+    if (NULL == fp)
+    {
+        P_WARNING("failed to open /proc/self/smaps");
+        return ;
+    }
+    /* 大块madvise过，所在的vma不会与其它映射合并，按vma起始地址判断 */
+    char line[512];
+    bool ours = false;
+    while (::fgets(line, sizeof line, fp))
+    {
+        unsigned long begin, end;
+        unsigned long kb;
+        if (::sscanf(line, "%lx-%lx ", &begin, &end) == 2)
+        {
+            ours = false;
+            for (size_t i = 0; i < ranges.size(); ++i)
+            {
+                if ((char *)begin >= ranges[i].first && (char *)begin < ranges[i].second)
+                {
+                    ours = true;
+                    break;
+                }
+            }
+        }
+        else if (ours && ::sscanf(line, "AnonHugePages: %lu kB", &kb) == 1)
+        {
+            stats.huge_bytes += (uint64_t)kb * 1024;
+        }
+    }
+    ::fclose(fp);
+}
+
+void page_alloc_print_meta()
+{
+    page_alloc_stats_t stats;
+    page_alloc_stats(stats);
+    P_WARNING("page backend[%s]: chunks=%lu, mapped=%lu, used=%lu, huge=%lu(%lu huge pages)",
+            PAGE_BACKEND_HUGE == s_conf.backend ? "huge" : "malloc",
+            stats.chunk_num, stats.mapped_bytes, stats.used_bytes,
+            stats.huge_bytes, stats.huge_bytes / AGILE_SE_HUGE_PAGE_SIZE);
+}
@@ -0,0 +1,1572 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <malloc.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "log_utils.h"
+#include "index/forward_index.h"
+#include "index/hashtable.h"
+#include "index/flat_hashtable.h"
+#include "index/skiplist.h"
+#include "index/signdict.h"
+#include "index/sortlist.h"
+#include "index/term_vector.h"
+#include "index/cow_btree.h"
+#include "index/segment_invert.h"
+#include "index/index.h"
+#include "pool/epoch.h"
+#include "pool/page_alloc.h"
+#include "pool/concurrent_pool.h"
+#include "index/facet.h"
+#include "search/bitmaplist.h"
+
+log_conf_t lc;
+
+static int64_t now_us()
+{
+    struct timeval tv;
+    ::gettimeofday(&tv, NULL);
+    return int64_t(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+/* 用brand_id/cate_id/price构造doc_num个doc */
+static bool build_forward(ForwardIndex &forward, int32_t doc_num)
+{
+    char buf[256];
+    for (int32_t i = 0; i < doc_num; ++i)
+    {
+        ::snprintf(buf, sizeof buf, "{\"brand_id\":%d,\"cate_id\":%d,\"price\":%d.5}",
+                int((int64_t(i) * 7919) % 5000), i % 300, i % 10000);
+        std::vector<forward_data_t> fields;
+        cJSON *json = parse_forward_json(buf, fields);
+        if (NULL == json)
+        {
+            P_WARNING("failed to parse forward json");
+            return false;
+        }
+        const bool ok = forward.update(i, fields, NULL);
+        cJSON_Delete(json);
+        if (!ok)
+        {
+            P_WARNING("failed to update doc[%d]", i);
+            return false;
+        }
+    }
+    return true;
+}
+
+static DocList *all_docs(int32_t doc_num)
+{
+    std::vector<uint64_t> bits((doc_num + 63) / 64, ~(uint64_t)0);
+    if (doc_num & 63)
+    {
+        bits.back() = (((uint64_t)1) << (doc_num & 63)) - 1;
+    }
+    return new BitmapList(0, bits);
+}
+
+/* bench facet <conf_path> <conf_file> [doc_num] [max_thread_num] */
+static int bench_facet(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s facet <conf_path> <conf_file> [doc_num] [max_thread_num]\n", argv[0]);
+        return -1;
+    }
+    const int32_t doc_num = argc > 4 ? ::atoi(argv[4]) : 1000000;
+    const int max_thread_num = argc > 5 ? ::atoi(argv[5]) : 8;
+    const char *fields[] = { "brand_id", "cate_id" };
+
+    ForwardIndex forward;
+    if (forward.init(argv[2], argv[3]) < 0 || !build_forward(forward, doc_num))
+    {
+        return -1;
+    }
+    for (size_t f = 0; f < sizeof(fields) / sizeof(fields[0]); ++f)
+    {
+        const int32_t array_offset = forward.get_array_offset_by_name(fields[f]);
+        /* 对照组：逐个doc取正排计数 */
+        DocList *list = all_docs(doc_num);
+        int64_t begin = now_us();
+        std::vector<uint32_t> counts;
+        size_t hits = 0;
+        for (int32_t docid = list->first(); docid != -1; docid = list->next())
+        {
+            const int32_t *info = (const int32_t *)forward.get_info_by_id(docid);
+            if (NULL == info) { continue; }
+            const uint32_t value = info[array_offset];
+            if (value >= counts.size()) { counts.resize(value + 1, 0); }
+            ++counts[value];
+            ++hits;
+        }
+        printf("facet[%s] naive: hits=%lu, %ld us\n", fields[f], (unsigned long)hits, long(now_us() - begin));
+        delete list;
+
+        for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2)
+        {
+            list = all_docs(doc_num);
+            std::vector<facet_t> top;
+            FacetCounter counter;
+            counter.init(&forward, fields[f]);
+            begin = now_us();
+            if (thread_num > 1)
+            {
+                std::vector<int32_t> ids;
+                ids.reserve(list->cost());
+                for (int32_t docid = list->first(); docid != -1; docid = list->next())
+                {
+                    ids.push_back(docid);
+                }
+                counter.count(&ids[0], ids.size(), thread_num);
+            }
+            else
+            {
+                counter.count(list);
+            }
+            counter.top(10, top);
+            printf("facet[%s] threads=%d: hits=%lu, top1=%d:%u, %ld us\n", fields[f], thread_num,
+                    (unsigned long)counter.doc_num(), top.empty() ? -1 : top[0].value,
+                    top.empty() ? 0 : top[0].count, long(now_us() - begin));
+            delete list;
+        }
+    }
+    return 0;
+}
+
+void init_time_updater();
+
+struct reclaim_value_t
+{
+    int32_t data[16];
+};
+typedef HashTable<int32_t, reclaim_value_t> ReclaimHash;
+
+struct reclaim_ctx_t
+{
+    ReclaimHash *hash;
+    int32_t key_num;
+    volatile bool stop;
+    volatile uint64_t reads;
+};
+
+static void *reclaim_reader(void *arg)
+{
+    reclaim_ctx_t *ctx = (reclaim_ctx_t *)arg;
+    uint32_t seed = (uint32_t)(intptr_t)&seed;
+    uint64_t reads = 0;
+    int64_t sum = 0;
+    while (!ctx->stop)
+    {
+        EpochGuard guard;
+        for (int i = 0; i < 64; ++i)
+        {
+            const reclaim_value_t *v = ctx->hash->find(::rand_r(&seed) % ctx->key_num);
+            if (v)
+            {
+                sum += v->data[0] + v->data[15];
+            }
+        }
+        reads += 64;
+    }
+    __sync_fetch_and_add(&ctx->reads, reads + (sum & 0));
+    return NULL;
+}
+
+/* 写线程持续覆盖key_num个key，读线程随机查找，统计待回收内存的峰值 */
+static void run_reclaim(const char *mode, int seconds, int reader_num, int32_t key_num)
+{
+    TDelayPool<Mempool> pool;
+    ReclaimHash::ObjectPool node_pool;
+    ReclaimHash hash(key_num);
+    if (node_pool.init(&pool) < 0 || pool.init(key_num * 4) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return ;
+    }
+    hash.set_pool(&node_pool);
+
+    reclaim_ctx_t ctx;
+    ctx.hash = &hash;
+    ctx.key_num = key_num;
+    ctx.stop = false;
+    ctx.reads = 0;
+    reclaim_value_t value;
+    ::memset(&value, 0, sizeof(value));
+    for (int32_t i = 0; i < key_num; ++i)
+    {
+        hash.insert(i, value);
+    }
+    std::vector<pthread_t> tids(reader_num);
+    for (int i = 0; i < reader_num; ++i)
+    {
+        ::pthread_create(&tids[i], NULL, reclaim_reader, &ctx);
+    }
+    uint64_t writes = 0;
+    const int64_t begin = now_us();
+    const int64_t end = begin + int64_t(seconds) * 1000000;
+    while (now_us() < end)
+    {
+        for (int i = 0; i < 1024; ++i)
+        {
+            value.data[0] = writes;
+            hash.insert((writes * 7919) % key_num, value);
+            ++writes;
+        }
+        pool.recycle();
+    }
+    ctx.stop = true;
+    for (int i = 0; i < reader_num; ++i)
+    {
+        ::pthread_join(tids[i], NULL);
+    }
+    const int64_t used = now_us() - begin;
+    printf("reclaim[%s] readers=%d: writes=%lu/s, reads=%lu/s, peak garbage bytes=%lu, garbage bytes at end=%lu\n",
+            mode, reader_num, (unsigned long)(writes * 1000000 / used),
+            (unsigned long)(ctx.reads * 1000000 / used),
+            (unsigned long)pool.peak_garbage_bytes(), (unsigned long)pool.garbage_bytes());
+}
+
+/* bench reclaim [seconds] [reader_num] [key_num] */
+static int bench_reclaim(int argc, char *argv[])
+{
+    const int seconds = argc > 2 ? ::atoi(argv[2]) : 10;
+    const int reader_num = argc > 3 ? ::atoi(argv[3]) : 4;
+    const int32_t key_num = argc > 4 ? ::atoi(argv[4]) : 1000000;
+
+    init_time_updater();
+    run_reclaim("time", seconds, reader_num, key_num);
+    enable_epoch_reclaim();
+    run_reclaim("epoch", seconds, reader_num, key_num);
+    return 0;
+}
+
+/* 在指定页后端上构建key_num个key的HashTable，统计随机查找延迟 */
+static void run_pagealloc(const char *backend, int32_t key_num, int64_t lookup_num)
+{
+    page_alloc_conf_t conf;
+    if (page_alloc_parse(backend, "none", "", conf) < 0 || page_alloc_init(conf) < 0)
+    {
+        fprintf(stderr, "failed to init page backend[%s]\n", backend);
+        return ;
+    }
+    {
+        TDelayPool<Mempool> pool;
+        ReclaimHash::ObjectPool node_pool;
+        ReclaimHash hash(key_num);
+        if (node_pool.init(&pool) < 0 || pool.init(key_num * 2) < 0)
+        {
+            fprintf(stderr, "failed to init pool\n");
+            return ;
+        }
+        hash.set_pool(&node_pool);
+        reclaim_value_t value;
+        ::memset(&value, 0, sizeof(value));
+        int64_t begin = now_us();
+        for (int32_t i = 0; i < key_num; ++i)
+        {
+            value.data[0] = i;
+            hash.insert((int32_t)((int64_t(i) * 2654435761u) & 0x7fffffff), value);
+        }
+        const int64_t build_us = now_us() - begin;
+
+        uint32_t seed = 12345;
+        int64_t sum = 0;
+        begin = now_us();
+        for (int64_t i = 0; i < lookup_num; ++i)
+        {
+            const int32_t k = ::rand_r(&seed) % key_num;
+            const reclaim_value_t *v = hash.find((int32_t)((int64_t(k) * 2654435761u) & 0x7fffffff));
+            if (v)
+            {
+                sum += v->data[0];
+            }
+        }
+        const int64_t lookup_us = now_us() - begin;
+
+        page_alloc_stats_t stats;
+        page_alloc_stats(stats);
+        printf("pagealloc[%s] keys=%d: build=%ld ms, lookup=%.1f ns/op, mapped=%lu MB, huge=%lu MB, checksum=%ld\n",
+                backend, key_num, (long)(build_us / 1000), lookup_us * 1000.0 / lookup_num,
+                (unsigned long)(stats.mapped_bytes >> 20), (unsigned long)(stats.huge_bytes >> 20), (long)sum);
+    }
+}
+
+/* bench pagealloc [key_num] [lookup_num] */
+static int bench_pagealloc(int argc, char *argv[])
+{
+    const int32_t key_num = argc > 2 ? ::atoi(argv[2]) : 4000000;
+    const int64_t lookup_num = argc > 3 ? ::atoll(argv[3]) : 20000000;
+
+    init_time_updater();
+    run_pagealloc("malloc", key_num, lookup_num);
+    run_pagealloc("huge", key_num, lookup_num);
+    return 0;
+}
+
+/* 同样的数据分别放在32位和64位vaddr的pool中，比较HashTable/TSkipList/CowBtree的查找延迟 */
+template<typename TMemoryPool>
+static void run_vaddr_lookup(const char *name, int32_t key_num, int64_t lookup_num)
+{
+    typedef HashTable<int32_t, reclaim_value_t, __gnu_cxx::hash<int32_t>, std::equal_to<int32_t>, TMemoryPool> Hash;
+    typedef TSkipList<TMemoryPool> SkipList;
+    typedef CowBtree<TMemoryPool, 32> Btree;
+
+    TDelayPool<TMemoryPool> pool;
+    typename Hash::ObjectPool node_pool;
+    Hash hash(key_num);
+    if (node_pool.init(&pool) < 0 || SkipList::init_pool(&pool, sizeof(int32_t)) < 0
+            || pool.register_item(Btree::node_size()) < 0
+            || pool.register_item(Btree::leaf_size(sizeof(int32_t))) < 0
+            || pool.init(key_num * 4) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return ;
+    }
+    hash.set_pool(&node_pool);
+    SkipList list(&pool, 0, sizeof(int32_t));
+    Btree tree(&pool, 0, sizeof(int32_t));
+
+    reclaim_value_t value;
+    ::memset(&value, 0, sizeof(value));
+    tree.init_for_modify();
+    for (int32_t i = 0; i < key_num; ++i)
+    {
+        value.data[0] = i;
+        int32_t payload = i;
+        hash.insert(i * 7, value);
+        list.insert(i * 7, &payload);
+        tree.insert(i * 7, &payload);
+    }
+    tree.end_for_modify();
+
+    int64_t sum = 0;
+    uint32_t seed = 12345;
+    int64_t begin = now_us();
+    for (int64_t i = 0; i < lookup_num; ++i)
+    {
+        const reclaim_value_t *v = hash.find((::rand_r(&seed) % key_num) * 7);
+        sum += v ? v->data[0] : 0;
+    }
+    const int64_t hash_us = now_us() - begin;
+
+    seed = 12345;
+    begin = now_us();
+    for (int64_t i = 0; i < lookup_num; ++i)
+    {
+        void *payload = NULL;
+        list.find((::rand_r(&seed) % key_num) * 7, &payload);
+        sum += payload ? *(int32_t *)payload : 0;
+    }
+    const int64_t list_us = now_us() - begin;
+
+    seed = 12345;
+    begin = now_us();
+    for (int64_t i = 0; i < lookup_num; ++i)
+    {
+        void *payload = NULL;
+        tree.seek((::rand_r(&seed) % key_num) * 7, &payload);
+        sum += payload ? *(int32_t *)payload : 0;
+    }
+    const int64_t tree_us = now_us() - begin;
+
+    printf("vaddr[%s] keys=%d: hash=%.1f ns/op, skiplist=%.1f ns/op, cowbtree=%.1f ns/op, checksum=%ld\n",
+            name, key_num, hash_us * 1000.0 / lookup_num, list_us * 1000.0 / lookup_num,
+            tree_us * 1000.0 / lookup_num, (long)sum);
+}
+
+/* 一直分配8字节的元素直到失败或者达到target个，页从huge后端的大块中切分，不会真正占用内存 */
+template<typename TMemoryPool>
+static void run_vaddr_capacity(const char *name, uint64_t target)
+{
+    TMemoryPool pool;
+    if (pool.register_item(8) < 0 || pool.init(1u << 24) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return ;
+    }
+    typename TMemoryPool::vaddr_t last = 0;
+    uint64_t num = 0;
+    const int64_t begin = now_us();
+    while (num < target)
+    {
+        const typename TMemoryPool::vaddr_t ptr = pool.alloc(8);
+        if (0 == ptr)
+        {
+            break;
+        }
+        last = ptr;
+        ++num;
+    }
+    uint64_t *tail = (uint64_t *)pool.addr(last);
+    if (tail)
+    {
+        *tail = num;
+    }
+    printf("vaddr[%s] capacity: alloced %lu elems (%s 2^32) in %ld ms, last vaddr=%#lx, tail ok=%d\n",
+            name, (unsigned long)num, num > (((uint64_t)1) << 32) ? ">" : "<=",
+            (long)((now_us() - begin) / 1000), (unsigned long)last, tail && *tail == num);
+    pool.clear();
+}
+
+/* bench vaddr64 [key_num] [lookup_num] [capacity]，capacity为0时不做容量测试 */
+static int bench_vaddr64(int argc, char *argv[])
+{
+    const int32_t key_num = argc > 2 ? ::atoi(argv[2]) : 1000000;
+    const int64_t lookup_num = argc > 3 ? ::atoll(argv[3]) : 10000000;
+    const uint64_t capacity = argc > 4 ? ::strtoull(argv[4], NULL, 10) : (((uint64_t)1) << 32) + (1u << 24);
+
+    init_time_updater();
+    run_vaddr_lookup<Mempool>("32", key_num, lookup_num);
+    run_vaddr_lookup<Mempool64>("64", key_num, lookup_num);
+    if (capacity > 0)
+    {
+        page_alloc_conf_t conf;
+        if (page_alloc_parse("huge", "none", "", conf) < 0 || page_alloc_init(conf) < 0)
+        {
+            return -1;
+        }
+        run_vaddr_capacity<Mempool>("32", capacity);
+        run_vaddr_capacity<Mempool64>("64", capacity);
+    }
+    return 0;
+}
+
+/* 多线程下只能整体加锁使用的Mempool，作为对照 */
+class LockedMempool
+{
+    public:
+        typedef Mempool::vaddr_t vaddr_t;
+    public:
+        LockedMempool() { ::pthread_mutex_init(&m_lock, NULL); }
+        ~LockedMempool() { ::pthread_mutex_destroy(&m_lock); }
+
+        int register_item(uint32_t elem_size) { return m_pool.register_item(elem_size); }
+        int init(uint32_t max_items_num) { return m_pool.init(max_items_num); }
+        vaddr_t alloc(uint32_t elem_size)
+        {
+            ::pthread_mutex_lock(&m_lock);
+            vaddr_t ptr = m_pool.alloc(elem_size);
+            ::pthread_mutex_unlock(&m_lock);
+            return ptr;
+        }
+        void free(vaddr_t ptr, uint32_t elem_size)
+        {
+            ::pthread_mutex_lock(&m_lock);
+            m_pool.free(ptr, elem_size);
+            ::pthread_mutex_unlock(&m_lock);
+        }
+        void *addr(vaddr_t ptr) const { return m_pool.addr(ptr); }
+    private:
+        Mempool m_pool;
+        pthread_mutex_t m_lock;
+};
+
+static const uint32_t s_alloc_sizes[] = { 16, 24, 48, 64, 128 };
+#define ALLOC_SIZE_NUM  (sizeof(s_alloc_sizes) / sizeof(s_alloc_sizes[0]))
+#define ALLOC_SLOT_NUM  4096
+
+struct alloc_slot_t
+{
+    uint32_t ptr;
+    uint32_t size;
+    uint32_t stamp;
+};
+
+template<typename Pool>
+struct alloc_ctx_t
+{
+    Pool *pool;
+    int64_t ops;
+    uint32_t id;
+    uint64_t errors;
+    std::vector<alloc_slot_t> slots;
+};
+
+/* 随机替换槽位中的元素，释放前检查内容没有被别的分配覆盖 */
+template<typename Pool>
+static void *alloc_worker(void *arg)
+{
+    alloc_ctx_t<Pool> *ctx = (alloc_ctx_t<Pool> *)arg;
+    uint32_t seed = ctx->id * 2654435761u + 1;
+    ctx->slots.assign(ALLOC_SLOT_NUM, alloc_slot_t());
+    for (int64_t i = 0; i < ctx->ops; ++i)
+    {
+        alloc_slot_t &slot = ctx->slots[::rand_r(&seed) % ALLOC_SLOT_NUM];
+        if (slot.ptr)
+        {
+            const uint32_t *p = (const uint32_t *)ctx->pool->addr(slot.ptr);
+            if (p[0] != ctx->id || p[1] != slot.stamp || p[slot.size / 4 - 1] != slot.stamp)
+            {
+                ++ctx->errors;
+            }
+            ctx->pool->free(slot.ptr, slot.size);
+        }
+        slot.size = s_alloc_sizes[::rand_r(&seed) % ALLOC_SIZE_NUM];
+        slot.stamp = (uint32_t)i;
+        slot.ptr = ctx->pool->alloc(slot.size);
+        if (0 == slot.ptr)
+        {
+            ++ctx->errors;
+            continue;
+        }
+        uint32_t *p = (uint32_t *)ctx->pool->addr(slot.ptr);
+        p[0] = ctx->id;
+        p[1] = slot.stamp;
+        p[slot.size / 4 - 1] = slot.stamp;
+    }
+    return NULL;
+}
+
+/* 线程退出后由主线程释放剩下的元素，覆盖跨线程释放，返回检查出的错误数 */
+template<typename Pool>
+static uint64_t run_alloc(const char *name, int thread_num, int64_t ops)
+{
+    Pool pool;
+    for (size_t i = 0; i < ALLOC_SIZE_NUM; ++i)
+    {
+        pool.register_item(s_alloc_sizes[i]);
+    }
+    if (pool.init(1u << 20) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return 1;
+    }
+    std::vector<alloc_ctx_t<Pool> > ctxs(thread_num);
+    std::vector<pthread_t> tids(thread_num);
+    const int64_t begin = now_us();
+    for (int i = 0; i < thread_num; ++i)
+    {
+        ctxs[i].pool = &pool;
+        ctxs[i].ops = ops;
+        ctxs[i].id = i + 1;
+        ctxs[i].errors = 0;
+        ::pthread_create(&tids[i], NULL, alloc_worker<Pool>, &ctxs[i]);
+    }
+    for (int i = 0; i < thread_num; ++i)
+    {
+        ::pthread_join(tids[i], NULL);
+    }
+    const int64_t used = now_us() - begin;
+    uint64_t errors = 0;
+    for (int i = 0; i < thread_num; ++i)
+    {
+        errors += ctxs[i].errors;
+        for (size_t j = 0; j < ctxs[i].slots.size(); ++j)
+        {
+            pool.free(ctxs[i].slots[j].ptr, ctxs[i].slots[j].size);
+        }
+    }
+    printf("alloc[%s] threads=%d: %.1f ns/op, %.2f Mops/s, errors=%lu\n", name, thread_num,
+            used * 1000.0 / (ops * thread_num),
+            ops * thread_num / (double)used, (unsigned long)errors);
+    return errors;
+}
+
+/* 容器以ConcurrentPool为池：TDelayPool<ConcurrentPool>的全部接口都要能编译 */
+template class TDelayPool<ConcurrentPool>;
+typedef HashTable<int32_t, int32_t, __gnu_cxx::hash<int32_t>, std::equal_to<int32_t>, ConcurrentPool> ConcurrentHash;
+
+/* 插入、覆盖、删除之后逐个key检查，返回错误数 */
+static uint64_t check_concurrent_hash(int32_t key_num)
+{
+    TDelayPool<ConcurrentPool> pool;
+    ConcurrentHash::ObjectPool node_pool;
+    ConcurrentHash hash(1024);
+    if (node_pool.init(&pool) < 0 || pool.init(key_num * 2) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return 1;
+    }
+    hash.set_pool(&node_pool);
+    for (int32_t i = 0; i < key_num; ++i)
+    {
+        hash.insert(i, i);
+    }
+    for (int32_t i = 0; i < key_num; i += 2)
+    {
+        hash.insert(i, -i);
+    }
+    for (int32_t i = 1; i < key_num; i += 4)
+    {
+        hash.remove(i);
+    }
+    g_now_time += 3600;
+    pool.recycle();
+    hash.recycle();
+    uint64_t errors = 0;
+    for (int32_t i = 0; i < key_num; ++i)
+    {
+        const int32_t *v = hash.find(i);
+        if (i % 4 == 1 ? NULL != v : (NULL == v || *v != (i % 2 ? i : -i)))
+        {
+            ++errors;
+        }
+    }
+    mempool_stats_t ps;
+    pool.get_stats(ps);
+    const uint64_t expect = hash.size() * sizeof(ConcurrentHash::node_t);
+    if (hash.size() != size_t(key_num - (key_num + 2) / 4) || ps.live_bytes < expect)
+    {
+        ++errors;
+    }
+    printf("alloc[hashtable over concurrent]: keys=%lu, live bytes=%lu, errors=%lu\n",
+            (unsigned long)hash.size(), (unsigned long)ps.live_bytes, (unsigned long)errors);
+    return errors;
+}
+
+/* bench alloc [max_thread_num] [ops_per_thread]，每次一个alloc加一个free，有错误时返回非0 */
+static int bench_alloc(int argc, char *argv[])
+{
+    const int max_thread_num = argc > 2 ? ::atoi(argv[2]) : 8;
+    const int64_t ops = argc > 3 ? ::atoll(argv[3]) : 5000000;
+
+    uint64_t errors = 0;
+    for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2)
+    {
+        errors += run_alloc<LockedMempool>("mempool+mutex", thread_num, ops);
+        errors += run_alloc<ConcurrentPool>("concurrent", thread_num, ops);
+    }
+    errors += check_concurrent_hash(200000);
+    return errors > 0 ? 1 : 0;
+}
+
+typedef HashTable<int32_t, int32_t> RehashTable;
+
+static double rehash_lookup(const RehashTable &table, int32_t key_num, int64_t lookup_num, int64_t &sum)
+{
+    uint32_t seed = 12345;
+    const int64_t begin = now_us();
+    for (int64_t i = 0; i < lookup_num; ++i)
+    {
+        const int32_t *v = table.find((::rand_r(&seed) % key_num) * 7);
+        sum += v ? *v : 0;
+    }
+    return (now_us() - begin) * 1000.0 / lookup_num;
+}
+
+/*
+ * bench rehash [bucket_size] [max_factor] [lookup_num]
+ * 同样的key插入桶数固定的表和按负载因子扩容的表，元素数每翻一倍比较一次查找延迟
+ */
+static int bench_rehash(int argc, char *argv[])
+{
+    const int32_t bucket_size = argc > 2 ? ::atoi(argv[2]) : 65536;
+    const int32_t max_factor = argc > 3 ? ::atoi(argv[3]) : 32;
+    const int64_t lookup_num = argc > 4 ? ::atoll(argv[4]) : 5000000;
+
+    TDelayPool<Mempool> pool;
+    RehashTable::ObjectPool node_pool;
+    if (node_pool.init(&pool) < 0 || pool.init(bucket_size * max_factor * 2) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return -1;
+    }
+    RehashTable fixed(bucket_size);
+    RehashTable resizable(bucket_size);
+    fixed.set_pool(&node_pool);
+    fixed.set_max_load(0);
+    resizable.set_pool(&node_pool);
+
+    int64_t sum = 0;
+    int32_t key_num = 0;
+    for (int32_t target = bucket_size / 2; target <= bucket_size * max_factor; target *= 2)
+    {
+        int64_t begin = now_us();
+        for (int32_t i = key_num; i < target; ++i)
+        {
+            fixed.insert(i * 7, i);
+        }
+        const int64_t fixed_insert = now_us() - begin;
+        begin = now_us();
+        for (int32_t i = key_num; i < target; ++i)
+        {
+            resizable.insert(i * 7, i);
+        }
+        const int64_t resizable_insert = now_us() - begin;
+        const int32_t inserted = target - key_num;
+        key_num = target;
+
+        const double fixed_ns = rehash_lookup(fixed, key_num, lookup_num, sum);
+        const double resizable_ns = rehash_lookup(resizable, key_num, lookup_num, sum);
+        printf("rehash keys=%d(%.1fx): fixed[buckets=%lu] find=%.1f ns/op insert=%.1f ns/op, "
+                "resizable[buckets=%lu%s] find=%.1f ns/op insert=%.1f ns/op, checksum=%ld\n",
+                key_num, key_num / (double)bucket_size,
+                (unsigned long)fixed.bucket_size(), fixed_ns, fixed_insert * 1000.0 / inserted,
+                (unsigned long)resizable.bucket_size(), resizable.rehashing() ? ", rehashing" : "",
+                resizable_ns, resizable_insert * 1000.0 / inserted, (long)sum);
+    }
+    return 0;
+}
+
+template<typename Table>
+struct flat_ctx_t
+{
+    const Table *table;
+    int32_t key_num;
+    int64_t lookup_num;
+    int64_t sum;
+};
+
+/* 一半命中一半不命中 */
+template<typename Table>
+static void *flat_reader(void *arg)
+{
+    flat_ctx_t<Table> *ctx = (flat_ctx_t<Table> *)arg;
+    uint32_t seed = (uint32_t)(intptr_t)ctx;
+    int64_t sum = 0;
+    for (int64_t i = 0; i < ctx->lookup_num; ++i)
+    {
+        const int32_t key = ::rand_r(&seed) % (ctx->key_num * 2);
+        const int32_t *v = ctx->table->find(key * 7);
+        sum += v ? *v : 0;
+    }
+    ctx->sum = sum;
+    return NULL;
+}
+
+template<typename Table>
+static void run_flat(const char *name, int32_t key_num, int64_t lookup_num, int max_thread_num)
+{
+    TDelayPool<Mempool> pool;
+    typename Table::ObjectPool node_pool;
+    if (node_pool.init(&pool) < 0 || pool.init(key_num * 2) < 0)
+    {
+        fprintf(stderr, "failed to init pool\n");
+        return ;
+    }
+    Table table(key_num);
+    table.set_pool(&node_pool);
+    const int64_t begin = now_us();
+    for (int32_t i = 0; i < key_num; ++i)
+    {
+        table.insert(i * 7, i);
+    }
+    const int64_t insert_us = now_us() - begin;
+    printf("%s keys=%d: insert=%.1f ns/op, mem=%lu\n", name, key_num,
+            insert_us * 1000.0 / key_num, (unsigned long)table.mem_used());
+
+    for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2)
+    {
+        std::vector<pthread_t> threads(thread_num);
+        std::vector<flat_ctx_t<Table> > ctx(thread_num);
+        const int64_t start = now_us();
+        for (int i = 0; i < thread_num; ++i)
+        {
+            ctx[i].table = &table;
+            ctx[i].key_num = key_num;
+            ctx[i].lookup_num = lookup_num;
+            ctx[i].sum = 0;
+            ::pthread_create(&threads[i], NULL, flat_reader<Table>, &ctx[i]);
+        }
+        int64_t sum = 0;
+        for (int i = 0; i < thread_num; ++i)
+        {
+            ::pthread_join(threads[i], NULL);
+            sum += ctx[i].sum;
+        }
+        const int64_t used = now_us() - start;
+        printf("%s threads=%d: %.2f M lookups/s, %.1f ns/op, checksum=%ld\n", name, thread_num,
+                lookup_num * thread_num / (double)used,
+                used * 1000.0 * thread_num / (lookup_num * thread_num), (long)sum);
+    }
+}
+
+/* bench flathash [key_num] [lookup_num] [max_thread_num]，比较拉链HashTable和开放寻址FlatHashTable */
+static int bench_flathash(int argc, char *argv[])
+{
+    const int32_t key_num = argc > 2 ? ::atoi(argv[2]) : 1000000;
+    const int64_t lookup_num = argc > 3 ? ::atoll(argv[3]) : 10000000;
+    const int max_thread_num = argc > 4 ? ::atoi(argv[4]) : 4;
+
+    run_flat<HashTable<int32_t, int32_t> >("chained", key_num, lookup_num, max_thread_num);
+    run_flat<FlatHashTable<int32_t, int32_t> >("flat", key_num, lookup_num, max_thread_num);
+    return 0;
+}
+
+struct signdict_ctx_t
+{
+    SignDict *dict;
+    int32_t word_num;
+    int32_t start;
+    int64_t sum;
+    std::vector<uint32_t> ids;  /* 插入线程拿到的每个词的id */
+};
+
+static uint64_t signdict_sign(int32_t k)
+{
+    return uint64_t(k + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+/* 每个线程从不同位置开始插入全部词，有一部分同时插入同一个词 */
+static void *signdict_inserter(void *arg)
+{
+    signdict_ctx_t *ctx = (signdict_ctx_t *)arg;
+    char buf[32];
+    int64_t sum = 0;
+    ctx->ids.assign(ctx->word_num, 0);
+    for (int32_t i = 0; i < ctx->word_num; ++i)
+    {
+        const int32_t k = (ctx->start + i) % ctx->word_num;
+        const int len = ::snprintf(buf, sizeof buf, "word%d", k);
+        uint32_t id = 0;
+        if (ctx->dict->find_or_insert(signdict_sign(k), buf, len, id))
+        {
+            ctx->ids[k] = id;
+        }
+        sum += id;
+    }
+    ctx->sum = sum;
+    return NULL;
+}
+
+static void *signdict_reader(void *arg)
+{
+    signdict_ctx_t *ctx = (signdict_ctx_t *)arg;
+    uint32_t seed = (uint32_t)(intptr_t)ctx;
+    int64_t sum = 0;
+    for (int32_t i = 0; i < ctx->word_num; ++i)
+    {
+        const int32_t k = ::rand_r(&seed) % ctx->word_num;
+        uint32_t id = 0;
+        ctx->dict->find(signdict_sign(k), id);
+        sum += id;
+    }
+    ctx->sum = sum;
+    return NULL;
+}
+
+static int64_t run_signdict_threads(SignDict &dict, void *(*fun)(void *), int32_t word_num, int thread_num,
+        std::vector<signdict_ctx_t> &ctx)
+{
+    std::vector<pthread_t> threads(thread_num);
+    ctx.assign(thread_num, signdict_ctx_t());
+    const int64_t start = now_us();
+    for (int i = 0; i < thread_num; ++i)
+    {
+        ctx[i].dict = &dict;
+        ctx[i].word_num = word_num;
+        ctx[i].start = int32_t(int64_t(word_num) * i / thread_num);
+        ctx[i].sum = 0;
+        ::pthread_create(&threads[i], NULL, fun, &ctx[i]);
+    }
+    for (int i = 0; i < thread_num; ++i)
+    {
+        ::pthread_join(threads[i], NULL);
+    }
+    return now_us() - start;
+}
+
+/*
+ * 每个词都能找到，id在[1, idnum]内且互不相同，按id取回的词一致；
+ * expect非空时id还要和它一致(插入线程拿到的或加载前的)，返回错误数
+ */
+static uint64_t check_signdict(const SignDict &dict, int32_t word_num, const std::vector<uint32_t> &expect)
+{
+    uint64_t errors = (dict.idnum() == uint32_t(word_num)) ? 0 : 1;
+    std::vector<bool> seen(word_num + 1, false);
+    char buf[32];
+    std::string word;
+    for (int32_t k = 0; k < word_num; ++k)
+    {
+        uint32_t id = 0;
+        if (!dict.find(signdict_sign(k), id) || 0 == id || id > uint32_t(word_num) || seen[id]
+                || (!expect.empty() && expect[k] != id))
+        {
+            ++errors;
+            continue;
+        }
+        seen[id] = true;
+        const int len = ::snprintf(buf, sizeof buf, "word%d", k);
+        if (!dict.find(id, word) || word != std::string(buf, len))
+        {
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+/*
+ * bench signdict [word_num] [max_thread_num] [dir]，并发插入、无锁查找，dump后比较拷贝加载和mmap加载
+ * 每次插入和加载后检查所有词的id，有错误时返回非0
+ */
+static int bench_signdict(int argc, char *argv[])
+{
+    const int32_t word_num = argc > 2 ? ::atoi(argv[2]) : 1000000;
+    const int max_thread_num = argc > 3 ? ::atoi(argv[3]) : 4;
+    const char *dir = argc > 4 ? argv[4] : ".";
+
+    uint64_t errors = 0;
+    std::vector<uint32_t> dumped; /* dump的那个词典的id */
+    for (int thread_num = 1; thread_num <= max_thread_num; thread_num *= 2)
+    {
+        SignDict dict;
+        if (dict.init(1024, 1024*1024) < 0)
+        {
+            fprintf(stderr, "failed to init sign dict\n");
+            return -1;
+        }
+        std::vector<signdict_ctx_t> ctx;
+        const int64_t insert_us = run_signdict_threads(dict, signdict_inserter, word_num, thread_num, ctx);
+        /* 同时插入同一个词的线程须拿到同一个id */
+        uint64_t errs = check_signdict(dict, word_num, ctx[0].ids);
+        for (int i = 1; i < thread_num; ++i)
+        {
+            errs += (ctx[i].ids == ctx[0].ids) ? 0 : 1;
+        }
+        errors += errs;
+        dumped.swap(ctx[0].ids);
+        const int64_t find_us = run_signdict_threads(dict, signdict_reader, word_num, thread_num, ctx);
+        printf("threads=%d: insert %.2f M ops/s, find %.2f M ops/s, idnum=%u, errors=%lu\n", thread_num,
+                int64_t(word_num) * thread_num / (double)insert_us,
+                int64_t(word_num) * thread_num / (double)find_us, dict.idnum(), (unsigned long)errs);
+        if (thread_num * 2 > max_thread_num && !dict.dump(dir))
+        {
+            fprintf(stderr, "failed to dump sign dict to %s\n", dir);
+            return -1;
+        }
+    }
+    for (int mmap_load = 0; mmap_load < 2; ++mmap_load)
+    {
+        SignDict dict;
+        dict.init(1024, 1024*1024);
+        dict.set_mmap_load(mmap_load != 0);
+        const int64_t start = now_us();
+        if (!dict.load(dir))
+        {
+            fprintf(stderr, "failed to load sign dict from %s\n", dir);
+            return -1;
+        }
+        const int64_t load_us = now_us() - start;
+        const uint64_t errs = check_signdict(dict, word_num, dumped);
+        errors += errs;
+        MemStats stats;
+        dict.mem_stats(stats, "signdict");
+        printf("%s load: %.1f ms, heap=%lu, mmap=%lu, errors=%lu\n", mmap_load ? "mmap" : "copy",
+                load_us / 1000.0,
+                (unsigned long)(stats.get("signdict") - stats.get("signdict/mmap")),
+                (unsigned long)stats.get("signdict/mmap"), (unsigned long)errs);
+    }
+    return errors > 0 ? 1 : 0;
+}
+
+/* 偏斜的sign id，小id出现得多，和按出现顺序分配的SignDict id接近 */
+static uint32_t words_bag_sign(uint32_t &seed, uint32_t vocab)
+{
+    const double r = ::rand_r(&seed) / (RAND_MAX + 1.0);
+    return 1 + uint32_t(r * r * r * vocab);
+}
+
+static void words_bag_cleanup(HashTable<uint32_t, void *>::node_t *node, intptr_t)
+{
+    TermVector::destroy(node->value);
+}
+
+/* bench termvector [doc_num] [terms_per_doc] [vocab]，比较每个doc一个SortList和一个TermVector的words bag */
+static int bench_termvector(int argc, char *argv[])
+{
+    typedef TDelayPool<Mempool> Pool;
+    typedef HashTable<uint32_t, Pool::vaddr_t> VHash;
+    typedef SortList<uint32_t, Mempool> IDList;
+    typedef TObjectPool<IDList, Mempool> IDListPool;
+    typedef HashTable<uint32_t, void *> WHash;
+
+    const int32_t doc_num = argc > 2 ? ::atoi(argv[2]) : 200000;
+    const uint32_t terms = argc > 3 ? ::atoi(argv[3]) : 30;
+    const uint32_t vocab = argc > 4 ? ::atoi(argv[4]) : 1000000;
+    std::vector<uint32_t> signs;
+    int64_t sum = 0;
+
+    {
+        Pool pool;
+        VHash::ObjectPool vnode_pool;
+        IDList::ObjectPool inode_pool;
+        IDListPool idlist_pool;
+        if (vnode_pool.init(&pool) < 0 || inode_pool.init(&pool) < 0 || idlist_pool.init(&pool) < 0
+                || pool.init(doc_num) < 0)
+        {
+            fprintf(stderr, "failed to init pool\n");
+            return -1;
+        }
+        VHash bag(doc_num);
+        bag.set_pool(&vnode_pool);
+        uint32_t seed = 1;
+        int64_t start = now_us();
+        for (int32_t d = 0; d < doc_num; ++d)
+        {
+            const Pool::vaddr_t vlist = idlist_pool.alloc(&inode_pool);
+            IDList *list = idlist_pool.addr(vlist);
+            for (uint32_t t = 0; t < terms; ++t)
+            {
+                list->insert(words_bag_sign(seed, vocab));
+            }
+            bag.insert(d, vlist);
+        }
+        const int64_t insert_us = now_us() - start;
+        start = now_us();
+        for (int32_t d = 0; d < doc_num; ++d)
+        {
+            const IDList *list = idlist_pool.addr(*bag.find(d));
+            for (IDList::iterator it = list->begin(); it != list->end(); ++it)
+            {
+                sum += *it;
+            }
+        }
+        const int64_t read_us = now_us() - start;
+        mempool_stats_t ps;
+        pool.get_stats(ps);
+        const uint64_t mem = ps.live_bytes + bag.mem_used() - bag.pool_bytes();
+        printf("sortlist: insert %.1f ns/term, read %.1f ns/term, mem=%lu (%.2f bytes/term)\n",
+                insert_us * 1000.0 / doc_num / terms, read_us * 1000.0 / doc_num / terms,
+                (unsigned long)mem, mem / double(doc_num) / terms);
+    }
+    {
+        Pool pool;
+        WHash::ObjectPool wnode_pool;
+        if (wnode_pool.init(&pool) < 0 || pool.init(doc_num) < 0)
+        {
+            fprintf(stderr, "failed to init pool\n");
+            return -1;
+        }
+        WHash bag(doc_num);
+        bag.set_pool(&wnode_pool);
+        bag.set_cleanup(words_bag_cleanup, 0);
+        uint32_t seed = 1;
+        int64_t start = now_us();
+        for (int32_t d = 0; d < doc_num; ++d)
+        {
+            /* 和InvertIndex::insert一样一个doc的sign攒齐后只生成一次TermVector */
+            signs.clear();
+            for (uint32_t t = 0; t < terms; ++t)
+            {
+                signs.push_back(words_bag_sign(seed, vocab));
+            }
+            void *tv = TermVector::create(signs);
+            if (tv)
+            {
+                bag.insert(d, tv);
+            }
+        }
+        const int64_t insert_us = now_us() - start;
+        start = now_us();
+        uint64_t heap = 0;
+        for (int32_t d = 0; d < doc_num; ++d)
+        {
+            const void *tv = *bag.find(d);
+            TermVector::iterator it(tv);
+            uint32_t sign;
+            while (it.next(sign))
+            {
+                sum -= sign;
+            }
+            heap += ::malloc_usable_size((void *)tv) + sizeof(size_t);
+        }
+        const int64_t read_us = now_us() - start;
+        /* 被替换的TermVector和节点过了延迟时间之后释放，只算稳定后的内存 */
+        g_now_time += 3600;
+        pool.recycle();
+        bag.recycle();
+        mempool_stats_t ps;
+        pool.get_stats(ps);
+        const uint64_t mem = ps.live_bytes + bag.mem_used() - bag.pool_bytes() + heap;
+        printf("termvector: insert %.1f ns/term, read %.1f ns/term, mem=%lu (%.2f bytes/term), checksum=%ld\n",
+                insert_us * 1000.0 / doc_num / terms, read_us * 1000.0 / doc_num / terms,
+                (unsigned long)mem, mem / double(doc_num) / terms, (long)sum);
+    }
+    return 0;
+}
+
+/* 对照每个doc的sign集合，检查每个sign的拉链和每个doc的sign，返回错误数 */
+static uint64_t check_segment(const SegmentInvert &seg, const std::vector<std::vector<uint32_t> > &docs, uint32_t vocab)
+{
+    std::vector<std::vector<int32_t> > lists(vocab + 1);
+    for (size_t docid = 0; docid < docs.size(); ++docid)
+    {
+        for (size_t i = 0; i < docs[docid].size(); ++i)
+        {
+            lists[docs[docid][i]].push_back(docid);
+        }
+    }
+    uint64_t errors = 0;
+    std::vector<int32_t> ids;
+    for (uint32_t sign = 1; sign <= vocab; ++sign)
+    {
+        ids.clear();
+        DocList *list = seg.trigger(sign);
+        if (list)
+        {
+            for (int32_t docid = list->first(); docid != -1; docid = list->next())
+            {
+                ids.push_back(docid);
+            }
+            delete list;
+        }
+        if (ids != lists[sign])
+        {
+            ++errors;
+        }
+    }
+    std::vector<uint32_t> signs;
+    for (size_t docid = 0; docid < docs.size(); ++docid)
+    {
+        seg.get_signs_by_docid(docid, signs);
+        if (signs != docs[docid])
+        {
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+/*
+ * bench segment <conf_path> <invert_conf_file> <dir> [doc_num] [ops] [seal_size]
+ * 随机重写/删除doc、删除单个posting、改docid，同时封段和后台合并，
+ * 定期和每个doc的sign集合对照，最后dump再load也对照一次，有错误时返回非0
+ */
+static int bench_segment(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "usage: %s segment <conf_path> <invert_conf_file> <dir> [doc_num] [ops] [seal_size]\n", argv[0]);
+        return -1;
+    }
+    const int32_t doc_num = argc > 5 ? ::atoi(argv[5]) : 20000;
+    const int64_t ops = argc > 6 ? ::atoll(argv[6]) : 200000;
+    const uint32_t seal_size = argc > 7 ? ::atoi(argv[7]) : 20000;
+    const uint32_t vocab = 5000;
+    const uint32_t terms = 10;
+    const std::string dir(argv[4]);
+
+    init_time_updater();
+    InvertTypes types;
+    if (types.init(argv[2], argv[3]) < 0 || !types.is_valid_type(0) || !types.is_valid_type(1))
+    {
+        fprintf(stderr, "failed to init invert types with type 0 and 1\n");
+        return -1;
+    }
+    SegmentInvert::conf_t conf;
+    conf.path = dir + "/segs";
+    conf.max_items_num = 1 << 20;
+    conf.hash_size = 65536;
+    conf.seal_size = seal_size;
+    conf.merge_factor = 3;
+    ::mkdir(dir.c_str(), 0755);
+    ::mkdir((dir + "/dump").c_str(), 0755);
+
+    std::vector<std::vector<uint32_t> > docs(doc_num);
+    uint64_t errors = 0;
+    {
+        SegmentInvert seg;
+        if (seg.init(types, conf) < 0)
+        {
+            fprintf(stderr, "failed to init segments at %s\n", conf.path.c_str());
+            return -1;
+        }
+        uint32_t seed = 1;
+        const int64_t begin = now_us();
+        for (int64_t i = 0; i < ops; ++i)
+        {
+            const int32_t docid = ::rand_r(&seed) % doc_num;
+            std::vector<uint32_t> &signs = docs[docid];
+            const uint32_t r = ::rand_r(&seed) % 10;
+            if (r < 7)
+            {
+                seg.remove(docid);
+                signs.clear();
+                for (uint32_t t = 0; t < terms; ++t)
+                {
+                    signs.push_back(1 + ::rand_r(&seed) % vocab);
+                }
+                std::sort(signs.begin(), signs.end());
+                signs.erase(std::unique(signs.begin(), signs.end()), signs.end());
+                for (size_t j = 0; j < signs.size(); ++j)
+                {
+                    errors += seg.insert(signs[j], signs[j] % 2, docid, NULL) ? 0 : 1;
+                }
+            }
+            else if (r < 8)
+            {
+                seg.remove(docid);
+                signs.clear();
+            }
+            else if (r < 9)
+            {
+                if (!signs.empty())
+                {
+                    const size_t j = ::rand_r(&seed) % signs.size();
+                    errors += seg.remove(signs[j], docid) ? 0 : 1;
+                    signs.erase(signs.begin() + j);
+                }
+            }
+            else
+            {
+                const int32_t to = ::rand_r(&seed) % doc_num;
+                if (to != docid && docs[to].empty() && !signs.empty())
+                {
+                    errors += seg.update_docid(docid, to) ? 0 : 1;
+                    docs[to].swap(signs);
+                }
+            }
+            if ((i + 1) % 1000 == 0)
+            {
+                seg.recycle();
+            }
+            if ((i + 1) % (ops / 5) == 0)
+            {
+                errors += check_segment(seg, docs, vocab);
+            }
+        }
+        const int64_t used = now_us() - begin;
+        /* 封掉可变段，等后台合并装上之后再对照 */
+        seg.seal();
+        for (int i = 0; i < 100; ++i)
+        {
+            seg.recycle();
+            ::usleep(20 * 1000);
+        }
+        errors += check_segment(seg, docs, vocab);
+        if (!seg.dump((dir + "/dump").c_str(), &DefaultFS::s_default))
+        {
+            fprintf(stderr, "failed to dump segments to %s/dump\n", dir.c_str());
+            return -1;
+        }
+        printf("segment: %.1f us/op (with checks), errors=%lu\n", used / double(ops), (unsigned long)errors);
+        seg.print_meta();
+    }
+    SegmentInvert loaded;
+    if (loaded.init(types, conf) < 0 || !loaded.load((dir + "/dump").c_str(), &DefaultFS::s_default))
+    {
+        fprintf(stderr, "failed to load segments from %s/dump\n", dir.c_str());
+        return -1;
+    }
+    const uint64_t errs = check_segment(loaded, docs, vocab);
+    printf("segment load: errors=%lu\n", (unsigned long)errs);
+    errors += errs;
+    return errors > 0 ? 1 : 0;
+}
+
+/* 按oid成串生成base模式的增量，两层交错，同一oid上连续插入/更新/删除 */
+static bool write_pipeline_events(const std::string &file, int64_t event_num, int32_t oid_num)
+{
+    FILE *fp = ::fopen(file.c_str(), "w");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "failed to open %s\n", file.c_str());
+        return false;
+    }
+    const char *tags[] = { "phone", "apple" };
+    uint32_t seed = 1;
+    int32_t oid = 0;
+    uint32_t level = 2;
+    uint32_t burst = 0;
+    for (int64_t i = 0; i < event_num; ++i)
+    {
+        if (0 == burst)
+        {
+            oid = ::rand_r(&seed) % oid_num;
+            level = ::rand_r(&seed) % 4 == 0 ? 1 : 2;
+            burst = 1 + ::rand_r(&seed) % 6;
+        }
+        --burst;
+        const uint32_t r = ::rand_r(&seed) % 10;
+        const uint32_t optype = r < 5 ? 0 : (r < 8 ? 2 : 1); /* insert, update, delete */
+        const uint32_t a = ::rand_r(&seed) % 10000;
+        const uint32_t b = ::rand_r(&seed) % 10000;
+        const uint32_t w1 = ::rand_r(&seed) % 20;
+        const uint32_t w2 = ::rand_r(&seed) % 20;
+        const uint32_t w3 = ::rand_r(&seed) % 20;
+        fprintf(fp, "%ld\t%u\t%u\t%d", long(i), level, optype, oid);
+        if (1 == level && 0 == optype)
+        {
+            fprintf(fp, "\t{\"id\": %u, \"weight\": %u.%02u}", a, b % 10, b % 100);
+        }
+        else if (1 == level && 2 == optype)
+        {
+            fprintf(fp, "\t{\"weight\": %u.%02u}", b % 10, b % 100);
+        }
+        else if (0 == optype)
+        {
+            fprintf(fp, "\t{\"brand_id\": %u, \"cate_id\": %u, \"price\": %u.%02u, \"weight\": 0.5}"
+                    "\t{\"0\": [\"w%u\",\"w%u\",\"w%u\",\"%s\"], \"1\": [\"c%u\"]}",
+                    a, a % 200, b, b % 100, w1, w2, w3, tags[w1 & 1], w2 % 10);
+        }
+        else if (2 == optype)
+        {
+            fprintf(fp, "\t{\"brand_id\": %u, \"price\": %u.%02u}", a, b, b % 100);
+        }
+        fprintf(fp, "\n");
+    }
+    ::fclose(fp);
+    return true;
+}
+
+struct pipeline_run_t
+{
+    const char *name;
+    const char *processor;
+    int32_t coalesce_window; /* 0表示不合并 */
+};
+
+/* 写一份Index配置，0和1目录下都放base模式的index.meta，从头读events */
+static bool write_pipeline_index(const std::string &dir, const char *conf_path,
+        const pipeline_run_t &run, int64_t event_num)
+{
+    const std::string path = dir + "/" + run.name;
+    const char *subs[] = { "/0", "/1" };
+    ::mkdir(path.c_str(), 0755);
+    for (size_t i = 0; i < sizeof(subs) / sizeof(subs[0]); ++i)
+    {
+        const std::string meta = path + subs[i] + "/index.meta";
+        ::mkdir((path + subs[i]).c_str(), 0755);
+        FILE *fp = ::fopen(meta.c_str(), "w");
+        if (NULL == fp)
+        {
+            fprintf(stderr, "failed to open %s\n", meta.c_str());
+            return false;
+        }
+        fprintf(fp, "inc_name: %s\ninc_file_prefix: %s/inc/event\nfile_no: 0\nline_no: 0\n"
+                "max_line_no: %ld\npartition_cur: 0\npartition_num: 1\nbase_mode: 1\n",
+                run.name, dir.c_str(), long(event_num));
+        ::fclose(fp);
+    }
+    const std::string conf = dir + "/" + run.name + ".conf";
+    FILE *fp = ::fopen(conf.c_str(), "w");
+    if (NULL == fp)
+    {
+        fprintf(stderr, "failed to open %s\n", conf.c_str());
+        return false;
+    }
+    fprintf(fp, "INDEX_PATH: %s\nINDEX_META_FILE: index.meta\nDUMP_FLAG_FILE: %s/dump_flag\n"
+            "INC_PROCESSOR: %s\nINC_DAS_WARNING_TIME: 3600\n"
+            "INC_PARSE_THREADS: 3\nINC_QUEUE_SIZE: 256\nINC_QUEUE_MEMORY: 4\n"
+            "INC_COALESCE_WINDOW: %d\nINC_COALESCE_MS: 5\n"
+            "level_num: 2\n"
+            "level_0: 1\nlevel_0_name: merchant\nlevel_0_conf_path: %s\nlevel_0_conf_file: merchant_index.conf\n"
+            "level_1: 2\nlevel_1_name: goods\nlevel_1_conf_path: %s\nlevel_1_conf_file: goods_index.conf\n",
+            path.c_str(), path.c_str(), run.processor, run.coalesce_window, conf_path, conf_path);
+    ::fclose(fp);
+    return true;
+}
+
+static std::vector<int32_t> pipeline_oids(const LevelIndex *lx, const char *word, int8_t type)
+{
+    std::vector<int32_t> oids;
+    DocList *list = lx->trigger(word, type);
+    if (list)
+    {
+        for (int32_t docid = list->first(); docid != -1; docid = list->next())
+        {
+            int32_t oid = -1;
+            lx->get_info_by_docid(docid, &oid);
+            oids.push_back(oid);
+        }
+        delete list;
+    }
+    std::sort(oids.begin(), oids.end());
+    return oids;
+}
+
+/* 和串行回放的结果对照每个oid的存在性、int/float正排字段，以及每个词的拉链，返回错误数 */
+static uint64_t check_pipeline(const Index &expect, const Index &got, int32_t oid_num)
+{
+    uint64_t errors = 0;
+    for (size_t level = 1; level <= 2; ++level)
+    {
+        const LevelIndex *ex = expect.get_level_index(level);
+        const LevelIndex *lx = got.get_level_index(level);
+        if (ex->doc_num() != lx->doc_num())
+        {
+            ++errors;
+        }
+        std::vector<int32_t> offsets;
+        for (size_t slot = 0; slot < ex->field_slot_num(); ++slot)
+        {
+            const int type = ex->get_field_slot_type(slot);
+            const int32_t offset = ex->get_field_offset_by_name(ex->get_field_slot_name(slot));
+            if ((ForwardIndex::INT_TYPE == type || ForwardIndex::FLOAT_TYPE == type) && offset >= 0)
+            {
+                offsets.push_back(offset);
+            }
+        }
+        for (int32_t oid = 0; oid < oid_num; ++oid)
+        {
+            const int32_t a = ex->get_id_by_oid(oid);
+            const int32_t b = lx->get_id_by_oid(oid);
+            if ((a < 0) != (b < 0))
+            {
+                ++errors;
+                continue;
+            }
+            if (a < 0)
+            {
+                continue;
+            }
+            const char *x = (const char *)ex->get_info_by_docid(a);
+            const char *y = (const char *)lx->get_info_by_docid(b);
+            for (size_t i = 0; i < offsets.size(); ++i)
+            {
+                if (::memcmp(x + offsets[i], y + offsets[i], 4) != 0)
+                {
+                    ++errors;
+                    break;
+                }
+            }
+        }
+    }
+    const LevelIndex *ex = expect.get_level_index(2);
+    const LevelIndex *lx = got.get_level_index(2);
+    char word[32];
+    for (int i = 0; i < 32; ++i)
+    {
+        const int8_t type = i < 22 ? 0 : 1;
+        if (i < 20)
+        {
+            ::snprintf(word, sizeof word, "w%d", i);
+        }
+        else if (i < 22)
+        {
+            ::snprintf(word, sizeof word, "%s", 20 == i ? "phone" : "apple");
+        }
+        else
+        {
+            ::snprintf(word, sizeof word, "c%d", i - 22);
+        }
+        if (pipeline_oids(ex, word, type) != pipeline_oids(lx, word, type))
+        {
+            ++errors;
+        }
+    }
+    return errors;
+}
+
+/*
+ * bench pipeline <conf_path> <dir> [event_num] [oid_num]
+ * 在repo根目录下运行，conf_path为merchant/goods两层的配置目录，dir须是新目录；
+ * 同一份成串操作同一oid的增量，先用inc::das_processor串行回放，
+ * 再用inc::pipeline_processor和每层一个写线程的inc::level_pipeline_processor回放，
+ * 两者再各开一次合并窗口，分别和串行结果对照，有差异时返回非0
+ */
+static int bench_pipeline(int argc, char *argv[])
+{
+    if (argc < 4)
+    {
+        fprintf(stderr, "usage: %s pipeline <conf_path> <dir> [event_num] [oid_num]\n", argv[0]);
+        return -1;
+    }
+    const char *conf_path = argv[2];
+    const std::string dir(argv[3]);
+    const int64_t event_num = argc > 4 ? ::atoll(argv[4]) : 200000;
+    const int32_t oid_num = argc > 5 ? ::atoi(argv[5]) : 2000;
+    const pipeline_run_t serial = { "das", "inc::das_processor", 0 };
+    const pipeline_run_t runs[] = {
+        { "pipeline", "inc::pipeline_processor", 0 },
+        { "level_pipeline", "inc::level_pipeline_processor", 0 },
+        { "pipeline_coalesce", "inc::pipeline_processor", 32 },
+        { "level_pipeline_coalesce", "inc::level_pipeline_processor", 32 },
+    };
+
+    if (::mkdir(dir.c_str(), 0755) != 0 || ::mkdir((dir + "/inc").c_str(), 0755) != 0)
+    {
+        fprintf(stderr, "failed to mkdir %s, it must not exist\n", dir.c_str());
+        return -1;
+    }
+    if (!write_pipeline_events(dir + "/inc/event.0", event_num, oid_num))
+    {
+        return -1;
+    }
+    init_nbslib();
+
+    /* Index里有10M的行缓冲，不能放在栈上 */
+    Index *expect = new Index;
+    int64_t begin = now_us();
+    if (!write_pipeline_index(dir, conf_path, serial, event_num)
+            || expect->init(dir.c_str(), (std::string(serial.name) + ".conf").c_str()) < 0)
+    {
+        fprintf(stderr, "failed to init %s index\n", serial.name);
+        return -1;
+    }
+    expect->join();
+    printf("%s: %.3f s, merchant %lu, goods %lu\n", serial.name, (now_us() - begin) / 1e6,
+            (unsigned long)expect->get_level_index(1)->doc_num(),
+            (unsigned long)expect->get_level_index(2)->doc_num());
+
+    uint64_t errors = 0;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(runs[0]); ++i)
+    {
+        Index *got = new Index;
+        begin = now_us();
+        if (!write_pipeline_index(dir, conf_path, runs[i], event_num)
+                || got->init(dir.c_str(), (std::string(runs[i].name) + ".conf").c_str()) < 0)
+        {
+            fprintf(stderr, "failed to init %s index\n", runs[i].name);
+            return -1;
+        }
+        got->join();
+        const int64_t used = now_us() - begin;
+        const uint64_t errs = check_pipeline(*expect, *got, oid_num);
+        printf("%s: %.3f s, errors=%lu\n", runs[i].name, used / 1e6, (unsigned long)errs);
+        errors += errs;
+        delete got;
+    }
+    delete expect;
+    return errors > 0 ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    ::snprintf(lc._path_prefix, sizeof(lc._path_prefix), "./bench");
+    lc._max_log_length = 4096;
+    init_log(&lc);
+
+    if (argc >= 2 && ::strcmp(argv[1], "facet") == 0)
+    {
+        return bench_facet(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "reclaim") == 0)
+    {
+        return bench_reclaim(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "pagealloc") == 0)
+    {
+        return bench_pagealloc(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "vaddr64") == 0)
+    {
+        return bench_vaddr64(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "alloc") == 0)
+    {
+        return bench_alloc(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "rehash") == 0)
+    {
+        return bench_rehash(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "flathash") == 0)
+    {
+        return bench_flathash(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "signdict") == 0)
+    {
+        return bench_signdict(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "termvector") == 0)
+    {
+        return bench_termvector(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "segment") == 0)
+    {
+        return bench_segment(argc, argv);
+    }
+    if (argc >= 2 && ::strcmp(argv[1], "pipeline") == 0)
+    {
+        return bench_pipeline(argc, argv);
+    }
+    fprintf(stderr, "usage: %s facet|reclaim|pagealloc|vaddr64|alloc|rehash|flathash|signdict|termvector|segment|pipeline ...\n", argc > 0 ? argv[0] : "bench");
+    return -1;
+}
@@ -0,0 +1,35 @@
+/*
+ * 离线建基准库
+ *   base_build <conf_path> <index_conf>
+ * index_conf中INC_PROCESSOR须为inc::base_build_processor，index.meta中base_mode: 1，各层REBUILD_INDEX: 1
+ * 建好后写到INDEX_PATH的0/1目录中的可写目录并切换，服务端各层REBUILD_INDEX: 0正常加载
+ */
+#include <stdio.h>
+#include <pthread.h>
+#include "log_utils.h"
+#include "index/index.h"
+
+log_conf_t lc;
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        fprintf(stderr, "usage: %s <conf_path> <index_conf>\n", argv[0]);
+        return -1;
+    }
+    ::snprintf(lc._path_prefix, sizeof(lc._path_prefix), "./base_build");
+    lc._max_log_length = 4096;
+    init_log(&lc);
+    init_nbslib();
+
+    Index index;
+    if (index.init(argv[1], argv[2]) < 0)
+    {
+        P_WARNING("failed to init index[%s][%s]", argv[1], argv[2]);
+        return -1;
+    }
+    void *ret = NULL;
+    ::pthread_join(index.m_inc_tid, &ret);
+    return NULL == ret ? 0 : -1;
+}
@@ -0,0 +1,328 @@
+/*
+ * 把tsv+json格式的增量/基准文件转换成二进制格式(inc/inc_record.h)
+ *   inc_convert <conf_path> <index_conf> <input> <output> [base_mode]
+ * 正排字段slot、倒排签名和payload都按index_conf中各层的配置预先算好，
+ * 每一行输出一个record，转换失败的行输出optype为RECORD_OP_INVALID的record，保证line_no不变
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "configure.h"
+#include "log_utils.h"
+#include "str_utils.h"
+#include "json2pb.h"
+#include "encode_util.h"
+#include "index/index.h"
+#include "inc/event_parser.h"
+#include "inc/inc_reader.h"
+#include "inc/inc_record.h"
+
+using namespace inc;
+
+log_conf_t lc;
+
+static char s_line[1024*1024*10];
+static char s_binary[5*1024*1024];
+
+struct level_t
+{
+    LevelIndex *index;
+    EventParser *parser;
+};
+
+static bool init_levels(const char *path, const char *file, std::vector<level_t> &levels)
+{
+    Config conf(path, file);
+    if (conf.parse() < 0)
+    {
+        P_WARNING("failed to load [%s][%s]", path, file);
+        return false;
+    }
+    uint32_t level_num = 0;
+    if (!parseUInt32(conf["level_num"], level_num))
+    {
+        P_WARNING("failed to parse level_num");
+        return false;
+    }
+    for (uint32_t i = 0; i < level_num; ++i)
+    {
+        char tmpbuf[256];
+        uint32_t level = 0;
+        ::snprintf(tmpbuf, sizeof tmpbuf, "level_%d", i);
+        if (!parseUInt32(conf[tmpbuf], level))
+        {
+            P_WARNING("failed to parse %s", tmpbuf);
+            return false;
+        }
+        if (level >= levels.size())
+        {
+            level_t empty = { NULL, NULL };
+            levels.resize(level + 1, empty);
+        }
+        ::snprintf(tmpbuf, sizeof tmpbuf, "level_%d_conf_path", i);
+        std::string conf_path = conf[tmpbuf];
+        ::snprintf(tmpbuf, sizeof tmpbuf, "level_%d_conf_file", i);
+        std::string conf_file = conf[tmpbuf];
+        levels[level].index = new (std::nothrow) LevelIndex;
+        levels[level].parser = new (std::nothrow) EventParser;
+        if (NULL == levels[level].index || NULL == levels[level].parser
+                || levels[level].index->init(conf_path.c_str(), conf_file.c_str()) < 0
+                || levels[level].parser->init(levels[level].index) < 0)
+        {
+            P_WARNING("failed to init level[%u]", level);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* 把正排值转成NUMBER/RAW，binary字段base64解码，pb字段序列化，转换出的字节存到storage */
+static bool convert_fields(const LevelIndex &index, const std::vector<forward_value_t> &values,
+        std::vector<forward_value_t> &fields, std::deque<std::string> &storage)
+{
+    fields.clear();
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        forward_value_t field = values[i];
+        const char *name = index.get_field_slot_name(field.slot);
+        const int type = index.get_field_slot_type(field.slot);
+        if (ForwardIndex::INT_TYPE == type || ForwardIndex::FLOAT_TYPE == type)
+        {
+            if (forward_value_t::NUMBER != field.kind)
+            {
+                continue; /* 与文本格式一致，非数字的值忽略 */
+            }
+        }
+        else if (ForwardIndex::BINARY_TYPE == type)
+        {
+            int outlen = sizeof s_binary;
+            if (forward_value_t::STRING != field.kind
+                    || ::std_base64_decode(s_binary, &outlen, field.str, field.len) != 0)
+            {
+                P_WARNING("failed to decode binary, field_name[%s]", name);
+                return false;
+            }
+            storage.push_back(std::string(s_binary, outlen));
+        }
+        else
+        {
+            google::protobuf::Message *msg = index.get_field_slot_message(field.slot)->New();
+            bool ok = false;
+            if (forward_value_t::STRING == field.kind)
+            {
+                ok = json2pb(*msg, field.str);
+            }
+            else if (forward_value_t::OBJECT == field.kind)
+            {
+                ok = json2pb(*msg, field.json);
+            }
+            storage.push_back(std::string());
+            ok = ok && msg->SerializeToString(&storage.back());
+            delete msg;
+            if (!ok)
+            {
+                P_WARNING("failed to convert protobuf, field_name[%s]", name);
+                return false;
+            }
+        }
+        if (forward_value_t::NUMBER != field.kind)
+        {
+            field.kind = forward_value_t::RAW;
+            field.str = storage.back().data();
+            field.len = storage.back().length();
+        }
+        fields.push_back(field);
+    }
+    return true;
+}
+
+/* 倒排词预先签名，payload用配置的parser解析好 */
+static bool convert_inverts(const LevelIndex &index, const std::vector<invert_data_t> &values,
+        std::vector<invert_sign_t> &inverts, std::deque<std::string> &storage)
+{
+    inverts.clear();
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        const invert_data_t &value = values[i];
+        invert_sign_t invert;
+        char buffer[256];
+        uint32_t len = sizeof buffer;
+        if (!index.create_sign(value.key, value.type, buffer, len, invert.sign))
+        {
+            P_WARNING("failed to sign word[%s], type[%d]", value.key, value.type);
+            return false;
+        }
+        storage.push_back(std::string(buffer, len));
+        invert.type = value.type;
+        invert.word = storage.back().data();
+        invert.word_len = len;
+        invert.payload_len = index.get_payload_len(value.type);
+        invert.payload = NULL;
+        if (invert.payload_len > 0)
+        {
+            const void *payload = index.parse_payload(value.type, value.value);
+            if (NULL == payload)
+            {
+                P_WARNING("failed to parse payload of word[%s], type[%d]", value.key, value.type);
+                return false;
+            }
+            storage.push_back(std::string((const char *)payload, invert.payload_len));
+            invert.payload = storage.back().data();
+        }
+        inverts.push_back(invert);
+    }
+    return true;
+}
+
+/* 与IncReader::split一致 */
+static size_t split(char *line, bool base_mode, char **columns, size_t max_num)
+{
+    char *p = line;
+    if (base_mode && ::strchr(p, '\t'))
+    {
+        p = ::strchr(p, '\t') + 1;
+    }
+    size_t num = 0;
+    while (num < max_num)
+    {
+        columns[num++] = p;
+        char *q = (num < max_num) ? ::strchr(p, '\t') : NULL;
+        if (NULL == q)
+        {
+            break;
+        }
+        *q = '\0';
+        p = q + 1;
+    }
+    return num;
+}
+
+static bool convert_line(std::vector<level_t> &levels, char *line, bool base_mode, record_head_t &head,
+        std::vector<forward_value_t> &fields, std::vector<invert_sign_t> &inverts, std::deque<std::string> &storage)
+{
+    std::vector<forward_value_t> values;
+    std::vector<invert_data_t> words;
+    char *columns[IncReader::MAX_COLUMNS];
+
+    head.eventid = base_mode ? 0 : ::strtoul(line, NULL, 10);
+    const size_t column_num = split(line, base_mode, columns, IncReader::MAX_COLUMNS);
+    if (column_num < 3)
+    {
+        P_WARNING("must has {[eventid] level, optype, oid}");
+        return false;
+    }
+    uint32_t level = 0;
+    uint32_t optype = 0;
+    uint64_t oid = 0;
+    if (!parseUInt32(columns[0], level) || !parseUInt32(columns[1], optype)
+            || !parseUInt64(columns[2], oid) || optype >= RECORD_OP_INVALID)
+    {
+        P_WARNING("invalid level, optype, oid");
+        return false;
+    }
+    head.level = level;
+    head.optype = optype;
+    head.oid = oid;
+    if (head.level >= levels.size() || NULL == levels[head.level].index)
+    {
+        P_WARNING("invalid level=%u", head.level);
+        return false;
+    }
+    if (OP_INSERT != optype && OP_UPDATE != optype)
+    {
+        return true;
+    }
+    const level_t &lx = levels[level];
+    lx.parser->reset();
+    if (column_num < 4 || !lx.parser->parse_forward(columns[3], values)
+            || !convert_fields(*lx.index, values, fields, storage))
+    {
+        P_WARNING("failed to convert forward json");
+        return false;
+    }
+    if (column_num >= 5)
+    {
+        if (!lx.parser->parse_invert(columns[4], words)
+                || !convert_inverts(*lx.index, words, inverts, storage))
+        {
+            P_WARNING("failed to convert invert json");
+            return false;
+        }
+        head.flags |= RECORD_FLAG_INVERT;
+    }
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 5)
+    {
+        fprintf(stderr, "usage: %s <conf_path> <index_conf> <input> <output> [base_mode]\n", argv[0]);
+        return -1;
+    }
+    ::snprintf(lc._path_prefix, sizeof(lc._path_prefix), "./inc_convert");
+    lc._max_log_length = 4096;
+    init_log(&lc);
+    init_nbslib();
+
+    const bool base_mode = argc > 5 && ::atoi(argv[5]) != 0;
+    std::vector<level_t> levels;
+    if (!init_levels(argv[1], argv[2], levels))
+    {
+        return -1;
+    }
+    FILE *in = ::fopen(argv[3], "r");
+    FILE *out = ::fopen(argv[4], "w");
+    if (NULL == in || NULL == out)
+    {
+        P_WARNING("failed to open file[%s] or [%s]", argv[3], argv[4]);
+        return -1;
+    }
+    ::fwrite(INC_BINARY_MAGIC, INC_BINARY_MAGIC_LEN, 1, out);
+
+    uint32_t line_no = 0;
+    uint32_t invalid_num = 0;
+    std::string record;
+    std::vector<forward_value_t> fields;
+    std::vector<invert_sign_t> inverts;
+    std::deque<std::string> storage;
+    while (readline(in, s_line, sizeof s_line, true) > 0)
+    {
+        ++line_no;
+        record_head_t head;
+        ::memset(&head, 0, sizeof head);
+        fields.clear();
+        inverts.clear();
+        storage.clear();
+        record.clear();
+        if (!convert_line(levels, s_line, base_mode, head, fields, inverts, storage)
+                || !encode_record(record, head, fields, inverts))
+        {
+            P_WARNING("failed to convert line[%u], write an invalid record", line_no);
+            ++invalid_num;
+            record_head_t invalid = head;
+            invalid.optype = RECORD_OP_INVALID;
+            invalid.flags = 0;
+            fields.clear();
+            inverts.clear();
+            record.clear();
+            encode_record(record, invalid, fields, inverts);
+        }
+        if (::fwrite(record.data(), record.length(), 1, out) != 1)
+        {
+            P_WARNING("failed to write file[%s]", argv[4]);
+            return -1;
+        }
+    }
+    ::fclose(in);
+    if (::fclose(out) != 0)
+    {
+        P_WARNING("failed to close file[%s]", argv[4]);
+        return -1;
+    }
+    P_WARNING("convert [%s] to [%s] ok, lines=%u, invalid=%u", argv[3], argv[4], line_no, invalid_num);
+    return 0;
+}